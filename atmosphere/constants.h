@@ -60,6 +60,9 @@ constexpr int SCATTERING_TEXTURE_DEPTH = SCATTERING_TEXTURE_R_SIZE;
 constexpr int IRRADIANCE_TEXTURE_WIDTH = 64;
 constexpr int IRRADIANCE_TEXTURE_HEIGHT = 16;
 
+constexpr int DENSITY_TEXTURE_WIDTH = 1024;
+constexpr int DENSITY_TEXTURE_HEIGHT = 1;
+
 // The conversion factor between watts and lumens.
 constexpr double MAX_LUMINOUS_EFFICACY = 683.0;
 
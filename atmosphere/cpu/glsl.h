@@ -0,0 +1,356 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/cpu/glsl.h</h2>
+
+<p>This file provides the minimal subset of the GLSL types and built-in
+functions which is needed to compile our <a href="../functions.glsl.html">GLSL
+atmosphere functions</a> as C++ code, with single precision floating point
+numbers and vectors as on GPU (contrary to the
+<a href="../reference/definitions.h.html">reference model</a>, which uses double
+precision and dimensional types). It also provides 2D and 3D RGBA float
+textures, with the same filtering and wrapping modes as the textures of the
+<a href="../model.cc.html">GPU model</a> (i.e. linear filtering and clamp to
+edge). Note that, as in GLSL, the names of these types are in lowercase.
+*/
+
+#ifndef ATMOSPHERE_CPU_GLSL_H_
+#define ATMOSPHERE_CPU_GLSL_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace atmosphere {
+namespace cpu {
+
+/*
+<h3>Vectors</h3>
+
+<p>The 2D, 3D and 4D vectors support the usual component-wise arithmetic
+operators, with vectors or scalars. The only supported "swizzling" operation is
+the truncation of a vector to its first components, via an explicit
+constructor:
+*/
+
+class vec4;
+
+class vec2 {
+ public:
+  vec2() : x(0.0f), y(0.0f) {}
+  explicit vec2(float v) : x(v), y(v) {}
+  vec2(float x, float y) : x(x), y(y) {}
+  float x;
+  float y;
+};
+
+class vec3 {
+ public:
+  vec3() : x(0.0f), y(0.0f), z(0.0f) {}
+  explicit vec3(float v) : x(v), y(v), z(v) {}
+  vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+  explicit vec3(const vec4& v);
+  float x;
+  float y;
+  float z;
+};
+
+class vec4 {
+ public:
+  vec4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+  explicit vec4(float v) : x(v), y(v), z(v), w(v) {}
+  vec4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+  vec4(const vec3& v, float w) : x(v.x), y(v.y), z(v.z), w(w) {}
+  float x;
+  float y;
+  float z;
+  float w;
+};
+
+inline vec3::vec3(const vec4& v) : x(v.x), y(v.y), z(v.z) {}
+
+inline vec2 operator+(const vec2& a, const vec2& b) {
+  return vec2(a.x + b.x, a.y + b.y);
+}
+inline vec2 operator+(const vec2& a, float b) { return vec2(a.x + b, a.y + b); }
+inline vec2 operator+(float a, const vec2& b) { return vec2(a + b.x, a + b.y); }
+inline vec2& operator+=(vec2& a, const vec2& b) { return a = a + b; }
+inline vec2& operator+=(vec2& a, float b) { return a = a + b; }
+inline vec2 operator-(const vec2& a, const vec2& b) {
+  return vec2(a.x - b.x, a.y - b.y);
+}
+inline vec2 operator-(const vec2& a, float b) { return vec2(a.x - b, a.y - b); }
+inline vec2 operator-(float a, const vec2& b) { return vec2(a - b.x, a - b.y); }
+inline vec2& operator-=(vec2& a, const vec2& b) { return a = a - b; }
+inline vec2& operator-=(vec2& a, float b) { return a = a - b; }
+inline vec2 operator*(const vec2& a, const vec2& b) {
+  return vec2(a.x * b.x, a.y * b.y);
+}
+inline vec2 operator*(const vec2& a, float b) { return vec2(a.x * b, a.y * b); }
+inline vec2 operator*(float a, const vec2& b) { return vec2(a * b.x, a * b.y); }
+inline vec2& operator*=(vec2& a, const vec2& b) { return a = a * b; }
+inline vec2& operator*=(vec2& a, float b) { return a = a * b; }
+inline vec2 operator/(const vec2& a, const vec2& b) {
+  return vec2(a.x / b.x, a.y / b.y);
+}
+inline vec2 operator/(const vec2& a, float b) { return vec2(a.x / b, a.y / b); }
+inline vec2 operator/(float a, const vec2& b) { return vec2(a / b.x, a / b.y); }
+inline vec2& operator/=(vec2& a, const vec2& b) { return a = a / b; }
+inline vec2& operator/=(vec2& a, float b) { return a = a / b; }
+inline vec2 operator-(const vec2& a) { return vec2(-a.x, -a.y); }
+
+inline vec3 operator+(const vec3& a, const vec3& b) {
+  return vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+inline vec3 operator+(const vec3& a, float b) {
+  return vec3(a.x + b, a.y + b, a.z + b);
+}
+inline vec3 operator+(float a, const vec3& b) {
+  return vec3(a + b.x, a + b.y, a + b.z);
+}
+inline vec3& operator+=(vec3& a, const vec3& b) { return a = a + b; }
+inline vec3& operator+=(vec3& a, float b) { return a = a + b; }
+inline vec3 operator-(const vec3& a, const vec3& b) {
+  return vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+inline vec3 operator-(const vec3& a, float b) {
+  return vec3(a.x - b, a.y - b, a.z - b);
+}
+inline vec3 operator-(float a, const vec3& b) {
+  return vec3(a - b.x, a - b.y, a - b.z);
+}
+inline vec3& operator-=(vec3& a, const vec3& b) { return a = a - b; }
+inline vec3& operator-=(vec3& a, float b) { return a = a - b; }
+inline vec3 operator*(const vec3& a, const vec3& b) {
+  return vec3(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+inline vec3 operator*(const vec3& a, float b) {
+  return vec3(a.x * b, a.y * b, a.z * b);
+}
+inline vec3 operator*(float a, const vec3& b) {
+  return vec3(a * b.x, a * b.y, a * b.z);
+}
+inline vec3& operator*=(vec3& a, const vec3& b) { return a = a * b; }
+inline vec3& operator*=(vec3& a, float b) { return a = a * b; }
+inline vec3 operator/(const vec3& a, const vec3& b) {
+  return vec3(a.x / b.x, a.y / b.y, a.z / b.z);
+}
+inline vec3 operator/(const vec3& a, float b) {
+  return vec3(a.x / b, a.y / b, a.z / b);
+}
+inline vec3 operator/(float a, const vec3& b) {
+  return vec3(a / b.x, a / b.y, a / b.z);
+}
+inline vec3& operator/=(vec3& a, const vec3& b) { return a = a / b; }
+inline vec3& operator/=(vec3& a, float b) { return a = a / b; }
+inline vec3 operator-(const vec3& a) { return vec3(-a.x, -a.y, -a.z); }
+
+inline vec4 operator+(const vec4& a, const vec4& b) {
+  return vec4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w);
+}
+inline vec4 operator+(const vec4& a, float b) {
+  return vec4(a.x + b, a.y + b, a.z + b, a.w + b);
+}
+inline vec4 operator+(float a, const vec4& b) {
+  return vec4(a + b.x, a + b.y, a + b.z, a + b.w);
+}
+inline vec4& operator+=(vec4& a, const vec4& b) { return a = a + b; }
+inline vec4& operator+=(vec4& a, float b) { return a = a + b; }
+inline vec4 operator-(const vec4& a, const vec4& b) {
+  return vec4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w);
+}
+inline vec4 operator-(const vec4& a, float b) {
+  return vec4(a.x - b, a.y - b, a.z - b, a.w - b);
+}
+inline vec4 operator-(float a, const vec4& b) {
+  return vec4(a - b.x, a - b.y, a - b.z, a - b.w);
+}
+inline vec4& operator-=(vec4& a, const vec4& b) { return a = a - b; }
+inline vec4& operator-=(vec4& a, float b) { return a = a - b; }
+inline vec4 operator*(const vec4& a, const vec4& b) {
+  return vec4(a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w);
+}
+inline vec4 operator*(const vec4& a, float b) {
+  return vec4(a.x * b, a.y * b, a.z * b, a.w * b);
+}
+inline vec4 operator*(float a, const vec4& b) {
+  return vec4(a * b.x, a * b.y, a * b.z, a * b.w);
+}
+inline vec4& operator*=(vec4& a, const vec4& b) { return a = a * b; }
+inline vec4& operator*=(vec4& a, float b) { return a = a * b; }
+inline vec4 operator/(const vec4& a, const vec4& b) {
+  return vec4(a.x / b.x, a.y / b.y, a.z / b.z, a.w / b.w);
+}
+inline vec4 operator/(const vec4& a, float b) {
+  return vec4(a.x / b, a.y / b, a.z / b, a.w / b);
+}
+inline vec4 operator/(float a, const vec4& b) {
+  return vec4(a / b.x, a / b.y, a / b.z, a / b.w);
+}
+inline vec4& operator/=(vec4& a, const vec4& b) { return a = a / b; }
+inline vec4& operator/=(vec4& a, float b) { return a = a / b; }
+inline vec4 operator-(const vec4& a) { return vec4(-a.x, -a.y, -a.z, -a.w); }
+
+/*
+<h3>Built-in functions</h3>
+
+<p>The GLSL built-in functions used in our atmosphere functions are the
+following. Note that the scalar versions must be declared here, even if they
+already exist in the standard library, because the vector versions would
+otherwise hide them:
+*/
+
+inline float abs(float x) { return std::abs(x); }
+inline float cos(float x) { return std::cos(x); }
+inline float sin(float x) { return std::sin(x); }
+inline float acos(float x) { return std::acos(x); }
+inline float sqrt(float x) { return std::sqrt(x); }
+inline float exp(float x) { return std::exp(x); }
+inline float pow(float x, float y) { return std::pow(x, y); }
+inline float floor(float x) { return std::floor(x); }
+inline float mod(float x, float y) { return x - y * std::floor(x / y); }
+inline float min(float x, float y) { return std::min(x, y); }
+inline float max(float x, float y) { return std::max(x, y); }
+inline float clamp(float x, float min_value, float max_value) {
+  return std::min(std::max(x, min_value), max_value);
+}
+inline float smoothstep(float edge0, float edge1, float x) {
+  float t = clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+  return t * t * (3.0f - 2.0f * t);
+}
+
+inline vec3 exp(const vec3& v) {
+  return vec3(std::exp(v.x), std::exp(v.y), std::exp(v.z));
+}
+inline vec3 min(const vec3& a, const vec3& b) {
+  return vec3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+}
+inline vec3 max(const vec3& a, const vec3& b) {
+  return vec3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+inline float dot(const vec2& a, const vec2& b) { return a.x * b.x + a.y * b.y; }
+inline float dot(const vec3& a, const vec3& b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+inline float length(const vec2& v) { return std::sqrt(dot(v, v)); }
+inline float length(const vec3& v) { return std::sqrt(dot(v, v)); }
+inline vec3 normalize(const vec3& v) { return v / length(v); }
+
+/*
+<h3>Textures</h3>
+
+<p>Finally, the 2D and 3D textures store RGBA float values (with the texel
+$(i,j,k)$ stored at index $i+w(j+hk)$, like in OpenGL), and support linear
+filtering with clamp to edge wrapping, via the GLSL <code>texture</code>
+function. To compute the filtered values, we need the index of the texels
+surrounding a texture coordinate along each axis, and the corresponding
+interpolation weight:
+*/
+
+inline void GetTexelIndices(float u, int size, int* i0, int* i1, float* t) {
+  float x = clamp(u * size - 0.5f, 0.0f, size - 1.0f);
+  *i0 = std::min(static_cast<int>(x), size - 1);
+  *i1 = std::min(*i0 + 1, size - 1);
+  *t = x - *i0;
+}
+
+class sampler2D {
+ public:
+  sampler2D() : sampler2D(0, 0) {}
+  sampler2D(int width, int height)
+      : width_(width), height_(height), texels_(width * height) {}
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  const vec4& Get(int i, int j) const { return texels_[i + width_ * j]; }
+  void Set(int i, int j, const vec4& value) { texels_[i + width_ * j] = value; }
+
+ private:
+  int width_;
+  int height_;
+  std::vector<vec4> texels_;
+};
+
+class sampler3D {
+ public:
+  sampler3D() : sampler3D(0, 0, 0) {}
+  sampler3D(int width, int height, int depth)
+      : width_(width), height_(height), depth_(depth),
+        texels_(width * height * depth) {}
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int depth() const { return depth_; }
+
+  const vec4& Get(int i, int j, int k) const {
+    return texels_[i + width_ * (j + height_ * k)];
+  }
+  void Set(int i, int j, int k, const vec4& value) {
+    texels_[i + width_ * (j + height_ * k)] = value;
+  }
+
+ private:
+  int width_;
+  int height_;
+  int depth_;
+  std::vector<vec4> texels_;
+};
+
+inline vec4 texture(const sampler2D& sampler, const vec2& uv) {
+  int i0, i1, j0, j1;
+  float s, t;
+  GetTexelIndices(uv.x, sampler.width(), &i0, &i1, &s);
+  GetTexelIndices(uv.y, sampler.height(), &j0, &j1, &t);
+  return (sampler.Get(i0, j0) * (1.0f - s) + sampler.Get(i1, j0) * s) *
+      (1.0f - t) +
+      (sampler.Get(i0, j1) * (1.0f - s) + sampler.Get(i1, j1) * s) * t;
+}
+
+inline vec4 texture(const sampler3D& sampler, const vec3& uvw) {
+  int i0, i1, j0, j1, k0, k1;
+  float s, t, r;
+  GetTexelIndices(uvw.x, sampler.width(), &i0, &i1, &s);
+  GetTexelIndices(uvw.y, sampler.height(), &j0, &j1, &t);
+  GetTexelIndices(uvw.z, sampler.depth(), &k0, &k1, &r);
+  vec4 v0 =
+      (sampler.Get(i0, j0, k0) * (1.0f - s) + sampler.Get(i1, j0, k0) * s) *
+          (1.0f - t) +
+      (sampler.Get(i0, j1, k0) * (1.0f - s) + sampler.Get(i1, j1, k0) * s) * t;
+  vec4 v1 =
+      (sampler.Get(i0, j0, k1) * (1.0f - s) + sampler.Get(i1, j0, k1) * s) *
+          (1.0f - t) +
+      (sampler.Get(i0, j1, k1) * (1.0f - s) + sampler.Get(i1, j1, k1) * s) * t;
+  return v0 * (1.0f - r) + v1 * r;
+}
+
+}  // namespace cpu
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_CPU_GLSL_H_
@@ -0,0 +1,1170 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/cpu/model.cc</h2>
+
+<p>This file implements the <a href="model.h.html">API of our RGB CPU atmosphere
+model</a>. Like the <a href="../model.cc.html">GPU model</a>, its main role is
+to precompute the transmittance, scattering and irradiance textures, by calling
+the <a href="../functions.glsl.html">GLSL functions</a> on each texel, in the
+same order as on GPU. Here, however, these functions are compiled as C++ code,
+using the single precision types provided in <a href="glsl.h.html">glsl.h</a>.
+
+<p>We start by including the files we need:
+*/
+
+#include "atmosphere/cpu/model.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "atmosphere/constants.h"
+#include "atmosphere/spectrum.h"
+#include "util/progress_bar.h"
+
+/*
+<p>We then include the GLSL definitions and functions, after the definitions of
+the macros they need (as in the <a href="../reference/functions.cc.html">
+reference model</a>, except that here we don't need templates since all the
+textures have the same type). The <code>COMBINED_SCATTERING_TEXTURES</code>
+option is a compile time option in GLSL, while it is a runtime option here. We
+thus include the GLSL functions twice, in two different namespaces: one without
+and one with this option (the texture precomputation functions are identical in
+both cases, and we use those of the first namespace). Finally, as in the GPU
+model, we disable the assertions of the GLSL functions, which are meant for
+double precision values and can fail due to single precision round off errors
+(they are enabled again after the GLSL includes, for the code of this file):
+*/
+
+#undef assert
+#define assert(x)
+#define IN(x) const x&
+#define OUT(x) x&
+#define TEMPLATE(x)
+#define TEMPLATE_ARGUMENT(x)
+
+namespace atmosphere {
+namespace cpu {
+
+#include "atmosphere/definitions.glsl"
+
+namespace separate_textures {
+#include "atmosphere/functions.glsl"
+}  // namespace separate_textures
+
+namespace combined_textures {
+#define COMBINED_SCATTERING_TEXTURES
+#include "atmosphere/functions.glsl"
+#undef COMBINED_SCATTERING_TEXTURES
+}  // namespace combined_textures
+
+}  // namespace cpu
+}  // namespace atmosphere
+
+#undef assert
+#include <cassert>  // NOLINT(build/include_order)
+
+namespace atmosphere {
+namespace cpu {
+
+using separate_textures::ComputeDensityTexture;
+using separate_textures::ComputeTransmittanceToTopAtmosphereBoundaryTexture;
+using separate_textures::ComputeDirectIrradianceTexture;
+using separate_textures::ComputeSingleScatteringTexture;
+using separate_textures::ComputeScatteringDensityTexture;
+using separate_textures::ComputeIndirectIrradianceTexture;
+using separate_textures::ComputeMultipleScatteringTexture;
+using separate_textures::RayleighPhaseFunction;
+
+/*
+<p>The precomputation steps need to multiply the computed radiance values with
+a <code>luminance_from_radiance</code> matrix, which is done with the following
+helper function:
+*/
+
+namespace {
+
+vec3 Multiply(const std::array<float, 9>& matrix, const vec3& v) {
+  return vec3(
+      matrix[0] * v.x + matrix[1] * v.y + matrix[2] * v.z,
+      matrix[3] * v.x + matrix[4] * v.y + matrix[5] * v.z,
+      matrix[6] * v.x + matrix[7] * v.y + matrix[8] * v.z);
+}
+
+}  // anonymous namespace
+
+/*
+<p>The constructor computes the atmosphere parameters for the 3 wavelengths
+<code>kLambdaR</code>, <code>kLambdaG</code> and <code>kLambdaB</code>, as well
+as the luminance conversion constants, exactly as in the
+<a href="../model.cc.html">GPU model</a> (where they are used to generate the
+GLSL <code>ATMOSPHERE</code>, <code>SKY_SPECTRAL_RADIANCE_TO_LUMINANCE</code>,
+<code>SUN_SPECTRAL_RADIANCE_TO_LUMINANCE</code> and *<code>_RADIANCE_SCALE
+</code> constants). It also allocates the precomputed textures (but does not
+initialize them):
+*/
+
+Model::Model(
+    const std::vector<double>& wavelengths,
+    const std::vector<double>& solar_irradiance,
+    const double sun_angular_radius,
+    double bottom_radius,
+    double top_radius,
+    const std::vector<atmosphere::DensityProfileLayer>& rayleigh_density,
+    const std::vector<double>& rayleigh_scattering,
+    const std::vector<atmosphere::DensityProfileLayer>& mie_density,
+    const std::vector<double>& mie_scattering,
+    const std::vector<double>& mie_extinction,
+    double mie_phase_function_g,
+    const std::vector<atmosphere::DensityProfileLayer>& absorption_density,
+    const std::vector<double>& absorption_extinction,
+    const std::vector<double>& ground_albedo,
+    double max_sun_zenith_angle,
+    double length_unit_in_meters,
+    unsigned int num_precomputed_wavelengths,
+    bool combine_scattering_textures,
+    bool runtime_solar_irradiance,
+    bool runtime_ground_albedo) :
+        num_precomputed_wavelengths_(num_precomputed_wavelengths),
+        combine_scattering_textures_(combine_scattering_textures),
+        runtime_solar_irradiance_(runtime_solar_irradiance),
+        runtime_ground_albedo_(runtime_ground_albedo),
+        wavelengths_(wavelengths),
+        ground_albedo_(ground_albedo) {
+  auto to_vec3 = [wavelengths](const std::vector<double>& v,
+      const vec3& lambdas, double scale) {
+    return vec3(
+        Interpolate(wavelengths, v, lambdas.x) * scale,
+        Interpolate(wavelengths, v, lambdas.y) * scale,
+        Interpolate(wavelengths, v, lambdas.z) * scale);
+  };
+  auto density_profile = [length_unit_in_meters](
+      std::vector<atmosphere::DensityProfileLayer> layers) {
+    constexpr int kLayerCount = 2;
+    while (layers.size() < kLayerCount) {
+      layers.insert(layers.begin(), atmosphere::DensityProfileLayer());
+    }
+    DensityProfile result;
+    for (int i = 0; i < kLayerCount; ++i) {
+      result.layers[i].width = layers[i].width / length_unit_in_meters;
+      result.layers[i].exp_term = layers[i].exp_term;
+      result.layers[i].exp_scale = layers[i].exp_scale * length_unit_in_meters;
+      result.layers[i].linear_term =
+          layers[i].linear_term * length_unit_in_meters;
+      result.layers[i].constant_term = layers[i].constant_term;
+    }
+    return result;
+  };
+  const std::vector<double> precomputed_solar_irradiance =
+      runtime_solar_irradiance ?
+          std::vector<double>(wavelengths.size(), 1.0) : solar_irradiance;
+  atmosphere_factory_ = [=](const vec3& lambdas,
+      AtmosphereParameters* atmosphere) {
+    atmosphere->solar_irradiance =
+        to_vec3(precomputed_solar_irradiance, lambdas, 1.0);
+    atmosphere->sun_angular_radius = sun_angular_radius;
+    atmosphere->bottom_radius = bottom_radius / length_unit_in_meters;
+    atmosphere->top_radius = top_radius / length_unit_in_meters;
+    atmosphere->rayleigh_density = density_profile(rayleigh_density);
+    atmosphere->rayleigh_scattering =
+        to_vec3(rayleigh_scattering, lambdas, length_unit_in_meters);
+    atmosphere->mie_density = density_profile(mie_density);
+    atmosphere->mie_scattering =
+        to_vec3(mie_scattering, lambdas, length_unit_in_meters);
+    atmosphere->mie_extinction =
+        to_vec3(mie_extinction, lambdas, length_unit_in_meters);
+    atmosphere->mie_phase_function_g = mie_phase_function_g;
+    atmosphere->absorption_density = density_profile(absorption_density);
+    atmosphere->absorption_extinction =
+        to_vec3(absorption_extinction, lambdas, length_unit_in_meters);
+    atmosphere->ground_albedo = to_vec3(ground_albedo, lambdas, 1.0);
+    atmosphere->mu_s_min = cos(max_sun_zenith_angle);
+  };
+  atmosphere_.reset(new AtmosphereParameters());
+  atmosphere_factory_(vec3(kLambdaR, kLambdaG, kLambdaB), atmosphere_.get());
+
+  ComputeSolarIrradianceFactors(solar_irradiance);
+
+  transmittance_texture_ = sampler2D(
+      TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
+  scattering_texture_ = sampler3D(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  if (!combine_scattering_textures) {
+    optional_single_mie_scattering_texture_ = sampler3D(
+        SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT,
+        SCATTERING_TEXTURE_DEPTH);
+  }
+  irradiance_texture_ =
+      sampler2D(IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+}
+
+Model::~Model() {}
+
+/*
+<p>The solar irradiance dependent factors are also computed as in the GPU
+model (see its <code>SetSolarIrradiance</code> method):
+*/
+
+void Model::SetSolarIrradiance(const std::vector<double>& solar_irradiance) {
+  assert(runtime_solar_irradiance_);
+  assert(solar_irradiance.size() == wavelengths_.size());
+  ComputeSolarIrradianceFactors(solar_irradiance);
+  if (!group_scattering_textures_.empty()) {
+    CombineWavelengthGroups();
+  }
+}
+
+void Model::ComputeSolarIrradianceFactors(
+    const std::vector<double>& solar_irradiance) {
+  solar_irradiance_ = solar_irradiance;
+  // See the GPU Model for the rationale of these values.
+  bool precompute_illuminance = num_precomputed_wavelengths_ > 3;
+  double sky_k_r, sky_k_g, sky_k_b;
+  if (precompute_illuminance) {
+    sky_k_r = sky_k_g = sky_k_b = MAX_LUMINOUS_EFFICACY;
+  } else {
+    ComputeSpectralRadianceToLuminanceFactors(wavelengths_, solar_irradiance,
+        -3 /* lambda_power */, &sky_k_r, &sky_k_g, &sky_k_b);
+  }
+  double sun_k_r, sun_k_g, sun_k_b;
+  ComputeSpectralRadianceToLuminanceFactors(wavelengths_, solar_irradiance,
+      0 /* lambda_power */, &sun_k_r, &sun_k_g, &sun_k_b);
+  sky_spectral_radiance_to_luminance_ = vec3(sky_k_r, sky_k_g, sky_k_b);
+  sun_spectral_radiance_to_luminance_ = vec3(sun_k_r, sun_k_g, sun_k_b);
+  vec3 solar_rgb(
+      Interpolate(wavelengths_, solar_irradiance, kLambdaR),
+      Interpolate(wavelengths_, solar_irradiance, kLambdaG),
+      Interpolate(wavelengths_, solar_irradiance, kLambdaB));
+  vec3 one(1.0, 1.0, 1.0);
+  sun_radiance_scale_ = runtime_solar_irradiance_ ? solar_rgb : one;
+  sky_radiance_scale_ = runtime_solar_irradiance_ && !precompute_illuminance ?
+      solar_rgb : one;
+}
+
+/*
+<p>Likewise, the textures precomputed for several ground albedo values are
+combined as in the GPU model (see its <code>SetGroundAlbedo</code> method):
+*/
+
+void Model::SetGroundAlbedo(const std::vector<double>& ground_albedo) {
+  assert(runtime_ground_albedo_);
+  assert(ground_albedo.size() == wavelengths_.size());
+  ground_albedo_ = ground_albedo;
+  if (!group_scattering_textures_.empty()) {
+    CombineWavelengthGroups();
+  }
+}
+
+/*
+<p>The <code>Init</code> method precomputes the atmosphere textures, exactly as
+in the <a href="../model.cc.html">GPU model</a> (see its documentation for more
+details), either directly for the 3 wavelengths <code>kLambdaR</code>,
+<code>kLambdaG</code> and <code>kLambdaB</code>, or by accumulating the sRGB
+illuminance values computed for <code>num_precomputed_wavelengths_</code>
+wavelengths, 3 at a time (or, with the <code>runtime_solar_irradiance</code>
+option, by keeping the values computed for each group of 3 wavelengths, and by
+combining them in <code>CombineWavelengthGroups</code>). With the
+<code>runtime_ground_albedo</code> option, the values are also computed and
+kept for several uniform ground albedo values, as on GPU:
+*/
+
+void Model::Init(unsigned int num_scattering_orders) {
+  group_lambdas_.clear();
+  group_luminance_from_radiance_.clear();
+  group_ground_albedos_.clear();
+  group_scattering_textures_.clear();
+  group_single_mie_scattering_textures_.clear();
+  group_irradiance_textures_.clear();
+  DeleteUpdateCorrections();
+
+  // The temporary textures needed for the precomputations (as on GPU,
+  // delta_multiple_scattering_texture and delta_rayleigh_scattering_texture
+  // can be stored in the same texture).
+  sampler2D delta_irradiance_texture(
+      IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+  sampler3D delta_rayleigh_scattering_texture(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  sampler3D delta_mie_scattering_texture(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  sampler3D delta_scattering_density_texture(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  sampler3D* delta_multiple_scattering_texture =
+      &delta_rayleigh_scattering_texture;
+
+  // The density lookup table does not depend on the wavelength, so we compute
+  // it only once here.
+  sampler2D density_texture(DENSITY_TEXTURE_WIDTH, DENSITY_TEXTURE_HEIGHT);
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < DENSITY_TEXTURE_WIDTH; ++i) {
+      density_texture.Set(i, j, vec4(
+          ComputeDensityTexture(*atmosphere_, vec2(i + 0.5, j + 0.5)), 0.0));
+    }
+  }, DENSITY_TEXTURE_HEIGHT);
+
+  // As on GPU, with the runtime_solar_irradiance option in precomputed
+  // illuminance mode, or with the runtime_ground_albedo option, the values
+  // for each group of 3 wavelengths (and for each ground albedo sample) are
+  // precomputed in new textures, including the 3 components of the single Mie
+  // scattering, and combined at the end of this method.
+  ground_albedo_samples_.clear();
+  if (runtime_ground_albedo_) {
+    unsigned int num_samples = std::max(num_scattering_orders, 1u);
+    for (unsigned int j = 0; j < num_samples; ++j) {
+      ground_albedo_samples_.push_back(
+          num_samples > 1 ? j / (num_samples - 1.0) : 0.0);
+    }
+  } else {
+    ground_albedo_samples_.push_back(-1.0);
+  }
+  auto precompute_groups = [&](const AtmosphereParameters& atmosphere,
+      const vec3& lambdas, const mat3& luminance_from_radiance) {
+    for (double ground_albedo : ground_albedo_samples_) {
+      AtmosphereParameters group_atmosphere = atmosphere;
+      if (runtime_ground_albedo_) {
+        group_atmosphere.ground_albedo =
+            vec3(ground_albedo, ground_albedo, ground_albedo);
+      }
+      group_lambdas_.push_back(lambdas);
+      group_luminance_from_radiance_.push_back(luminance_from_radiance);
+      group_ground_albedos_.push_back(ground_albedo);
+      group_scattering_textures_.emplace_back(SCATTERING_TEXTURE_WIDTH,
+          SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+      group_single_mie_scattering_textures_.emplace_back(
+          SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT,
+          SCATTERING_TEXTURE_DEPTH);
+      group_irradiance_textures_.emplace_back(
+          IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+      std::swap(scattering_texture_, group_scattering_textures_.back());
+      std::swap(optional_single_mie_scattering_texture_,
+          group_single_mie_scattering_textures_.back());
+      std::swap(irradiance_texture_, group_irradiance_textures_.back());
+      mat3 identity{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+      Precompute(group_atmosphere, density_texture, &delta_irradiance_texture,
+          &delta_rayleigh_scattering_texture, &delta_mie_scattering_texture,
+          &delta_scattering_density_texture, delta_multiple_scattering_texture,
+          identity, false /* blend */, num_scattering_orders);
+      std::swap(scattering_texture_, group_scattering_textures_.back());
+      std::swap(optional_single_mie_scattering_texture_,
+          group_single_mie_scattering_textures_.back());
+      std::swap(irradiance_texture_, group_irradiance_textures_.back());
+    }
+  };
+
+  if (num_precomputed_wavelengths_ <= 3) {
+    mat3 luminance_from_radiance{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+    if (runtime_ground_albedo_) {
+      precompute_groups(*atmosphere_, vec3(kLambdaR, kLambdaG, kLambdaB),
+          luminance_from_radiance);
+    } else {
+      Precompute(*atmosphere_, density_texture, &delta_irradiance_texture,
+          &delta_rayleigh_scattering_texture, &delta_mie_scattering_texture,
+          &delta_scattering_density_texture, delta_multiple_scattering_texture,
+          luminance_from_radiance, false /* blend */, num_scattering_orders);
+    }
+  } else {
+    int num_iterations = (num_precomputed_wavelengths_ + 2) / 3;
+    double dlambda =
+        static_cast<double>(kLambdaMax - kLambdaMin) / (3 * num_iterations);
+    for (int i = 0; i < num_iterations; ++i) {
+      vec3 lambdas(
+          kLambdaMin + (3 * i + 0.5) * dlambda,
+          kLambdaMin + (3 * i + 1.5) * dlambda,
+          kLambdaMin + (3 * i + 2.5) * dlambda);
+      auto coeff = [dlambda](double lambda, int component) {
+        double x = CieColorMatchingFunctionTableValue(lambda, 1);
+        double y = CieColorMatchingFunctionTableValue(lambda, 2);
+        double z = CieColorMatchingFunctionTableValue(lambda, 3);
+        return static_cast<float>((
+            XYZ_TO_SRGB[component * 3] * x +
+            XYZ_TO_SRGB[component * 3 + 1] * y +
+            XYZ_TO_SRGB[component * 3 + 2] * z) * dlambda);
+      };
+      mat3 luminance_from_radiance{
+        coeff(lambdas.x, 0), coeff(lambdas.y, 0), coeff(lambdas.z, 0),
+        coeff(lambdas.x, 1), coeff(lambdas.y, 1), coeff(lambdas.z, 1),
+        coeff(lambdas.x, 2), coeff(lambdas.y, 2), coeff(lambdas.z, 2)
+      };
+      AtmosphereParameters atmosphere;
+      atmosphere_factory_(lambdas, &atmosphere);
+      if (runtime_solar_irradiance_ || runtime_ground_albedo_) {
+        precompute_groups(atmosphere, lambdas, luminance_from_radiance);
+      } else {
+        Precompute(atmosphere, density_texture, &delta_irradiance_texture,
+            &delta_rayleigh_scattering_texture, &delta_mie_scattering_texture,
+            &delta_scattering_density_texture,
+            delta_multiple_scattering_texture, luminance_from_radiance,
+            i > 0 /* blend */, num_scattering_orders);
+      }
+    }
+
+    // Recompute the transmittance for kLambdaR, kLambdaG and kLambdaB.
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < TRANSMITTANCE_TEXTURE_WIDTH; ++i) {
+        transmittance_texture_.Set(i, j, vec4(
+            ComputeTransmittanceToTopAtmosphereBoundaryTexture(
+                *atmosphere_, density_texture, vec2(i + 0.5, j + 0.5)), 0.0));
+      }
+    }, TRANSMITTANCE_TEXTURE_HEIGHT);
+  }
+  if (!group_lambdas_.empty()) {
+    CombineWavelengthGroups();
+  }
+}
+
+/*
+<p>The <code>Update</code> method corrects the multiple scattering of a previous
+model with the difference between the next scattering orders of the two models,
+as in the <a href="../model.cc.html">GPU model</a> (see its documentation for
+the details and for the error bound). As on GPU, the radiance fields to which
+the scattering operators are applied are stored as in the scattering textures
+(i.e. with the multiple scattering divided by the Rayleigh phase function and
+added to the single Rayleigh scattering), and passed to the precomputation
+functions in place of the single scattering textures:
+*/
+
+void Model::Update(const Model& previous_model, unsigned int num_iterations) {
+  if (num_iterations == 0 || num_precomputed_wavelengths_ > 3 ||
+      runtime_ground_albedo_ ||
+      previous_model.num_precomputed_wavelengths_ > 3 ||
+      previous_model.runtime_ground_albedo_) {
+    throw std::invalid_argument("Model::Update requires at least one "
+        "iteration, and models in precomputed radiance mode without the "
+        "runtime_ground_albedo option");
+  }
+  assert(&previous_model != this);
+  assert(previous_model.runtime_solar_irradiance_ == runtime_solar_irradiance_);
+  group_lambdas_.clear();
+  group_luminance_from_radiance_.clear();
+  group_ground_albedos_.clear();
+  group_scattering_textures_.clear();
+  group_single_mie_scattering_textures_.clear();
+  group_irradiance_textures_.clear();
+  DeleteUpdateCorrections();
+
+  // The temporary textures: those of Init, plus the ground irradiance (direct
+  // plus indirect) and the indirect irradiance computed at each iteration.
+  sampler2D delta_irradiance_texture(
+      IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+  sampler3D delta_rayleigh_scattering_texture(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  sampler3D delta_mie_scattering_texture(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  sampler3D delta_scattering_density_texture(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  sampler3D delta_multiple_scattering_texture(SCATTERING_TEXTURE_WIDTH,
+      SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  sampler2D ground_irradiance_texture(
+      IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+  sampler2D indirect_irradiance_texture(
+      IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+
+  // Compute the density table, and the transmittance, direct irradiance and
+  // single scattering as in Init.
+  sampler2D density_texture(DENSITY_TEXTURE_WIDTH, DENSITY_TEXTURE_HEIGHT);
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < DENSITY_TEXTURE_WIDTH; ++i) {
+      density_texture.Set(i, j, vec4(
+          ComputeDensityTexture(*atmosphere_, vec2(i + 0.5, j + 0.5)), 0.0));
+    }
+  }, DENSITY_TEXTURE_HEIGHT);
+  const mat3 identity{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  Precompute(*atmosphere_, density_texture, &delta_irradiance_texture,
+      &delta_rayleigh_scattering_texture, &delta_mie_scattering_texture,
+      &delta_scattering_density_texture, &delta_multiple_scattering_texture,
+      identity, false /* blend */, 1 /* num_scattering_orders */);
+
+  // Applies the scattering operator K of 'atmosphere' (whose density table is
+  // 'density_table') to the radiance field given by 'scattering_texture' and
+  // 'single_mie_scattering_texture', with the ground irradiance in
+  // ground_irradiance_texture. The result, divided by the Rayleigh phase
+  // function, is stored in delta_multiple_scattering_texture, and its
+  // irradiance in indirect_irradiance_texture.
+  auto apply_scattering_operator = [&](const AtmosphereParameters& atmosphere,
+      const sampler2D& density_table, const sampler2D& transmittance_texture,
+      const sampler3D& scattering_texture,
+      const sampler3D& single_mie_scattering_texture) {
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          delta_scattering_density_texture.Set(i, j, k, vec4(
+              ComputeScatteringDensityTexture(atmosphere,
+                  transmittance_texture, density_table, scattering_texture,
+                  single_mie_scattering_texture,
+                  delta_multiple_scattering_texture, ground_irradiance_texture,
+                  vec3(i + 0.5, j + 0.5, k + 0.5), 2 /* scattering_order */),
+              0.0));
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+        indirect_irradiance_texture.Set(i, j, vec4(
+            ComputeIndirectIrradianceTexture(atmosphere, scattering_texture,
+                single_mie_scattering_texture,
+                delta_multiple_scattering_texture, vec2(i + 0.5, j + 0.5),
+                1 /* scattering_order */),
+            0.0));
+      }
+    }, IRRADIANCE_TEXTURE_HEIGHT);
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          float nu;
+          vec3 delta_multiple_scattering = ComputeMultipleScatteringTexture(
+              atmosphere, transmittance_texture,
+              delta_scattering_density_texture,
+              vec3(i + 0.5, j + 0.5, k + 0.5), nu);
+          delta_multiple_scattering_texture.Set(i, j, k,
+              vec4(delta_multiple_scattering / RayleighPhaseFunction(nu), 0.0));
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+  };
+
+  // If this was not already done by a previous call, compute the density
+  // table, single scattering and direct irradiance of the previous model, then
+  // T' and its irradiance, and finally the scattering and irradiance
+  // corrections M' - T', all kept in the previous model.
+  if (previous_model.update_next_scattering_texture_.width() == 0) {
+    const AtmosphereParameters& previous_atmosphere =
+        *previous_model.atmosphere_;
+    sampler2D previous_density_texture(
+        DENSITY_TEXTURE_WIDTH, DENSITY_TEXTURE_HEIGHT);
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < DENSITY_TEXTURE_WIDTH; ++i) {
+        previous_density_texture.Set(i, j, vec4(ComputeDensityTexture(
+            previous_atmosphere, vec2(i + 0.5, j + 0.5)), 0.0));
+      }
+    }, DENSITY_TEXTURE_HEIGHT);
+    sampler3D previous_delta_rayleigh_scattering_texture(
+        SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT,
+        SCATTERING_TEXTURE_DEPTH);
+    sampler3D previous_delta_mie_scattering_texture(SCATTERING_TEXTURE_WIDTH,
+        SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          vec3 delta_rayleigh;
+          vec3 delta_mie;
+          ComputeSingleScatteringTexture(previous_atmosphere,
+              previous_model.transmittance_texture_, previous_density_texture,
+              vec3(i + 0.5, j + 0.5, k + 0.5), delta_rayleigh, delta_mie);
+          previous_delta_rayleigh_scattering_texture.Set(i, j, k,
+              vec4(delta_rayleigh, 0.0));
+          previous_delta_mie_scattering_texture.Set(i, j, k,
+              vec4(delta_mie, 0.0));
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+        ground_irradiance_texture.Set(i, j, vec4(
+            ComputeDirectIrradianceTexture(previous_atmosphere,
+                previous_model.transmittance_texture_, vec2(i + 0.5, j + 0.5)),
+            0.0) + previous_model.irradiance_texture_.Get(i, j));
+      }
+    }, IRRADIANCE_TEXTURE_HEIGHT);
+    apply_scattering_operator(previous_atmosphere, previous_density_texture,
+        previous_model.transmittance_texture_,
+        previous_model.scattering_texture_,
+        previous_delta_mie_scattering_texture);
+    sampler3D scattering_correction_texture(SCATTERING_TEXTURE_WIDTH,
+        SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          scattering_correction_texture.Set(i, j, k, vec4(
+              vec3(previous_model.scattering_texture_.Get(i, j, k)) -
+              vec3(previous_delta_rayleigh_scattering_texture.Get(i, j, k)) -
+              vec3(delta_multiple_scattering_texture.Get(i, j, k)), 0.0));
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+    sampler2D irradiance_correction_texture(
+        IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+        irradiance_correction_texture.Set(i, j,
+            previous_model.irradiance_texture_.Get(i, j) -
+            indirect_irradiance_texture.Get(i, j));
+      }
+    }, IRRADIANCE_TEXTURE_HEIGHT);
+    previous_model.update_next_scattering_texture_ =
+        std::move(delta_multiple_scattering_texture);
+    previous_model.update_scattering_correction_texture_ =
+        std::move(scattering_correction_texture);
+    previous_model.update_irradiance_correction_texture_ =
+        std::move(irradiance_correction_texture);
+    delta_multiple_scattering_texture = sampler3D(SCATTERING_TEXTURE_WIDTH,
+        SCATTERING_TEXTURE_HEIGHT, SCATTERING_TEXTURE_DEPTH);
+  }
+  const sampler3D& scattering_correction_texture =
+      previous_model.update_scattering_correction_texture_;
+  const sampler2D& irradiance_correction_texture =
+      previous_model.update_irradiance_correction_texture_;
+
+  // Compute L_1 + M_0 in scattering_texture_, as L_1 + T' + (M' - T'), and the
+  // ground irradiance for M_0. Then, at each iteration, compute M_{k+1} in
+  // scattering_texture_ and the corresponding irradiance.
+  auto compute_corrected_scattering_texture = [&](
+      const sampler3D& multiple_scattering_texture) {
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          vec3 rayleigh(delta_rayleigh_scattering_texture.Get(i, j, k));
+          vec3 mie(delta_mie_scattering_texture.Get(i, j, k));
+          scattering_texture_.Set(i, j, k, vec4(rayleigh +
+              vec3(multiple_scattering_texture.Get(i, j, k)) +
+              vec3(scattering_correction_texture.Get(i, j, k)),
+              combine_scattering_textures_ ? mie.x : 0.0f));
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+  };
+  auto compute_ground_irradiance_texture = [&](const sampler2D& indirect) {
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+        ground_irradiance_texture.Set(i, j,
+            delta_irradiance_texture.Get(i, j) + indirect.Get(i, j));
+      }
+    }, IRRADIANCE_TEXTURE_HEIGHT);
+  };
+  compute_corrected_scattering_texture(
+      previous_model.update_next_scattering_texture_);
+  compute_ground_irradiance_texture(previous_model.irradiance_texture_);
+  for (unsigned int iteration = 0; iteration < num_iterations; ++iteration) {
+    if (iteration > 0) {
+      compute_ground_irradiance_texture(irradiance_texture_);
+    }
+    apply_scattering_operator(*atmosphere_, density_texture,
+        transmittance_texture_, scattering_texture_,
+        delta_mie_scattering_texture);
+    compute_corrected_scattering_texture(delta_multiple_scattering_texture);
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+        irradiance_texture_.Set(i, j, indirect_irradiance_texture.Get(i, j) +
+            irradiance_correction_texture.Get(i, j));
+      }
+    }, IRRADIANCE_TEXTURE_HEIGHT);
+  }
+}
+
+void Model::DeleteUpdateCorrections() {
+  update_next_scattering_texture_ = sampler3D();
+  update_scattering_correction_texture_ = sampler3D();
+  update_irradiance_correction_texture_ = sampler2D();
+}
+
+/*
+<p>The <code>Blend</code> method computes the weighted sum of the precomputed
+textures of several models, as in the <a href="../model.cc.html">GPU model</a>:
+*/
+
+void Model::Blend(const std::vector<const Model*>& models,
+    const std::vector<double>& weights) {
+  assert(!models.empty() && models.size() == weights.size());
+  assert(!runtime_ground_albedo_ &&
+      (num_precomputed_wavelengths_ <= 3 || !runtime_solar_irradiance_));
+  for (unsigned int m = 0; m < models.size(); ++m) {
+    assert(models[m]->num_precomputed_wavelengths_ ==
+        num_precomputed_wavelengths_ &&
+        models[m]->combine_scattering_textures_ ==
+        combine_scattering_textures_ &&
+        models[m]->runtime_solar_irradiance_ == runtime_solar_irradiance_ &&
+        models[m]->runtime_ground_albedo_ == runtime_ground_albedo_);
+  }
+  group_lambdas_.clear();
+  group_luminance_from_radiance_.clear();
+  group_ground_albedos_.clear();
+  group_scattering_textures_.clear();
+  group_single_mie_scattering_textures_.clear();
+  group_irradiance_textures_.clear();
+  DeleteUpdateCorrections();
+
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < TRANSMITTANCE_TEXTURE_WIDTH; ++i) {
+      vec4 transmittance(0.0);
+      for (unsigned int m = 0; m < models.size(); ++m) {
+        transmittance += models[m]->transmittance_texture_.Get(i, j) *
+            static_cast<float>(weights[m]);
+      }
+      transmittance_texture_.Set(i, j, transmittance);
+    }
+  }, TRANSMITTANCE_TEXTURE_HEIGHT);
+  RunJobs([&](unsigned int k) {
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        vec4 scattering(0.0);
+        vec4 single_mie_scattering(0.0);
+        for (unsigned int m = 0; m < models.size(); ++m) {
+          const float weight = weights[m];
+          scattering += models[m]->scattering_texture_.Get(i, j, k) * weight;
+          if (optional_single_mie_scattering_texture_.width() > 0) {
+            single_mie_scattering += weight *
+                models[m]->optional_single_mie_scattering_texture_.Get(i, j, k);
+          }
+        }
+        scattering_texture_.Set(i, j, k, scattering);
+        if (optional_single_mie_scattering_texture_.width() > 0) {
+          optional_single_mie_scattering_texture_.Set(
+              i, j, k, single_mie_scattering);
+        }
+      }
+    }
+  }, SCATTERING_TEXTURE_DEPTH);
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+      vec4 irradiance(0.0);
+      for (unsigned int m = 0; m < models.size(); ++m) {
+        irradiance += models[m]->irradiance_texture_.Get(i, j) *
+            static_cast<float>(weights[m]);
+      }
+      irradiance_texture_.Set(i, j, irradiance);
+    }
+  }, IRRADIANCE_TEXTURE_HEIGHT);
+}
+
+/*
+<p>The <code>SetTextures</code> method simply copies the given textures, whose
+texels are in the same order as in our samplers:
+*/
+
+void Model::SetTextures(const PrecomputedTextures& textures) {
+  const size_t scattering_size = 4 * SCATTERING_TEXTURE_WIDTH *
+      SCATTERING_TEXTURE_HEIGHT * SCATTERING_TEXTURE_DEPTH;
+  if (runtime_ground_albedo_ ||
+      (num_precomputed_wavelengths_ > 3 && runtime_solar_irradiance_)) {
+    throw std::invalid_argument("Model::SetTextures does not support the "
+        "runtime_ground_albedo option, nor the runtime_solar_irradiance "
+        "option in precomputed illuminance mode");
+  }
+  if (textures.transmittance.size() !=
+          4 * TRANSMITTANCE_TEXTURE_WIDTH * TRANSMITTANCE_TEXTURE_HEIGHT ||
+      textures.scattering.size() != scattering_size ||
+      textures.single_mie_scattering.size() !=
+          (combine_scattering_textures_ ? 0 : scattering_size) ||
+      textures.irradiance.size() !=
+          4 * IRRADIANCE_TEXTURE_WIDTH * IRRADIANCE_TEXTURE_HEIGHT) {
+    throw std::invalid_argument("Unexpected precomputed texture sizes");
+  }
+  group_lambdas_.clear();
+  group_luminance_from_radiance_.clear();
+  group_ground_albedos_.clear();
+  group_scattering_textures_.clear();
+  group_single_mie_scattering_textures_.clear();
+  group_irradiance_textures_.clear();
+  DeleteUpdateCorrections();
+
+  auto texel = [](const std::vector<float>& texture, unsigned int index) {
+    return vec4(texture[4 * index], texture[4 * index + 1],
+        texture[4 * index + 2], texture[4 * index + 3]);
+  };
+  for (unsigned int j = 0; j < TRANSMITTANCE_TEXTURE_HEIGHT; ++j) {
+    for (unsigned int i = 0; i < TRANSMITTANCE_TEXTURE_WIDTH; ++i) {
+      transmittance_texture_.Set(i, j, texel(textures.transmittance,
+          i + TRANSMITTANCE_TEXTURE_WIDTH * j));
+    }
+  }
+  for (unsigned int k = 0; k < SCATTERING_TEXTURE_DEPTH; ++k) {
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        const unsigned int index =
+            i + SCATTERING_TEXTURE_WIDTH * (j + SCATTERING_TEXTURE_HEIGHT * k);
+        scattering_texture_.Set(i, j, k, texel(textures.scattering, index));
+        if (!combine_scattering_textures_) {
+          optional_single_mie_scattering_texture_.Set(i, j, k,
+              texel(textures.single_mie_scattering, index));
+        }
+      }
+    }
+  }
+  for (unsigned int j = 0; j < IRRADIANCE_TEXTURE_HEIGHT; ++j) {
+    for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+      irradiance_texture_.Set(i, j, texel(textures.irradiance,
+          i + IRRADIANCE_TEXTURE_WIDTH * j));
+    }
+  }
+}
+
+/*
+<p>The final textures are combined from the textures precomputed for each
+group of wavelengths (and for each ground albedo sample) as on GPU, with the
+conversion matrix of each group multiplied with the solar irradiance and with
+the Lagrange basis polynomial of its ground albedo sample at its wavelengths:
+*/
+
+void Model::CombineWavelengthGroups() {
+  std::vector<mat3> luminance_from_radiance = group_luminance_from_radiance_;
+  for (unsigned int g = 0; g < group_lambdas_.size(); ++g) {
+    const float lambdas[3] = {
+      group_lambdas_[g].x, group_lambdas_[g].y, group_lambdas_[g].z
+    };
+    for (int j = 0; j < 3; ++j) {
+      double weight = 1.0;
+      if (runtime_solar_irradiance_ && num_precomputed_wavelengths_ > 3) {
+        weight *= Interpolate(wavelengths_, solar_irradiance_, lambdas[j]);
+      }
+      if (runtime_ground_albedo_) {
+        const double ground_albedo =
+            Interpolate(wavelengths_, ground_albedo_, lambdas[j]);
+        const double sample = group_ground_albedos_[g];
+        for (double other_sample : ground_albedo_samples_) {
+          if (other_sample != sample) {
+            weight *= (ground_albedo - other_sample) / (sample - other_sample);
+          }
+        }
+      }
+      for (int i = 0; i < 3; ++i) {
+        luminance_from_radiance[g][3 * i + j] *= weight;
+      }
+    }
+  }
+  RunJobs([&](unsigned int k) {
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        vec3 scattering(0.0, 0.0, 0.0);
+        vec3 mie(0.0, 0.0, 0.0);
+        for (unsigned int g = 0; g < group_lambdas_.size(); ++g) {
+          scattering += Multiply(luminance_from_radiance[g],
+              vec3(group_scattering_textures_[g].Get(i, j, k)));
+          mie += Multiply(luminance_from_radiance[g],
+              vec3(group_single_mie_scattering_textures_[g].Get(i, j, k)));
+        }
+        scattering_texture_.Set(i, j, k, vec4(scattering,
+            combine_scattering_textures_ ? mie.x : 0.0f));
+        if (!combine_scattering_textures_) {
+          optional_single_mie_scattering_texture_.Set(i, j, k, vec4(mie, 0.0));
+        }
+      }
+    }
+  }, SCATTERING_TEXTURE_DEPTH);
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+      vec3 irradiance(0.0, 0.0, 0.0);
+      for (unsigned int g = 0; g < group_lambdas_.size(); ++g) {
+        irradiance += Multiply(luminance_from_radiance[g],
+            vec3(group_irradiance_textures_[g].Get(i, j)));
+      }
+      irradiance_texture_.Set(i, j, vec4(irradiance, 0.0));
+    }
+  }, IRRADIANCE_TEXTURE_HEIGHT);
+}
+
+/*
+<p>The API methods simply call the corresponding GLSL functions, like the GLSL
+code of the <code>kAtmosphereShader</code> in the
+<a href="../model.cc.html">GPU model</a>, with the functions compiled with or
+without the <code>COMBINED_SCATTERING_TEXTURES</code> option, depending on the
+<code>combine_scattering_textures</code> constructor argument:
+*/
+
+vec3 Model::GetSolarRadiance() const {
+  assert(num_precomputed_wavelengths_ <= 3);
+  return atmosphere_->solar_irradiance / (PI * atmosphere_->sun_angular_radius *
+      atmosphere_->sun_angular_radius) * sun_radiance_scale_;
+}
+
+vec3 Model::GetSkyRadiance(const vec3& camera, const vec3& view_ray,
+    float shadow_length, const vec3& sun_direction,
+    vec3* transmittance) const {
+  assert(num_precomputed_wavelengths_ <= 3);
+  return GetSkyLuminance(camera, view_ray, shadow_length, sun_direction,
+      transmittance) / sky_spectral_radiance_to_luminance_;
+}
+
+vec3 Model::GetSkyRadianceToPoint(const vec3& camera, const vec3& point,
+    float shadow_length, const vec3& sun_direction,
+    vec3* transmittance) const {
+  assert(num_precomputed_wavelengths_ <= 3);
+  return GetSkyLuminanceToPoint(camera, point, shadow_length, sun_direction,
+      transmittance) / sky_spectral_radiance_to_luminance_;
+}
+
+vec3 Model::GetSunAndSkyIrradiance(const vec3& p, const vec3& normal,
+    const vec3& sun_direction, vec3* sky_irradiance) const {
+  assert(num_precomputed_wavelengths_ <= 3);
+  vec3 sun_irradiance = separate_textures::GetSunAndSkyIrradiance(
+      *atmosphere_, transmittance_texture_, irradiance_texture_, p, normal,
+      sun_direction, *sky_irradiance);
+  *sky_irradiance *= sky_radiance_scale_;
+  return sun_irradiance * sun_radiance_scale_;
+}
+
+vec3 Model::GetSolarLuminance() const {
+  return atmosphere_->solar_irradiance / (PI * atmosphere_->sun_angular_radius *
+      atmosphere_->sun_angular_radius) * sun_radiance_scale_ *
+      sun_spectral_radiance_to_luminance_;
+}
+
+vec3 Model::GetSkyLuminance(const vec3& camera, const vec3& view_ray,
+    float shadow_length, const vec3& sun_direction,
+    vec3* transmittance) const {
+  vec3 radiance = combine_scattering_textures_ ?
+      combined_textures::GetSkyRadiance(*atmosphere_, transmittance_texture_,
+          scattering_texture_, optional_single_mie_scattering_texture_,
+          camera, view_ray, shadow_length, sun_direction, *transmittance) :
+      separate_textures::GetSkyRadiance(*atmosphere_, transmittance_texture_,
+          scattering_texture_, optional_single_mie_scattering_texture_,
+          camera, view_ray, shadow_length, sun_direction, *transmittance);
+  return radiance * sky_radiance_scale_ * sky_spectral_radiance_to_luminance_;
+}
+
+vec3 Model::GetSkyLuminanceToPoint(const vec3& camera, const vec3& point,
+    float shadow_length, const vec3& sun_direction,
+    vec3* transmittance) const {
+  vec3 radiance = combine_scattering_textures_ ?
+      combined_textures::GetSkyRadianceToPoint(*atmosphere_,
+          transmittance_texture_, scattering_texture_,
+          optional_single_mie_scattering_texture_, camera, point,
+          shadow_length, sun_direction, *transmittance) :
+      separate_textures::GetSkyRadianceToPoint(*atmosphere_,
+          transmittance_texture_, scattering_texture_,
+          optional_single_mie_scattering_texture_, camera, point,
+          shadow_length, sun_direction, *transmittance);
+  return radiance * sky_radiance_scale_ * sky_spectral_radiance_to_luminance_;
+}
+
+vec3 Model::GetSunAndSkyIlluminance(const vec3& p, const vec3& normal,
+    const vec3& sun_direction, vec3* sky_illuminance) const {
+  vec3 sun_irradiance = separate_textures::GetSunAndSkyIrradiance(
+      *atmosphere_, transmittance_texture_, irradiance_texture_, p, normal,
+      sun_direction, *sky_illuminance);
+  *sky_illuminance *= sky_radiance_scale_ * sky_spectral_radiance_to_luminance_;
+  return sun_irradiance * sun_radiance_scale_ *
+      sun_spectral_radiance_to_luminance_;
+}
+
+/*
+<p>The view cache methods call the corresponding GLSL functions too, in
+parallel, with several threads, each processing a contiguous chunk of view rays
+(the terms in the cache do not depend on the
+<code>combine_scattering_textures</code> option):
+*/
+
+namespace {
+
+constexpr unsigned int kViewCacheChunkSize = 256;
+
+template<class F>
+void RunViewCacheJobs(unsigned int size, const F& job) {
+  RunJobs([&](unsigned int chunk) {
+    unsigned int end = std::min(size, (chunk + 1) * kViewCacheChunkSize);
+    for (unsigned int i = chunk * kViewCacheChunkSize; i < end; ++i) {
+      job(i);
+    }
+  }, (size + kViewCacheChunkSize - 1) / kViewCacheChunkSize);
+}
+
+}  // anonymous namespace
+
+void Model::ComputeViewCache(const vec3& camera,
+    const std::vector<vec3>& view_rays, ViewCache* cache) const {
+  cache->view_rays_.resize(view_rays.size());
+  RunViewCacheJobs(view_rays.size(), [&](unsigned int i) {
+    ViewCache::ViewRay& ray = cache->view_rays_[i];
+    ray.view_ray = view_rays[i];
+    ray.ray_intersects_atmosphere = separate_textures::GetViewRayTerms(
+        *atmosphere_, transmittance_texture_, camera, ray.view_ray,
+        ray.camera_in_atmosphere, ray.r, ray.mu,
+        ray.ray_r_mu_intersects_ground, ray.transmittance);
+  });
+}
+
+void Model::GetSkyRadiance(const ViewCache& cache, const vec3& sun_direction,
+    std::vector<vec3>* radiance) const {
+  assert(num_precomputed_wavelengths_ <= 3);
+  GetSkyLuminance(cache, sun_direction, radiance);
+  for (vec3& value : *radiance) {
+    value /= sky_spectral_radiance_to_luminance_;
+  }
+}
+
+void Model::GetSkyLuminance(const ViewCache& cache, const vec3& sun_direction,
+    std::vector<vec3>* luminance) const {
+  luminance->resize(cache.size());
+  RunViewCacheJobs(cache.size(), [&](unsigned int i) {
+    const ViewCache::ViewRay& ray = cache.view_rays_[i];
+    if (!ray.ray_intersects_atmosphere) {
+      (*luminance)[i] = vec3(0.0, 0.0, 0.0);
+      return;
+    }
+    vec3 radiance = combine_scattering_textures_ ?
+        combined_textures::GetSkyRadianceFromViewRayTerms(*atmosphere_,
+            scattering_texture_, optional_single_mie_scattering_texture_,
+            ray.camera_in_atmosphere, ray.view_ray, ray.r, ray.mu,
+            ray.ray_r_mu_intersects_ground, sun_direction) :
+        separate_textures::GetSkyRadianceFromViewRayTerms(*atmosphere_,
+            scattering_texture_, optional_single_mie_scattering_texture_,
+            ray.camera_in_atmosphere, ray.view_ray, ray.r, ray.mu,
+            ray.ray_r_mu_intersects_ground, sun_direction);
+    (*luminance)[i] =
+        radiance * sky_radiance_scale_ * sky_spectral_radiance_to_luminance_;
+  });
+}
+
+/*
+<p>Finally, the precomputation algorithm is the same as in the
+<a href="../model.cc.html">GPU model</a>, but instead of drawing quads with
+shaders in framebuffers, we compute each texel of each texture with the
+corresponding GLSL function, in parallel with several threads. As on GPU, the
+final textures are either set or incremented (if <code>blend</code> is true)
+with the precomputed radiance values, multiplied by
+<code>luminance_from_radiance</code>:
+*/
+
+void Model::Precompute(
+    const AtmosphereParameters& atmosphere,
+    const sampler2D& density_texture,
+    sampler2D* delta_irradiance_texture,
+    sampler3D* delta_rayleigh_scattering_texture,
+    sampler3D* delta_mie_scattering_texture,
+    sampler3D* delta_scattering_density_texture,
+    sampler3D* delta_multiple_scattering_texture,
+    const mat3& luminance_from_radiance,
+    bool blend,
+    unsigned int num_scattering_orders) {
+  // Compute the transmittance, and store it in transmittance_texture_.
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < TRANSMITTANCE_TEXTURE_WIDTH; ++i) {
+      transmittance_texture_.Set(i, j, vec4(
+          ComputeTransmittanceToTopAtmosphereBoundaryTexture(
+              atmosphere, density_texture, vec2(i + 0.5, j + 0.5)), 0.0));
+    }
+  }, TRANSMITTANCE_TEXTURE_HEIGHT);
+
+  // Compute the direct irradiance, store it in delta_irradiance_texture and,
+  // depending on 'blend', either initialize irradiance_texture_ with zeros or
+  // leave it unchanged.
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+      delta_irradiance_texture->Set(i, j, vec4(
+          ComputeDirectIrradianceTexture(
+              atmosphere, transmittance_texture_, vec2(i + 0.5, j + 0.5)),
+          0.0));
+      if (!blend) {
+        irradiance_texture_.Set(i, j, vec4(0.0));
+      }
+    }
+  }, IRRADIANCE_TEXTURE_HEIGHT);
+
+  // Compute the rayleigh and mie single scattering, store them in
+  // delta_rayleigh_scattering_texture and delta_mie_scattering_texture, and
+  // either store them or accumulate them in scattering_texture_ and
+  // optional_single_mie_scattering_texture_.
+  RunJobs([&](unsigned int k) {
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        vec3 delta_rayleigh;
+        vec3 delta_mie;
+        ComputeSingleScatteringTexture(atmosphere, transmittance_texture_,
+            density_texture, vec3(i + 0.5, j + 0.5, k + 0.5), delta_rayleigh,
+            delta_mie);
+        delta_rayleigh_scattering_texture->Set(i, j, k,
+            vec4(delta_rayleigh, 0.0));
+        delta_mie_scattering_texture->Set(i, j, k, vec4(delta_mie, 0.0));
+        vec3 rayleigh = Multiply(luminance_from_radiance, delta_rayleigh);
+        vec3 mie = Multiply(luminance_from_radiance, delta_mie);
+        vec4 scattering = vec4(rayleigh, combine_scattering_textures_ ?
+            mie.x : 0.0f);
+        scattering_texture_.Set(i, j, k, blend ?
+            scattering_texture_.Get(i, j, k) + scattering : scattering);
+        if (optional_single_mie_scattering_texture_.width() > 0) {
+          optional_single_mie_scattering_texture_.Set(i, j, k, blend ?
+              optional_single_mie_scattering_texture_.Get(i, j, k) +
+                  vec4(mie, 0.0) :
+              vec4(mie, 0.0));
+        }
+      }
+    }
+  }, SCATTERING_TEXTURE_DEPTH);
+
+  // Compute the 2nd, 3rd and 4th order of scattering, in sequence.
+  for (unsigned int scattering_order = 2;
+       scattering_order <= num_scattering_orders;
+       ++scattering_order) {
+    // Compute the scattering density, and store it in
+    // delta_scattering_density_texture.
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          delta_scattering_density_texture->Set(i, j, k, vec4(
+              ComputeScatteringDensityTexture(atmosphere,
+                  transmittance_texture_, density_texture,
+                  *delta_rayleigh_scattering_texture,
+                  *delta_mie_scattering_texture,
+                  *delta_multiple_scattering_texture,
+                  *delta_irradiance_texture, vec3(i + 0.5, j + 0.5, k + 0.5),
+                  scattering_order),
+              0.0));
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+
+    // Compute the indirect irradiance, store it in delta_irradiance_texture and
+    // accumulate it in irradiance_texture_.
+    RunJobs([&](unsigned int j) {
+      for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+        vec3 delta_irradiance = ComputeIndirectIrradianceTexture(atmosphere,
+            *delta_rayleigh_scattering_texture, *delta_mie_scattering_texture,
+            *delta_multiple_scattering_texture, vec2(i + 0.5, j + 0.5),
+            scattering_order - 1);
+        delta_irradiance_texture->Set(i, j, vec4(delta_irradiance, 0.0));
+        irradiance_texture_.Set(i, j, irradiance_texture_.Get(i, j) +
+            vec4(Multiply(luminance_from_radiance, delta_irradiance), 0.0));
+      }
+    }, IRRADIANCE_TEXTURE_HEIGHT);
+
+    // Compute the multiple scattering, store it in
+    // delta_multiple_scattering_texture, and accumulate it in
+    // scattering_texture_.
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          float nu;
+          vec3 delta_multiple_scattering = ComputeMultipleScatteringTexture(
+              atmosphere, transmittance_texture_,
+              *delta_scattering_density_texture,
+              vec3(i + 0.5, j + 0.5, k + 0.5), nu);
+          delta_multiple_scattering_texture->Set(i, j, k,
+              vec4(delta_multiple_scattering, 0.0));
+          scattering_texture_.Set(i, j, k, scattering_texture_.Get(i, j, k) +
+              vec4(Multiply(luminance_from_radiance, delta_multiple_scattering)
+                  / RayleighPhaseFunction(nu), 0.0));
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+  }
+}
+
+}  // namespace cpu
+}  // namespace atmosphere
@@ -0,0 +1,281 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/cpu/model.h</h2>
+
+<p>This file defines the API to use our atmosphere model on CPU, with the same
+precomputed textures as the <a href="../model.h.html">GPU model</a> (i.e. with
+single precision RGB values for 3 wavelengths, or with sRGB illuminance values,
+in textures having the same layout as on GPU), and with the same API functions
+as the ones provided by its shader. This "RGB CPU model" is thus much faster
+than the <a href="../reference/model.h.html">reference CPU model</a>, which
+uses double precision spectral values with 47 wavelengths, and gives the same
+results as the GPU model, without requiring a GPU. To use it:
+<ul>
+<li>create a <code>Model</code> instance with the desired atmosphere
+parameters (see the GPU <code>Model</code> constructor for their
+documentation),</li>
+<li>call <code>Init</code> to precompute the atmosphere textures (or
+<code>Update</code> to precompute them faster from those of a previous model
+with close atmosphere parameters, or <code>Blend</code> to interpolate those of
+models precomputed on a grid of atmosphere parameters, or
+<code>SetTextures</code> to set those interpolated from a
+<a href="../grid_bundle.h.html">grid bundle</a>),</li>
+<li>call the methods corresponding to the GPU shader functions as desired
+(with the same arguments, and the same restrictions depending on
+<code>num_precomputed_wavelengths</code>),</li>
+<li>delete your <code>Model</code> when you no longer need it (the destructor
+deletes the precomputed textures from memory).</li>
+</ul>
+*/
+
+#ifndef ATMOSPHERE_CPU_MODEL_H_
+#define ATMOSPHERE_CPU_MODEL_H_
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "atmosphere/cpu/glsl.h"
+#include "atmosphere/parameters.h"
+#include "atmosphere/spectrum.h"
+
+namespace atmosphere {
+namespace cpu {
+
+// Defined in definitions.glsl, which can only be included in model.cc (because
+// it defines preprocessor macros for all the physical quantity types).
+struct AtmosphereParameters;
+
+class Model {
+ public:
+  Model(
+    const std::vector<double>& wavelengths,
+    const std::vector<double>& solar_irradiance,
+    double sun_angular_radius,
+    double bottom_radius,
+    double top_radius,
+    const std::vector<DensityProfileLayer>& rayleigh_density,
+    const std::vector<double>& rayleigh_scattering,
+    const std::vector<DensityProfileLayer>& mie_density,
+    const std::vector<double>& mie_scattering,
+    const std::vector<double>& mie_extinction,
+    double mie_phase_function_g,
+    const std::vector<DensityProfileLayer>& absorption_density,
+    const std::vector<double>& absorption_extinction,
+    const std::vector<double>& ground_albedo,
+    double max_sun_zenith_angle,
+    double length_unit_in_meters,
+    unsigned int num_precomputed_wavelengths,
+    bool combine_scattering_textures,
+    bool runtime_solar_irradiance = false,
+    bool runtime_ground_albedo = false);
+
+  ~Model();
+
+  void Init(unsigned int num_scattering_orders = 4);
+
+  // Same as Init, but for atmosphere parameters close to those of
+  // 'previous_model', by correcting its multiple scattering with
+  // 'num_iterations' iterations (see the GPU Model method with the same name,
+  // which has the same requirements and costs). Only the precomputed radiance
+  // mode is supported, without the runtime_ground_albedo option: in the other
+  // modes, and if num_iterations is 0, this throws a std::invalid_argument
+  // exception.
+  void Update(const Model& previous_model, unsigned int num_iterations = 1);
+
+  // Sets the precomputed textures to the weighted sum of those of 'models',
+  // e.g. to interpolate models precomputed on a ParameterGrid (see the GPU
+  // Model method with the same name, which has the same requirements).
+  void Blend(const std::vector<const Model*>& models,
+      const std::vector<double>& weights);
+
+  // Sets the precomputed textures to the given ones, e.g. interpolated from a
+  // grid bundle with GridBundle::Blend (see the GPU Model method with the same
+  // name, which has the same requirements). The texture sizes must be those
+  // of constants.h.
+  void SetTextures(const PrecomputedTextures& textures);
+
+  // Changes the solar irradiance without recomputing the precomputed textures
+  // (see the GPU Model method with the same name). This requires the
+  // runtime_solar_irradiance constructor option.
+  void SetSolarIrradiance(const std::vector<double>& solar_irradiance);
+
+  // Changes the ground albedo without recomputing the precomputed textures
+  // (see the GPU Model method with the same name). This requires the
+  // runtime_ground_albedo constructor option.
+  void SetGroundAlbedo(const std::vector<double>& ground_albedo);
+
+  // The radiance API, only available if num_precomputed_wavelengths <= 3. The
+  // results are spectral radiance and irradiance values at kLambdaR, kLambdaG
+  // and kLambdaB.
+  vec3 GetSolarRadiance() const;
+
+  vec3 GetSkyRadiance(const vec3& camera, const vec3& view_ray,
+      float shadow_length, const vec3& sun_direction,
+      vec3* transmittance) const;
+
+  vec3 GetSkyRadianceToPoint(const vec3& camera, const vec3& point,
+      float shadow_length, const vec3& sun_direction,
+      vec3* transmittance) const;
+
+  vec3 GetSunAndSkyIrradiance(const vec3& p, const vec3& normal,
+      const vec3& sun_direction, vec3* sky_irradiance) const;
+
+  // The luminance API, always available. The results are luminance and
+  // illuminance values in linear sRGB space.
+  vec3 GetSolarLuminance() const;
+
+  vec3 GetSkyLuminance(const vec3& camera, const vec3& view_ray,
+      float shadow_length, const vec3& sun_direction,
+      vec3* transmittance) const;
+
+  vec3 GetSkyLuminanceToPoint(const vec3& camera, const vec3& point,
+      float shadow_length, const vec3& sun_direction,
+      vec3* transmittance) const;
+
+  vec3 GetSunAndSkyIlluminance(const vec3& p, const vec3& normal,
+      const vec3& sun_direction, vec3* sky_illuminance) const;
+
+  // The terms of GetSkyRadiance and GetSkyLuminance which do not depend on the
+  // Sun direction, for a fixed camera and a fixed set of view rays (without
+  // light shafts). Computed once with ComputeViewCache, they can then be used
+  // to evaluate the sky for many Sun directions (e.g. for a time-lapse
+  // sequence), in parallel in several threads, with the methods below (each
+  // view ray is evaluated with the same scalar code as GetSkyRadiance,
+  // without SIMD vectorization).
+  class ViewCache {
+   public:
+    unsigned int size() const { return view_rays_.size(); }
+
+    // The transmittance along the i-th view ray (1 if it does not intersect
+    // the atmosphere, 0 if it intersects the ground).
+    const vec3& transmittance(unsigned int i) const {
+      return view_rays_[i].transmittance;
+    }
+
+   private:
+    friend class Model;
+
+    struct ViewRay {
+      vec3 camera_in_atmosphere;
+      vec3 view_ray;
+      float r;
+      float mu;
+      bool ray_r_mu_intersects_ground;
+      bool ray_intersects_atmosphere;
+      vec3 transmittance;
+    };
+    std::vector<ViewRay> view_rays_;
+  };
+
+  void ComputeViewCache(const vec3& camera, const std::vector<vec3>& view_rays,
+      ViewCache* cache) const;
+
+  // Only available if num_precomputed_wavelengths <= 3 (see above).
+  void GetSkyRadiance(const ViewCache& cache, const vec3& sun_direction,
+      std::vector<vec3>* radiance) const;
+
+  void GetSkyLuminance(const ViewCache& cache, const vec3& sun_direction,
+      std::vector<vec3>* luminance) const;
+
+  static constexpr double kLambdaR = atmosphere::kLambdaR;
+  static constexpr double kLambdaG = atmosphere::kLambdaG;
+  static constexpr double kLambdaB = atmosphere::kLambdaB;
+
+ private:
+  typedef std::array<float, 9> mat3;
+
+  void Precompute(
+      const AtmosphereParameters& atmosphere,
+      const sampler2D& density_texture,
+      sampler2D* delta_irradiance_texture,
+      sampler3D* delta_rayleigh_scattering_texture,
+      sampler3D* delta_mie_scattering_texture,
+      sampler3D* delta_scattering_density_texture,
+      sampler3D* delta_multiple_scattering_texture,
+      const mat3& luminance_from_radiance,
+      bool blend,
+      unsigned int num_scattering_orders);
+
+  void ComputeSolarIrradianceFactors(
+      const std::vector<double>& solar_irradiance);
+
+  void CombineWavelengthGroups();
+
+  void DeleteUpdateCorrections();
+
+  unsigned int num_precomputed_wavelengths_;
+  bool combine_scattering_textures_;
+  bool runtime_solar_irradiance_;
+  bool runtime_ground_albedo_;
+  std::vector<double> wavelengths_;
+  std::vector<double> solar_irradiance_;
+  std::vector<double> ground_albedo_;
+  std::vector<double> ground_albedo_samples_;
+  // Computes the atmosphere parameters for the 3 given wavelengths.
+  std::function<void(const vec3&, AtmosphereParameters*)> atmosphere_factory_;
+  // The atmosphere parameters for kLambdaR, kLambdaG and kLambdaB.
+  std::unique_ptr<AtmosphereParameters> atmosphere_;
+  vec3 sky_spectral_radiance_to_luminance_;
+  vec3 sun_spectral_radiance_to_luminance_;
+  vec3 sky_radiance_scale_;
+  vec3 sun_radiance_scale_;
+  sampler2D transmittance_texture_;
+  sampler3D scattering_texture_;
+  sampler3D optional_single_mie_scattering_texture_;
+  sampler2D irradiance_texture_;
+
+  // In precomputed illuminance mode with the runtime_solar_irradiance option,
+  // the textures precomputed by Init for a unit solar irradiance, for each
+  // group of 3 wavelengths (as in the GPU model). With the
+  // runtime_ground_albedo option, the textures precomputed for each group and
+  // for each ground albedo sample.
+  std::vector<vec3> group_lambdas_;
+  std::vector<mat3> group_luminance_from_radiance_;
+  std::vector<double> group_ground_albedos_;
+  std::vector<sampler3D> group_scattering_textures_;
+  std::vector<sampler3D> group_single_mie_scattering_textures_;
+  std::vector<sampler2D> group_irradiance_textures_;
+
+  // The scattering operator applied to the scattering of this model (T' in
+  // model.cc), and the scattering and irradiance corrections M' - T', computed
+  // by the first Update call using this model as 'previous_model', and kept
+  // for the next ones until the textures of this model change (empty if not
+  // computed yet).
+  mutable sampler3D update_next_scattering_texture_;
+  mutable sampler3D update_scattering_correction_texture_;
+  mutable sampler2D update_irradiance_correction_texture_;
+};
+
+}  // namespace cpu
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_CPU_MODEL_H_
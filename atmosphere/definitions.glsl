@@ -111,6 +111,8 @@ macros. The full definitions are given in the
 #define Position vec3
 // A unit direction vector in 3D (3 unitless values).
 #define Direction vec3
+// A vector of 3 length values.
+#define Length3 vec3
 // A vector of 3 luminance values.
 #define Luminance3 vec3
 // A vector of 3 illuminance values.
@@ -131,6 +133,7 @@ macros. The full definitions are given in the
 #define ScatteringTexture sampler3D
 #define ScatteringDensityTexture sampler3D
 #define IrradianceTexture sampler2D
+#define DensityTexture sampler2D
 
 /*
 <h3>Physical units</h3>
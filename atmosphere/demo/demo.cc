@@ -43,6 +43,7 @@ independent of our atmosphere model. The only part which is related to it is the
 #include <GL/freeglut.h>
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <map>
 #include <stdexcept>
@@ -70,6 +71,28 @@ constexpr double kPi = 3.1415926;
 constexpr double kSunAngularRadius = 0.00935 / 2.0;
 constexpr double kSunSolidAngle = kPi * kSunAngularRadius * kSunAngularRadius;
 constexpr double kLengthUnitInMeters = 1000.0;
+constexpr double kBottomRadius = 6360000.0;
+// The time budget per frame for the incremental precomputation of a new model.
+constexpr double kPrecomputationBudgetMs = 4.0;
+
+// Values from "Reference Solar Spectral Irradiance: ASTM G-173", ETR column
+// (see http://rredc.nrel.gov/solar/spectra/am1.5/ASTMG173/ASTMG173.html),
+// summed and averaged in each bin (e.g. the value for 360nm is the average
+// of the ASTM G-173 values for all wavelengths between 360 and 370nm).
+// Values in W.m^-2.
+constexpr int kLambdaMin = 360;
+constexpr int kLambdaMax = 830;
+constexpr double kSolarIrradiance[48] = {
+  1.11776, 1.14259, 1.01249, 1.14716, 1.72765, 1.73054, 1.6887, 1.61253,
+  1.91198, 2.03474, 2.02042, 2.02212, 1.93377, 1.95809, 1.91686, 1.8298,
+  1.8685, 1.8931, 1.85149, 1.8504, 1.8341, 1.8345, 1.8147, 1.78158, 1.7533,
+  1.6965, 1.68194, 1.64654, 1.6048, 1.52143, 1.55622, 1.5113, 1.474, 1.4482,
+  1.41018, 1.36775, 1.34188, 1.31429, 1.28303, 1.26758, 1.2367, 1.2082,
+  1.18737, 1.14683, 1.12362, 1.1058, 1.07124, 1.04992
+};
+// Wavelength independent solar irradiance "spectrum" (not physically
+// realistic, but was used in the original implementation).
+constexpr double kConstantSolarIrradiance = 1.5;
 
 const char kVertexShader[] = R"(
     #version 330
@@ -106,8 +129,14 @@ Demo::Demo(int viewport_width, int viewport_height) :
     use_half_precision_(true),
     use_luminance_(NONE),
     do_white_balance_(false),
+    use_sky_view_(false),
     show_help_(true),
     program_(0),
+    model_use_luminance_(NONE),
+    pending_fragment_shader_(0),
+    pending_program_(0),
+    pending_fence_(0),
+    pending_use_constant_solar_spectrum_(false),
     view_distance_meters_(9000.0),
     view_zenith_angle_radians_(1.47),
     view_azimuth_angle_radians_(-0.1),
@@ -160,6 +189,11 @@ Demo::Demo(int viewport_width, int viewport_height) :
   glEnableVertexAttribArray(kAttribIndex);
   glBindVertexArray(0);
 
+  vertex_shader_ = glCreateShader(GL_VERTEX_SHADER);
+  const char* const vertex_shader_source = kVertexShader;
+  glShaderSource(vertex_shader_, 1, &vertex_shader_source, NULL);
+  glCompileShader(vertex_shader_);
+
   text_renderer_.reset(new TextRenderer);
 
   InitModel();
@@ -170,6 +204,11 @@ Demo::Demo(int viewport_width, int viewport_height) :
 */
 
 Demo::~Demo() {
+  if (pending_fence_ != 0) {
+    glDeleteSync(pending_fence_);
+  }
+  glDeleteShader(pending_fragment_shader_);
+  glDeleteProgram(pending_program_);
   glDeleteShader(vertex_shader_);
   glDeleteShader(fragment_shader_);
   glDeleteProgram(program_);
@@ -180,27 +219,17 @@ Demo::~Demo() {
 
 /*
 <p>The "real" initialization work, which is specific to our atmosphere model,
-is done in the following method. It starts with the creation of an atmosphere
-<code>Model</code> instance, with parameters corresponding to the Earth
-atmosphere:
+starts with the creation of an atmosphere <code>Model</code> instance, with
+parameters corresponding to the Earth atmosphere. This is done in the following
+function, also used by the <a href="precompute_grid.cc.html">grid bundle
+precomputation tool</a> (which changes the Mie and ozone parameters with the
+last 3 arguments):
 */
 
-void Demo::InitModel() {
-  // Values from "Reference Solar Spectral Irradiance: ASTM G-173", ETR column
-  // (see http://rredc.nrel.gov/solar/spectra/am1.5/ASTMG173/ASTMG173.html),
-  // summed and averaged in each bin (e.g. the value for 360nm is the average
-  // of the ASTM G-173 values for all wavelengths between 360 and 370nm).
-  // Values in W.m^-2.
-  constexpr int kLambdaMin = 360;
-  constexpr int kLambdaMax = 830;
-  constexpr double kSolarIrradiance[48] = {
-    1.11776, 1.14259, 1.01249, 1.14716, 1.72765, 1.73054, 1.6887, 1.61253,
-    1.91198, 2.03474, 2.02042, 2.02212, 1.93377, 1.95809, 1.91686, 1.8298,
-    1.8685, 1.8931, 1.85149, 1.8504, 1.8341, 1.8345, 1.8147, 1.78158, 1.7533,
-    1.6965, 1.68194, 1.64654, 1.6048, 1.52143, 1.55622, 1.5113, 1.474, 1.4482,
-    1.41018, 1.36775, 1.34188, 1.31429, 1.28303, 1.26758, 1.2367, 1.2082,
-    1.18737, 1.14683, 1.12362, 1.1058, 1.07124, 1.04992
-  };
+Model* NewDemoModel(bool use_constant_solar_spectrum, bool use_ozone,
+    bool use_combined_textures, bool use_half_precision,
+    bool use_precomputed_luminance, double mie_scale_height_factor,
+    double mie_angstrom_beta_factor, double ozone_density_factor) {
   // Values from http://www.iup.uni-bremen.de/gruppen/molspec/databases/
   // referencespectra/o3spectra2011/index.html for 233K, summed and averaged in
   // each bin (e.g. the value for 360nm is the average of the original values
@@ -220,10 +249,6 @@ void Demo::InitModel() {
   // 300 Dobson units of ozone - for this we divide 300 DU by the integral of
   // the ozone density profile defined below, which is equal to 15km).
   constexpr double kMaxOzoneNumberDensity = 300.0 * kDobsonUnit / 15000.0;
-  // Wavelength independent solar irradiance "spectrum" (not physically
-  // realistic, but was used in the original implementation).
-  constexpr double kConstantSolarIrradiance = 1.5;
-  constexpr double kBottomRadius = 6360000.0;
   constexpr double kTopRadius = 6420000.0;
   constexpr double kRayleigh = 1.24062e-6;
   constexpr double kRayleighScaleHeight = 8000.0;
@@ -234,11 +259,13 @@ void Demo::InitModel() {
   constexpr double kMiePhaseFunctionG = 0.8;
   constexpr double kGroundAlbedo = 0.1;
   const double max_sun_zenith_angle =
-      (use_half_precision_ ? 102.0 : 120.0) / 180.0 * kPi;
+      (use_half_precision ? 102.0 : 120.0) / 180.0 * kPi;
 
   DensityProfileLayer
       rayleigh_layer(0.0, 1.0, -1.0 / kRayleighScaleHeight, 0.0, 0.0);
-  DensityProfileLayer mie_layer(0.0, 1.0, -1.0 / kMieScaleHeight, 0.0, 0.0);
+  const double mie_scale_height = kMieScaleHeight * mie_scale_height_factor;
+  const double mie_angstrom_beta = kMieAngstromBeta * mie_angstrom_beta_factor;
+  DensityProfileLayer mie_layer(0.0, 1.0, -1.0 / mie_scale_height, 0.0, 0.0);
   // Density profile increasing linearly from 0 to 1 between 10 and 25km, and
   // decreasing linearly from 1 to 0 between 25 and 40km. This is an approximate
   // profile from http://www.kln.ac.lk/science/Chemistry/Teaching_Resources/
@@ -259,9 +286,9 @@ void Demo::InitModel() {
   for (int l = kLambdaMin; l <= kLambdaMax; l += 10) {
     double lambda = static_cast<double>(l) * 1e-3;  // micro-meters
     double mie =
-        kMieAngstromBeta / kMieScaleHeight * pow(lambda, -kMieAngstromAlpha);
+        mie_angstrom_beta / mie_scale_height * pow(lambda, -kMieAngstromAlpha);
     wavelengths.push_back(l);
-    if (use_constant_solar_spectrum_) {
+    if (use_constant_solar_spectrum) {
       solar_irradiance.push_back(kConstantSolarIrradiance);
     } else {
       solar_irradiance.push_back(kSolarIrradiance[(l - kLambdaMin) / 10]);
@@ -269,30 +296,42 @@ void Demo::InitModel() {
     rayleigh_scattering.push_back(kRayleigh * pow(lambda, -4));
     mie_scattering.push_back(mie * kMieSingleScatteringAlbedo);
     mie_extinction.push_back(mie);
-    absorption_extinction.push_back(use_ozone_ ?
-        kMaxOzoneNumberDensity * kOzoneCrossSection[(l - kLambdaMin) / 10] :
+    absorption_extinction.push_back(use_ozone ?
+        ozone_density_factor * kMaxOzoneNumberDensity *
+            kOzoneCrossSection[(l - kLambdaMin) / 10] :
         0.0);
     ground_albedo.push_back(kGroundAlbedo);
   }
 
-  model_.reset(new Model(wavelengths, solar_irradiance, kSunAngularRadius,
+  return new Model(wavelengths, solar_irradiance, kSunAngularRadius,
       kBottomRadius, kTopRadius, {rayleigh_layer}, rayleigh_scattering,
       {mie_layer}, mie_scattering, mie_extinction, kMiePhaseFunctionG,
       ozone_density, absorption_extinction, ground_albedo, max_sun_zenith_angle,
-      kLengthUnitInMeters, use_luminance_ == PRECOMPUTED ? 15 : 3,
-      use_combined_textures_, use_half_precision_));
-  model_->Init();
+      kLengthUnitInMeters, use_precomputed_luminance ? 15 : 3,
+      use_combined_textures, use_half_precision, TextureSizes(),
+      true /* runtime_solar_irradiance */);
+}
 
 /*
-<p>Then, it creates and compiles the vertex and fragment shaders used to render
-our demo scene, and link them with the <code>Model</code>'s atmosphere shader
-to get the final scene rendering program:
+<p>The new model is stored in <code>pending_model_</code>, and only replaces
+the current model once its precomputation is complete (see below), so that
+changing an option does not freeze the demo while the new textures are
+precomputed:
 */
 
-  vertex_shader_ = glCreateShader(GL_VERTEX_SHADER);
-  const char* const vertex_shader_source = kVertexShader;
-  glShaderSource(vertex_shader_, 1, &vertex_shader_source, NULL);
-  glCompileShader(vertex_shader_);
+void Demo::InitModel() {
+  pending_model_.reset(NewDemoModel(use_constant_solar_spectrum_, use_ozone_,
+      use_combined_textures_, use_half_precision_,
+      use_luminance_ == PRECOMPUTED));
+  pending_use_constant_solar_spectrum_ = use_constant_solar_spectrum_;
+
+/*
+<p>Then, it compiles the fragment shader used to render our demo scene (the
+vertex shader, which does not depend on the options, is compiled once in the
+constructor), and links them with the <code>Model</code>'s atmosphere shader to
+get the final scene rendering program. Note that this program does not depend on
+the precomputed textures, and can thus be linked before they are computed:
+*/
 
   const std::string fragment_shader_str =
       "#version 330\n" +
@@ -301,30 +340,121 @@ to get the final scene rendering program:
       std::to_string(kLengthUnitInMeters) + ";\n" +
       demo_glsl;
   const char* fragment_shader_source = fragment_shader_str.c_str();
-  fragment_shader_ = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader_, 1, &fragment_shader_source, NULL);
-  glCompileShader(fragment_shader_);
+  glDeleteShader(pending_fragment_shader_);
+  pending_fragment_shader_ = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(pending_fragment_shader_, 1, &fragment_shader_source, NULL);
+  glCompileShader(pending_fragment_shader_);
+
+  glDeleteProgram(pending_program_);
+  pending_program_ = glCreateProgram();
+  glAttachShader(pending_program_, vertex_shader_);
+  glAttachShader(pending_program_, pending_fragment_shader_);
+  glAttachShader(pending_program_, pending_model_->shader());
+  glLinkProgram(pending_program_);
+  glDetachShader(pending_program_, vertex_shader_);
+  glDetachShader(pending_program_, pending_fragment_shader_);
+  glDetachShader(pending_program_, pending_model_->shader());
+
+/*
+<p>Finally, it starts the precomputation of the new model. The first model is
+precomputed synchronously, since there is nothing else to render meanwhile, and
+is swapped in immediately. The next ones are precomputed incrementally, a few
+passes per frame, with <code>BeginInit</code> and <code>Step</code> (a pending
+model which is not yet complete is simply discarded and replaced with the new
+one):
+*/
 
-  if (program_ != 0) {
-    glDeleteProgram(program_);
+  if (pending_fence_ != 0) {
+    glDeleteSync(pending_fence_);
+    pending_fence_ = 0;
   }
-  program_ = glCreateProgram();
-  glAttachShader(program_, vertex_shader_);
-  glAttachShader(program_, fragment_shader_);
-  glAttachShader(program_, model_->shader());
-  glLinkProgram(program_);
-  glDetachShader(program_, vertex_shader_);
-  glDetachShader(program_, fragment_shader_);
-  glDetachShader(program_, model_->shader());
+  if (model_ == nullptr) {
+    pending_model_->Init();
+    SwapPendingModel();
+  } else {
+    pending_model_->BeginInit();
+  }
+}
+
+/*
+<p>The incremental precomputation is done in the following method, called at
+the beginning of each frame. Once all the precomputation passes have been
+issued, it inserts a fence in the GL command stream, and swaps the new model in
+when this fence is signaled, i.e. when the GPU has actually completed the
+precomputation. This avoids stalling the CPU while waiting for the GPU, in
+<code>SwapPendingModel</code> or in the first rendering with the new model:
+*/
+
+void Demo::StepPendingModel() {
+  if (pending_model_ == nullptr) {
+    return;
+  }
+  if (pending_fence_ == 0) {
+    if (pending_model_->Step(kPrecomputationBudgetMs)) {
+      pending_fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    // The precomputation passes use their own programs and texture units,
+    // which must be restored for the current model.
+    glUseProgram(program_);
+    model_->SetProgramUniforms(program_, 0, 1, 2, 3);
+  } else if (glClientWaitSync(pending_fence_, 0, 0) != GL_TIMEOUT_EXPIRED) {
+    glDeleteSync(pending_fence_);
+    pending_fence_ = 0;
+    SwapPendingModel();
+  }
+}
 
 /*
-<p>Finally, it sets the uniforms of this program that can be set once and for
-all (in our case this includes the <code>Model</code>'s texture uniforms,
-because our demo app does not have any texture of its own):
+<p>Swapping the new model in does not require any shader compilation or program
+linking, since this was done in <code>InitModel</code>. It simply replaces the
+current model and program with the new ones, and sets the uniforms of this
+program that can be set once and for all (in our case this includes the
+<code>Model</code>'s texture uniforms, because our demo app does not have any
+texture of its own):
 */
 
+void Demo::SwapPendingModel() {
+  model_ = std::move(pending_model_);
+  glDeleteShader(fragment_shader_);
+  glDeleteProgram(program_);
+  fragment_shader_ = pending_fragment_shader_;
+  program_ = pending_program_;
+  model_use_luminance_ = use_luminance_;
+  pending_fragment_shader_ = 0;
+  pending_program_ = 0;
+
+  std::vector<double> wavelengths;
+  std::vector<double> solar_irradiance;
+  for (int l = kLambdaMin; l <= kLambdaMax; l += 10) {
+    wavelengths.push_back(l);
+    solar_irradiance.push_back(use_constant_solar_spectrum_ ?
+        kConstantSolarIrradiance : kSolarIrradiance[(l - kLambdaMin) / 10]);
+  }
+  // The solar spectrum option might have changed during the precomputation.
+  if (pending_use_constant_solar_spectrum_ != use_constant_solar_spectrum_) {
+    model_->SetSolarIrradiance(solar_irradiance);
+  }
   glUseProgram(program_);
+  SetWhitePoint(wavelengths, solar_irradiance);
   model_->SetProgramUniforms(program_, 0, 1, 2, 3);
+  glUniform3f(glGetUniformLocation(program_, "earth_center"),
+      0.0, 0.0, -kBottomRadius / kLengthUnitInMeters);
+  glUniform2f(glGetUniformLocation(program_, "sun_size"),
+      tan(kSunAngularRadius),
+      cos(kSunAngularRadius));
+
+  // This sets 'view_from_clip', which only depends on the window size.
+  HandleReshapeEvent(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+}
+
+/*
+<p>The white point, used for white balance, depends on the solar spectrum. It
+is set with the following method (which assumes that <code>program_</code> is
+the current program):
+*/
+
+void Demo::SetWhitePoint(const std::vector<double>& wavelengths,
+    const std::vector<double>& solar_irradiance) {
   double white_point_r = 1.0;
   double white_point_g = 1.0;
   double white_point_b = 1.0;
@@ -338,23 +468,40 @@ because our demo app does not have any texture of its own):
   }
   glUniform3f(glGetUniformLocation(program_, "white_point"),
       white_point_r, white_point_g, white_point_b);
-  glUniform3f(glGetUniformLocation(program_, "earth_center"),
-      0.0, 0.0, -kBottomRadius / kLengthUnitInMeters);
-  glUniform2f(glGetUniformLocation(program_, "sun_size"),
-      tan(kSunAngularRadius),
-      cos(kSunAngularRadius));
+}
 
-  // This sets 'view_from_clip', which only depends on the window size.
-  HandleReshapeEvent(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+/*
+<p>Since our <code>Model</code> is created with the
+<code>runtime_solar_irradiance</code> option, switching between the realistic
+and the constant solar spectra does not require a new model. Instead, the new
+spectrum is simply set in the existing model, and the program uniforms which
+depend on it are updated:
+*/
+
+void Demo::UpdateSolarIrradiance() {
+  std::vector<double> wavelengths;
+  std::vector<double> solar_irradiance;
+  for (int l = kLambdaMin; l <= kLambdaMax; l += 10) {
+    wavelengths.push_back(l);
+    solar_irradiance.push_back(use_constant_solar_spectrum_ ?
+        kConstantSolarIrradiance : kSolarIrradiance[(l - kLambdaMin) / 10]);
+  }
+  model_->SetSolarIrradiance(solar_irradiance);
+  glUseProgram(program_);
+  SetWhitePoint(wavelengths, solar_irradiance);
+  model_->SetProgramUniforms(program_, 0, 1, 2, 3);
 }
 
 /*
 <p>The scene rendering method simply sets the uniforms related to the camera
-position and to the Sun direction, and then draws a full screen quad (and
-optionally a help screen).
+position and to the Sun direction (after baking the sky view texture for them,
+if this option is enabled), and then draws a full screen quad (and optionally a
+help screen).
 */
 
-void Demo::HandleRedisplayEvent() const {
+void Demo::HandleRedisplayEvent() {
+  StepPendingModel();
+
   // Unit vectors of the camera frame, expressed in world space.
   float cos_z = cos(view_zenith_angle_radians_);
   float sin_z = sin(view_zenith_angle_radians_);
@@ -374,18 +521,29 @@ void Demo::HandleRedisplayEvent() const {
     0.0, 0.0, 0.0, 1.0
   };
 
+  const std::array<double, 3> sun_direction = {{
+      cos(sun_azimuth_angle_radians_) * sin(sun_zenith_angle_radians_),
+      sin(sun_azimuth_angle_radians_) * sin(sun_zenith_angle_radians_),
+      cos(sun_zenith_angle_radians_)}};
+  if (use_sky_view_) {
+    model_->BakeSkyView({{model_from_view[3], model_from_view[7],
+        model_from_view[11] + kBottomRadius / kLengthUnitInMeters}},
+        sun_direction);
+    glUseProgram(program_);
+    model_->SetSkyViewUniforms(program_, 4);
+  }
+  glUniform1i(glGetUniformLocation(program_, "use_sky_view"), use_sky_view_);
+
   glUniform3f(glGetUniformLocation(program_, "camera"),
       model_from_view[3],
       model_from_view[7],
       model_from_view[11]);
   glUniform1f(glGetUniformLocation(program_, "exposure"),
-      use_luminance_ != NONE ? exposure_ * 1e-5 : exposure_);
+      model_use_luminance_ != NONE ? exposure_ * 1e-5 : exposure_);
   glUniformMatrix4fv(glGetUniformLocation(program_, "model_from_view"),
       1, true, model_from_view);
   glUniform3f(glGetUniformLocation(program_, "sun_direction"),
-      cos(sun_azimuth_angle_radians_) * sin(sun_zenith_angle_radians_),
-      sin(sun_azimuth_angle_radians_) * sin(sun_zenith_angle_radians_),
-      cos(sun_zenith_angle_radians_));
+      sun_direction[0], sun_direction[1], sun_direction[2]);
 
   glBindVertexArray(full_screen_quad_vao_);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
@@ -409,8 +567,13 @@ void Demo::HandleRedisplayEvent() const {
              (use_luminance_ == APPROXIMATE ? "approximate" : "off")) << ")\n"
          << " w: white balance (currently: "
          << (do_white_balance_ ? "on" : "off") << ")\n"
+         << " v: sky view texture (currently: "
+         << (use_sky_view_ ? "on" : "off") << ")\n"
          << " +/-: increase/decrease exposure (" << exposure_ << ")\n"
          << " 1-9: predefined views\n";
+    if (pending_model_ != nullptr) {
+      help << "Precomputing new model...\n";
+    }
     text_renderer_->SetColor(1.0, 0.0, 0.0);
     text_renderer_->DrawText(help.str(), 5, 4);
   }
@@ -464,6 +627,8 @@ void Demo::HandleKeyboardEvent(unsigned char key) {
     }
   } else if (key == 'w') {
     do_white_balance_ = !do_white_balance_;
+  } else if (key == 'v') {
+    use_sky_view_ = !use_sky_view_;
   } else if (key == '+') {
     exposure_ *= 1.1;
   } else if (key == '-') {
@@ -487,9 +652,10 @@ void Demo::HandleKeyboardEvent(unsigned char key) {
   } else if (key == '9') {
     SetView(1.2e7, 0.0, 0.0, 0.93, -2.0, 10.0);
   }
-  if (key == 's' || key == 'o' || key == 't' || key == 'p' || key == 'l' ||
-      key == 'w') {
+  if (key == 'o' || key == 't' || key == 'p' || key == 'l') {
     InitModel();
+  } else if (key == 's' || key == 'w') {
+    UpdateSolarIrradiance();
   }
 }
 
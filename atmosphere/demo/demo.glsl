@@ -46,6 +46,7 @@ uniform vec3 white_point;
 uniform vec3 earth_center;
 uniform vec3 sun_direction;
 uniform vec2 sun_size;
+uniform bool use_sky_view;
 in vec3 view_ray;
 layout(location = 0) out vec4 color;
 
@@ -67,6 +68,7 @@ const vec3 kGroundAlbedo = vec3(0.0, 0.0, 0.04);
 #define GetSolarRadiance GetSolarLuminance
 #define GetSkyRadiance GetSkyLuminance
 #define GetSkyRadianceToPoint GetSkyLuminanceToPoint
+#define GetSkyViewRadiance GetSkyViewLuminance
 #define GetSunAndSkyIrradiance GetSunAndSkyIlluminance
 #endif
 
@@ -75,6 +77,7 @@ vec3 GetSkyRadiance(vec3 camera, vec3 view_ray, float shadow_length,
     vec3 sun_direction, out vec3 transmittance);
 vec3 GetSkyRadianceToPoint(vec3 camera, vec3 point, float shadow_length,
     vec3 sun_direction, out vec3 transmittance);
+vec3 GetSkyViewRadiance(vec3 view_ray);
 vec3 GetSunAndSkyIrradiance(
     vec3 p, vec3 normal, vec3 sun_direction, out vec3 sky_irradiance);
 
@@ -364,16 +367,25 @@ on the ground by the sun and sky visibility factors):
 /*
 <p>Finally, we compute the radiance and transmittance of the sky, and composite
 together, from back to front, the radiance and opacities of all the objects of
-the scene:
+the scene. If the <code>use_sky_view</code> option is enabled, the sky radiance
+is read from the sky view texture baked at each frame, except in the light
+shafts and in the Sun disc (this texture contains neither the effect of the
+shadow length, nor the transmittance needed to attenuate the Sun):
 */
 
   // Compute the radiance of the sky.
   float shadow_length = max(0.0, shadow_out - shadow_in) *
       lightshaft_fadein_hack;
   vec3 transmittance;
-  vec3 radiance = GetSkyRadiance(
-      camera - earth_center, view_direction, shadow_length, sun_direction,
-      transmittance);
+  vec3 radiance;
+  if (use_sky_view && shadow_length == 0.0 &&
+      dot(view_direction, sun_direction) <= sun_size.y) {
+    radiance = GetSkyViewRadiance(view_direction);
+    transmittance = vec3(0.0);
+  } else {
+    radiance = GetSkyRadiance(camera - earth_center, view_direction,
+        shadow_length, sun_direction, transmittance);
+  }
 
   // If the view ray intersects the Sun, add the Sun radiance.
   if (dot(view_direction, sun_direction) > sun_size.y) {
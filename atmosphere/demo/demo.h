@@ -43,6 +43,7 @@ to render the scene and the help messages:
 #include <glad/glad.h>
 
 #include <memory>
+#include <vector>
 
 #include "atmosphere/model.h"
 #include "text/text_renderer.h"
@@ -77,7 +78,12 @@ class Demo {
   };
 
   void InitModel();
-  void HandleRedisplayEvent() const;
+  void StepPendingModel();
+  void SwapPendingModel();
+  void SetWhitePoint(const std::vector<double>& wavelengths,
+      const std::vector<double>& solar_irradiance);
+  void UpdateSolarIrradiance();
+  void HandleRedisplayEvent();
   void HandleReshapeEvent(int viewport_width, int viewport_height);
   void HandleKeyboardEvent(unsigned char key);
   void HandleMouseClickEvent(int button, int state, int mouse_x, int mouse_y);
@@ -93,12 +99,27 @@ class Demo {
   bool use_half_precision_;
   Luminance use_luminance_;
   bool do_white_balance_;
+  bool use_sky_view_;
   bool show_help_;
 
   std::unique_ptr<Model> model_;
   GLuint vertex_shader_;
   GLuint fragment_shader_;
   GLuint program_;
+  // The use_luminance_ option used for model_ and program_ (use_luminance_ can
+  // differ while pending_model_ is being precomputed).
+  Luminance model_use_luminance_;
+
+  // The model which replaces model_, and its rendering program, after a change
+  // of atmosphere options. It is precomputed incrementally over several frames
+  // and is swapped in once 'pending_fence_' is signaled.
+  std::unique_ptr<Model> pending_model_;
+  GLuint pending_fragment_shader_;
+  GLuint pending_program_;
+  GLsync pending_fence_;
+  // The use_constant_solar_spectrum_ option used for pending_model_.
+  bool pending_use_constant_solar_spectrum_;
+
   GLuint full_screen_quad_vao_;
   GLuint full_screen_quad_vbo_;
   std::unique_ptr<TextRenderer> text_renderer_;
@@ -116,6 +137,15 @@ class Demo {
   bool is_ctrl_key_pressed_;
 };
 
+// Returns a new Model, not yet initialized, with the Earth atmosphere
+// parameters of the demo and the given options. The Mie scale height, the Mie
+// Angstrom beta coefficient and the ozone density are multiplied by the last 3
+// arguments.
+Model* NewDemoModel(bool use_constant_solar_spectrum, bool use_ozone,
+    bool use_combined_textures, bool use_half_precision,
+    bool use_precomputed_luminance, double mie_scale_height_factor = 1.0,
+    double mie_angstrom_beta_factor = 1.0, double ozone_density_factor = 1.0);
+
 }  // namespace demo
 }  // namespace atmosphere
 
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/demo/precompute_grid.cc</h2>
+
+<p>This tool precomputes the textures of the demo atmosphere on a grid of Mie
+scale height, Mie Angstrom beta coefficient and ozone density values (relative
+to the default demo values), and writes them in a
+<a href="../grid_bundle.h.html">grid bundle</a>. An application can then get
+the textures for any values in the grid range, in a few milliseconds, with
+<code>GridBundle::Blend</code> and <code>Model::SetTextures</code>. Usage:
+<pre>
+precompute_grid &lt;output file&gt; [&lt;mie scale height factors&gt;
+    &lt;mie angstrom beta factors&gt; &lt;ozone density factors&gt;]
+</pre>
+where each list of factors is a comma separated list of increasing values (the
+default grid has 2x3x2 points). The models are precomputed one after the other
+on GPU, using an hidden window, and only one of them is in memory at a time:
+*/
+
+#include <glad/glad.h>
+#include <GL/freeglut.h>
+
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "atmosphere/demo/demo.h"
+#include "atmosphere/grid_bundle.h"
+#include "atmosphere/model.h"
+
+using atmosphere::GridBundle;
+using atmosphere::Model;
+using atmosphere::ParameterGrid;
+using atmosphere::PrecomputedTextures;
+
+std::vector<double> ParseAxis(const std::string& values) {
+  std::vector<double> axis;
+  std::stringstream stream(values);
+  std::string value;
+  while (std::getline(stream, value, ',')) {
+    axis.push_back(std::stod(value));
+  }
+  return axis;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2 && argc != 5) {
+    std::cerr << "Usage: " << argv[0] << " <output file> [<mie scale height "
+        << "factors> <mie angstrom beta factors> <ozone density factors>]"
+        << std::endl;
+    return 1;
+  }
+  const ParameterGrid grid(argc == 5 ?
+      std::vector<std::vector<double>>{
+          ParseAxis(argv[2]), ParseAxis(argv[3]), ParseAxis(argv[4])} :
+      std::vector<std::vector<double>>{
+          {0.75, 1.5}, {0.5, 1.0, 2.0}, {0.5, 1.5}});
+
+  glutInitContextVersion(3, 3);
+  glutInitContextProfile(GLUT_CORE_PROFILE);
+  glutInit(&argc, argv);
+  glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE);
+  glutCreateWindow("Precompute Grid");
+  glutHideWindow();
+  if (!gladLoadGL()) {
+    throw std::runtime_error("GLAD initialization failed");
+  }
+
+  // The demo default options, in precomputed radiance mode (the only one
+  // supported by Model::SetTextures with the runtime_solar_irradiance option
+  // used by the demo).
+  constexpr bool kUseCombinedTextures = true;
+  constexpr bool kUseHalfPrecision = true;
+  std::unique_ptr<Model> model;
+  GridBundle::Write(argv[1], grid, atmosphere::TextureSizes(),
+      kUseCombinedTextures,
+      [&](const std::vector<double>& point, PrecomputedTextures* textures) {
+        std::cout << "Precomputing " << point[0] << " " << point[1] << " "
+            << point[2] << std::endl;
+        model.reset(atmosphere::demo::NewDemoModel(
+            false /* use_constant_solar_spectrum */, true /* use_ozone */,
+            kUseCombinedTextures, kUseHalfPrecision,
+            false /* use_precomputed_luminance */, point[0], point[1],
+            point[2]));
+        model->Init();
+        model->GetTextures(textures);
+      });
+  return 0;
+}
@@ -43,7 +43,7 @@ the OpenGL API, and are saved to disk:
 #include <fstream>
 
 #include "atmosphere/demo/demo.h"
-#include "atmosphere/constants.h"
+#include "atmosphere/model.h"
 
 using atmosphere::demo::Demo;
 
@@ -85,24 +85,22 @@ int main(int argc, char** argv) {
   SaveShader(demo->model().shader(), output_dir + "atmosphere_shader.txt");
   SaveShader(demo->vertex_shader(), output_dir + "vertex_shader.txt");
   SaveShader(demo->fragment_shader(), output_dir + "fragment_shader.txt");
+  const atmosphere::TextureSizes& sizes = demo->model().texture_sizes();
   SaveTexture(
       GL_TEXTURE0,
       GL_TEXTURE_2D,
-      atmosphere::TRANSMITTANCE_TEXTURE_WIDTH *
-          atmosphere::TRANSMITTANCE_TEXTURE_HEIGHT,
+      sizes.transmittance_width * sizes.transmittance_height,
       output_dir + "transmittance.dat");
   SaveTexture(
       GL_TEXTURE1,
       GL_TEXTURE_3D,
-      atmosphere::SCATTERING_TEXTURE_WIDTH *
-          atmosphere::SCATTERING_TEXTURE_HEIGHT *
-          atmosphere::SCATTERING_TEXTURE_DEPTH,
+      sizes.scattering_width() * sizes.scattering_height() *
+          sizes.scattering_depth(),
       output_dir + "scattering.dat");
   SaveTexture(
       GL_TEXTURE2,
       GL_TEXTURE_2D,
-      atmosphere::IRRADIANCE_TEXTURE_WIDTH *
-          atmosphere::IRRADIANCE_TEXTURE_HEIGHT,
+      sizes.irradiance_width * sizes.irradiance_height,
       output_dir + "irradiance.dat");
 
   return 0;
@@ -97,6 +97,8 @@ be compiled either with a GLSL compiler or with a C++ compiler (see the
 <li><a href="#irradiance_lookup">Lookup</a></li>
 </ul>
 </li>
+<li><a href="#approximate_multiple_scattering">Approximate multiple
+scattering</a></li>
 <li><a href="#rendering">Rendering</a>
 <ul>
 <li><a href="#rendering_sky">Sky</a></li>
@@ -462,6 +464,108 @@ DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundaryTexture(
   return ComputeTransmittanceToTopAtmosphereBoundary(atmosphere, r, mu);
 }
 
+/*
+<p>This precomputation evaluates the 3 density profiles analytically at each
+integration sample, i.e. with one exponential (plus a clamp and a branch) per
+profile and per sample. Since these profiles only depend on the altitude, we can
+also precompute them once in a small 1D lookup table, and then get the 3
+densities at any altitude with a single texture lookup. This table can also
+contain arbitrary tabulated profiles (e.g. measured soundings), since nothing
+requires its content to come from the analytic layers (see the
+<code>tabulated_densities</code> option of the <a href="model.h.html">GPU
+model</a>, and the <code>density.dat</code> file of the
+<a href="reference/model.h.html">CPU model</a>). For this to give
+consistent results, all the precomputations use this table, i.e. the
+transmittance as well as the single scattering and the scattering density
+(see below), instead of the analytic profiles.
+
+<p>We store this table in a 2D texture of height 1, containing the Rayleigh, Mie
+and absorption densities in its RGB channels. Note that we do not store the
+cumulative optical lengths along vertical rays: all the optical lengths needed
+by our model are along slanted rays, and can not be derived exactly from the
+vertical ones (this would require an approximation of the Chapman function,
+which would change the results). The altitude is mapped to the $u$ texture
+coordinate with the same texel center convention as above:
+*/
+
+Number GetDensityTextureUFromAltitude(IN(AtmosphereParameters) atmosphere,
+    Length altitude) {
+  return GetTextureCoordFromUnitRange(
+      altitude / (atmosphere.top_radius - atmosphere.bottom_radius),
+      DENSITY_TEXTURE_WIDTH);
+}
+
+vec3 ComputeDensityTexture(IN(AtmosphereParameters) atmosphere,
+    IN(vec2) frag_coord) {
+  Length thickness = atmosphere.top_radius - atmosphere.bottom_radius;
+  Length altitude = thickness * GetUnitRangeFromTextureCoord(
+      frag_coord.x / Number(DENSITY_TEXTURE_WIDTH), DENSITY_TEXTURE_WIDTH);
+  return vec3(
+      GetProfileDensity(atmosphere.rayleigh_density, altitude),
+      GetProfileDensity(atmosphere.mie_density, altitude),
+      GetProfileDensity(atmosphere.absorption_density, altitude));
+}
+
+/*
+<p>The densities at some altitude can then be read with a single (linearly
+interpolated) lookup in this texture:
+*/
+
+vec3 GetProfileDensities(IN(AtmosphereParameters) atmosphere,
+    IN(DensityTexture) density_texture, Length altitude) {
+  Number u = GetDensityTextureUFromAltitude(atmosphere, altitude);
+  return vec3(texture(density_texture, vec2(u, 0.5)));
+}
+
+/*
+<p>With this table, the 3 optical lengths needed for the transmittance can be
+computed in a single integration loop, with one texture lookup per sample
+instead of 3 analytic density evaluations. This yields the following variants
+of the above functions, which we use in our precomputations:
+*/
+
+DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundary(
+    IN(AtmosphereParameters) atmosphere, IN(DensityTexture) density_texture,
+    Length r, Number mu) {
+  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);
+  assert(mu >= -1.0 && mu <= 1.0);
+  // Number of intervals for the numerical integration.
+  const int SAMPLE_COUNT = 500;
+  // The integration step, i.e. the length of each integration interval.
+  Length dx =
+      DistanceToTopAtmosphereBoundary(atmosphere, r, mu) / Number(SAMPLE_COUNT);
+  // Integration loop, for the Rayleigh, Mie and absorption optical lengths.
+  Length3 optical_length = Length3(0.0 * m, 0.0 * m, 0.0 * m);
+  for (int i = 0; i <= SAMPLE_COUNT; ++i) {
+    Length d_i = Number(i) * dx;
+    // Distance between the current sample point and the planet center.
+    Length r_i = sqrt(d_i * d_i + 2.0 * r * mu * d_i + r * r);
+    // The 3 number densities at the current sample point.
+    vec3 y_i = GetProfileDensities(
+        atmosphere, density_texture, r_i - atmosphere.bottom_radius);
+    // Sample weight (from the trapezoidal rule).
+    Number weight_i = i == 0 || i == SAMPLE_COUNT ? 0.5 : 1.0;
+    optical_length = optical_length + y_i * (weight_i * dx);
+  }
+  return exp(-(
+      atmosphere.rayleigh_scattering * optical_length.x +
+      atmosphere.mie_extinction * optical_length.y +
+      atmosphere.absorption_extinction * optical_length.z));
+}
+
+DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundaryTexture(
+    IN(AtmosphereParameters) atmosphere, IN(DensityTexture) density_texture,
+    IN(vec2) frag_coord) {
+  const vec2 TRANSMITTANCE_TEXTURE_SIZE =
+      vec2(TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
+  Length r;
+  Number mu;
+  GetRMuFromTransmittanceTextureUv(
+      atmosphere, frag_coord / TRANSMITTANCE_TEXTURE_SIZE, r, mu);
+  return ComputeTransmittanceToTopAtmosphereBoundary(
+      atmosphere, density_texture, r, mu);
+}
+
 /*
 <h4 id="transmittance_lookup">Lookup</h4>
 
@@ -650,6 +754,7 @@ on for efficiency reasons):
 void ComputeSingleScatteringIntegrand(
     IN(AtmosphereParameters) atmosphere,
     IN(TransmittanceTexture) transmittance_texture,
+    IN(DensityTexture) density_texture,
     Length r, Number mu, Number mu_s, Number nu, Length d,
     bool ray_r_mu_intersects_ground,
     OUT(DimensionlessSpectrum) rayleigh, OUT(DimensionlessSpectrum) mie) {
@@ -661,10 +766,10 @@ void ComputeSingleScatteringIntegrand(
           ray_r_mu_intersects_ground) *
       GetTransmittanceToSun(
           atmosphere, transmittance_texture, r_d, mu_s_d);
-  rayleigh = transmittance * GetProfileDensity(
-      atmosphere.rayleigh_density, r_d - atmosphere.bottom_radius);
-  mie = transmittance * GetProfileDensity(
-      atmosphere.mie_density, r_d - atmosphere.bottom_radius);
+  vec3 densities = GetProfileDensities(
+      atmosphere, density_texture, r_d - atmosphere.bottom_radius);
+  rayleigh = transmittance * densities.x;
+  mie = transmittance * densities.y;
 }
 
 /*
@@ -695,6 +800,7 @@ rule</a>):
 void ComputeSingleScattering(
     IN(AtmosphereParameters) atmosphere,
     IN(TransmittanceTexture) transmittance_texture,
+    IN(DensityTexture) density_texture,
     Length r, Number mu, Number mu_s, Number nu,
     bool ray_r_mu_intersects_ground,
     OUT(IrradianceSpectrum) rayleigh, OUT(IrradianceSpectrum) mie) {
@@ -718,7 +824,8 @@ void ComputeSingleScattering(
     DimensionlessSpectrum rayleigh_i;
     DimensionlessSpectrum mie_i;
     ComputeSingleScatteringIntegrand(atmosphere, transmittance_texture,
-        r, mu, mu_s, nu, d_i, ray_r_mu_intersects_ground, rayleigh_i, mie_i);
+        density_texture, r, mu, mu_s, nu, d_i, ray_r_mu_intersects_ground,
+        rayleigh_i, mie_i);
     // Sample weight (from the trapezoidal rule).
     Number weight_i = (i == 0 || i == SAMPLE_COUNT) ? 0.5 : 1.0;
     rayleigh_sum += rayleigh_i * weight_i;
@@ -931,7 +1038,8 @@ the single scattering in a 3D texture:
 */
 
 void ComputeSingleScatteringTexture(IN(AtmosphereParameters) atmosphere,
-    IN(TransmittanceTexture) transmittance_texture, IN(vec3) frag_coord,
+    IN(TransmittanceTexture) transmittance_texture,
+    IN(DensityTexture) density_texture, IN(vec3) frag_coord,
     OUT(IrradianceSpectrum) rayleigh, OUT(IrradianceSpectrum) mie) {
   Length r;
   Number mu;
@@ -940,7 +1048,7 @@ void ComputeSingleScatteringTexture(IN(AtmosphereParameters) atmosphere,
   bool ray_r_mu_intersects_ground;
   GetRMuMuSNuFromScatteringTextureFragCoord(atmosphere, frag_coord,
       r, mu, mu_s, nu, ray_r_mu_intersects_ground);
-  ComputeSingleScattering(atmosphere, transmittance_texture,
+  ComputeSingleScattering(atmosphere, transmittance_texture, density_texture,
       r, mu, mu_s, nu, ray_r_mu_intersects_ground, rayleigh, mie);
 }
 
@@ -952,7 +1060,11 @@ between a point and the nearest atmosphere boundary with two texture lookups (we
 need two 3D texture lookups to emulate a single 4D texture lookup with
 quadrilinear interpolation; the 3D texture coordinates are computed using the
 inverse of the 3D-4D mapping defined in
-<code>GetRMuMuSNuFromScatteringTextureFragCoord</code>):
+<code>GetRMuMuSNuFromScatteringTextureFragCoord</code>). Note that the C++
+version of this code uses <a href="reference/quaternary_function.h.html">true
+4D textures</a> instead, with a single quadrilinear lookup (this is enabled
+with the <code>NATIVE_4D_SCATTERING_TEXTURES</code> macro, which is only
+defined in C++):
 */
 
 TEMPLATE(AbstractSpectrum)
@@ -964,6 +1076,9 @@ AbstractSpectrum GetScattering(
     bool ray_r_mu_intersects_ground) {
   vec4 uvwz = GetScatteringTextureUvwzFromRMuMuSNu(
       atmosphere, r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+#ifdef NATIVE_4D_SCATTERING_TEXTURES
+  return texture(scattering_texture, uvwz);
+#else
   Number tex_coord_x = uvwz.x * Number(SCATTERING_TEXTURE_NU_SIZE - 1);
   Number tex_x = floor(tex_coord_x);
   Number lerp = tex_coord_x - tex_x;
@@ -973,6 +1088,7 @@ AbstractSpectrum GetScattering(
       uvwz.z, uvwz.w);
   return AbstractSpectrum(texture(scattering_texture, uvw0) * (1.0 - lerp) +
       texture(scattering_texture, uvw1) * lerp);
+#endif
 }
 
 /*
@@ -1163,6 +1279,7 @@ equal to $n$):</li>
 RadianceDensitySpectrum ComputeScatteringDensity(
     IN(AtmosphereParameters) atmosphere,
     IN(TransmittanceTexture) transmittance_texture,
+    IN(DensityTexture) density_texture,
     IN(ReducedScatteringTexture) single_rayleigh_scattering_texture,
     IN(ReducedScatteringTexture) single_mie_scattering_texture,
     IN(ScatteringTexture) multiple_scattering_texture,
@@ -1183,6 +1300,9 @@ RadianceDensitySpectrum ComputeScatteringDensity(
   Number sun_dir_x = omega.x == 0.0 ? 0.0 : (nu - mu * mu_s) / omega.x;
   Number sun_dir_y = sqrt(max(1.0 - sun_dir_x * sun_dir_x - mu_s * mu_s, 0.0));
   vec3 omega_s = vec3(sun_dir_x, sun_dir_y, mu_s);
+  // The Rayleigh and Mie densities at r.
+  vec3 densities = GetProfileDensities(
+      atmosphere, density_texture, r - atmosphere.bottom_radius);
 
   const int SAMPLE_COUNT = 16;
   const Angle dphi = pi / Number(SAMPLE_COUNT);
@@ -1244,14 +1364,10 @@ RadianceDensitySpectrum ComputeScatteringDensity(
       // coefficient, and the phase function for directions omega and omega_i
       // (all this summed over all particle types, i.e. Rayleigh and Mie).
       Number nu2 = dot(omega, omega_i);
-      Number rayleigh_density = GetProfileDensity(
-          atmosphere.rayleigh_density, r - atmosphere.bottom_radius);
-      Number mie_density = GetProfileDensity(
-          atmosphere.mie_density, r - atmosphere.bottom_radius);
       rayleigh_mie += incident_radiance * (
-          atmosphere.rayleigh_scattering * rayleigh_density *
+          atmosphere.rayleigh_scattering * densities.x *
               RayleighPhaseFunction(nu2) +
-          atmosphere.mie_scattering * mie_density *
+          atmosphere.mie_scattering * densities.y *
               MiePhaseFunction(atmosphere.mie_phase_function_g, nu2)) *
           domega_i;
     }
@@ -1348,6 +1464,7 @@ over the number of bounces:
 RadianceDensitySpectrum ComputeScatteringDensityTexture(
     IN(AtmosphereParameters) atmosphere,
     IN(TransmittanceTexture) transmittance_texture,
+    IN(DensityTexture) density_texture,
     IN(ReducedScatteringTexture) single_rayleigh_scattering_texture,
     IN(ReducedScatteringTexture) single_mie_scattering_texture,
     IN(ScatteringTexture) multiple_scattering_texture,
@@ -1361,9 +1478,9 @@ RadianceDensitySpectrum ComputeScatteringDensityTexture(
   GetRMuMuSNuFromScatteringTextureFragCoord(atmosphere, frag_coord,
       r, mu, mu_s, nu, ray_r_mu_intersects_ground);
   return ComputeScatteringDensity(atmosphere, transmittance_texture,
-      single_rayleigh_scattering_texture, single_mie_scattering_texture,
-      multiple_scattering_texture, irradiance_texture, r, mu, mu_s, nu,
-      scattering_order);
+      density_texture, single_rayleigh_scattering_texture,
+      single_mie_scattering_texture, multiple_scattering_texture,
+      irradiance_texture, r, mu, mu_s, nu, scattering_order);
 }
 
 RadianceSpectrum ComputeMultipleScatteringTexture(
@@ -1600,6 +1717,166 @@ IrradianceSpectrum GetIrradiance(
   return IrradianceSpectrum(texture(irradiance_texture, uv));
 }
 
+/*
+<h3 id="approximate_multiple_scattering">Approximate multiple scattering</h3>
+
+<p>The <a href="#multiple_scattering">multiple scattering</a> algorithm above
+computes each scattering order in sequence, and each order requires the costly
+double integral of <code>ComputeScatteringDensity</code> for each texel of a 4D
+texture. As an alternative, we also provide a much cheaper approximation of all
+the scattering orders $n\ge 2$, following <a href=
+"https://sebh.github.io/publications/egsr2020.pdf">Hillaire 2020</a>. This
+approximation assumes that the light scattered at a point $\bq$ after 2 or more
+bounces is isotropic, and that it only depends on $r$ and $\mu_s$ (i.e. that it
+is the same as if all the points around $\bq$ had the same altitude and Sun
+zenith angle). Under these assumptions, the radiance $L_2$ scattered towards
+$\bq$ after 2 bounces, summed over all directions, is the integral over all
+directions $\bw_i$ of
+<ul>
+<li>the single scattering arriving at $\bq$ from direction $\bw_i$, with an
+isotropic phase function $1/4\pi$,</li>
+<li>plus, if the ray $[\bq,\bw_i)$ intersects the ground at $\br$, the
+transmittance between $\bq$ and $\br$ times the direct irradiance at $\br$
+times the ground albedo and the Lambertian BRDF $1/\pi$.</li>
+</ul>
+Each additional bounce then multiplies this light with the fraction $f$ of the
+light, emitted isotropically at $\bq$, which is scattered back towards $\bq$.
+This fraction is the integral over all directions $\bw_i$ of the product of the
+transmittance and of the scattering coefficient, integrated along the ray
+$[\bq,\bw_i)$, times $1/4\pi$. The sum of all the orders $n\ge 2$ is thus the
+geometric series $L_2(1+f+f^2+\ldots)=L_2/(1-f)$, which we compute with the
+following function (we use a small number of samples, like in the
+<a href="#irradiance_computation">indirect irradiance</a> computations, since
+this function is smooth):
+*/
+
+IrradianceSpectrum ComputeMultipleScatteringFluence(
+    IN(AtmosphereParameters) atmosphere,
+    IN(TransmittanceTexture) transmittance_texture,
+    IN(DensityTexture) density_texture,
+    Length r, Number mu_s) {
+  assert(r >= atmosphere.bottom_radius && r <= atmosphere.top_radius);
+  assert(mu_s >= -1.0 && mu_s <= 1.0);
+
+  const int SAMPLE_COUNT = 16;
+  const int RAY_SAMPLE_COUNT = 20;
+  const Angle dphi = pi / Number(SAMPLE_COUNT);
+  const Angle dtheta = pi / Number(SAMPLE_COUNT);
+  const InverseSolidAngle isotropic_phase_function = 1.0 / (4.0 * PI * sr);
+  vec3 omega_s = vec3(sqrt(1.0 - mu_s * mu_s), 0.0, mu_s);
+
+  IrradianceSpectrum second_order =
+      IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm);
+  DimensionlessSpectrum transfer = DimensionlessSpectrum(0.0);
+  for (int l = 0; l < SAMPLE_COUNT; ++l) {
+    Angle theta = (Number(l) + 0.5) * dtheta;
+    Number mu = cos(theta);
+    bool ray_r_mu_intersects_ground = RayIntersectsGround(atmosphere, r, mu);
+    Length distance_to_boundary = DistanceToNearestAtmosphereBoundary(
+        atmosphere, r, mu, ray_r_mu_intersects_ground);
+    Length dx = distance_to_boundary / Number(RAY_SAMPLE_COUNT);
+    SolidAngle domega = (dtheta / rad) * (dphi / rad) * sin(theta) * sr;
+
+    for (int m = 0; m < 2 * SAMPLE_COUNT; ++m) {
+      Angle phi = (Number(m) + 0.5) * dphi;
+      Number nu = dot(omega_s,
+          vec3(cos(phi) * sin(theta), sin(phi) * sin(theta), mu));
+
+      // The single scattering and the transfer fraction along the ray, with the
+      // trapezoidal rule (see ComputeSingleScattering).
+      DimensionlessSpectrum rayleigh_sum = DimensionlessSpectrum(0.0);
+      DimensionlessSpectrum mie_sum = DimensionlessSpectrum(0.0);
+      DimensionlessSpectrum rayleigh_transfer = DimensionlessSpectrum(0.0);
+      DimensionlessSpectrum mie_transfer = DimensionlessSpectrum(0.0);
+      for (int i = 0; i <= RAY_SAMPLE_COUNT; ++i) {
+        Length d_i = Number(i) * dx;
+        Length r_i = ClampRadius(
+            atmosphere, sqrt(d_i * d_i + 2.0 * r * mu * d_i + r * r));
+        Number mu_s_i = ClampCosine((r * mu_s + d_i * nu) / r_i);
+        Number weight_i = (i == 0 || i == RAY_SAMPLE_COUNT) ? 0.5 : 1.0;
+        DimensionlessSpectrum transmittance = GetTransmittance(
+            atmosphere, transmittance_texture, r, mu, d_i,
+            ray_r_mu_intersects_ground) * weight_i;
+        DimensionlessSpectrum transmittance_to_sun = GetTransmittanceToSun(
+            atmosphere, transmittance_texture, r_i, mu_s_i);
+        vec3 densities = GetProfileDensities(
+            atmosphere, density_texture, r_i - atmosphere.bottom_radius);
+        rayleigh_sum += transmittance * transmittance_to_sun * densities.x;
+        mie_sum += transmittance * transmittance_to_sun * densities.y;
+        rayleigh_transfer += transmittance * densities.x;
+        mie_transfer += transmittance * densities.y;
+      }
+      second_order += (atmosphere.rayleigh_scattering * rayleigh_sum +
+          atmosphere.mie_scattering * mie_sum) * dx *
+              atmosphere.solar_irradiance * isotropic_phase_function * domega;
+      transfer += (atmosphere.rayleigh_scattering * rayleigh_transfer +
+          atmosphere.mie_scattering * mie_transfer) * dx *
+              isotropic_phase_function * domega;
+
+      // The light reflected on the ground, if the ray intersects it.
+      if (ray_r_mu_intersects_ground) {
+        Length r_g = atmosphere.bottom_radius;
+        Number mu_s_g =
+            ClampCosine((r * mu_s + distance_to_boundary * nu) / r_g);
+        second_order += GetTransmittance(atmosphere, transmittance_texture,
+            r, mu, distance_to_boundary, true /* ray_intersects_ground */) *
+            atmosphere.ground_albedo * (1.0 / (PI * sr)) *
+            ComputeDirectIrradiance(
+                atmosphere, transmittance_texture, r_g, mu_s_g) * domega;
+      }
+    }
+  }
+  return second_order / (DimensionlessSpectrum(1.0) - transfer);
+}
+
+/*
+<p>This function only depends on $r$ and $\mu_s$, like the ground irradiance, so
+we can store it in a texture with the same layout as the irradiance texture:
+*/
+
+IrradianceSpectrum ComputeMultipleScatteringFluenceTexture(
+    IN(AtmosphereParameters) atmosphere,
+    IN(TransmittanceTexture) transmittance_texture,
+    IN(DensityTexture) density_texture,
+    IN(vec2) frag_coord) {
+  Length r;
+  Number mu_s;
+  GetRMuSFromIrradianceTextureUv(
+      atmosphere, frag_coord / IRRADIANCE_TEXTURE_SIZE, r, mu_s);
+  return ComputeMultipleScatteringFluence(
+      atmosphere, transmittance_texture, density_texture, r, mu_s);
+}
+
+/*
+<p>With this texture, the scattering density for all the orders $n\ge 2$ is
+simply the product of the scattering coefficient with the isotropic phase
+function and with the above function (read with <code>GetIrradiance</code>).
+We can thus compute it in the same texture layout as the scattering density of
+the <a href="#multiple_scattering_precomputation">exact algorithm</a>, and then
+use <code>ComputeMultipleScatteringTexture</code> to integrate it along each
+view ray, which gives all the multiple scattering orders in a single step:
+*/
+
+RadianceDensitySpectrum ComputeApproximateScatteringDensityTexture(
+    IN(AtmosphereParameters) atmosphere,
+    IN(DensityTexture) density_texture,
+    IN(IrradianceTexture) multiple_scattering_fluence_texture,
+    IN(vec3) frag_coord) {
+  Length r;
+  Number mu;
+  Number mu_s;
+  Number nu;
+  bool ray_r_mu_intersects_ground;
+  GetRMuMuSNuFromScatteringTextureFragCoord(atmosphere, frag_coord,
+      r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+  vec3 densities = GetProfileDensities(
+      atmosphere, density_texture, r - atmosphere.bottom_radius);
+  return GetIrradiance(
+      atmosphere, multiple_scattering_fluence_texture, r, mu_s) *
+      (atmosphere.rayleigh_scattering * densities.x +
+          atmosphere.mie_scattering * densities.y) * (1.0 / (4.0 * PI * sr));
+}
+
 /*
 <h3 id="rendering">Rendering</h3>
 
@@ -1619,9 +1896,10 @@ option was not provided our <a href=
 >original implementation</a>),</li>
 <li>or, if the <code>COMBINED_SCATTERING_TEXTURES</code> preprocessor
 macro is defined, in the <code>scattering_texture</code>. In this case, which is
-only available with a GLSL compiler, Rayleigh and multiple scattering are stored
-in the RGB channels, and the red component of the single Mie scattering is
-stored in the alpha channel).</li>
+only available with 3 wavelengths (i.e. with the GPU model or with the
+<a href="cpu/model.cc.html">RGB CPU model</a>), Rayleigh and multiple scattering
+are stored in the RGB channels, and the red component of the single Mie
+scattering is stored in the alpha channel).</li>
 </ul>
 
 <p>In the second case, the green and blue components of the single Mie
@@ -1635,11 +1913,11 @@ vec3 GetExtrapolatedSingleMieScattering(
     IN(AtmosphereParameters) atmosphere, IN(vec4) scattering) {
   // Algebraically this can never be negative, but rounding errors can produce
   // that effect for sufficiently short view rays.
-  if (scattering.r <= 0.0) {
+  if (scattering.x <= 0.0) {
     return vec3(0.0);
   }
-  return scattering.rgb * scattering.a / scattering.r *
-	    (atmosphere.rayleigh_scattering.r / atmosphere.mie_scattering.r) *
+  return vec3(scattering) * scattering.w / scattering.x *
+	    (atmosphere.rayleigh_scattering.x / atmosphere.mie_scattering.x) *
 	    (atmosphere.mie_scattering / atmosphere.rayleigh_scattering);
 }
 #endif
@@ -1652,7 +1930,8 @@ following function, based on
 some code here, instead of using two calls to <code>GetScattering</code>, to
 make sure that the texture coordinates computation is shared between the lookups
 in <code>scattering_texture</code> and
-<code>single_mie_scattering_texture</code>):
+<code>single_mie_scattering_texture</code>; in C++, with true 4D textures, a
+single quadrilinear lookup per texture is needed):
 */
 
 IrradianceSpectrum GetCombinedScattering(
@@ -1664,6 +1943,10 @@ IrradianceSpectrum GetCombinedScattering(
     OUT(IrradianceSpectrum) single_mie_scattering) {
   vec4 uvwz = GetScatteringTextureUvwzFromRMuMuSNu(
       atmosphere, r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+#ifdef NATIVE_4D_SCATTERING_TEXTURES
+  IrradianceSpectrum scattering = texture(scattering_texture, uvwz);
+  single_mie_scattering = texture(single_mie_scattering_texture, uvwz);
+#else
   Number tex_coord_x = uvwz.x * Number(SCATTERING_TEXTURE_NU_SIZE - 1);
   Number tex_x = floor(tex_coord_x);
   Number lerp = tex_coord_x - tex_x;
@@ -1685,6 +1968,7 @@ IrradianceSpectrum GetCombinedScattering(
   single_mie_scattering = IrradianceSpectrum(
       texture(single_mie_scattering_texture, uvw0) * (1.0 - lerp) +
       texture(single_mie_scattering_texture, uvw1) * lerp);
+#endif
 #endif
   return scattering;
 }
@@ -1697,77 +1981,261 @@ get with a lookup in the precomputed scattering texture(s), multiplied by the
 phase function terms that were omitted during precomputation. We can also return
 the transmittance of the atmosphere (which we can get with a single lookup in
 the precomputed transmittance texture), which is needed to correctly render the
-objects in space (such as the Sun and the Moon). This leads to the following
-function, where most of the computations are used to correctly handle the case
-of viewers outside the atmosphere, and the case of light shafts:
+objects in space (such as the Sun and the Moon).
+
+<p>For a fixed camera and a fixed set of view rays, e.g. to render a time-lapse
+sequence with a moving Sun, only $\mu_s$ and $\nu$ change from one frame to the
+next (if there are no light shafts). We thus split this computation in several
+parts. Most of the computations are used to correctly handle the case of viewers
+outside the atmosphere, with the following function. It moves the viewer to
+the top atmosphere boundary (along the view ray) if it is in space, and returns
+false if the view ray does not intersect the atmosphere:
 */
 
-RadianceSpectrum GetSkyRadiance(
+bool GetCameraInAtmosphere(
     IN(AtmosphereParameters) atmosphere,
-    IN(TransmittanceTexture) transmittance_texture,
-    IN(ReducedScatteringTexture) scattering_texture,
-    IN(ReducedScatteringTexture) single_mie_scattering_texture,
-    Position camera, IN(Direction) view_ray, Length shadow_length,
-    IN(Direction) sun_direction, OUT(DimensionlessSpectrum) transmittance) {
+    IN(Position) camera, IN(Direction) view_ray,
+    OUT(Position) camera_in_atmosphere, OUT(Length) r, OUT(Length) rmu) {
   // Compute the distance to the top atmosphere boundary along the view ray,
   // assuming the viewer is in space (or NaN if the view ray does not intersect
   // the atmosphere).
-  Length r = length(camera);
-  Length rmu = dot(camera, view_ray);
+  r = length(camera);
+  rmu = dot(camera, view_ray);
   Length distance_to_top_atmosphere_boundary = -rmu -
       sqrt(rmu * rmu - r * r + atmosphere.top_radius * atmosphere.top_radius);
+  camera_in_atmosphere = camera;
   // If the viewer is in space and the view ray intersects the atmosphere, move
   // the viewer to the top atmosphere boundary (along the view ray):
   if (distance_to_top_atmosphere_boundary > 0.0 * m) {
-    camera = camera + view_ray * distance_to_top_atmosphere_boundary;
+    camera_in_atmosphere =
+        camera + view_ray * distance_to_top_atmosphere_boundary;
     r = atmosphere.top_radius;
     rmu += distance_to_top_atmosphere_boundary;
-  } else if (r > atmosphere.top_radius) {
-    // If the view ray does not intersect the atmosphere, simply return 0.
-    transmittance = DimensionlessSpectrum(1.0);
-    return RadianceSpectrum(0.0 * watt_per_square_meter_per_sr_per_nm);
   }
-  // Compute the r, mu, mu_s and nu parameters needed for the texture lookups.
-  Number mu = rmu / r;
-  Number mu_s = dot(camera, sun_direction) / r;
-  Number nu = dot(view_ray, sun_direction);
-  bool ray_r_mu_intersects_ground = RayIntersectsGround(atmosphere, r, mu);
+  return r <= atmosphere.top_radius;
+}
 
+/*
+<p>The first part of the sky radiance computation then computes the terms which
+only depend on the view ray, and can thus be computed once per view ray. It
+returns false if the view ray does not intersect the atmosphere, in which case
+the sky radiance is 0 and the transmittance is 1:
+*/
+
+bool GetViewRayTerms(
+    IN(AtmosphereParameters) atmosphere,
+    IN(TransmittanceTexture) transmittance_texture,
+    Position camera, IN(Direction) view_ray,
+    OUT(Position) camera_in_atmosphere, OUT(Length) r, OUT(Number) mu,
+    OUT(bool) ray_r_mu_intersects_ground,
+    OUT(DimensionlessSpectrum) transmittance) {
+  Length rmu;
+  if (!GetCameraInAtmosphere(
+          atmosphere, camera, view_ray, camera_in_atmosphere, r, rmu)) {
+    // If the view ray does not intersect the atmosphere, simply return false.
+    mu = Number(1.0);
+    ray_r_mu_intersects_ground = false;
+    transmittance = DimensionlessSpectrum(1.0);
+    return false;
+  }
+  // Compute the r and mu parameters needed for the texture lookups.
+  mu = rmu / r;
+  ray_r_mu_intersects_ground = RayIntersectsGround(atmosphere, r, mu);
   transmittance = ray_r_mu_intersects_ground ? DimensionlessSpectrum(0.0) :
       GetTransmittanceToTopAtmosphereBoundary(
           atmosphere, transmittance_texture, r, mu);
+  return true;
+}
+
+/*
+<p>The second part does the Sun dependent computations, i.e. the scattering
+texture lookups and the phase functions, from the outputs of the previous
+function (without light shafts):
+*/
+
+RadianceSpectrum GetSkyRadianceFromViewRayTerms(
+    IN(AtmosphereParameters) atmosphere,
+    IN(ReducedScatteringTexture) scattering_texture,
+    IN(ReducedScatteringTexture) single_mie_scattering_texture,
+    IN(Position) camera_in_atmosphere, IN(Direction) view_ray,
+    Length r, Number mu, bool ray_r_mu_intersects_ground,
+    IN(Direction) sun_direction) {
+  Number mu_s = dot(camera_in_atmosphere, sun_direction) / r;
+  Number nu = dot(view_ray, sun_direction);
   IrradianceSpectrum single_mie_scattering;
-  IrradianceSpectrum scattering;
+  IrradianceSpectrum scattering = GetCombinedScattering(
+      atmosphere, scattering_texture, single_mie_scattering_texture,
+      r, mu, mu_s, nu, ray_r_mu_intersects_ground,
+      single_mie_scattering);
+  return scattering * RayleighPhaseFunction(nu) + single_mie_scattering *
+      MiePhaseFunction(atmosphere.mie_phase_function_g, nu);
+}
+
+/*
+<p>In the case of light shafts, we also need the $r,\mu,\mu_s$ parameters at
+the point at distance $d$ from the camera along the view ray (note that $\nu$ is
+the same at this point and at the camera):
+*/
+
+void GetRMuMuSAtDistance(
+    IN(AtmosphereParameters) atmosphere,
+    Length r, Number mu, Number mu_s, Number nu, Length d,
+    OUT(Length) r_d, OUT(Number) mu_d, OUT(Number) mu_s_d) {
+  r_d = ClampRadius(atmosphere, sqrt(d * d + 2.0 * r * mu * d + r * r));
+  mu_d = (r * mu + d) / r_d;
+  mu_s_d = (r * mu_s + d * nu) / r_d;
+}
+
+/*
+<p>The sky radiance for a single view ray is then given by the following
+function, which combines the above parts, and handles the case of light shafts:
+*/
+
+RadianceSpectrum GetSkyRadiance(
+    IN(AtmosphereParameters) atmosphere,
+    IN(TransmittanceTexture) transmittance_texture,
+    IN(ReducedScatteringTexture) scattering_texture,
+    IN(ReducedScatteringTexture) single_mie_scattering_texture,
+    Position camera, IN(Direction) view_ray, Length shadow_length,
+    IN(Direction) sun_direction, OUT(DimensionlessSpectrum) transmittance) {
+  Position camera_in_atmosphere;
+  Length r;
+  Number mu;
+  bool ray_r_mu_intersects_ground;
+  if (!GetViewRayTerms(atmosphere, transmittance_texture, camera, view_ray,
+          camera_in_atmosphere, r, mu, ray_r_mu_intersects_ground,
+          transmittance)) {
+    return RadianceSpectrum(0.0 * watt_per_square_meter_per_sr_per_nm);
+  }
   if (shadow_length == 0.0 * m) {
-    scattering = GetCombinedScattering(
-        atmosphere, scattering_texture, single_mie_scattering_texture,
-        r, mu, mu_s, nu, ray_r_mu_intersects_ground,
-        single_mie_scattering);
-  } else {
-    // Case of light shafts (shadow_length is the total length noted l in our
-    // paper): we omit the scattering between the camera and the point at
-    // distance l, by implementing Eq. (18) of the paper (shadow_transmittance
-    // is the T(x,x_s) term, scattering is the S|x_s=x+lv term).
-    Length d = shadow_length;
-    Length r_p =
-        ClampRadius(atmosphere, sqrt(d * d + 2.0 * r * mu * d + r * r));
-    Number mu_p = (r * mu + d) / r_p;
-    Number mu_s_p = (r * mu_s + d * nu) / r_p;
-
-    scattering = GetCombinedScattering(
-        atmosphere, scattering_texture, single_mie_scattering_texture,
-        r_p, mu_p, mu_s_p, nu, ray_r_mu_intersects_ground,
-        single_mie_scattering);
-    DimensionlessSpectrum shadow_transmittance =
-        GetTransmittance(atmosphere, transmittance_texture,
-            r, mu, shadow_length, ray_r_mu_intersects_ground);
-    scattering = scattering * shadow_transmittance;
-    single_mie_scattering = single_mie_scattering * shadow_transmittance;
+    return GetSkyRadianceFromViewRayTerms(atmosphere, scattering_texture,
+        single_mie_scattering_texture, camera_in_atmosphere, view_ray, r, mu,
+        ray_r_mu_intersects_ground, sun_direction);
   }
+  // Case of light shafts (shadow_length is the total length noted l in our
+  // paper): we omit the scattering between the camera and the point at
+  // distance l, by implementing Eq. (18) of the paper (shadow_transmittance
+  // is the T(x,x_s) term, scattering is the S|x_s=x+lv term).
+  Number mu_s = dot(camera_in_atmosphere, sun_direction) / r;
+  Number nu = dot(view_ray, sun_direction);
+  Length r_p;
+  Number mu_p;
+  Number mu_s_p;
+  GetRMuMuSAtDistance(
+      atmosphere, r, mu, mu_s, nu, shadow_length, r_p, mu_p, mu_s_p);
+
+  IrradianceSpectrum single_mie_scattering;
+  IrradianceSpectrum scattering = GetCombinedScattering(
+      atmosphere, scattering_texture, single_mie_scattering_texture,
+      r_p, mu_p, mu_s_p, nu, ray_r_mu_intersects_ground,
+      single_mie_scattering);
+  DimensionlessSpectrum shadow_transmittance =
+      GetTransmittance(atmosphere, transmittance_texture,
+          r, mu, shadow_length, ray_r_mu_intersects_ground);
+  scattering = scattering * shadow_transmittance;
+  single_mie_scattering = single_mie_scattering * shadow_transmittance;
   return scattering * RayleighPhaseFunction(nu) + single_mie_scattering *
       MiePhaseFunction(atmosphere.mie_phase_function_g, nu);
 }
 
+/*
+<h4 id="rendering_sky_view">Sky view</h4>
+
+<p>For a given camera position and sun direction, the sky radiance only depends
+on the view direction. When it is needed for many view rays, e.g. to render the
+sky background of a frame, it can thus be precomputed in a small 2D "sky view"
+texture, once per frame, as proposed in <a href=
+"https://sebh.github.io/publications/egsr2020.pdf">A Scalable and Production
+Ready Sky and Atmosphere Rendering Technique</a>. The sky can then be rendered
+with a single 2D texture lookup per pixel.
+
+<p>Since the sky radiance is symmetric with respect to the vertical plane
+containing the Sun, this texture only needs to cover the view azimuths between
+0 and $\pi$, relatively to the Sun azimuth (we use a linear mapping for this
+azimuth). For the view zenith angle, we use one half of the texture for the
+view rays above the horizon, and the other half for those below it (the
+horizon zenith angle depends on the camera altitude), with a quadratic mapping
+in each half which puts more texels near the horizon, where the radiance varies
+the most. This gives the following mapping from $(r,\mu,\mu_s,\nu)$ to
+texture coordinates in the unit range (i.e. where 0 and 1 correspond to the
+centers of the boundary texels, see
+<a href="#transmittance_precomputation">GetTextureCoordFromUnitRange</a>):
+*/
+
+vec2 GetSkyViewUvFromRMuMuSNu(IN(AtmosphereParameters) atmosphere,
+    Length r, Number mu, Number mu_s, Number nu) {
+  // The angle between the nadir and the horizon.
+  Angle beta = acos(ClampCosine(SafeSqrt(
+      r * r - atmosphere.bottom_radius * atmosphere.bottom_radius) / r));
+  Angle horizon_zenith_angle = pi - beta;
+  Angle view_zenith_angle = acos(ClampCosine(mu));
+  Number v;
+  if (view_zenith_angle < horizon_zenith_angle) {
+    v = 0.5 * (1.0 - sqrt(max(
+        1.0 - view_zenith_angle / horizon_zenith_angle, 0.0)));
+  } else {
+    v = 0.5 * (1.0 + sqrt(max(
+        (view_zenith_angle - horizon_zenith_angle) / beta, 0.0)));
+  }
+  // The cosine of the view azimuth, relatively to the Sun azimuth.
+  Number denominator = sqrt(max((1.0 - mu * mu) * (1.0 - mu_s * mu_s), 0.0));
+  Number cos_phi = denominator > 0.0 ?
+      ClampCosine((nu - mu * mu_s) / denominator) : Number(1.0);
+  return vec2(acos(cos_phi) / pi, v);
+}
+
+/*
+<p>The inverse mapping, used to precompute the sky view texture, is the
+following (given $r$ and $\mu_s$, it gives the $\mu$ and $\nu$ values
+corresponding to some texture coordinates):
+*/
+
+void GetMuNuFromSkyViewUv(IN(AtmosphereParameters) atmosphere,
+    Length r, Number mu_s, IN(vec2) uv, OUT(Number) mu, OUT(Number) nu) {
+  Angle beta = acos(ClampCosine(SafeSqrt(
+      r * r - atmosphere.bottom_radius * atmosphere.bottom_radius) / r));
+  Angle horizon_zenith_angle = pi - beta;
+  Angle view_zenith_angle;
+  if (uv.y < 0.5) {
+    Number coord = 1.0 - 2.0 * uv.y;
+    view_zenith_angle = horizon_zenith_angle * (1.0 - coord * coord);
+  } else {
+    Number coord = 2.0 * uv.y - 1.0;
+    view_zenith_angle = horizon_zenith_angle + beta * coord * coord;
+  }
+  mu = cos(view_zenith_angle);
+  nu = ClampCosine(mu * mu_s + cos(uv.x * pi) *
+      sqrt(max((1.0 - mu * mu) * (1.0 - mu_s * mu_s), 0.0)));
+}
+
+/*
+<p>Using this mapping, the sky view texture can be precomputed with
+<code>GetSkyRadiance</code>, in a reference frame where the camera is on the
+z axis and the Sun direction is in the xz plane:
+*/
+
+RadianceSpectrum ComputeSkyViewTexture(
+    IN(AtmosphereParameters) atmosphere,
+    IN(TransmittanceTexture) transmittance_texture,
+    IN(ReducedScatteringTexture) scattering_texture,
+    IN(ReducedScatteringTexture) single_mie_scattering_texture,
+    Length r, Number mu_s, IN(vec2) uv) {
+  Number mu;
+  Number nu;
+  GetMuNuFromSkyViewUv(atmosphere, r, mu_s, uv, mu, nu);
+  Number sin_theta = sqrt(max(1.0 - mu * mu, 0.0));
+  Number sin_theta_s = sqrt(max(1.0 - mu_s * mu_s, 0.0));
+  Number cos_phi = cos(uv.x * pi);
+  Number sin_phi = sin(uv.x * pi);
+  Direction view_ray =
+      Direction(sin_theta * cos_phi, sin_theta * sin_phi, mu);
+  Direction sun_direction = Direction(sin_theta_s, 0.0, mu_s);
+  DimensionlessSpectrum transmittance;
+  return GetSkyRadiance(atmosphere, transmittance_texture, scattering_texture,
+      single_mie_scattering_texture, Position(0.0 * m, 0.0 * m, r), view_ray,
+      0.0 * m, sun_direction, transmittance);
+}
+
 /*
 <h4 id="rendering_aerial_perspective">Aerial perspective</h4>
 
@@ -1791,27 +2259,20 @@ RadianceSpectrum GetSkyRadianceToPoint(
     IN(ReducedScatteringTexture) single_mie_scattering_texture,
     Position camera, IN(Position) point, Length shadow_length,
     IN(Direction) sun_direction, OUT(DimensionlessSpectrum) transmittance) {
-  // Compute the distance to the top atmosphere boundary along the view ray,
-  // assuming the viewer is in space (or NaN if the view ray does not intersect
-  // the atmosphere).
+  // If the viewer is in space, move it to the top atmosphere boundary (along
+  // the view ray).
   Direction view_ray = normalize(point - camera);
-  Length r = length(camera);
-  Length rmu = dot(camera, view_ray);
-  Length distance_to_top_atmosphere_boundary = -rmu -
-      sqrt(rmu * rmu - r * r + atmosphere.top_radius * atmosphere.top_radius);
-  // If the viewer is in space and the view ray intersects the atmosphere, move
-  // the viewer to the top atmosphere boundary (along the view ray):
-  if (distance_to_top_atmosphere_boundary > 0.0 * m) {
-    camera = camera + view_ray * distance_to_top_atmosphere_boundary;
-    r = atmosphere.top_radius;
-    rmu += distance_to_top_atmosphere_boundary;
-  }
+  Position camera_in_atmosphere;
+  Length r;
+  Length rmu;
+  GetCameraInAtmosphere(
+      atmosphere, camera, view_ray, camera_in_atmosphere, r, rmu);
 
   // Compute the r, mu, mu_s and nu parameters for the first texture lookup.
   Number mu = rmu / r;
-  Number mu_s = dot(camera, sun_direction) / r;
+  Number mu_s = dot(camera_in_atmosphere, sun_direction) / r;
   Number nu = dot(view_ray, sun_direction);
-  Length d = length(point - camera);
+  Length d = length(point - camera_in_atmosphere);
   bool ray_r_mu_intersects_ground = RayIntersectsGround(atmosphere, r, mu);
 
   transmittance = GetTransmittance(atmosphere, transmittance_texture,
@@ -1829,9 +2290,10 @@ RadianceSpectrum GetSkyRadianceToPoint(
   // do by subtracting shadow_length from d (this way scattering_p is equal to
   // the S|x_s=x_0-lv term in Eq. (17) of our paper).
   d = max(d - shadow_length, 0.0 * m);
-  Length r_p = ClampRadius(atmosphere, sqrt(d * d + 2.0 * r * mu * d + r * r));
-  Number mu_p = (r * mu + d) / r_p;
-  Number mu_s_p = (r * mu_s + d * nu) / r_p;
+  Length r_p;
+  Number mu_p;
+  Number mu_s_p;
+  GetRMuMuSAtDistance(atmosphere, r, mu, mu_s, nu, d, r_p, mu_p, mu_s_p);
 
   IrradianceSpectrum single_mie_scattering_p;
   IrradianceSpectrum scattering_p = GetCombinedScattering(
@@ -1851,7 +2313,7 @@ RadianceSpectrum GetSkyRadianceToPoint(
       single_mie_scattering - shadow_transmittance * single_mie_scattering_p;
 #ifdef COMBINED_SCATTERING_TEXTURES
   single_mie_scattering = GetExtrapolatedSingleMieScattering(
-      atmosphere, vec4(scattering, single_mie_scattering.r));
+      atmosphere, vec4(scattering, single_mie_scattering.x));
 #endif
 
   // Hack to avoid rendering artifacts when the sun is below the horizon.
@@ -1872,7 +2334,23 @@ via <code>GetTransmittanceToSun</code>, while the indirect irradiance is given
 by a lookup in the precomputed irradiance texture (this texture only contains
 the irradiance for horizontal surfaces; we use the approximation defined in our
 <a href="https://hal.inria.fr/inria-00288758/en">paper</a> for the other cases).
-The function below returns the direct and indirect irradiances separately:
+The geometric terms needed for this, which do not depend on the wavelength, are
+computed with the following function:
+*/
+
+void GetSunAndSkyIrradianceTerms(
+    IN(Position) point, IN(Direction) normal, IN(Direction) sun_direction,
+    OUT(Length) r, OUT(Number) mu_s, OUT(Number) sun_factor,
+    OUT(Number) sky_factor) {
+  r = length(point);
+  mu_s = dot(point, sun_direction) / r;
+  sun_factor = max(dot(normal, sun_direction), 0.0);
+  sky_factor = (1.0 + dot(normal, point) / r) * 0.5;
+}
+
+/*
+<p>The function below then returns the direct and indirect irradiances
+separately:
 */
 
 IrradianceSpectrum GetSunAndSkyIrradiance(
@@ -1881,16 +2359,19 @@ IrradianceSpectrum GetSunAndSkyIrradiance(
     IN(IrradianceTexture) irradiance_texture,
     IN(Position) point, IN(Direction) normal, IN(Direction) sun_direction,
     OUT(IrradianceSpectrum) sky_irradiance) {
-  Length r = length(point);
-  Number mu_s = dot(point, sun_direction) / r;
+  Length r;
+  Number mu_s;
+  Number sun_factor;
+  Number sky_factor;
+  GetSunAndSkyIrradianceTerms(
+      point, normal, sun_direction, r, mu_s, sun_factor, sky_factor);
 
   // Indirect irradiance (approximated if the surface is not horizontal).
-  sky_irradiance = GetIrradiance(atmosphere, irradiance_texture, r, mu_s) *
-      (1.0 + dot(normal, point) / r) * 0.5;
+  sky_irradiance =
+      GetIrradiance(atmosphere, irradiance_texture, r, mu_s) * sky_factor;
 
   // Direct irradiance.
   return atmosphere.solar_irradiance *
       GetTransmittanceToSun(
-          atmosphere, transmittance_texture, r, mu_s) *
-      max(dot(normal, sun_direction), 0.0);
+          atmosphere, transmittance_texture, r, mu_s) * sun_factor;
 }
@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/grid_bundle.cc</h2>
+
+<p>This file implements the <a href="grid_bundle.h.html">grid bundle</a> file
+format. A grid bundle is a binary file, in the native byte order, containing a
+header followed by the textures of each grid point. The header contains:
+<ul>
+<li>the <code>kMagicNumber</code> and <code>kVersion</code> values below,</li>
+<li>the number of grid axes and, for each axis, its number of values followed
+by these values (as doubles),</li>
+<li>the 8 <code>TextureSizes</code> fields, and the
+<code>combine_scattering_textures</code> option.</li>
+</ul>
+The textures of each grid point follow, in increasing index order, each as RGBA
+floats: the transmittance, scattering, single Mie scattering (without the
+<code>combine_scattering_textures</code> option) and irradiance textures. All
+the grid points thus use the same number of bytes, which gives the position of
+the textures of any grid point in the file:
+*/
+
+#include "atmosphere/grid_bundle.h"
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+
+namespace atmosphere {
+
+namespace {
+
+constexpr uint32_t kMagicNumber = 0x41474244;
+constexpr uint32_t kVersion = 1;
+
+template<typename T>
+void WriteValue(std::ofstream& file, T value) {
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+T ReadValue(std::ifstream& file) {
+  T value;
+  file.read(reinterpret_cast<char*>(&value), sizeof(T));
+  if (!file) {
+    throw std::runtime_error("Invalid grid bundle");
+  }
+  return value;
+}
+
+// The number of floats of each texture, in the order of the file.
+std::vector<size_t> GetTextureSizes(const TextureSizes& texture_sizes,
+    bool combine_scattering_textures) {
+  const size_t scattering_size = 4 * static_cast<size_t>(
+      texture_sizes.scattering_width()) * texture_sizes.scattering_height() *
+      texture_sizes.scattering_depth();
+  return {
+    4 * static_cast<size_t>(texture_sizes.transmittance_width) *
+        texture_sizes.transmittance_height,
+    scattering_size,
+    combine_scattering_textures ? 0 : scattering_size,
+    4 * static_cast<size_t>(texture_sizes.irradiance_width) *
+        texture_sizes.irradiance_height
+  };
+}
+
+std::vector<float>* GetTexture(int i, PrecomputedTextures* textures) {
+  switch (i) {
+    case 0: return &textures->transmittance;
+    case 1: return &textures->scattering;
+    case 2: return &textures->single_mie_scattering;
+    default: return &textures->irradiance;
+  }
+}
+
+}  // anonymous namespace
+
+/*
+<p>Writing a grid bundle is straightforward. Note that the textures of each
+grid point are written as soon as they are computed, so that the textures of
+only one model are in memory at any time:
+*/
+
+void GridBundle::Write(const std::string& filename, const ParameterGrid& grid,
+    const TextureSizes& texture_sizes, bool combine_scattering_textures,
+    const std::function<void(const std::vector<double>& point,
+        PrecomputedTextures* textures)>& precompute) {
+  std::ofstream file(filename, std::ofstream::binary);
+  if (!file) {
+    throw std::runtime_error("Can't write grid bundle " + filename);
+  }
+  WriteValue<uint32_t>(file, kMagicNumber);
+  WriteValue<uint32_t>(file, kVersion);
+  WriteValue<uint32_t>(file, grid.axes.size());
+  for (const std::vector<double>& axis : grid.axes) {
+    WriteValue<uint32_t>(file, axis.size());
+    for (double value : axis) {
+      WriteValue<double>(file, value);
+    }
+  }
+  for (int size : {texture_sizes.transmittance_width,
+      texture_sizes.transmittance_height, texture_sizes.scattering_r_size,
+      texture_sizes.scattering_mu_size, texture_sizes.scattering_mu_s_size,
+      texture_sizes.scattering_nu_size, texture_sizes.irradiance_width,
+      texture_sizes.irradiance_height}) {
+    WriteValue<int32_t>(file, size);
+  }
+  WriteValue<uint32_t>(file, combine_scattering_textures ? 1 : 0);
+
+  const std::vector<size_t> sizes =
+      GetTextureSizes(texture_sizes, combine_scattering_textures);
+  for (unsigned int index = 0; index < grid.num_points(); ++index) {
+    PrecomputedTextures textures;
+    precompute(grid.GetPoint(index), &textures);
+    for (int i = 0; i < 4; ++i) {
+      const std::vector<float>& texture = *GetTexture(i, &textures);
+      if (texture.size() != sizes[i]) {
+        throw std::runtime_error("Unexpected precomputed texture size");
+      }
+      file.write(reinterpret_cast<const char*>(texture.data()),
+          texture.size() * sizeof(float));
+    }
+    if (!file) {
+      throw std::runtime_error("Can't write grid bundle " + filename);
+    }
+  }
+}
+
+/*
+<p>The constructor only reads the header, and checks that the file size is
+consistent with it:
+*/
+
+GridBundle::GridBundle(const std::string& filename)
+    : filename_(filename), grid_(std::vector<std::vector<double>>()) {
+  std::ifstream file(filename, std::ifstream::binary);
+  if (!file) {
+    throw std::runtime_error("Can't read grid bundle " + filename);
+  }
+  if (ReadValue<uint32_t>(file) != kMagicNumber ||
+      ReadValue<uint32_t>(file) != kVersion) {
+    throw std::runtime_error("Invalid grid bundle " + filename);
+  }
+  const uint32_t num_axes = ReadValue<uint32_t>(file);
+  for (uint32_t i = 0; i < num_axes; ++i) {
+    std::vector<double> axis(ReadValue<uint32_t>(file));
+    for (double& value : axis) {
+      value = ReadValue<double>(file);
+    }
+    grid_.axes.push_back(axis);
+  }
+  texture_sizes_.transmittance_width = ReadValue<int32_t>(file);
+  texture_sizes_.transmittance_height = ReadValue<int32_t>(file);
+  texture_sizes_.scattering_r_size = ReadValue<int32_t>(file);
+  texture_sizes_.scattering_mu_size = ReadValue<int32_t>(file);
+  texture_sizes_.scattering_mu_s_size = ReadValue<int32_t>(file);
+  texture_sizes_.scattering_nu_size = ReadValue<int32_t>(file);
+  texture_sizes_.irradiance_width = ReadValue<int32_t>(file);
+  texture_sizes_.irradiance_height = ReadValue<int32_t>(file);
+  combine_scattering_textures_ = ReadValue<uint32_t>(file) != 0;
+
+  header_size_ = file.tellg();
+  point_size_ = 0;
+  for (size_t size :
+      GetTextureSizes(texture_sizes_, combine_scattering_textures_)) {
+    point_size_ += size * sizeof(float);
+  }
+  file.seekg(0, std::ifstream::end);
+  if (file.tellg() != header_size_ + grid_.num_points() * point_size_) {
+    throw std::runtime_error("Invalid grid bundle size " + filename);
+  }
+}
+
+/*
+<p>Finally, the <code>Blend</code> method reads the textures of the grid points
+around the given parameter values, one point at a time, and accumulates them
+with their interpolation weights:
+*/
+
+void GridBundle::Blend(const std::vector<double>& values,
+    PrecomputedTextures* textures) const {
+  std::vector<unsigned int> indices;
+  std::vector<double> weights;
+  grid_.GetBlendWeights(values, &indices, &weights);
+
+  const std::vector<size_t> sizes =
+      GetTextureSizes(texture_sizes_, combine_scattering_textures_);
+  for (int i = 0; i < 4; ++i) {
+    GetTexture(i, textures)->assign(sizes[i], 0.0f);
+  }
+  std::ifstream file(filename_, std::ifstream::binary);
+  std::vector<float> buffer;
+  for (unsigned int k = 0; k < indices.size(); ++k) {
+    file.seekg(header_size_ + indices[k] * point_size_);
+    const float weight = weights[k];
+    for (int i = 0; i < 4; ++i) {
+      std::vector<float>& texture = *GetTexture(i, textures);
+      buffer.resize(sizes[i]);
+      file.read(reinterpret_cast<char*>(buffer.data()),
+          buffer.size() * sizeof(float));
+      for (size_t j = 0; j < buffer.size(); ++j) {
+        texture[j] += weight * buffer[j];
+      }
+    }
+    if (!file) {
+      throw std::runtime_error("Can't read grid bundle " + filename_);
+    }
+  }
+}
+
+}  // namespace atmosphere
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/grid_bundle.h</h2>
+
+<p>This file defines a file format to store the textures of models precomputed
+at each point of a <a href="parameters.h.html">ParameterGrid</a>, and the
+functions to write and read such a "grid bundle". The textures for any
+parameter values in the grid range can then be computed from the textures of
+the (at most) 2^n grid points around these values, which are the only ones read
+from the file, and set in a <a href="model.h.html">GPU model</a> or in a
+<a href="cpu/model.h.html">RGB CPU model</a> with their
+<code>SetTextures</code> method. This does not depend on OpenGL.
+*/
+
+#ifndef ATMOSPHERE_GRID_BUNDLE_H_
+#define ATMOSPHERE_GRID_BUNDLE_H_
+
+#include <functional>
+#include <ios>
+#include <string>
+#include <vector>
+
+#include "atmosphere/parameters.h"
+
+namespace atmosphere {
+
+class GridBundle {
+ public:
+  // Writes a grid bundle in 'filename', with the textures computed by
+  // 'precompute' for the parameter values of each point of 'grid' (in
+  // increasing index order). These textures must have the given sizes, and a
+  // single Mie scattering texture unless 'combine_scattering_textures' is
+  // true. They are written as soon as they are computed, so that only one
+  // model needs to be in memory at a time. Throws a std::runtime_error if the
+  // file can't be written, or if some textures don't have the expected size.
+  static void Write(const std::string& filename, const ParameterGrid& grid,
+      const TextureSizes& texture_sizes, bool combine_scattering_textures,
+      const std::function<void(const std::vector<double>& point,
+          PrecomputedTextures* textures)>& precompute);
+
+  // Reads the header of the grid bundle in 'filename' (but not its textures).
+  // Throws a std::runtime_error if the file can't be read or is not a valid
+  // grid bundle.
+  explicit GridBundle(const std::string& filename);
+
+  const ParameterGrid& grid() const { return grid_; }
+  const TextureSizes& texture_sizes() const { return texture_sizes_; }
+  bool combine_scattering_textures() const {
+    return combine_scattering_textures_;
+  }
+
+  // Computes the textures for the given parameter values, with a multilinear
+  // interpolation of the textures of the grid points around them (see
+  // ParameterGrid::GetBlendWeights), read from the file.
+  void Blend(const std::vector<double>& values,
+      PrecomputedTextures* textures) const;
+
+ private:
+  std::string filename_;
+  ParameterGrid grid_;
+  TextureSizes texture_sizes_;
+  bool combine_scattering_textures_;
+  // The size in bytes of the file header, and of the textures of each point.
+  std::streamoff header_size_;
+  std::streamoff point_size_;
+};
+
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_GRID_BUNDLE_H_
@@ -45,12 +45,19 @@ of the following C++ code.
 
 #include <glad/glad.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <deque>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <stdexcept>
+#include <utility>
 
 #include "atmosphere/constants.h"
+#include "atmosphere/spectrum.h"
 
 /*
 <p>The rest of this file is organized in 3 parts:
@@ -58,7 +65,10 @@ of the following C++ code.
 <li>the <a href="#shaders">first part</a> defines the shaders used to precompute
 the atmospheric textures,</li>
 <li>the <a href="#utilities">second part</a> provides utility classes and
-functions used to compile shaders, create textures, draw quads, etc,</li>
+functions used to compile shaders, create textures, draw quads, etc (the
+utility functions for spectra are provided separately, in
+<a href="spectrum.h.html">spectrum.h</a>, because they do not depend on
+OpenGL),</li>
 <li>the <a href="#implementation">third part</a> provides the actual
 implementation of the <code>Model</code> class, using the above tools.</li>
 </ul>
@@ -122,11 +132,18 @@ illuminance mode to convert the radiance values computed by the
 #include "atmosphere/definitions.glsl.inc"
 #include "atmosphere/functions.glsl.inc"
 
+const char kComputeDensityShader[] = R"(
+    layout(location = 0) out vec3 density;
+    void main() {
+      density = ComputeDensityTexture(ATMOSPHERE, gl_FragCoord.xy);
+    })";
+
 const char kComputeTransmittanceShader[] = R"(
     layout(location = 0) out vec3 transmittance;
+    uniform sampler2D density_texture;
     void main() {
       transmittance = ComputeTransmittanceToTopAtmosphereBoundaryTexture(
-          ATMOSPHERE, gl_FragCoord.xy);
+          ATMOSPHERE, density_texture, gl_FragCoord.xy);
     })";
 
 const char kComputeDirectIrradianceShader[] = R"(
@@ -146,11 +163,12 @@ const char kComputeSingleScatteringShader[] = R"(
     layout(location = 3) out vec3 single_mie_scattering;
     uniform mat3 luminance_from_radiance;
     uniform sampler2D transmittance_texture;
+    uniform sampler2D density_texture;
     uniform int layer;
     void main() {
       ComputeSingleScatteringTexture(
-          ATMOSPHERE, transmittance_texture, vec3(gl_FragCoord.xy, layer + 0.5),
-          delta_rayleigh, delta_mie);
+          ATMOSPHERE, transmittance_texture, density_texture,
+          vec3(gl_FragCoord.xy, layer + 0.5), delta_rayleigh, delta_mie);
       scattering = vec4(luminance_from_radiance * delta_rayleigh.rgb,
           (luminance_from_radiance * delta_mie).r);
       single_mie_scattering = luminance_from_radiance * delta_mie;
@@ -159,6 +177,7 @@ const char kComputeSingleScatteringShader[] = R"(
 const char kComputeScatteringDensityShader[] = R"(
     layout(location = 0) out vec3 scattering_density;
     uniform sampler2D transmittance_texture;
+    uniform sampler2D density_texture;
     uniform sampler3D single_rayleigh_scattering_texture;
     uniform sampler3D single_mie_scattering_texture;
     uniform sampler3D multiple_scattering_texture;
@@ -167,10 +186,10 @@ const char kComputeScatteringDensityShader[] = R"(
     uniform int layer;
     void main() {
       scattering_density = ComputeScatteringDensityTexture(
-          ATMOSPHERE, transmittance_texture, single_rayleigh_scattering_texture,
-          single_mie_scattering_texture, multiple_scattering_texture,
-          irradiance_texture, vec3(gl_FragCoord.xy, layer + 0.5),
-          scattering_order);
+          ATMOSPHERE, transmittance_texture, density_texture,
+          single_rayleigh_scattering_texture, single_mie_scattering_texture,
+          multiple_scattering_texture, irradiance_texture,
+          vec3(gl_FragCoord.xy, layer + 0.5), scattering_order);
     })";
 
 const char kComputeIndirectIrradianceShader[] = R"(
@@ -207,15 +226,322 @@ const char kComputeMultipleScatteringShader[] = R"(
           0.0);
     })";
 
+/*
+<p>For the approximate multiple scattering mode (see
+<code>InitApproximate</code>), we also need a shader to compute the multiple
+scattering fluence texture, and a shader to compute the approximate scattering
+density from it (the multiple scattering is then computed from this density
+with <code>kComputeMultipleScatteringShader</code>):
+*/
+
+const char kComputeMultipleScatteringFluenceShader[] = R"(
+    layout(location = 0) out vec3 multiple_scattering_fluence;
+    uniform sampler2D transmittance_texture;
+    uniform sampler2D density_texture;
+    void main() {
+      multiple_scattering_fluence = ComputeMultipleScatteringFluenceTexture(
+          ATMOSPHERE, transmittance_texture, density_texture, gl_FragCoord.xy);
+    })";
+
+const char kComputeApproximateScatteringDensityShader[] = R"(
+    layout(location = 0) out vec3 scattering_density;
+    uniform sampler2D density_texture;
+    uniform sampler2D multiple_scattering_fluence_texture;
+    uniform int layer;
+    void main() {
+      scattering_density = ComputeApproximateScatteringDensityTexture(
+          ATMOSPHERE, density_texture, multiple_scattering_fluence_texture,
+          vec3(gl_FragCoord.xy, layer + 0.5));
+    })";
+
+/*
+<p>For the warm-started precomputation mode (see <code>Update</code>), we also
+need a shader to compute the difference between the multiple scattering of a
+previous model and the next scattering order of this model (from the scattering
+texture and the single Rayleigh scattering of the previous model, and from its
+next order), a shader to compute a scattering texture from the single scattering
+and from the multiple scattering plus this difference (as in
+<code>kComputeMultipleScatteringShader</code>, the multiple scattering is
+divided by the Rayleigh phase function), and a shader to compute weighted sums
+of irradiance textures. All these shaders read their inputs at the same texel
+as the output one:
+*/
+
+const char kComputeScatteringCorrectionShader[] = R"(
+    layout(location = 0) out vec3 scattering_correction;
+    uniform sampler3D previous_scattering_texture;
+    uniform sampler3D previous_single_rayleigh_scattering_texture;
+    uniform sampler3D previous_next_multiple_scattering_texture;
+    uniform int layer;
+    void main() {
+      float r;
+      float mu;
+      float mu_s;
+      float nu;
+      bool ray_r_mu_intersects_ground;
+      GetRMuMuSNuFromScatteringTextureFragCoord(ATMOSPHERE,
+          vec3(gl_FragCoord.xy, layer + 0.5), r, mu, mu_s, nu,
+          ray_r_mu_intersects_ground);
+      ivec3 texel = ivec3(gl_FragCoord.xy, layer);
+      scattering_correction =
+          texelFetch(previous_scattering_texture, texel, 0).rgb -
+          texelFetch(
+              previous_single_rayleigh_scattering_texture, texel, 0).rgb -
+          texelFetch(previous_next_multiple_scattering_texture, texel, 0).rgb /
+              RayleighPhaseFunction(nu);
+    })";
+
+const char kComputeCorrectedScatteringShader[] = R"(
+    layout(location = 0) out vec4 scattering;
+    uniform sampler3D single_rayleigh_scattering_texture;
+    uniform sampler3D single_mie_scattering_texture;
+    uniform sampler3D multiple_scattering_texture;
+    uniform sampler3D scattering_correction_texture;
+    uniform int layer;
+    void main() {
+      float r;
+      float mu;
+      float mu_s;
+      float nu;
+      bool ray_r_mu_intersects_ground;
+      GetRMuMuSNuFromScatteringTextureFragCoord(ATMOSPHERE,
+          vec3(gl_FragCoord.xy, layer + 0.5), r, mu, mu_s, nu,
+          ray_r_mu_intersects_ground);
+      ivec3 texel = ivec3(gl_FragCoord.xy, layer);
+      vec3 rayleigh =
+          texelFetch(single_rayleigh_scattering_texture, texel, 0).rgb;
+      vec3 mie = texelFetch(single_mie_scattering_texture, texel, 0).rgb;
+      vec3 multiple = texelFetch(multiple_scattering_texture, texel, 0).rgb;
+      vec3 correction =
+          texelFetch(scattering_correction_texture, texel, 0).rgb;
+      scattering = vec4(
+          rayleigh + multiple / RayleighPhaseFunction(nu) + correction, mie.r);
+    })";
+
+const char kComputeIrradianceSumShader[] = R"(
+    layout(location = 0) out vec3 irradiance;
+    uniform sampler2D irradiance_texture_0;
+    uniform sampler2D irradiance_texture_1;
+    uniform vec2 weights;
+    void main() {
+      ivec2 texel = ivec2(gl_FragCoord.xy);
+      irradiance =
+          weights.x * texelFetch(irradiance_texture_0, texel, 0).rgb +
+          weights.y * texelFetch(irradiance_texture_1, texel, 0).rgb;
+    })";
+
+/*
+<p>For the progressive precomputation mode (see <code>InitProgressive</code>),
+we also need shaders to resample textures precomputed at a coarse resolution
+into the full resolution textures. For this we convert the texture coordinates
+of each target texel to the unit range, and then back to texture coordinates in
+the source texture (see
+<a href="functions.glsl.html#transmittance_precomputation">
+<code>GetTextureCoordFromUnitRange</code></a>). For 4D scattering textures, this
+is done separately for each 4D coordinate, with the same mappings as in
+<a href="functions.glsl.html#single_scattering_precomputation">
+<code>GetRMuMuSNuFromScatteringTextureFragCoord</code></a>, and the 4D lookup
+in the source texture is done as in
+<a href="functions.glsl.html#single_scattering_lookup">
+<code>GetScattering</code></a>:
+*/
+
+const char kResampleTexture2dShader[] = R"(
+    layout(location = 0) out vec4 color;
+    uniform sampler2D source_texture;
+    uniform int source_width;
+    uniform int source_height;
+    uniform int target_width;
+    uniform int target_height;
+    float Resample(float u, int target_size, int source_size) {
+      return GetTextureCoordFromUnitRange(
+          GetUnitRangeFromTextureCoord(u, target_size), source_size);
+    }
+    void main() {
+      vec2 uv = vec2(
+          Resample(gl_FragCoord.x / float(target_width), target_width,
+              source_width),
+          Resample(gl_FragCoord.y / float(target_height), target_height,
+              source_height));
+      color = texture(source_texture, uv);
+    })";
+
+const char kResampleScatteringShader[] = R"(
+    layout(location = 0) out vec4 color;
+    uniform sampler3D source_texture;
+    uniform int source_nu_size;
+    uniform int source_mu_s_size;
+    uniform int source_mu_size;
+    uniform int source_r_size;
+    uniform int layer;
+    float Resample(float u, int target_size, int source_size) {
+      return GetTextureCoordFromUnitRange(
+          GetUnitRangeFromTextureCoord(u, target_size), source_size);
+    }
+    void main() {
+      float frag_coord_nu =
+          floor(gl_FragCoord.x / float(SCATTERING_TEXTURE_MU_S_SIZE));
+      float frag_coord_mu_s =
+          mod(gl_FragCoord.x, float(SCATTERING_TEXTURE_MU_S_SIZE));
+      float u_nu = frag_coord_nu / float(SCATTERING_TEXTURE_NU_SIZE - 1);
+      float u_mu_s = Resample(
+          frag_coord_mu_s / float(SCATTERING_TEXTURE_MU_S_SIZE),
+          SCATTERING_TEXTURE_MU_S_SIZE, source_mu_s_size);
+      // The mu coordinate is split in two halves, for the rays which intersect
+      // the ground (u_mu < 0.5) and for those which don't.
+      float u_mu = gl_FragCoord.y / float(SCATTERING_TEXTURE_MU_SIZE);
+      float mu_side = u_mu < 0.5 ? -1.0 : 1.0;
+      u_mu = 0.5 + 0.5 * mu_side * Resample(abs(2.0 * u_mu - 1.0),
+          SCATTERING_TEXTURE_MU_SIZE / 2, source_mu_size / 2);
+      float u_r = Resample((layer + 0.5) / float(SCATTERING_TEXTURE_R_SIZE),
+          SCATTERING_TEXTURE_R_SIZE, source_r_size);
+      float tex_coord_x = u_nu * float(source_nu_size - 1);
+      float tex_x = floor(tex_coord_x);
+      float lerp = tex_coord_x - tex_x;
+      vec3 uvw0 = vec3((tex_x + u_mu_s) / float(source_nu_size), u_mu, u_r);
+      vec3 uvw1 =
+          vec3((tex_x + 1.0 + u_mu_s) / float(source_nu_size), u_mu, u_r);
+      color = texture(source_texture, uvw0) * (1.0 - lerp) +
+          texture(source_texture, uvw1) * lerp;
+    })";
+
+/*
+<p>With the <code>runtime_solar_irradiance</code> option, in precomputed
+illuminance mode, <code>Init</code> keeps the textures precomputed for each
+group of 3 wavelengths, for a unit solar irradiance. The final textures are
+then computed by accumulating each group of textures, multiplied with a matrix
+combining the solar irradiance and the CIE color matching functions at these
+wavelengths (see <code>Init</code>), with the following shaders (which do not
+depend on the atmosphere parameters):
+*/
+
+const char kCombineScatteringShader[] = R"(
+    #version 330
+    layout(location = 0) out vec4 scattering;
+    layout(location = 1) out vec3 single_mie_scattering;
+    uniform mat3 luminance_from_radiance;
+    uniform sampler3D group_scattering_texture;
+    uniform sampler3D group_single_mie_scattering_texture;
+    uniform int layer;
+    void main() {
+      ivec3 texel = ivec3(gl_FragCoord.xy, layer);
+      single_mie_scattering = luminance_from_radiance *
+          texelFetch(group_single_mie_scattering_texture, texel, 0).rgb;
+      scattering = vec4(luminance_from_radiance *
+          texelFetch(group_scattering_texture, texel, 0).rgb,
+          single_mie_scattering.r);
+    })";
+
+const char kCombineIrradianceShader[] = R"(
+    #version 330
+    layout(location = 0) out vec3 irradiance;
+    uniform mat3 luminance_from_radiance;
+    uniform sampler2D group_irradiance_texture;
+    void main() {
+      irradiance = luminance_from_radiance *
+          texelFetch(group_irradiance_texture, ivec2(gl_FragCoord.xy), 0).rgb;
+    })";
+
+/*
+<p>The <code>Blend</code> method computes the weighted sum of the precomputed
+textures of several models, by accumulating them in the textures of this model
+with the following shaders (which do not depend on the atmosphere parameters
+either):
+*/
+
+const char kBlendTexture2dShader[] = R"(
+    #version 330
+    layout(location = 0) out vec4 color;
+    uniform float weight;
+    uniform sampler2D source_texture;
+    void main() {
+      color = weight * texelFetch(source_texture, ivec2(gl_FragCoord.xy), 0);
+    })";
+
+const char kBlendScatteringShader[] = R"(
+    #version 330
+    layout(location = 0) out vec4 scattering;
+    layout(location = 1) out vec3 single_mie_scattering;
+    uniform float weight;
+    uniform sampler3D source_scattering_texture;
+    uniform sampler3D source_single_mie_scattering_texture;
+    uniform int layer;
+    void main() {
+      ivec3 texel = ivec3(gl_FragCoord.xy, layer);
+      scattering = weight * texelFetch(source_scattering_texture, texel, 0);
+      single_mie_scattering = weight *
+          texelFetch(source_single_mie_scattering_texture, texel, 0).rgb;
+    })";
+
+/*
+<p>The sky view texture computed by <code>BakeSkyView</code> is computed with
+the following shader, using the
+<a href="functions.glsl.html#rendering_sky_view">sky view mapping</a> defined
+in functions.glsl:
+*/
+
+const char kComputeSkyViewShader[] = R"(
+    layout(location = 0) out vec3 sky_view;
+    uniform sampler2D transmittance_texture;
+    uniform sampler3D scattering_texture;
+    uniform sampler3D single_mie_scattering_texture;
+    uniform vec3 camera;
+    uniform vec3 sun_direction;
+    uniform vec2 size;
+    void main() {
+      Length r = max(length(camera), ATMOSPHERE.bottom_radius);
+      Number mu_s = dot(camera, sun_direction) / length(camera);
+      vec2 uv = vec2(
+          GetUnitRangeFromTextureCoord(gl_FragCoord.x / size.x, int(size.x)),
+          GetUnitRangeFromTextureCoord(gl_FragCoord.y / size.y, int(size.y)));
+      sky_view = ComputeSkyViewTexture(ATMOSPHERE, transmittance_texture,
+          scattering_texture, single_mie_scattering_texture, r, mu_s, uv);
+    })";
+
+/*
+<p>The aerial perspective volume computed by <code>BakeAerialPerspective</code>
+is computed with the following shader, one depth slice at a time. Slice k
+contains the sky radiance and transmittance between the camera and the point at
+distance <code>max_distance * ((k + 0.5) / depth)^2</code> along each view ray
+(this quadratic distribution gives more precision near the camera, where the
+aerial perspective varies most):
+*/
+
+const char kComputeAerialPerspectiveShader[] = R"(
+    layout(location = 0) out vec3 scattering;
+    layout(location = 1) out vec3 transmittance;
+    uniform sampler2D transmittance_texture;
+    uniform sampler3D scattering_texture;
+    uniform sampler3D single_mie_scattering_texture;
+    uniform vec3 camera;
+    uniform vec3 sun_direction;
+    uniform mat3 model_from_clip;
+    uniform float max_distance;
+    uniform vec3 size;
+    uniform int layer;
+    void main() {
+      vec2 clip_xy = 2.0 * gl_FragCoord.xy / size.xy - 1.0;
+      vec3 view_ray = normalize(model_from_clip * vec3(clip_xy, 1.0));
+      float w = (float(layer) + 0.5) / size.z;
+      vec3 point = camera + view_ray * (max_distance * w * w);
+      scattering = GetSkyRadianceToPoint(ATMOSPHERE, transmittance_texture,
+          scattering_texture, single_mie_scattering_texture,
+          camera, point, 0.0, sun_direction, transmittance);
+    })";
+
 /*
 <p>We finally need a shader implementing the GLSL functions exposed in our API,
 which can be done by calling the corresponding functions in
 <a href="functions.glsl.html#rendering">functions.glsl</a>, with the precomputed
 texture arguments taken from uniform variables (note also the
-*<code>_RADIANCE_TO_LUMINANCE</code> conversion constants in the last functions:
-they are computed in the <a href="#utilities">second part</a> below, and their
-definitions are concatenated to this GLSL code to get a fully functional
-shader).
+*<code>_RADIANCE_TO_LUMINANCE</code> conversion constants in the luminance
+functions, and the *<code>_RADIANCE_SCALE</code> constants in all the
+functions: they are computed in the <a href="#utilities">second part</a> below,
+and their definitions are concatenated to this GLSL code to get a fully
+functional shader. The scale constants are equal to 1, except with the
+<code>runtime_solar_irradiance</code> option, where the textures are
+precomputed for a unit solar irradiance, and where all these constants are
+replaced with uniforms, set from the actual solar irradiance).
 */
 
 const char kAtmosphereShader[] = R"(
@@ -226,33 +552,39 @@ const char kAtmosphereShader[] = R"(
     #ifdef RADIANCE_API_ENABLED
     RadianceSpectrum GetSolarRadiance() {
       return ATMOSPHERE.solar_irradiance /
-          (PI * ATMOSPHERE.sun_angular_radius * ATMOSPHERE.sun_angular_radius);
+          (PI * ATMOSPHERE.sun_angular_radius * ATMOSPHERE.sun_angular_radius) *
+          SUN_RADIANCE_SCALE;
     }
     RadianceSpectrum GetSkyRadiance(
         Position camera, Direction view_ray, Length shadow_length,
         Direction sun_direction, out DimensionlessSpectrum transmittance) {
       return GetSkyRadiance(ATMOSPHERE, transmittance_texture,
           scattering_texture, single_mie_scattering_texture,
-          camera, view_ray, shadow_length, sun_direction, transmittance);
+          camera, view_ray, shadow_length, sun_direction, transmittance) *
+          SKY_RADIANCE_SCALE;
     }
     RadianceSpectrum GetSkyRadianceToPoint(
         Position camera, Position point, Length shadow_length,
         Direction sun_direction, out DimensionlessSpectrum transmittance) {
       return GetSkyRadianceToPoint(ATMOSPHERE, transmittance_texture,
           scattering_texture, single_mie_scattering_texture,
-          camera, point, shadow_length, sun_direction, transmittance);
+          camera, point, shadow_length, sun_direction, transmittance) *
+          SKY_RADIANCE_SCALE;
     }
     IrradianceSpectrum GetSunAndSkyIrradiance(
        Position p, Direction normal, Direction sun_direction,
        out IrradianceSpectrum sky_irradiance) {
-      return GetSunAndSkyIrradiance(ATMOSPHERE, transmittance_texture,
-          irradiance_texture, p, normal, sun_direction, sky_irradiance);
+      IrradianceSpectrum sun_irradiance = GetSunAndSkyIrradiance(
+          ATMOSPHERE, transmittance_texture, irradiance_texture, p, normal,
+          sun_direction, sky_irradiance);
+      sky_irradiance *= SKY_RADIANCE_SCALE;
+      return sun_irradiance * SUN_RADIANCE_SCALE;
     }
     #endif
     Luminance3 GetSolarLuminance() {
       return ATMOSPHERE.solar_irradiance /
           (PI * ATMOSPHERE.sun_angular_radius * ATMOSPHERE.sun_angular_radius) *
-          SUN_SPECTRAL_RADIANCE_TO_LUMINANCE;
+          SUN_RADIANCE_SCALE * SUN_SPECTRAL_RADIANCE_TO_LUMINANCE;
     }
     Luminance3 GetSkyLuminance(
         Position camera, Direction view_ray, Length shadow_length,
@@ -260,7 +592,7 @@ const char kAtmosphereShader[] = R"(
       return GetSkyRadiance(ATMOSPHERE, transmittance_texture,
           scattering_texture, single_mie_scattering_texture,
           camera, view_ray, shadow_length, sun_direction, transmittance) *
-          SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
+          SKY_RADIANCE_SCALE * SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
     }
     Luminance3 GetSkyLuminanceToPoint(
         Position camera, Position point, Length shadow_length,
@@ -268,7 +600,7 @@ const char kAtmosphereShader[] = R"(
       return GetSkyRadianceToPoint(ATMOSPHERE, transmittance_texture,
           scattering_texture, single_mie_scattering_texture,
           camera, point, shadow_length, sun_direction, transmittance) *
-          SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
+          SKY_RADIANCE_SCALE * SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
     }
     Illuminance3 GetSunAndSkyIlluminance(
        Position p, Direction normal, Direction sun_direction,
@@ -276,8 +608,61 @@ const char kAtmosphereShader[] = R"(
       IrradianceSpectrum sun_irradiance = GetSunAndSkyIrradiance(
           ATMOSPHERE, transmittance_texture, irradiance_texture, p, normal,
           sun_direction, sky_irradiance);
-      sky_irradiance *= SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
-      return sun_irradiance * SUN_SPECTRAL_RADIANCE_TO_LUMINANCE;
+      sky_irradiance *= SKY_RADIANCE_SCALE * SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
+      return sun_irradiance * SUN_RADIANCE_SCALE *
+          SUN_SPECTRAL_RADIANCE_TO_LUMINANCE;
+    }
+    uniform sampler3D aerial_perspective_scattering_texture;
+    uniform sampler3D aerial_perspective_transmittance_texture;
+    uniform float aerial_perspective_max_distance;
+    RadianceSpectrum GetAerialPerspective(vec2 screen_uv, Length distance,
+        out DimensionlessSpectrum transmittance) {
+      float depth =
+          float(textureSize(aerial_perspective_scattering_texture, 0).z);
+      float w2 = distance / aerial_perspective_max_distance;
+      vec3 uvw = vec3(screen_uv, sqrt(w2));
+      // Before the first slice, interpolate linearly with the distance between
+      // the values at the camera (no scattering, full transmittance) and the
+      // values in the first slice.
+      float fade = min(w2 * 4.0 * depth * depth, 1.0);
+      transmittance = mix(vec3(1.0),
+          texture(aerial_perspective_transmittance_texture, uvw).rgb, fade);
+      return texture(aerial_perspective_scattering_texture, uvw).rgb * fade *
+          SKY_RADIANCE_SCALE;
+    }
+    #ifdef RADIANCE_API_ENABLED
+    RadianceSpectrum GetAerialPerspectiveRadiance(vec2 screen_uv,
+        Length distance, out DimensionlessSpectrum transmittance) {
+      return GetAerialPerspective(screen_uv, distance, transmittance);
+    }
+    #endif
+    Luminance3 GetAerialPerspectiveLuminance(vec2 screen_uv,
+        Length distance, out DimensionlessSpectrum transmittance) {
+      return GetAerialPerspective(screen_uv, distance, transmittance) *
+          SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
+    }
+    uniform sampler2D sky_view_texture;
+    uniform vec3 sky_view_camera;
+    uniform vec3 sky_view_sun_direction;
+    RadianceSpectrum GetSkyView(Direction view_ray) {
+      Length r = max(length(sky_view_camera), ATMOSPHERE.bottom_radius);
+      Direction up = sky_view_camera / length(sky_view_camera);
+      vec2 uv = GetSkyViewUvFromRMuMuSNu(ATMOSPHERE, r, dot(view_ray, up),
+          dot(sky_view_sun_direction, up),
+          dot(view_ray, sky_view_sun_direction));
+      ivec2 size = textureSize(sky_view_texture, 0);
+      return texture(sky_view_texture, vec2(
+          GetTextureCoordFromUnitRange(uv.x, size.x),
+          GetTextureCoordFromUnitRange(uv.y, size.y))).rgb *
+          SKY_RADIANCE_SCALE;
+    }
+    #ifdef RADIANCE_API_ENABLED
+    RadianceSpectrum GetSkyViewRadiance(Direction view_ray) {
+      return GetSkyView(view_ray);
+    }
+    #endif
+    Luminance3 GetSkyViewLuminance(Direction view_ray) {
+      return GetSkyView(view_ray) * SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;
     })";
 
 /*<h3 id="utilities">Utility classes and functions</h3>
@@ -346,6 +731,13 @@ class Program {
     glUseProgram(program_);
   }
 
+  // Transfers the ownership of the GLSL program to the caller.
+  GLuint Release() {
+    GLuint program = program_;
+    program_ = 0;
+    return program;
+  }
+
   void BindMat3(const std::string& uniform_name,
       const std::array<float, 9>& value) const {
     glUniformMatrix3fv(glGetUniformLocation(program_, uniform_name.c_str()),
@@ -356,6 +748,14 @@ class Program {
     glUniform1i(glGetUniformLocation(program_, uniform_name.c_str()), value);
   }
 
+  void BindFloat(const std::string& uniform_name, float value) const {
+    glUniform1f(glGetUniformLocation(program_, uniform_name.c_str()), value);
+  }
+
+  void BindVec2(const std::string& uniform_name, float x, float y) const {
+    glUniform2f(glGetUniformLocation(program_, uniform_name.c_str()), x, y);
+  }
+
   void BindTexture2d(const std::string& sampler_uniform_name, GLuint texture,
       GLuint texture_unit) const {
     glActiveTexture(GL_TEXTURE0 + texture_unit);
@@ -415,6 +815,38 @@ class Program {
   GLuint program_;
 };
 
+/*
+<p>The precomputation passes (see <code>Model::Pass</code>) use programs which
+are only compiled when they are first used, so that the compilation cost is
+spread over several passes (and thus several <code>Model::Step</code> calls):
+*/
+
+class LazyProgram {
+ public:
+  LazyProgram(
+      const std::string& vertex_shader_source,
+      const std::string& geometry_shader_source,
+      const std::string& fragment_shader_source)
+    : vertex_shader_source_(vertex_shader_source),
+      geometry_shader_source_(geometry_shader_source),
+      fragment_shader_source_(fragment_shader_source) {
+  }
+
+  const Program& Get() {
+    if (!program_) {
+      program_.reset(new Program(vertex_shader_source_,
+          geometry_shader_source_, fragment_shader_source_));
+    }
+    return *program_;
+  }
+
+ private:
+  std::string vertex_shader_source_;
+  std::string geometry_shader_source_;
+  std::string fragment_shader_source_;
+  std::unique_ptr<Program> program_;
+};
+
 /*
 <p>We also need functions to allocate the precomputed textures on GPU:
 */
@@ -502,99 +934,85 @@ void DrawQuad(const std::vector<bool>& enable_blend, GLuint quad_vao) {
 }
 
 /*
-<p>Finally, we need a utility function to compute the value of the conversion
-constants *<code>_RADIANCE_TO_LUMINANCE</code>, used above to convert the
-spectral results into luminance values. These are the constants k_r, k_g, k_b
-described in Section 14.3 of <a href="https://arxiv.org/pdf/1612.04336.pdf">A
-Qualitative and Quantitative Evaluation of 8 Clear Sky Models</a>.
-
-<p>Computing their value requires an integral of a function times a CIE color
-matching function. Thus, we first need functions to interpolate an arbitrary
-function (specified by some samples), and a CIE color matching function
-(specified by tabulated values), at an arbitrary wavelength. This is the purpose
-of the following two functions:
+<p>and a function to check that some texture sizes can be used by the
+<a href="functions.glsl.html#transmittance_precomputation">texture coordinate
+mappings</a>, which divide by the size minus 1 (for the $\mu$ coordinate of the
+scattering textures, by half the size minus 1, since each half is used for
+either the rays intersecting the ground or the other rays). It returns the
+given sizes, or throws an exception if they are invalid:
 */
 
-constexpr int kLambdaMin = 360;
-constexpr int kLambdaMax = 830;
-
-double CieColorMatchingFunctionTableValue(double wavelength, int column) {
-  if (wavelength <= kLambdaMin || wavelength >= kLambdaMax) {
-    return 0.0;
+const TextureSizes& CheckTextureSizes(const TextureSizes& texture_sizes) {
+  if (texture_sizes.transmittance_width < 2 ||
+      texture_sizes.transmittance_height < 2 ||
+      texture_sizes.scattering_r_size < 2 ||
+      texture_sizes.scattering_mu_size < 4 ||
+      texture_sizes.scattering_mu_size % 2 != 0 ||
+      texture_sizes.scattering_mu_s_size < 2 ||
+      texture_sizes.scattering_nu_size < 2 ||
+      texture_sizes.irradiance_width < 2 ||
+      texture_sizes.irradiance_height < 2) {
+    throw std::invalid_argument("Invalid texture sizes: each size must be at "
+        "least 2, and the scattering mu size must be even and at least 4");
   }
-  double u = (wavelength - kLambdaMin) / 5.0;
-  int row = static_cast<int>(std::floor(u));
-  assert(row >= 0 && row + 1 < 95);
-  assert(CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * row] <= wavelength &&
-         CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * (row + 1)] >= wavelength);
-  u -= row;
-  return CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * row + column] * (1.0 - u) +
-      CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * (row + 1) + column] * u;
+  return texture_sizes;
 }
 
-double Interpolate(
-    const std::vector<double>& wavelengths,
-    const std::vector<double>& wavelength_function,
-    double wavelength) {
-  assert(wavelength_function.size() == wavelengths.size());
-  if (wavelength < wavelengths[0]) {
-    return wavelength_function[0];
-  }
-  for (unsigned int i = 0; i < wavelengths.size() - 1; ++i) {
-    if (wavelength < wavelengths[i + 1]) {
-      double u =
-          (wavelength - wavelengths[i]) / (wavelengths[i + 1] - wavelengths[i]);
-      return
-          wavelength_function[i] * (1.0 - u) + wavelength_function[i + 1] * u;
-    }
-  }
-  return wavelength_function[wavelength_function.size() - 1];
-}
+}  // anonymous namespace
 
 /*
-<p>We can then implement a utility function to compute the "spectral radiance to
-luminance" conversion constants (see Section 14.3 in <a
-href="https://arxiv.org/pdf/1612.04336.pdf">A Qualitative and Quantitative
-Evaluation of 8 Clear Sky Models</a> for their definitions):
+<p>Finally, we need a structure to store the state of the precomputations
+started by <code>Init</code> or <code>BeginInit</code> (see below), which
+destroys their GL resources when it is deleted:
 */
 
-// The returned constants are in lumen.nm / watt.
-void ComputeSpectralRadianceToLuminanceFactors(
-    const std::vector<double>& wavelengths,
-    const std::vector<double>& solar_irradiance,
-    double lambda_power, double* k_r, double* k_g, double* k_b) {
-  *k_r = 0.0;
-  *k_g = 0.0;
-  *k_b = 0.0;
-  double solar_r = Interpolate(wavelengths, solar_irradiance, Model::kLambdaR);
-  double solar_g = Interpolate(wavelengths, solar_irradiance, Model::kLambdaG);
-  double solar_b = Interpolate(wavelengths, solar_irradiance, Model::kLambdaB);
-  int dlambda = 1;
-  for (int lambda = kLambdaMin; lambda < kLambdaMax; lambda += dlambda) {
-    double x_bar = CieColorMatchingFunctionTableValue(lambda, 1);
-    double y_bar = CieColorMatchingFunctionTableValue(lambda, 2);
-    double z_bar = CieColorMatchingFunctionTableValue(lambda, 3);
-    const double* xyz2srgb = XYZ_TO_SRGB;
-    double r_bar =
-        xyz2srgb[0] * x_bar + xyz2srgb[1] * y_bar + xyz2srgb[2] * z_bar;
-    double g_bar =
-        xyz2srgb[3] * x_bar + xyz2srgb[4] * y_bar + xyz2srgb[5] * z_bar;
-    double b_bar =
-        xyz2srgb[6] * x_bar + xyz2srgb[7] * y_bar + xyz2srgb[8] * z_bar;
-    double irradiance = Interpolate(wavelengths, solar_irradiance, lambda);
-    *k_r += r_bar * irradiance / solar_r *
-        pow(lambda / Model::kLambdaR, lambda_power);
-    *k_g += g_bar * irradiance / solar_g *
-        pow(lambda / Model::kLambdaG, lambda_power);
-    *k_b += b_bar * irradiance / solar_b *
-        pow(lambda / Model::kLambdaB, lambda_power);
+struct Model::PendingInit {
+  ~PendingInit() {
+    glDeleteFramebuffers(1, &fbo);
+    for (GLuint texture : temporary_textures) {
+      glDeleteTextures(1, &texture);
+    }
+    glDeleteTextures(1, &transmittance_texture);
+    glDeleteTextures(1, &scattering_texture);
+    glDeleteTextures(1, &optional_single_mie_scattering_texture);
+    glDeleteTextures(1, &irradiance_texture);
+    for (unsigned int i = 0; i < group_lambdas.size(); ++i) {
+      glDeleteTextures(1, &group_scattering_textures[i]);
+      glDeleteTextures(1, &group_single_mie_scattering_textures[i]);
+      glDeleteTextures(1, &group_irradiance_textures[i]);
+    }
+    for (const auto& timer_query : timer_queries) {
+      glDeleteQueries(1, &timer_query.first);
+    }
   }
-  *k_r *= MAX_LUMINOUS_EFFICACY * dlambda;
-  *k_g *= MAX_LUMINOUS_EFFICACY * dlambda;
-  *k_b *= MAX_LUMINOUS_EFFICACY * dlambda;
-}
 
-}  // anonymous namespace
+  // The passes which remain to be run.
+  std::deque<Pass> passes;
+  // The temporary resources used by the passes.
+  GLuint fbo = 0;
+  std::vector<GLuint> temporary_textures;
+
+  // With BeginInit, the precomputed textures computed by the passes, swapped
+  // with the corresponding Model fields during each Step (and thus the
+  // previous textures of the Model, after the last Step).
+  GLuint transmittance_texture = 0;
+  GLuint scattering_texture = 0;
+  GLuint optional_single_mie_scattering_texture = 0;
+  GLuint irradiance_texture = 0;
+  std::vector<double> ground_albedo_samples;
+  std::vector<vec3> group_lambdas;
+  std::vector<mat3> group_luminance_from_radiance;
+  std::vector<double> group_ground_albedos;
+  std::vector<GLuint> group_scattering_textures;
+  std::vector<GLuint> group_single_mie_scattering_textures;
+  std::vector<GLuint> group_irradiance_textures;
+
+  // With BeginInit, the last measured GPU time of the passes using each
+  // shader, in milliseconds, and the timer queries of the passes whose GPU
+  // time is not yet available, with their shader.
+  std::map<const char*, double> gpu_time_ms;
+  std::deque<std::pair<GLuint, const char*>> timer_queries;
+};
 
 /*<h3 id="implementation">Model implementation</h3>
 
@@ -629,10 +1047,39 @@ Model::Model(
     double length_unit_in_meters,
     unsigned int num_precomputed_wavelengths,
     bool combine_scattering_textures,
-    bool half_precision) :
+    bool half_precision,
+    const TextureSizes& texture_sizes,
+    bool runtime_solar_irradiance,
+    bool runtime_ground_albedo,
+    const std::vector<double>& tabulated_densities) :
         num_precomputed_wavelengths_(num_precomputed_wavelengths),
         half_precision_(half_precision),
-        rgb_format_supported_(IsFramebufferRgbFormatSupported(half_precision)) {
+        texture_sizes_(CheckTextureSizes(texture_sizes)),
+        rgb_format_supported_(IsFramebufferRgbFormatSupported(half_precision)),
+        runtime_solar_irradiance_(runtime_solar_irradiance),
+        runtime_ground_albedo_(runtime_ground_albedo),
+        tabulated_densities_(tabulated_densities),
+        wavelengths_(wavelengths),
+        ground_albedo_(ground_albedo),
+        precomputed_ground_albedo_(ground_albedo),
+        update_next_scattering_texture_(0),
+        update_scattering_correction_texture_(0),
+        update_irradiance_correction_texture_(0),
+        sky_view_program_(0),
+        sky_view_texture_(0),
+        sky_view_size_{{0, 0}},
+        sky_view_camera_{{0.0, 0.0, 0.0}},
+        sky_view_sun_direction_{{0.0, 0.0, 0.0}},
+        aerial_perspective_program_(0),
+        aerial_perspective_scattering_texture_(0),
+        aerial_perspective_transmittance_texture_(0),
+        aerial_perspective_size_{{0, 0, 0}},
+        aerial_perspective_max_distance_(0.0) {
+  if (!tabulated_densities.empty() &&
+      tabulated_densities.size() != 3u * DENSITY_TEXTURE_WIDTH) {
+    throw std::invalid_argument("The tabulated densities must contain "
+        "3 * DENSITY_TEXTURE_WIDTH values");
+  }
   auto to_string = [&wavelengths](const std::vector<double>& v,
       const vec3& lambdas, double scale) {
     double r = Interpolate(wavelengths, v, lambdas[0]) * scale;
@@ -665,29 +1112,25 @@ Model::Model(
         return result;
       };
 
-  // Compute the values for the SKY_RADIANCE_TO_LUMINANCE constant. In theory
-  // this should be 1 in precomputed illuminance mode (because the precomputed
-  // textures already contain illuminance values). In practice, however, storing
-  // true illuminance values in half precision textures yields artefacts
-  // (because the values are too large), so we store illuminance values divided
-  // by MAX_LUMINOUS_EFFICACY instead. This is why, in precomputed illuminance
-  // mode, we set SKY_RADIANCE_TO_LUMINANCE to MAX_LUMINOUS_EFFICACY.
+  // Compute the values of the *_RADIANCE_TO_LUMINANCE and *_RADIANCE_SCALE
+  // constants (or the initial values of the corresponding uniforms).
   bool precompute_illuminance = num_precomputed_wavelengths > 3;
-  double sky_k_r, sky_k_g, sky_k_b;
-  if (precompute_illuminance) {
-    sky_k_r = sky_k_g = sky_k_b = MAX_LUMINOUS_EFFICACY;
-  } else {
-    ComputeSpectralRadianceToLuminanceFactors(wavelengths, solar_irradiance,
-        -3 /* lambda_power */, &sky_k_r, &sky_k_g, &sky_k_b);
-  }
-  // Compute the values for the SUN_RADIANCE_TO_LUMINANCE constant.
-  double sun_k_r, sun_k_g, sun_k_b;
-  ComputeSpectralRadianceToLuminanceFactors(wavelengths, solar_irradiance,
-      0 /* lambda_power */, &sun_k_r, &sun_k_g, &sun_k_b);
+  ComputeSolarIrradianceFactors(solar_irradiance);
+  auto vec3_to_string = [](const vec3& v) {
+    return "vec3(" + std::to_string(v[0]) + "," + std::to_string(v[1]) + "," +
+        std::to_string(v[2]) + ")";
+  };
+  // With the runtime_solar_irradiance option, the textures are precomputed
+  // for a unit solar irradiance at each wavelength.
+  const std::vector<double> precomputed_solar_irradiance =
+      runtime_solar_irradiance ?
+          std::vector<double>(wavelengths.size(), 1.0) : solar_irradiance;
 
   // A lambda that creates a GLSL header containing our atmosphere computation
-  // functions, specialized for the given atmosphere parameters and for the 3
-  // wavelengths in 'lambdas'.
+  // functions, specialized for the given atmosphere parameters, for the 3
+  // wavelengths in 'lambdas', and for the current texture_sizes_ (which are
+  // temporarily changed in InitProgressive) and precomputed_ground_albedo_
+  // (which is temporarily changed in Init).
   glsl_header_factory_ = [=](const vec3& lambdas) {
     return
       "#version 330\n"
@@ -697,26 +1140,28 @@ Model::Model(
       "#define TEMPLATE_ARGUMENT(x)\n"
       "#define assert(x)\n"
       "const int TRANSMITTANCE_TEXTURE_WIDTH = " +
-          std::to_string(TRANSMITTANCE_TEXTURE_WIDTH) + ";\n" +
+          std::to_string(texture_sizes_.transmittance_width) + ";\n" +
       "const int TRANSMITTANCE_TEXTURE_HEIGHT = " +
-          std::to_string(TRANSMITTANCE_TEXTURE_HEIGHT) + ";\n" +
+          std::to_string(texture_sizes_.transmittance_height) + ";\n" +
       "const int SCATTERING_TEXTURE_R_SIZE = " +
-          std::to_string(SCATTERING_TEXTURE_R_SIZE) + ";\n" +
+          std::to_string(texture_sizes_.scattering_r_size) + ";\n" +
       "const int SCATTERING_TEXTURE_MU_SIZE = " +
-          std::to_string(SCATTERING_TEXTURE_MU_SIZE) + ";\n" +
+          std::to_string(texture_sizes_.scattering_mu_size) + ";\n" +
       "const int SCATTERING_TEXTURE_MU_S_SIZE = " +
-          std::to_string(SCATTERING_TEXTURE_MU_S_SIZE) + ";\n" +
+          std::to_string(texture_sizes_.scattering_mu_s_size) + ";\n" +
       "const int SCATTERING_TEXTURE_NU_SIZE = " +
-          std::to_string(SCATTERING_TEXTURE_NU_SIZE) + ";\n" +
+          std::to_string(texture_sizes_.scattering_nu_size) + ";\n" +
       "const int IRRADIANCE_TEXTURE_WIDTH = " +
-          std::to_string(IRRADIANCE_TEXTURE_WIDTH) + ";\n" +
+          std::to_string(texture_sizes_.irradiance_width) + ";\n" +
       "const int IRRADIANCE_TEXTURE_HEIGHT = " +
-          std::to_string(IRRADIANCE_TEXTURE_HEIGHT) + ";\n" +
+          std::to_string(texture_sizes_.irradiance_height) + ";\n" +
+      "const int DENSITY_TEXTURE_WIDTH = " +
+          std::to_string(DENSITY_TEXTURE_WIDTH) + ";\n" +
       (combine_scattering_textures ?
           "#define COMBINED_SCATTERING_TEXTURES\n" : "") +
       definitions_glsl +
       "const AtmosphereParameters ATMOSPHERE = AtmosphereParameters(\n" +
-          to_string(solar_irradiance, lambdas, 1.0) + ",\n" +
+          to_string(precomputed_solar_irradiance, lambdas, 1.0) + ",\n" +
           std::to_string(sun_angular_radius) + ",\n" +
           std::to_string(bottom_radius / length_unit_in_meters) + ",\n" +
           std::to_string(top_radius / length_unit_in_meters) + ",\n" +
@@ -730,40 +1175,44 @@ Model::Model(
           density_profile(absorption_density) + ",\n" +
           to_string(
               absorption_extinction, lambdas, length_unit_in_meters) + ",\n" +
-          to_string(ground_albedo, lambdas, 1.0) + ",\n" +
+          to_string(precomputed_ground_albedo_, lambdas, 1.0) + ",\n" +
           std::to_string(cos(max_sun_zenith_angle)) + ");\n" +
-      "const vec3 SKY_SPECTRAL_RADIANCE_TO_LUMINANCE = vec3(" +
-          std::to_string(sky_k_r) + "," +
-          std::to_string(sky_k_g) + "," +
-          std::to_string(sky_k_b) + ");\n" +
-      "const vec3 SUN_SPECTRAL_RADIANCE_TO_LUMINANCE = vec3(" +
-          std::to_string(sun_k_r) + "," +
-          std::to_string(sun_k_g) + "," +
-          std::to_string(sun_k_b) + ");\n" +
+      (runtime_solar_irradiance ?
+          "uniform vec3 SKY_SPECTRAL_RADIANCE_TO_LUMINANCE;\n"
+          "uniform vec3 SUN_SPECTRAL_RADIANCE_TO_LUMINANCE;\n"
+          "uniform vec3 SKY_RADIANCE_SCALE;\n"
+          "uniform vec3 SUN_RADIANCE_SCALE;\n" :
+          "const vec3 SKY_SPECTRAL_RADIANCE_TO_LUMINANCE = " +
+              vec3_to_string(sky_spectral_radiance_to_luminance_) + ";\n" +
+          "const vec3 SUN_SPECTRAL_RADIANCE_TO_LUMINANCE = " +
+              vec3_to_string(sun_spectral_radiance_to_luminance_) + ";\n" +
+          "const vec3 SKY_RADIANCE_SCALE = vec3(1.0);\n" +
+          "const vec3 SUN_RADIANCE_SCALE = vec3(1.0);\n") +
       functions_glsl;
   };
 
   // Allocate the precomputed textures, but don't precompute them yet.
   transmittance_texture_ = NewTexture2d(
-      TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
+      texture_sizes_.transmittance_width,
+      texture_sizes_.transmittance_height);
   scattering_texture_ = NewTexture3d(
-      SCATTERING_TEXTURE_WIDTH,
-      SCATTERING_TEXTURE_HEIGHT,
-      SCATTERING_TEXTURE_DEPTH,
+      texture_sizes_.scattering_width(),
+      texture_sizes_.scattering_height(),
+      texture_sizes_.scattering_depth(),
       combine_scattering_textures || !rgb_format_supported_ ? GL_RGBA : GL_RGB,
       half_precision);
   if (combine_scattering_textures) {
     optional_single_mie_scattering_texture_ = 0;
   } else {
     optional_single_mie_scattering_texture_ = NewTexture3d(
-        SCATTERING_TEXTURE_WIDTH,
-        SCATTERING_TEXTURE_HEIGHT,
-        SCATTERING_TEXTURE_DEPTH,
+        texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height(),
+        texture_sizes_.scattering_depth(),
         rgb_format_supported_ ? GL_RGB : GL_RGBA,
         half_precision);
   }
   irradiance_texture_ = NewTexture2d(
-      IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+      texture_sizes_.irradiance_width, texture_sizes_.irradiance_height);
 
   // Create and compile the shader providing our API.
   std::string shader =
@@ -807,13 +1256,27 @@ Model::~Model() {
     glDeleteTextures(1, &optional_single_mie_scattering_texture_);
   }
   glDeleteTextures(1, &irradiance_texture_);
+  DeleteWavelengthGroups();
+  DeleteUpdateCorrections();
   glDeleteShader(atmosphere_shader_);
+  if (sky_view_program_ != 0) {
+    glDeleteProgram(sky_view_program_);
+    glDeleteTextures(1, &sky_view_texture_);
+  }
+  if (aerial_perspective_program_ != 0) {
+    glDeleteProgram(aerial_perspective_program_);
+    glDeleteTextures(1, &aerial_perspective_scattering_texture_);
+    glDeleteTextures(1, &aerial_perspective_transmittance_texture_);
+  }
 }
 
 /*
 <p>The Init method precomputes the atmosphere textures. It first allocates the
-temporary resources it needs, then calls <code>Precompute</code> to do the
-actual precomputations, and finally destroys the temporary resources.
+temporary resources it needs, then calls <code>Precompute</code> to create the
+passes doing the actual precomputations, runs them, and finally destroys the
+temporary resources. The passes and the temporary resources are created by
+<code>ScheduleInit</code>, which is shared with the time-sliced version of
+<code>Init</code> (see <code>BeginInit</code> below).
 
 <p>Note that there are two precomputation modes here, depending on whether we
 want to store precomputed irradiance or illuminance values:
@@ -860,33 +1323,82 @@ want to store precomputed irradiance or illuminance values:
   wavelengths (yielding a 3x3 matrix).</li>
 </ul>
 
+<p>With the <code>runtime_solar_irradiance</code> option, in precomputed
+illuminance mode, we can't use this merged loop, because the illuminance
+textures must be computed again when the solar irradiance changes. We thus
+use the naive solution instead, with temporary irradiance textures which are
+kept until the next <code>Init</code> call, and combined into the final
+illuminance textures in <code>CombineWavelengthGroups</code>.
+
+<p>Likewise, with the <code>runtime_ground_albedo</code> option, we precompute
+the textures for several uniform ground albedo values, in temporary textures
+which are kept until the next <code>Init</code> call, and combined into the
+final textures in <code>CombineWavelengthGroups</code>. Indeed, the ground
+albedo only appears in the computation of the scattering density, where it
+multiplies the irradiance from the previous scattering order. Scattering of
+order $n$ is thus a polynomial of the ground albedo, of degree at most $n-1$,
+at each wavelength (and so is the irradiance texture, which contains the
+irradiance of orders 1 to $n-1$ for $n$ scattering orders). A polynomial of
+degree $n-1$ being uniquely defined by its values for $n$ distinct arguments,
+it is sufficient to precompute the textures for $n$ ground albedo values
+$\alpha_j$ between 0 and 1 to get the textures for any ground albedo $\alpha$,
+with the Lagrange interpolation formula: they are the sum of the textures for
+the albedo $\alpha_j$ multiplied with $\prod_{k\ne j}(\alpha-\alpha_k)/
+(\alpha_j-\alpha_k)$ (we use this Lagrange basis instead of the monomial one
+because it is better conditioned, which is important with half precision
+textures, and because it does not require any additional computation after
+the precomputations). Note that this only requires the ground albedo to be
+uniform inside each group of 3 wavelengths, which is why we can get the
+textures for a ground albedo which varies with the wavelength.
+
 <p>This yields the following implementation:
 */
 
 void Model::Init(unsigned int num_scattering_orders) {
+  RunInit(num_scattering_orders, false /* approximate_multiple_scattering */);
+}
+
+void Model::RunInit(unsigned int num_scattering_orders,
+    bool approximate_multiple_scattering) {
+  DeleteWavelengthGroups();
+  DeleteUpdateCorrections();
+  PendingInit init;
+  ScheduleInit(num_scattering_orders, approximate_multiple_scattering, &init);
+  while (!init.passes.empty()) {
+    Pass pass = std::move(init.passes.front());
+    init.passes.pop_front();
+    pass.run();
+  }
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  assert(glGetError() == 0);
+}
+
+void Model::ScheduleInit(unsigned int num_scattering_orders,
+    bool approximate_multiple_scattering, PendingInit* init) {
   // The precomputations require temporary textures, in particular to store the
   // contribution of one scattering order, which is needed to compute the next
   // order of scattering (the final precomputed textures store the sum of all
-  // the scattering orders). We allocate them here, and destroy them at the end
-  // of this method.
+  // the scattering orders). We allocate them here, and they are destroyed with
+  // 'init'.
   GLuint delta_irradiance_texture = NewTexture2d(
-      IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
+      texture_sizes_.irradiance_width, texture_sizes_.irradiance_height);
   GLuint delta_rayleigh_scattering_texture = NewTexture3d(
-      SCATTERING_TEXTURE_WIDTH,
-      SCATTERING_TEXTURE_HEIGHT,
-      SCATTERING_TEXTURE_DEPTH,
+      texture_sizes_.scattering_width(),
+      texture_sizes_.scattering_height(),
+      texture_sizes_.scattering_depth(),
       rgb_format_supported_ ? GL_RGB : GL_RGBA,
       half_precision_);
   GLuint delta_mie_scattering_texture = NewTexture3d(
-      SCATTERING_TEXTURE_WIDTH,
-      SCATTERING_TEXTURE_HEIGHT,
-      SCATTERING_TEXTURE_DEPTH,
+      texture_sizes_.scattering_width(),
+      texture_sizes_.scattering_height(),
+      texture_sizes_.scattering_depth(),
       rgb_format_supported_ ? GL_RGB : GL_RGBA,
       half_precision_);
   GLuint delta_scattering_density_texture = NewTexture3d(
-      SCATTERING_TEXTURE_WIDTH,
-      SCATTERING_TEXTURE_HEIGHT,
-      SCATTERING_TEXTURE_DEPTH,
+      texture_sizes_.scattering_width(),
+      texture_sizes_.scattering_height(),
+      texture_sizes_.scattering_depth(),
       rgb_format_supported_ ? GL_RGB : GL_RGBA,
       half_precision_);
   // delta_multiple_scattering_texture is only needed to compute scattering
@@ -897,25 +1409,114 @@ void Model::Init(unsigned int num_scattering_orders) {
   GLuint delta_multiple_scattering_texture = delta_rayleigh_scattering_texture;
 
   // The precomputations also require a temporary framebuffer object, created
-  // here (and destroyed at the end of this method).
+  // here (and destroyed with 'init').
   GLuint fbo;
   glGenFramebuffers(1, &fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  // The density lookup table does not depend on the wavelength, so we compute
+  // it only once here, and use it in all the precomputation stages below.
+  GLuint density_texture =
+      NewTexture2d(DENSITY_TEXTURE_WIDTH, DENSITY_TEXTURE_HEIGHT);
+  init->fbo = fbo;
+  init->temporary_textures = {delta_irradiance_texture,
+      delta_rayleigh_scattering_texture, delta_mie_scattering_texture,
+      delta_scattering_density_texture, density_texture};
+  init->passes.push_back({kComputeDensityShader, [=]() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    ComputeDensityTexture(density_texture,
+        glsl_header_factory_({kLambdaR, kLambdaG, kLambdaB}));
+  }});
+
+  // Each call to Precompute below is done in a pass, which inserts the passes
+  // created by Precompute before the remaining ones (so that the GLSL programs
+  // they need are compiled only when they are about to be used).
+  auto schedule_precompute = [=](const vec3& lambdas,
+      const mat3& luminance_from_radiance, bool blend) {
+    std::vector<Pass> passes;
+    Precompute(fbo, density_texture, delta_irradiance_texture,
+        delta_rayleigh_scattering_texture, delta_mie_scattering_texture,
+        delta_scattering_density_texture, delta_multiple_scattering_texture,
+        lambdas, luminance_from_radiance, blend, num_scattering_orders,
+        approximate_multiple_scattering, &passes);
+    init->passes.insert(init->passes.begin(), passes.begin(), passes.end());
+  };
+
+  // With the runtime_solar_irradiance option in precomputed illuminance mode,
+  // or with the runtime_ground_albedo option, the textures for the 3
+  // wavelengths of each group (and for each ground albedo sample) are
+  // precomputed in new textures, kept until the next Init call, and combined
+  // into the final textures at the end of this method (this includes the 3
+  // components of the single Mie scattering, even with combined scattering
+  // textures, since they are all needed to compute its red luminance
+  // component).
+  ground_albedo_samples_.clear();
+  if (runtime_ground_albedo_) {
+    unsigned int num_samples = std::max(num_scattering_orders, 1u);
+    for (unsigned int j = 0; j < num_samples; ++j) {
+      ground_albedo_samples_.push_back(
+          num_samples > 1 ? j / (num_samples - 1.0) : 0.0);
+    }
+  } else {
+    ground_albedo_samples_.push_back(-1.0);
+  }
+  auto precompute_groups = [=](const vec3& lambdas,
+      const mat3& luminance_from_radiance) {
+    GLenum format = rgb_format_supported_ ? GL_RGB : GL_RGBA;
+    for (double ground_albedo : ground_albedo_samples_) {
+      init->passes.push_back({nullptr, [=]() {
+        if (runtime_ground_albedo_) {
+          precomputed_ground_albedo_.assign(wavelengths_.size(), ground_albedo);
+        }
+        group_lambdas_.push_back(lambdas);
+        group_luminance_from_radiance_.push_back(luminance_from_radiance);
+        group_ground_albedos_.push_back(ground_albedo);
+        group_scattering_textures_.push_back(NewTexture3d(
+            texture_sizes_.scattering_width(),
+            texture_sizes_.scattering_height(),
+            texture_sizes_.scattering_depth(),
+            format,
+            half_precision_));
+        group_single_mie_scattering_textures_.push_back(NewTexture3d(
+            texture_sizes_.scattering_width(),
+            texture_sizes_.scattering_height(),
+            texture_sizes_.scattering_depth(),
+            format,
+            half_precision_));
+        group_irradiance_textures_.push_back(NewTexture2d(
+            texture_sizes_.irradiance_width,
+            texture_sizes_.irradiance_height));
+        std::swap(scattering_texture_, group_scattering_textures_.back());
+        std::swap(optional_single_mie_scattering_texture_,
+            group_single_mie_scattering_textures_.back());
+        std::swap(irradiance_texture_, group_irradiance_textures_.back());
+        mat3 identity{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+        schedule_precompute(lambdas, identity, false /* blend */);
+        std::swap(scattering_texture_, group_scattering_textures_.back());
+        std::swap(optional_single_mie_scattering_texture_,
+            group_single_mie_scattering_textures_.back());
+        std::swap(irradiance_texture_, group_irradiance_textures_.back());
+        precomputed_ground_albedo_ = ground_albedo_;
+      }});
+    }
+  };
 
   // The actual precomputations depend on whether we want to store precomputed
   // irradiance or illuminance values.
   if (num_precomputed_wavelengths_ <= 3) {
     vec3 lambdas{kLambdaR, kLambdaG, kLambdaB};
     mat3 luminance_from_radiance{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
-    Precompute(fbo, delta_irradiance_texture, delta_rayleigh_scattering_texture,
-        delta_mie_scattering_texture, delta_scattering_density_texture,
-        delta_multiple_scattering_texture, lambdas, luminance_from_radiance,
-        false /* blend */, num_scattering_orders);
+    if (runtime_ground_albedo_) {
+      precompute_groups(lambdas, luminance_from_radiance);
+    } else {
+      init->passes.push_back({nullptr, [=]() {
+        schedule_precompute(
+            lambdas, luminance_from_radiance, false /* blend */);
+      }});
+    }
   } else {
-    constexpr double kLambdaMin = 360.0;
-    constexpr double kLambdaMax = 830.0;
     int num_iterations = (num_precomputed_wavelengths_ + 2) / 3;
-    double dlambda = (kLambdaMax - kLambdaMin) / (3 * num_iterations);
+    double dlambda =
+        static_cast<double>(kLambdaMax - kLambdaMin) / (3 * num_iterations);
     for (int i = 0; i < num_iterations; ++i) {
       vec3 lambdas{
         kLambdaMin + (3 * i + 0.5) * dlambda,
@@ -941,102 +1542,1305 @@ void Model::Init(unsigned int num_scattering_orders) {
         coeff(lambdas[0], 1), coeff(lambdas[1], 1), coeff(lambdas[2], 1),
         coeff(lambdas[0], 2), coeff(lambdas[1], 2), coeff(lambdas[2], 2)
       };
-      Precompute(fbo, delta_irradiance_texture,
-          delta_rayleigh_scattering_texture, delta_mie_scattering_texture,
-          delta_scattering_density_texture, delta_multiple_scattering_texture,
-          lambdas, luminance_from_radiance, i > 0 /* blend */,
-          num_scattering_orders);
+      if (runtime_solar_irradiance_ || runtime_ground_albedo_) {
+        precompute_groups(lambdas, luminance_from_radiance);
+      } else {
+        init->passes.push_back({nullptr, [=]() {
+          schedule_precompute(
+              lambdas, luminance_from_radiance, i > 0 /* blend */);
+        }});
+      }
     }
 
     // After the above iterations, the transmittance texture contains the
     // transmittance for the 3 wavelengths used at the last iteration. But we
     // want the transmittance at kLambdaR, kLambdaG, kLambdaB instead, so we
     // must recompute it here for these 3 wavelengths:
-    std::string header = glsl_header_factory_({kLambdaR, kLambdaG, kLambdaB});
-    Program compute_transmittance(
-        kVertexShader, header + kComputeTransmittanceShader);
-    glFramebufferTexture(
-        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, transmittance_texture_, 0);
+    init->passes.push_back({kComputeTransmittanceShader, [=]() {
+      std::string header = glsl_header_factory_({kLambdaR, kLambdaG, kLambdaB});
+      Program compute_transmittance(
+          kVertexShader, header + kComputeTransmittanceShader);
+      glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+      glFramebufferTexture(
+          GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, transmittance_texture_, 0);
+      glDrawBuffer(GL_COLOR_ATTACHMENT0);
+      glViewport(0, 0, texture_sizes_.transmittance_width,
+          texture_sizes_.transmittance_height);
+      compute_transmittance.Use();
+      compute_transmittance.BindTexture2d(
+          "density_texture", density_texture, 0);
+      DrawQuad({}, full_screen_quad_vao_);
+    }});
+  }
+  init->passes.push_back({kCombineScatteringShader, [this]() {
+    if (!group_lambdas_.empty()) {
+      CombineWavelengthGroups();
+    }
+  }});
+}
+
+/*
+<p>The <code>InitProgressive</code> method first precomputes the atmosphere
+textures at the given coarse resolution, which is much faster, resamples them
+into the full resolution textures, which the caller can use right away. It
+then starts the precomputation of the textures at full resolution with
+<code>BeginInit</code>, so that the caller can complete it with
+<code>Step</code> calls while rendering with the coarse textures (instead of
+blocking until the full resolution textures are ready). The coarse
+precomputation is done with the <code>Init</code> method, by temporarily
+replacing the texture sizes and the precomputed textures with coarse ones:
+*/
+
+void Model::InitProgressive(const TextureSizes& coarse_texture_sizes,
+    unsigned int num_scattering_orders) {
+  assert(pending_init_ == nullptr);
+  CheckTextureSizes(coarse_texture_sizes);
+  DeleteUpdateCorrections();
+  const TextureSizes full_texture_sizes = texture_sizes_;
+  GLuint transmittance_texture = transmittance_texture_;
+  GLuint scattering_texture = scattering_texture_;
+  GLuint optional_single_mie_scattering_texture =
+      optional_single_mie_scattering_texture_;
+  GLuint irradiance_texture = irradiance_texture_;
+
+  texture_sizes_ = coarse_texture_sizes;
+  transmittance_texture_ = NewTexture2d(
+      texture_sizes_.transmittance_width,
+      texture_sizes_.transmittance_height);
+  scattering_texture_ = NewTexture3d(
+      texture_sizes_.scattering_width(),
+      texture_sizes_.scattering_height(),
+      texture_sizes_.scattering_depth(),
+      GL_RGBA,
+      half_precision_);
+  if (optional_single_mie_scattering_texture != 0) {
+    optional_single_mie_scattering_texture_ = NewTexture3d(
+        texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height(),
+        texture_sizes_.scattering_depth(),
+        GL_RGBA,
+        half_precision_);
+  }
+  irradiance_texture_ = NewTexture2d(
+      texture_sizes_.irradiance_width, texture_sizes_.irradiance_height);
+  Init(num_scattering_orders);
+
+  std::swap(transmittance_texture, transmittance_texture_);
+  std::swap(scattering_texture, scattering_texture_);
+  std::swap(optional_single_mie_scattering_texture,
+      optional_single_mie_scattering_texture_);
+  std::swap(irradiance_texture, irradiance_texture_);
+  texture_sizes_ = full_texture_sizes;
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  std::string header = glsl_header_factory_({kLambdaR, kLambdaG, kLambdaB});
+  Program resample_texture_2d(kVertexShader, header + kResampleTexture2dShader);
+  Program resample_scattering(
+      kVertexShader, kGeometryShader, header + kResampleScatteringShader);
+  auto resample_2d = [&](GLuint source, int source_width, int source_height,
+      GLuint target, int target_width, int target_height) {
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, 0);
     glDrawBuffer(GL_COLOR_ATTACHMENT0);
-    glViewport(0, 0, TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
-    compute_transmittance.Use();
+    glViewport(0, 0, target_width, target_height);
+    resample_texture_2d.Use();
+    resample_texture_2d.BindTexture2d("source_texture", source, 0);
+    resample_texture_2d.BindInt("source_width", source_width);
+    resample_texture_2d.BindInt("source_height", source_height);
+    resample_texture_2d.BindInt("target_width", target_width);
+    resample_texture_2d.BindInt("target_height", target_height);
     DrawQuad({}, full_screen_quad_vao_);
+  };
+  auto resample_3d = [&](GLuint source, GLuint target) {
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height());
+    resample_scattering.Use();
+    resample_scattering.BindTexture3d("source_texture", source, 0);
+    resample_scattering.BindInt(
+        "source_nu_size", coarse_texture_sizes.scattering_nu_size);
+    resample_scattering.BindInt(
+        "source_mu_s_size", coarse_texture_sizes.scattering_mu_s_size);
+    resample_scattering.BindInt(
+        "source_mu_size", coarse_texture_sizes.scattering_mu_size);
+    resample_scattering.BindInt(
+        "source_r_size", coarse_texture_sizes.scattering_r_size);
+    for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+      resample_scattering.BindInt("layer", layer);
+      DrawQuad({}, full_screen_quad_vao_);
+    }
+  };
+  resample_2d(transmittance_texture,
+      coarse_texture_sizes.transmittance_width,
+      coarse_texture_sizes.transmittance_height,
+      transmittance_texture_,
+      texture_sizes_.transmittance_width,
+      texture_sizes_.transmittance_height);
+  resample_2d(irradiance_texture,
+      coarse_texture_sizes.irradiance_width,
+      coarse_texture_sizes.irradiance_height,
+      irradiance_texture_,
+      texture_sizes_.irradiance_width,
+      texture_sizes_.irradiance_height);
+  resample_3d(scattering_texture, scattering_texture_);
+  if (optional_single_mie_scattering_texture_ != 0) {
+    resample_3d(optional_single_mie_scattering_texture,
+        optional_single_mie_scattering_texture_);
+    glDeleteTextures(1, &optional_single_mie_scattering_texture);
   }
-
-  // Delete the temporary resources allocated at the begining of this method.
   glUseProgram(0);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   glDeleteFramebuffers(1, &fbo);
-  glDeleteTextures(1, &delta_scattering_density_texture);
-  glDeleteTextures(1, &delta_mie_scattering_texture);
-  glDeleteTextures(1, &delta_rayleigh_scattering_texture);
-  glDeleteTextures(1, &delta_irradiance_texture);
+  glDeleteTextures(1, &transmittance_texture);
+  glDeleteTextures(1, &scattering_texture);
+  glDeleteTextures(1, &irradiance_texture);
+  DeleteWavelengthGroups();
   assert(glGetError() == 0);
+
+  BeginInit(num_scattering_orders);
 }
 
 /*
-<p>The <code>SetProgramUniforms</code> method is straightforward: it simply
-binds the precomputed textures to the specified texture units, and then sets
-the corresponding uniforms in the user provided program to the index of these
-texture units.
+<p>The <code>InitApproximate</code> method is the same as <code>Init</code>,
+except that <code>Precompute</code> replaces its loop over the scattering
+orders with the <a href="functions.glsl.html#approximate_multiple_scattering"
+>approximate multiple scattering</a> computations. These computations are
+linear in the ground albedo, so that 2 ground albedo samples are sufficient
+with the <code>runtime_ground_albedo</code> option (whence the
+<code>num_scattering_orders</code> argument below, which is otherwise unused in
+this mode). The mode is passed explicitly to <code>ScheduleInit</code> and
+<code>Precompute</code>, via the <code>RunInit</code> method shared with
+<code>Init</code>:
 */
 
-void Model::SetProgramUniforms(
-    GLuint program,
-    GLuint transmittance_texture_unit,
-    GLuint scattering_texture_unit,
-    GLuint irradiance_texture_unit,
-    GLuint single_mie_scattering_texture_unit) const {
-  glActiveTexture(GL_TEXTURE0 + transmittance_texture_unit);
-  glBindTexture(GL_TEXTURE_2D, transmittance_texture_);
-  glUniform1i(glGetUniformLocation(program, "transmittance_texture"),
-      transmittance_texture_unit);
-
-  glActiveTexture(GL_TEXTURE0 + scattering_texture_unit);
-  glBindTexture(GL_TEXTURE_3D, scattering_texture_);
-  glUniform1i(glGetUniformLocation(program, "scattering_texture"),
-      scattering_texture_unit);
+void Model::InitApproximate() {
+  RunInit(2, true /* approximate_multiple_scattering */);
+}
 
-  glActiveTexture(GL_TEXTURE0 + irradiance_texture_unit);
-  glBindTexture(GL_TEXTURE_2D, irradiance_texture_);
-  glUniform1i(glGetUniformLocation(program, "irradiance_texture"),
-      irradiance_texture_unit);
+/*
+<p>The <code>BeginInit</code> method schedules the same passes as
+<code>Init</code>, but does not run them. Instead, they are run incrementally
+by the <code>Step</code> method. For this, the passes must compute new
+textures, distinct from the ones used for rendering until the last
+<code>Step</code>. To reuse <code>ScheduleInit</code> unchanged, we allocate
+these new textures in the <code>PendingInit</code> state, and swap them with
+the Model fields during <code>ScheduleInit</code> and each <code>Step</code>
+(as well as the textures precomputed for each group of wavelengths):
+*/
 
+void Model::BeginInit(unsigned int num_scattering_orders) {
+  assert(pending_init_ == nullptr);
+  DeleteUpdateCorrections();
+  pending_init_.reset(new PendingInit());
+  PendingInit& init = *pending_init_;
+  init.transmittance_texture = NewTexture2d(
+      texture_sizes_.transmittance_width,
+      texture_sizes_.transmittance_height);
+  init.scattering_texture = NewTexture3d(
+      texture_sizes_.scattering_width(),
+      texture_sizes_.scattering_height(),
+      texture_sizes_.scattering_depth(),
+      optional_single_mie_scattering_texture_ == 0 || !rgb_format_supported_ ?
+          GL_RGBA : GL_RGB,
+      half_precision_);
   if (optional_single_mie_scattering_texture_ != 0) {
-    glActiveTexture(GL_TEXTURE0 + single_mie_scattering_texture_unit);
-    glBindTexture(GL_TEXTURE_3D, optional_single_mie_scattering_texture_);
-    glUniform1i(glGetUniformLocation(program, "single_mie_scattering_texture"),
-        single_mie_scattering_texture_unit);
+    init.optional_single_mie_scattering_texture = NewTexture3d(
+        texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height(),
+        texture_sizes_.scattering_depth(),
+        rgb_format_supported_ ? GL_RGB : GL_RGBA,
+        half_precision_);
   }
+  init.irradiance_texture = NewTexture2d(
+      texture_sizes_.irradiance_width, texture_sizes_.irradiance_height);
+
+  SwapPendingInitTextures();
+  ScheduleInit(num_scattering_orders,
+      false /* approximate_multiple_scattering */, &init);
+  SwapPendingInitTextures();
+}
+
+void Model::SwapPendingInitTextures() {
+  PendingInit& init = *pending_init_;
+  std::swap(transmittance_texture_, init.transmittance_texture);
+  std::swap(scattering_texture_, init.scattering_texture);
+  std::swap(optional_single_mie_scattering_texture_,
+      init.optional_single_mie_scattering_texture);
+  std::swap(irradiance_texture_, init.irradiance_texture);
+  std::swap(ground_albedo_samples_, init.ground_albedo_samples);
+  std::swap(group_lambdas_, init.group_lambdas);
+  std::swap(group_luminance_from_radiance_,
+      init.group_luminance_from_radiance);
+  std::swap(group_ground_albedos_, init.group_ground_albedos);
+  std::swap(group_scattering_textures_, init.group_scattering_textures);
+  std::swap(group_single_mie_scattering_textures_,
+      init.group_single_mie_scattering_textures);
+  std::swap(group_irradiance_textures_, init.group_irradiance_textures);
 }
 
 /*
-<p>The utility method <code>ConvertSpectrumToLinearSrgb</code> is implemented
-with a simple numerical integration of the given function, times the CIE color
-matching funtions (with an integration step of 1nm), followed by a matrix
-multiplication:
+<p>Each <code>Step</code> first reads the available results of the timer queries
+issued by the previous steps, to update the estimated GPU time of each kind of
+pass (identified by its shader). It then runs the next passes while the sum of
+their estimated cost is less than the budget. The cost of a pass is the maximum
+of its estimated GPU time and of the CPU time needed to issue it (which can be
+large for the passes compiling a GLSL program). A pass whose GPU time is not
+yet known is only run if it is the first one of the step. Finally, if all the
+passes have been run, the new textures are kept, and the previous ones are
+deleted with the <code>PendingInit</code> state. The framebuffer and viewport
+of the caller are restored at the end:
 */
 
-void Model::ConvertSpectrumToLinearSrgb(
-    const std::vector<double>& wavelengths,
-    const std::vector<double>& spectrum,
-    double* r, double* g, double* b) {
-  double x = 0.0;
-  double y = 0.0;
-  double z = 0.0;
-  const int dlambda = 1;
-  for (int lambda = kLambdaMin; lambda < kLambdaMax; lambda += dlambda) {
-    double value = Interpolate(wavelengths, spectrum, lambda);
-    x += CieColorMatchingFunctionTableValue(lambda, 1) * value;
-    y += CieColorMatchingFunctionTableValue(lambda, 2) * value;
-    z += CieColorMatchingFunctionTableValue(lambda, 3) * value;
+bool Model::Step(double budget_ms) {
+  assert(pending_init_ != nullptr);
+  PendingInit& init = *pending_init_;
+  while (!init.timer_queries.empty()) {
+    GLuint query = init.timer_queries.front().first;
+    GLint available;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+    GLuint64 time_ns;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &time_ns);
+    init.gpu_time_ms[init.timer_queries.front().second] = time_ns * 1e-6;
+    glDeleteQueries(1, &query);
+    init.timer_queries.pop_front();
+  }
+
+  GLint previous_fbo;
+  GLint previous_viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_fbo);
+  glGetIntegerv(GL_VIEWPORT, previous_viewport);
+
+  SwapPendingInitTextures();
+  double cost_ms = 0.0;
+  bool first_pass = true;
+  while (!init.passes.empty()) {
+    const char* shader = init.passes.front().shader;
+    auto gpu_time_ms = init.gpu_time_ms.find(shader);
+    double estimated_gpu_time_ms = 0.0;
+    if (shader != nullptr) {
+      estimated_gpu_time_ms = gpu_time_ms != init.gpu_time_ms.end() ?
+          gpu_time_ms->second : budget_ms;
+    }
+    if (!first_pass && cost_ms + estimated_gpu_time_ms > budget_ms) {
+      break;
+    }
+    Pass pass = std::move(init.passes.front());
+    init.passes.pop_front();
+    GLuint query = 0;
+    if (shader != nullptr) {
+      glGenQueries(1, &query);
+      glBeginQuery(GL_TIME_ELAPSED, query);
+    }
+    auto start = std::chrono::steady_clock::now();
+    pass.run();
+    double cpu_time_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    if (shader != nullptr) {
+      glEndQuery(GL_TIME_ELAPSED);
+      init.timer_queries.emplace_back(query, shader);
+    }
+    cost_ms += std::max(estimated_gpu_time_ms, cpu_time_ms);
+    first_pass = false;
+  }
+  const bool complete = init.passes.empty();
+  if (!complete) {
+    SwapPendingInitTextures();
+  }
+
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+  glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2],
+      previous_viewport[3]);
+  if (complete) {
+    pending_init_.reset();
+  }
+  assert(glGetError() == 0);
+  return complete;
+}
+
+/*
+<p>The <code>Update</code> method computes the precomputed textures for
+atmosphere parameters close to those of a previous model, by correcting the
+multiple scattering of this previous model. Let $L_1$ be the single scattering,
+and $K$ the linear operator which maps a radiance field to the radiance
+scattered once more (i.e. the scattering density, including the light reflected
+on the ground, integrated along each view ray, as done for each order in
+<code>Precompute</code>). The multiple scattering computed by <code>Init</code>
+with $N$ scattering orders is then $M=\sum_{n=2}^N K^{n-1}L_1$, which satisfies
+$M=K(L_1+M)-T$, where $T=K^NL_1$ is the next scattering order. Starting from the
+multiple scattering $M_0=M'$ of the previous model (we use primes for the
+values of the previous model), each iteration computes
+$M_{k+1}=K(L_1+M_k)-T'$, where $L_1$ and $K$ are computed exactly with the new
+parameters, and where $T'=K'(L'_1+M')-M'$. The first iteration thus corrects
+$M'$ with the difference between the next scattering orders of the two models,
+$K(L_1+M')-K'(L'_1+M')$. We then have $M_{k+1}-M=K(M_k-M)+T-T'$, and thus
+$$\Vert M_k-M\Vert\le\rho^k\Vert M'-M\Vert+\frac{\Vert T-T'\Vert}{1-\rho},$$
+where $\rho<1$ is the norm of $K$ (about the ratio between the radiance of two
+successive scattering orders, which is less than 0.3 for Earth-like
+atmospheres). The first term decreases quickly with the number of iterations,
+and the second one is the change of the $(N+1)$-th scattering order, which is
+much smaller than the change of the multiple scattering (about $\rho^{N-1}$
+times the change of the double scattering). The irradiance texture is corrected
+in the same way. Each iteration costs one scattering order, so that
+<code>Update</code> with one iteration saves $N-2$ scattering orders compared to
+<code>Init</code>. Computing $T'$ costs another scattering order, plus the
+single scattering and direct irradiance of the previous model (recomputed with
+its own GLSL header to get $M'$ and $T'$), but $T'$ and the corrections $M'-T'$
+of the scattering and irradiance textures only depend on the previous model.
+We thus compute them only the first time a model is used as previous model,
+and keep them in this model (until its textures change) for the next
+<code>Update</code> calls (e.g. when the user changes the parameters
+continuously, each new model being updated from the same reference model).
+
+<p>Note that the radiance fields $L_1+M_k$ and $L'_1+M'$ are not stored with
+the phase functions applied (the Mie phase function is too peaked to be
+interpolated between the samples of $\nu$), but as in the final scattering
+textures, i.e. with the multiple scattering divided by the Rayleigh phase
+function and added to the single Rayleigh scattering. These textures and the
+single Mie scattering textures can then be passed to the precomputation
+functions in place of the single scattering textures, which thus see the
+radiance of all orders:
+*/
+
+void Model::Update(const Model& previous_model, unsigned int num_iterations) {
+  if (num_iterations == 0 || num_precomputed_wavelengths_ > 3 ||
+      runtime_ground_albedo_ ||
+      previous_model.num_precomputed_wavelengths_ > 3 ||
+      previous_model.runtime_ground_albedo_) {
+    throw std::invalid_argument("Model::Update requires at least one "
+        "iteration, and models in precomputed radiance mode without the "
+        "runtime_ground_albedo option");
+  }
+  assert(&previous_model != this);
+  assert(previous_model.runtime_solar_irradiance_ == runtime_solar_irradiance_);
+  assert(previous_model.texture_sizes_.scattering_width() ==
+      texture_sizes_.scattering_width() &&
+      previous_model.texture_sizes_.scattering_height() ==
+      texture_sizes_.scattering_height() &&
+      previous_model.texture_sizes_.scattering_depth() ==
+      texture_sizes_.scattering_depth() &&
+      previous_model.texture_sizes_.irradiance_width ==
+      texture_sizes_.irradiance_width &&
+      previous_model.texture_sizes_.irradiance_height ==
+      texture_sizes_.irradiance_height);
+  DeleteWavelengthGroups();
+  DeleteUpdateCorrections();
+
+  // The temporary textures: those of Init, plus the ground irradiance (direct
+  // plus indirect), and the indirect irradiance computed at each iteration.
+  GLenum format = rgb_format_supported_ ? GL_RGB : GL_RGBA;
+  auto new_scattering_texture = [&]() {
+    return NewTexture3d(
+        texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height(),
+        texture_sizes_.scattering_depth(),
+        format,
+        half_precision_);
+  };
+  auto new_irradiance_texture = [&]() {
+    return NewTexture2d(
+        texture_sizes_.irradiance_width, texture_sizes_.irradiance_height);
+  };
+  GLuint delta_irradiance_texture = new_irradiance_texture();
+  GLuint delta_rayleigh_scattering_texture = new_scattering_texture();
+  GLuint delta_mie_scattering_texture = new_scattering_texture();
+  GLuint delta_scattering_density_texture = new_scattering_texture();
+  GLuint delta_multiple_scattering_texture = new_scattering_texture();
+  GLuint ground_irradiance_texture = new_irradiance_texture();
+  GLuint indirect_irradiance_texture = new_irradiance_texture();
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  // Compute the transmittance, direct irradiance and single scattering as in
+  // Init.
+  const vec3 lambdas{kLambdaR, kLambdaG, kLambdaB};
+  const std::string header = glsl_header_factory_(lambdas);
+  auto new_density_texture = [&](const Model& model,
+      const std::string& glsl_header) {
+    GLuint texture =
+        NewTexture2d(DENSITY_TEXTURE_WIDTH, DENSITY_TEXTURE_HEIGHT);
+    model.ComputeDensityTexture(texture, glsl_header);
+    return texture;
+  };
+  GLuint density_texture = new_density_texture(*this, header);
+  const mat3 identity{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  std::vector<Pass> passes;
+  Precompute(fbo, density_texture, delta_irradiance_texture,
+      delta_rayleigh_scattering_texture, delta_mie_scattering_texture,
+      delta_scattering_density_texture, delta_multiple_scattering_texture,
+      lambdas, identity, false /* blend */, 1 /* num_scattering_orders */,
+      false /* approximate_multiple_scattering */, &passes);
+  for (const Pass& pass : passes) {
+    pass.run();
+  }
+
+  const GLuint kDrawBuffers[2] = {
+    GL_COLOR_ATTACHMENT0,
+    GL_COLOR_ATTACHMENT1
+  };
+  auto draw_irradiance = [&](GLuint target) {
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, texture_sizes_.irradiance_width,
+        texture_sizes_.irradiance_height);
+    DrawQuad({}, full_screen_quad_vao_);
+  };
+  auto draw_scattering = [&](const Program& program, GLuint target) {
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height());
+    for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+      program.BindInt("layer", layer);
+      DrawQuad({}, full_screen_quad_vao_);
+    }
+  };
+  Program compute_irradiance_sum(
+      kVertexShader, header + kComputeIrradianceSumShader);
+  auto compute_irradiance_sum_texture = [&](GLuint texture0, double weight0,
+      GLuint texture1, double weight1, GLuint target) {
+    compute_irradiance_sum.Use();
+    compute_irradiance_sum.BindTexture2d("irradiance_texture_0", texture0, 0);
+    compute_irradiance_sum.BindTexture2d("irradiance_texture_1", texture1, 1);
+    compute_irradiance_sum.BindVec2("weights", weight0, weight1);
+    draw_irradiance(target);
+  };
+
+  // Applies the scattering operator K of the model whose GLSL header and
+  // density table are 'glsl_header' and 'density_table' to the radiance field
+  // given by 'scattering_texture' and 'single_mie_scattering_texture' (see
+  // above), with the ground irradiance in ground_irradiance_texture. The result
+  // is stored in delta_multiple_scattering_texture, and its irradiance in
+  // 'indirect_irradiance'.
+  auto apply_scattering_operator = [&](const std::string& glsl_header,
+      GLuint density_table, GLuint transmittance_texture,
+      GLuint scattering_texture, GLuint single_mie_scattering_texture,
+      GLuint indirect_irradiance) {
+    Program compute_scattering_density(kVertexShader, kGeometryShader,
+        glsl_header + kComputeScatteringDensityShader);
+    compute_scattering_density.Use();
+    compute_scattering_density.BindTexture2d(
+        "transmittance_texture", transmittance_texture, 0);
+    compute_scattering_density.BindTexture3d(
+        "single_rayleigh_scattering_texture", scattering_texture, 1);
+    compute_scattering_density.BindTexture3d(
+        "single_mie_scattering_texture", single_mie_scattering_texture, 2);
+    compute_scattering_density.BindTexture3d(
+        "multiple_scattering_texture", delta_multiple_scattering_texture, 3);
+    compute_scattering_density.BindTexture2d(
+        "irradiance_texture", ground_irradiance_texture, 4);
+    compute_scattering_density.BindTexture2d(
+        "density_texture", density_table, 5);
+    compute_scattering_density.BindInt("scattering_order", 2);
+    draw_scattering(
+        compute_scattering_density, delta_scattering_density_texture);
+
+    Program compute_indirect_irradiance(
+        kVertexShader, glsl_header + kComputeIndirectIrradianceShader);
+    compute_indirect_irradiance.Use();
+    compute_indirect_irradiance.BindMat3("luminance_from_radiance", identity);
+    compute_indirect_irradiance.BindTexture3d(
+        "single_rayleigh_scattering_texture", scattering_texture, 0);
+    compute_indirect_irradiance.BindTexture3d(
+        "single_mie_scattering_texture", single_mie_scattering_texture, 1);
+    compute_indirect_irradiance.BindTexture3d(
+        "multiple_scattering_texture", delta_multiple_scattering_texture, 2);
+    compute_indirect_irradiance.BindInt("scattering_order", 1);
+    draw_irradiance(indirect_irradiance);
+
+    Program compute_multiple_scattering(kVertexShader, kGeometryShader,
+        glsl_header + kComputeMultipleScatteringShader);
+    compute_multiple_scattering.Use();
+    compute_multiple_scattering.BindMat3("luminance_from_radiance", identity);
+    compute_multiple_scattering.BindTexture2d(
+        "transmittance_texture", transmittance_texture, 0);
+    compute_multiple_scattering.BindTexture3d(
+        "scattering_density_texture", delta_scattering_density_texture, 1);
+    draw_scattering(
+        compute_multiple_scattering, delta_multiple_scattering_texture);
+  };
+
+  // If they are not already computed, compute T', the scattering correction
+  // M' - T' (divided by the Rayleigh phase function) and the irradiance
+  // correction of the previous model, and keep them in the previous model.
+  // For this, compute the single scattering and direct irradiance of the
+  // previous model, and then T' and its irradiance (in
+  // indirect_irradiance_texture).
+  if (previous_model.update_next_scattering_texture_ == 0) {
+    const std::string previous_header =
+        previous_model.glsl_header_factory_(lambdas);
+    GLuint previous_density_texture =
+        new_density_texture(previous_model, previous_header);
+    GLuint previous_delta_rayleigh_scattering_texture =
+        new_scattering_texture();
+    GLuint previous_delta_mie_scattering_texture = new_scattering_texture();
+    GLuint previous_delta_irradiance_texture = new_irradiance_texture();
+    {
+      Program compute_single_scattering(kVertexShader, kGeometryShader,
+          previous_header + kComputeSingleScatteringShader);
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+          previous_delta_mie_scattering_texture, 0);
+      compute_single_scattering.Use();
+      compute_single_scattering.BindMat3("luminance_from_radiance", identity);
+      compute_single_scattering.BindTexture2d(
+          "transmittance_texture", previous_model.transmittance_texture_, 0);
+      compute_single_scattering.BindTexture2d(
+          "density_texture", previous_density_texture, 1);
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+          previous_delta_rayleigh_scattering_texture, 0);
+      glDrawBuffers(2, kDrawBuffers);
+      glViewport(0, 0, texture_sizes_.scattering_width(),
+          texture_sizes_.scattering_height());
+      for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+        compute_single_scattering.BindInt("layer", layer);
+        DrawQuad({}, full_screen_quad_vao_);
+      }
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, 0, 0);
+
+      Program compute_direct_irradiance(
+          kVertexShader, previous_header + kComputeDirectIrradianceShader);
+      compute_direct_irradiance.Use();
+      compute_direct_irradiance.BindTexture2d(
+          "transmittance_texture", previous_model.transmittance_texture_, 0);
+      draw_irradiance(previous_delta_irradiance_texture);
+    }
+    compute_irradiance_sum_texture(previous_delta_irradiance_texture, 1.0,
+        previous_model.irradiance_texture_, 1.0, ground_irradiance_texture);
+    apply_scattering_operator(previous_header, previous_density_texture,
+        previous_model.transmittance_texture_,
+        previous_model.scattering_texture_,
+        previous_delta_mie_scattering_texture, indirect_irradiance_texture);
+    previous_model.update_next_scattering_texture_ = new_scattering_texture();
+    std::swap(previous_model.update_next_scattering_texture_,
+        delta_multiple_scattering_texture);
+
+    previous_model.update_scattering_correction_texture_ =
+        new_scattering_texture();
+    previous_model.update_irradiance_correction_texture_ =
+        new_irradiance_texture();
+    Program compute_scattering_correction(kVertexShader, kGeometryShader,
+        header + kComputeScatteringCorrectionShader);
+    compute_scattering_correction.Use();
+    compute_scattering_correction.BindTexture3d(
+        "previous_scattering_texture", previous_model.scattering_texture_, 0);
+    compute_scattering_correction.BindTexture3d(
+        "previous_single_rayleigh_scattering_texture",
+        previous_delta_rayleigh_scattering_texture, 1);
+    compute_scattering_correction.BindTexture3d(
+        "previous_next_multiple_scattering_texture",
+        previous_model.update_next_scattering_texture_, 2);
+    draw_scattering(compute_scattering_correction,
+        previous_model.update_scattering_correction_texture_);
+    compute_irradiance_sum_texture(previous_model.irradiance_texture_, 1.0,
+        indirect_irradiance_texture, -1.0,
+        previous_model.update_irradiance_correction_texture_);
+
+    glDeleteTextures(1, &previous_delta_irradiance_texture);
+    glDeleteTextures(1, &previous_delta_mie_scattering_texture);
+    glDeleteTextures(1, &previous_delta_rayleigh_scattering_texture);
+    glDeleteTextures(1, &previous_density_texture);
+  }
+
+  // Compute L_1 + M_0 in scattering_texture_, as L_1 + T' + (M' - T'), and the
+  // ground irradiance for M_0. Then, at each iteration, compute M_{k+1} in
+  // scattering_texture_ and the corresponding irradiance.
+  Program compute_corrected_scattering(kVertexShader, kGeometryShader,
+      header + kComputeCorrectedScatteringShader);
+  auto compute_corrected_scattering_texture =
+      [&](GLuint multiple_scattering_texture) {
+    compute_corrected_scattering.Use();
+    compute_corrected_scattering.BindTexture3d(
+        "single_rayleigh_scattering_texture",
+        delta_rayleigh_scattering_texture, 0);
+    compute_corrected_scattering.BindTexture3d(
+        "single_mie_scattering_texture", delta_mie_scattering_texture, 1);
+    compute_corrected_scattering.BindTexture3d(
+        "multiple_scattering_texture", multiple_scattering_texture, 2);
+    compute_corrected_scattering.BindTexture3d(
+        "scattering_correction_texture",
+        previous_model.update_scattering_correction_texture_, 3);
+    draw_scattering(compute_corrected_scattering, scattering_texture_);
+  };
+  compute_corrected_scattering_texture(
+      previous_model.update_next_scattering_texture_);
+  compute_irradiance_sum_texture(delta_irradiance_texture, 1.0,
+      previous_model.irradiance_texture_, 1.0, ground_irradiance_texture);
+  for (unsigned int iteration = 0; iteration < num_iterations; ++iteration) {
+    if (iteration > 0) {
+      compute_irradiance_sum_texture(delta_irradiance_texture, 1.0,
+          irradiance_texture_, 1.0, ground_irradiance_texture);
+    }
+    apply_scattering_operator(header, density_texture, transmittance_texture_,
+        scattering_texture_, delta_mie_scattering_texture,
+        indirect_irradiance_texture);
+    compute_corrected_scattering_texture(delta_multiple_scattering_texture);
+    compute_irradiance_sum_texture(indirect_irradiance_texture, 1.0,
+        previous_model.update_irradiance_correction_texture_, 1.0,
+        irradiance_texture_);
+  }
+
+  // Delete the temporary resources allocated at the begining of this method.
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &indirect_irradiance_texture);
+  glDeleteTextures(1, &ground_irradiance_texture);
+  glDeleteTextures(1, &delta_multiple_scattering_texture);
+  glDeleteTextures(1, &delta_scattering_density_texture);
+  glDeleteTextures(1, &delta_mie_scattering_texture);
+  glDeleteTextures(1, &delta_rayleigh_scattering_texture);
+  glDeleteTextures(1, &delta_irradiance_texture);
+  glDeleteTextures(1, &density_texture);
+  assert(glGetError() == 0);
+}
+
+void Model::DeleteUpdateCorrections() {
+  if (update_next_scattering_texture_ != 0) {
+    glDeleteTextures(1, &update_next_scattering_texture_);
+    glDeleteTextures(1, &update_scattering_correction_texture_);
+    glDeleteTextures(1, &update_irradiance_correction_texture_);
+    update_next_scattering_texture_ = 0;
+    update_scattering_correction_texture_ = 0;
+    update_irradiance_correction_texture_ = 0;
+  }
+}
+
+/*
+<p>The density lookup table used in <code>ScheduleInit</code> and
+<code>Update</code> is computed with the following method. Tabulated densities,
+if provided, are simply uploaded to the texture. Otherwise the table is computed
+from the analytic density profiles, with a shader:
+*/
+
+void Model::ComputeDensityTexture(GLuint density_texture,
+    const std::string& glsl_header) const {
+  if (!tabulated_densities_.empty()) {
+    std::vector<float> texels(4 * DENSITY_TEXTURE_WIDTH, 0.0f);
+    for (int i = 0; i < DENSITY_TEXTURE_WIDTH; ++i) {
+      for (int c = 0; c < 3; ++c) {
+        texels[4 * i + c] = tabulated_densities_[3 * i + c];
+      }
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, density_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DENSITY_TEXTURE_WIDTH,
+        DENSITY_TEXTURE_HEIGHT, GL_RGBA, GL_FLOAT, texels.data());
+    return;
+  }
+  Program compute_density(kVertexShader, glsl_header + kComputeDensityShader);
+  glFramebufferTexture(
+      GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, density_texture, 0);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  glViewport(0, 0, DENSITY_TEXTURE_WIDTH, DENSITY_TEXTURE_HEIGHT);
+  compute_density.Use();
+  DrawQuad({}, full_screen_quad_vao_);
+}
+
+/*
+<p>The <code>Blend</code> method accumulates the weighted textures of each
+model in the textures of this model, with the above shaders and with additive
+blending, as in <code>CombineWavelengthGroups</code>. Note that the scattering
+and irradiance textures are linear functions of the atmosphere parameters in
+the limit of small parameter changes, so that a multilinear interpolation
+between the models precomputed at the vertices of a grid cell is accurate if
+the cell is small enough. This is also true of the transmittance texture, which
+is blended in the same way (blending the optical depth would be more accurate
+for large cells, but would require one more texture per model). The
+framebuffer and viewport of the caller are restored at the end:
+*/
+
+void Model::Blend(const std::vector<const Model*>& models,
+    const std::vector<double>& weights) {
+  assert(!models.empty() && models.size() == weights.size());
+  assert(!runtime_ground_albedo_ &&
+      (num_precomputed_wavelengths_ <= 3 || !runtime_solar_irradiance_));
+  DeleteWavelengthGroups();
+  DeleteUpdateCorrections();
+
+  GLint previous_fbo;
+  GLint previous_viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_fbo);
+  glGetIntegerv(GL_VIEWPORT, previous_viewport);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  Program blend_texture_2d(kVertexShader, kBlendTexture2dShader);
+  Program blend_scattering(
+      kVertexShader, kGeometryShader, kBlendScatteringShader);
+  const GLuint kDrawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
+  auto draw_texture_2d = [&](GLuint source_texture, GLuint texture, int width,
+      int height, float weight, bool blend) {
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, width, height);
+    blend_texture_2d.Use();
+    blend_texture_2d.BindFloat("weight", weight);
+    blend_texture_2d.BindTexture2d("source_texture", source_texture, 0);
+    DrawQuad({blend}, full_screen_quad_vao_);
+  };
+  for (unsigned int i = 0; i < models.size(); ++i) {
+    const Model& model = *models[i];
+    assert(model.num_precomputed_wavelengths_ ==
+        num_precomputed_wavelengths_ &&
+        model.runtime_solar_irradiance_ == runtime_solar_irradiance_ &&
+        model.runtime_ground_albedo_ == runtime_ground_albedo_ &&
+        (model.optional_single_mie_scattering_texture_ != 0) ==
+        (optional_single_mie_scattering_texture_ != 0));
+    assert(model.texture_sizes_.transmittance_width ==
+        texture_sizes_.transmittance_width &&
+        model.texture_sizes_.transmittance_height ==
+        texture_sizes_.transmittance_height &&
+        model.texture_sizes_.scattering_width() ==
+        texture_sizes_.scattering_width() &&
+        model.texture_sizes_.scattering_height() ==
+        texture_sizes_.scattering_height() &&
+        model.texture_sizes_.scattering_depth() ==
+        texture_sizes_.scattering_depth() &&
+        model.texture_sizes_.irradiance_width ==
+        texture_sizes_.irradiance_width &&
+        model.texture_sizes_.irradiance_height ==
+        texture_sizes_.irradiance_height);
+    const float weight = weights[i];
+    const bool blend = i > 0;
+
+    draw_texture_2d(model.transmittance_texture_, transmittance_texture_,
+        texture_sizes_.transmittance_width,
+        texture_sizes_.transmittance_height, weight, blend);
+
+    glFramebufferTexture(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, scattering_texture_, 0);
+    if (optional_single_mie_scattering_texture_ != 0) {
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+          optional_single_mie_scattering_texture_, 0);
+      glDrawBuffers(2, kDrawBuffers);
+    } else {
+      glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    }
+    glViewport(0, 0, texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height());
+    blend_scattering.Use();
+    blend_scattering.BindFloat("weight", weight);
+    blend_scattering.BindTexture3d(
+        "source_scattering_texture", model.scattering_texture_, 0);
+    blend_scattering.BindTexture3d("source_single_mie_scattering_texture",
+        model.optional_single_mie_scattering_texture_, 1);
+    for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+      blend_scattering.BindInt("layer", layer);
+      DrawQuad({blend, blend}, full_screen_quad_vao_);
+    }
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, 0, 0);
+
+    draw_texture_2d(model.irradiance_texture_, irradiance_texture_,
+        texture_sizes_.irradiance_width, texture_sizes_.irradiance_height,
+        weight, blend);
+  }
+
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+  glDeleteFramebuffers(1, &fbo);
+  glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2],
+      previous_viewport[3]);
+}
+
+/*
+<p>The <code>GetTextures</code> and <code>SetTextures</code> methods simply
+read back and upload the precomputed textures, as RGBA floats (the OpenGL
+driver converts them from or to the internal format of the textures, e.g. half
+precision floats):
+*/
+
+void Model::GetTextures(PrecomputedTextures* textures) const {
+  auto get_texture = [](GLenum target, GLuint texture, int size,
+      std::vector<float>* pixels) {
+    pixels->resize(4 * size);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(target, texture);
+    glGetTexImage(target, 0, GL_RGBA, GL_FLOAT, pixels->data());
+  };
+  const int scattering_size = texture_sizes_.scattering_width() *
+      texture_sizes_.scattering_height() * texture_sizes_.scattering_depth();
+  get_texture(GL_TEXTURE_2D, transmittance_texture_,
+      texture_sizes_.transmittance_width * texture_sizes_.transmittance_height,
+      &textures->transmittance);
+  get_texture(GL_TEXTURE_3D, scattering_texture_, scattering_size,
+      &textures->scattering);
+  if (optional_single_mie_scattering_texture_ != 0) {
+    get_texture(GL_TEXTURE_3D, optional_single_mie_scattering_texture_,
+        scattering_size, &textures->single_mie_scattering);
+  } else {
+    textures->single_mie_scattering.clear();
+  }
+  get_texture(GL_TEXTURE_2D, irradiance_texture_,
+      texture_sizes_.irradiance_width * texture_sizes_.irradiance_height,
+      &textures->irradiance);
+}
+
+void Model::SetTextures(const PrecomputedTextures& textures) {
+  const size_t scattering_size = 4 * texture_sizes_.scattering_width() *
+      texture_sizes_.scattering_height() * texture_sizes_.scattering_depth();
+  if (runtime_ground_albedo_ ||
+      (num_precomputed_wavelengths_ > 3 && runtime_solar_irradiance_)) {
+    throw std::invalid_argument("Model::SetTextures does not support the "
+        "runtime_ground_albedo option, nor the runtime_solar_irradiance "
+        "option in precomputed illuminance mode");
+  }
+  if (textures.transmittance.size() != 4 * static_cast<size_t>(
+          texture_sizes_.transmittance_width *
+          texture_sizes_.transmittance_height) ||
+      textures.scattering.size() != scattering_size ||
+      textures.single_mie_scattering.size() !=
+          (optional_single_mie_scattering_texture_ != 0 ?
+              scattering_size : 0) ||
+      textures.irradiance.size() != 4 * static_cast<size_t>(
+          texture_sizes_.irradiance_width *
+          texture_sizes_.irradiance_height)) {
+    throw std::invalid_argument("Unexpected precomputed texture sizes");
+  }
+  DeleteWavelengthGroups();
+  DeleteUpdateCorrections();
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, transmittance_texture_);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_sizes_.transmittance_width,
+      texture_sizes_.transmittance_height, GL_RGBA, GL_FLOAT,
+      textures.transmittance.data());
+  glBindTexture(GL_TEXTURE_3D, scattering_texture_);
+  glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, texture_sizes_.scattering_width(),
+      texture_sizes_.scattering_height(), texture_sizes_.scattering_depth(),
+      GL_RGBA, GL_FLOAT, textures.scattering.data());
+  if (optional_single_mie_scattering_texture_ != 0) {
+    glBindTexture(GL_TEXTURE_3D, optional_single_mie_scattering_texture_);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0,
+        texture_sizes_.scattering_width(), texture_sizes_.scattering_height(),
+        texture_sizes_.scattering_depth(), GL_RGBA, GL_FLOAT,
+        textures.single_mie_scattering.data());
+  }
+  glBindTexture(GL_TEXTURE_2D, irradiance_texture_);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_sizes_.irradiance_width,
+      texture_sizes_.irradiance_height, GL_RGBA, GL_FLOAT,
+      textures.irradiance.data());
+}
+
+/*
+<p>The <code>SetProgramUniforms</code> method is straightforward: it simply
+binds the precomputed textures to the specified texture units, and then sets
+the corresponding uniforms in the user provided program to the index of these
+texture units.
+*/
+
+void Model::SetProgramUniforms(
+    GLuint program,
+    GLuint transmittance_texture_unit,
+    GLuint scattering_texture_unit,
+    GLuint irradiance_texture_unit,
+    GLuint single_mie_scattering_texture_unit) const {
+  glActiveTexture(GL_TEXTURE0 + transmittance_texture_unit);
+  glBindTexture(GL_TEXTURE_2D, transmittance_texture_);
+  glUniform1i(glGetUniformLocation(program, "transmittance_texture"),
+      transmittance_texture_unit);
+
+  glActiveTexture(GL_TEXTURE0 + scattering_texture_unit);
+  glBindTexture(GL_TEXTURE_3D, scattering_texture_);
+  glUniform1i(glGetUniformLocation(program, "scattering_texture"),
+      scattering_texture_unit);
+
+  glActiveTexture(GL_TEXTURE0 + irradiance_texture_unit);
+  glBindTexture(GL_TEXTURE_2D, irradiance_texture_);
+  glUniform1i(glGetUniformLocation(program, "irradiance_texture"),
+      irradiance_texture_unit);
+
+  if (optional_single_mie_scattering_texture_ != 0) {
+    glActiveTexture(GL_TEXTURE0 + single_mie_scattering_texture_unit);
+    glBindTexture(GL_TEXTURE_3D, optional_single_mie_scattering_texture_);
+    glUniform1i(glGetUniformLocation(program, "single_mie_scattering_texture"),
+        single_mie_scattering_texture_unit);
+  }
+
+  if (runtime_solar_irradiance_) {
+    auto set_uniform = [program](const char* name, const vec3& value) {
+      glUniform3f(glGetUniformLocation(program, name),
+          value[0], value[1], value[2]);
+    };
+    set_uniform("SKY_SPECTRAL_RADIANCE_TO_LUMINANCE",
+        sky_spectral_radiance_to_luminance_);
+    set_uniform("SUN_SPECTRAL_RADIANCE_TO_LUMINANCE",
+        sun_spectral_radiance_to_luminance_);
+    set_uniform("SKY_RADIANCE_SCALE", sky_radiance_scale_);
+    set_uniform("SUN_RADIANCE_SCALE", sun_radiance_scale_);
+  }
+}
+
+/*
+<p>With the <code>runtime_solar_irradiance</code> option, changing the solar
+irradiance simply requires updating the values of the above uniforms, computed
+as described in the constructor. In precomputed illuminance mode, however, the
+illuminance textures must also be combined again from the irradiance textures
+precomputed for each group of wavelengths (and the sky view and aerial
+perspective textures, which are computed from them, must then be baked again):
+*/
+
+void Model::SetSolarIrradiance(const std::vector<double>& solar_irradiance) {
+  assert(runtime_solar_irradiance_);
+  assert(solar_irradiance.size() == wavelengths_.size());
+  ComputeSolarIrradianceFactors(solar_irradiance);
+  if (!group_scattering_textures_.empty()) {
+    CombineWavelengthGroups();
   }
-  *r = MAX_LUMINOUS_EFFICACY *
-      (XYZ_TO_SRGB[0] * x + XYZ_TO_SRGB[1] * y + XYZ_TO_SRGB[2] * z) * dlambda;
-  *g = MAX_LUMINOUS_EFFICACY *
-      (XYZ_TO_SRGB[3] * x + XYZ_TO_SRGB[4] * y + XYZ_TO_SRGB[5] * z) * dlambda;
-  *b = MAX_LUMINOUS_EFFICACY *
-      (XYZ_TO_SRGB[6] * x + XYZ_TO_SRGB[7] * y + XYZ_TO_SRGB[8] * z) * dlambda;
+}
+
+void Model::ComputeSolarIrradianceFactors(
+    const std::vector<double>& solar_irradiance) {
+  solar_irradiance_ = solar_irradiance;
+  // Compute the values for the SKY_RADIANCE_TO_LUMINANCE constant. In theory
+  // this should be 1 in precomputed illuminance mode (because the precomputed
+  // textures already contain illuminance values). In practice, however,
+  // storing true illuminance values in half precision textures yields
+  // artefacts (because the values are too large), so we store illuminance
+  // values divided by MAX_LUMINOUS_EFFICACY instead. This is why, in
+  // precomputed illuminance mode, we set SKY_RADIANCE_TO_LUMINANCE to
+  // MAX_LUMINOUS_EFFICACY.
+  bool precompute_illuminance = num_precomputed_wavelengths_ > 3;
+  vec3& sky_k = sky_spectral_radiance_to_luminance_;
+  if (precompute_illuminance) {
+    sky_k = {{MAX_LUMINOUS_EFFICACY, MAX_LUMINOUS_EFFICACY,
+        MAX_LUMINOUS_EFFICACY}};
+  } else {
+    ComputeSpectralRadianceToLuminanceFactors(wavelengths_, solar_irradiance,
+        -3 /* lambda_power */, &sky_k[0], &sky_k[1], &sky_k[2]);
+  }
+  // Compute the values for the SUN_RADIANCE_TO_LUMINANCE constant.
+  vec3& sun_k = sun_spectral_radiance_to_luminance_;
+  ComputeSpectralRadianceToLuminanceFactors(wavelengths_, solar_irradiance,
+      0 /* lambda_power */, &sun_k[0], &sun_k[1], &sun_k[2]);
+  // Compute the values for the *_RADIANCE_SCALE constants. With the
+  // runtime_solar_irradiance option, the precomputed textures and the solar
+  // irradiance in ATMOSPHERE are for a unit solar irradiance, and must thus be
+  // multiplied with the solar irradiance at kLambdaR, kLambdaG and kLambdaB
+  // (except the precomputed illuminance textures, which already include the
+  // solar irradiance, see CombineWavelengthGroups).
+  vec3 solar_rgb{{
+    Interpolate(wavelengths_, solar_irradiance, kLambdaR),
+    Interpolate(wavelengths_, solar_irradiance, kLambdaG),
+    Interpolate(wavelengths_, solar_irradiance, kLambdaB)
+  }};
+  vec3 one{{1.0, 1.0, 1.0}};
+  sun_radiance_scale_ = runtime_solar_irradiance_ ? solar_rgb : one;
+  sky_radiance_scale_ = runtime_solar_irradiance_ && !precompute_illuminance ?
+      solar_rgb : one;
+}
+
+/*
+<p>Similarly, with the <code>runtime_ground_albedo</code> option, changing the
+ground albedo requires combining the textures precomputed for each ground
+albedo sample again:
+*/
+
+void Model::SetGroundAlbedo(const std::vector<double>& ground_albedo) {
+  assert(runtime_ground_albedo_);
+  assert(ground_albedo.size() == wavelengths_.size());
+  ground_albedo_ = ground_albedo;
+  precomputed_ground_albedo_ = ground_albedo;
+  if (!group_scattering_textures_.empty()) {
+    CombineWavelengthGroups();
+  }
+}
+
+/*
+<p>The final textures are combined from the textures precomputed for each group
+of wavelengths (and for each ground albedo sample) by accumulating them in the
+final textures, with the above <code>kCombineScatteringShader</code> and
+<code>kCombineIrradianceShader</code>. For this we use, for each group, the
+matrix converting irradiance to illuminance computed in <code>Init</code> (or
+the identity matrix in precomputed irradiance mode), with each column
+multiplied by the solar irradiance at the corresponding wavelength (with the
+<code>runtime_solar_irradiance</code> option in precomputed illuminance mode)
+and by the Lagrange basis polynomial of the group's ground albedo sample,
+evaluated at the ground albedo for this wavelength (with the
+<code>runtime_ground_albedo</code> option). The framebuffer and viewport of the
+caller are restored at the end:
+*/
+
+void Model::CombineWavelengthGroups() {
+  GLint previous_fbo;
+  GLint previous_viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_fbo);
+  glGetIntegerv(GL_VIEWPORT, previous_viewport);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  Program combine_scattering(
+      kVertexShader, kGeometryShader, kCombineScatteringShader);
+  Program combine_irradiance(kVertexShader, kCombineIrradianceShader);
+  const GLuint kDrawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
+  for (unsigned int i = 0; i < group_lambdas_.size(); ++i) {
+    mat3 luminance_from_radiance = group_luminance_from_radiance_[i];
+    for (int j = 0; j < 3; ++j) {
+      const double lambda = group_lambdas_[i][j];
+      double weight = 1.0;
+      if (runtime_solar_irradiance_ && num_precomputed_wavelengths_ > 3) {
+        weight *= Interpolate(wavelengths_, solar_irradiance_, lambda);
+      }
+      if (runtime_ground_albedo_) {
+        const double ground_albedo =
+            Interpolate(wavelengths_, ground_albedo_, lambda);
+        const double sample = group_ground_albedos_[i];
+        for (double other_sample : ground_albedo_samples_) {
+          if (other_sample != sample) {
+            weight *= (ground_albedo - other_sample) / (sample - other_sample);
+          }
+        }
+      }
+      for (int k = 0; k < 3; ++k) {
+        luminance_from_radiance[3 * k + j] *= weight;
+      }
+    }
+    bool blend = i > 0;
+
+    glFramebufferTexture(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, scattering_texture_, 0);
+    if (optional_single_mie_scattering_texture_ != 0) {
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+          optional_single_mie_scattering_texture_, 0);
+      glDrawBuffers(2, kDrawBuffers);
+    } else {
+      glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    }
+    glViewport(0, 0, texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height());
+    combine_scattering.Use();
+    combine_scattering.BindMat3(
+        "luminance_from_radiance", luminance_from_radiance);
+    combine_scattering.BindTexture3d(
+        "group_scattering_texture", group_scattering_textures_[i], 0);
+    combine_scattering.BindTexture3d("group_single_mie_scattering_texture",
+        group_single_mie_scattering_textures_[i], 1);
+    for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+      combine_scattering.BindInt("layer", layer);
+      DrawQuad({blend, blend}, full_screen_quad_vao_);
+    }
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, 0, 0);
+
+    glFramebufferTexture(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, irradiance_texture_, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, texture_sizes_.irradiance_width,
+        texture_sizes_.irradiance_height);
+    combine_irradiance.Use();
+    combine_irradiance.BindMat3(
+        "luminance_from_radiance", luminance_from_radiance);
+    combine_irradiance.BindTexture2d(
+        "group_irradiance_texture", group_irradiance_textures_[i], 0);
+    DrawQuad({blend}, full_screen_quad_vao_);
+  }
+
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+  glDeleteFramebuffers(1, &fbo);
+  glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2],
+      previous_viewport[3]);
+}
+
+void Model::DeleteWavelengthGroups() {
+  for (unsigned int i = 0; i < group_lambdas_.size(); ++i) {
+    glDeleteTextures(1, &group_scattering_textures_[i]);
+    glDeleteTextures(1, &group_single_mie_scattering_textures_[i]);
+    glDeleteTextures(1, &group_irradiance_textures_[i]);
+  }
+  group_lambdas_.clear();
+  group_luminance_from_radiance_.clear();
+  group_ground_albedos_.clear();
+  group_scattering_textures_.clear();
+  group_single_mie_scattering_textures_.clear();
+  group_irradiance_textures_.clear();
+}
+
+/*
+<p>The sky view texture is computed by rendering a full screen quad with the
+above <code>kComputeSkyViewShader</code>, in a temporary framebuffer object
+(the program and the texture are created on the first call, and the texture is
+reallocated only if its size changes). The framebuffer and viewport of the
+caller are restored at the end:
+*/
+
+void Model::BakeSkyView(const std::array<double, 3>& camera,
+    const std::array<double, 3>& sun_direction, int width, int height) {
+  if (sky_view_program_ == 0) {
+    sky_view_program_ = Program(kVertexShader,
+        glsl_header_factory_({kLambdaR, kLambdaG, kLambdaB}) +
+        kComputeSkyViewShader).Release();
+  }
+  if (sky_view_size_ != std::array<int, 2>{{width, height}}) {
+    if (sky_view_texture_ != 0) {
+      glDeleteTextures(1, &sky_view_texture_);
+    }
+    sky_view_texture_ = NewTexture2d(width, height);
+    sky_view_size_ = {{width, height}};
+  }
+  sky_view_camera_ = camera;
+  sky_view_sun_direction_ = sun_direction;
+
+  GLint previous_fbo;
+  GLint previous_viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_fbo);
+  glGetIntegerv(GL_VIEWPORT, previous_viewport);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      sky_view_texture_, 0);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  glViewport(0, 0, width, height);
+
+  const GLuint program = sky_view_program_;
+  glUseProgram(program);
+  SetProgramUniforms(program, 0, 1, 2, 3);
+  glUniform3f(glGetUniformLocation(program, "camera"),
+      camera[0], camera[1], camera[2]);
+  glUniform3f(glGetUniformLocation(program, "sun_direction"),
+      sun_direction[0], sun_direction[1], sun_direction[2]);
+  glUniform2f(glGetUniformLocation(program, "size"), width, height);
+  DrawQuad({}, full_screen_quad_vao_);
+
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+  glDeleteFramebuffers(1, &fbo);
+  glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2],
+      previous_viewport[3]);
+}
+
+void Model::SetSkyViewUniforms(GLuint program,
+    GLuint sky_view_texture_unit) const {
+  glActiveTexture(GL_TEXTURE0 + sky_view_texture_unit);
+  glBindTexture(GL_TEXTURE_2D, sky_view_texture_);
+  glUniform1i(glGetUniformLocation(program, "sky_view_texture"),
+      sky_view_texture_unit);
+  glUniform3f(glGetUniformLocation(program, "sky_view_camera"),
+      sky_view_camera_[0], sky_view_camera_[1], sky_view_camera_[2]);
+  glUniform3f(glGetUniformLocation(program, "sky_view_sun_direction"),
+      sky_view_sun_direction_[0], sky_view_sun_direction_[1],
+      sky_view_sun_direction_[2]);
+}
+
+/*
+<p>The aerial perspective volume is computed by rendering each of its depth
+slices with the above <code>kComputeAerialPerspectiveShader</code>, in a
+temporary framebuffer object (the program and the volume textures are created
+on the first call, and are reallocated only if the volume size changes). The
+framebuffer and viewport of the caller are restored at the end:
+*/
+
+void Model::BakeAerialPerspective(const std::array<double, 3>& camera,
+    const std::array<double, 3>& sun_direction,
+    const std::array<float, 9>& model_from_clip, double max_distance,
+    int width, int height, int depth) {
+  if (aerial_perspective_program_ == 0) {
+    aerial_perspective_program_ = Program(kVertexShader, kGeometryShader,
+        glsl_header_factory_({kLambdaR, kLambdaG, kLambdaB}) +
+        kComputeAerialPerspectiveShader).Release();
+  }
+  if (aerial_perspective_size_ != std::array<int, 3>{{width, height, depth}}) {
+    if (aerial_perspective_scattering_texture_ != 0) {
+      glDeleteTextures(1, &aerial_perspective_scattering_texture_);
+      glDeleteTextures(1, &aerial_perspective_transmittance_texture_);
+    }
+    GLenum format = rgb_format_supported_ ? GL_RGB : GL_RGBA;
+    aerial_perspective_scattering_texture_ =
+        NewTexture3d(width, height, depth, format, half_precision_);
+    aerial_perspective_transmittance_texture_ =
+        NewTexture3d(width, height, depth, format, half_precision_);
+    aerial_perspective_size_ = {{width, height, depth}};
+  }
+  aerial_perspective_max_distance_ = max_distance;
+
+  GLint previous_fbo;
+  GLint previous_viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_fbo);
+  glGetIntegerv(GL_VIEWPORT, previous_viewport);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      aerial_perspective_scattering_texture_, 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+      aerial_perspective_transmittance_texture_, 0);
+  const GLenum kDrawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(2, kDrawBuffers);
+  glViewport(0, 0, width, height);
+
+  const GLuint program = aerial_perspective_program_;
+  glUseProgram(program);
+  SetProgramUniforms(program, 0, 1, 2, 3);
+  glUniform3f(glGetUniformLocation(program, "camera"),
+      camera[0], camera[1], camera[2]);
+  glUniform3f(glGetUniformLocation(program, "sun_direction"),
+      sun_direction[0], sun_direction[1], sun_direction[2]);
+  glUniformMatrix3fv(glGetUniformLocation(program, "model_from_clip"),
+      1, true /* transpose */, model_from_clip.data());
+  glUniform1f(glGetUniformLocation(program, "max_distance"), max_distance);
+  glUniform3f(glGetUniformLocation(program, "size"), width, height, depth);
+  for (int layer = 0; layer < depth; ++layer) {
+    glUniform1i(glGetUniformLocation(program, "layer"), layer);
+    DrawQuad({}, full_screen_quad_vao_);
+  }
+
+  glUseProgram(0);
+  glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+  glDeleteFramebuffers(1, &fbo);
+  glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2],
+      previous_viewport[3]);
+}
+
+void Model::SetAerialPerspectiveUniforms(
+    GLuint program,
+    GLuint aerial_perspective_scattering_texture_unit,
+    GLuint aerial_perspective_transmittance_texture_unit) const {
+  glActiveTexture(GL_TEXTURE0 + aerial_perspective_scattering_texture_unit);
+  glBindTexture(GL_TEXTURE_3D, aerial_perspective_scattering_texture_);
+  glUniform1i(
+      glGetUniformLocation(program, "aerial_perspective_scattering_texture"),
+      aerial_perspective_scattering_texture_unit);
+
+  glActiveTexture(GL_TEXTURE0 + aerial_perspective_transmittance_texture_unit);
+  glBindTexture(GL_TEXTURE_3D, aerial_perspective_transmittance_texture_);
+  glUniform1i(
+      glGetUniformLocation(program, "aerial_perspective_transmittance_texture"),
+      aerial_perspective_transmittance_texture_unit);
+
+  glUniform1f(glGetUniformLocation(program, "aerial_perspective_max_distance"),
+      aerial_perspective_max_distance_);
+}
+
+/*
+<p>The utility method <code>ConvertSpectrumToLinearSrgb</code> is implemented
+with a simple numerical integration of the given function, times the CIE color
+matching funtions (with an integration step of 1nm), followed by a matrix
+multiplication. Since this is a linear function of the spectrum, these
+computations are folded into a weight matrix by
+<a href="spectrum.h.html"><code>SpectrumToSrgbConverter</code></a>, which
+should be used directly to convert many spectra with the same wavelengths:
+*/
+
+void Model::ConvertSpectrumToLinearSrgb(
+    const std::vector<double>& wavelengths,
+    const std::vector<double>& spectrum,
+    double* r, double* g, double* b) {
+  assert(spectrum.size() == wavelengths.size());
+  SpectrumToSrgbConverter(wavelengths).Convert(spectrum.data(), r, g, b);
 }
 
 /*
@@ -1047,6 +2851,7 @@ explained by the inline comments below.
 */
 void Model::Precompute(
     GLuint fbo,
+    GLuint density_texture,
     GLuint delta_irradiance_texture,
     GLuint delta_rayleigh_scattering_texture,
     GLuint delta_mie_scattering_texture,
@@ -1055,163 +2860,244 @@ void Model::Precompute(
     const vec3& lambdas,
     const mat3& luminance_from_radiance,
     bool blend,
-    unsigned int num_scattering_orders) {
+    unsigned int num_scattering_orders,
+    bool approximate_multiple_scattering,
+    std::vector<Pass>* passes) {
   // The precomputations require specific GLSL programs, for each precomputation
-  // step. We create and compile them here (they are automatically destroyed
-  // when this method returns, via the Program destructor).
+  // step. We create them here, and compile them when they are first used (they
+  // are automatically destroyed with the last pass using them, via the Program
+  // destructor).
   std::string header = glsl_header_factory_(lambdas);
-  Program compute_transmittance(
-      kVertexShader, header + kComputeTransmittanceShader);
-  Program compute_direct_irradiance(
-      kVertexShader, header + kComputeDirectIrradianceShader);
-  Program compute_single_scattering(kVertexShader, kGeometryShader,
-      header + kComputeSingleScatteringShader);
-  Program compute_scattering_density(kVertexShader, kGeometryShader,
-      header + kComputeScatteringDensityShader);
-  Program compute_indirect_irradiance(
-      kVertexShader, header + kComputeIndirectIrradianceShader);
-  Program compute_multiple_scattering(kVertexShader, kGeometryShader,
+  auto compute_transmittance = std::make_shared<LazyProgram>(
+      kVertexShader, "", header + kComputeTransmittanceShader);
+  auto compute_direct_irradiance = std::make_shared<LazyProgram>(
+      kVertexShader, "", header + kComputeDirectIrradianceShader);
+  auto compute_single_scattering = std::make_shared<LazyProgram>(
+      kVertexShader, kGeometryShader, header + kComputeSingleScatteringShader);
+  auto compute_scattering_density = std::make_shared<LazyProgram>(
+      kVertexShader, kGeometryShader, header + kComputeScatteringDensityShader);
+  auto compute_indirect_irradiance = std::make_shared<LazyProgram>(
+      kVertexShader, "", header + kComputeIndirectIrradianceShader);
+  auto compute_multiple_scattering = std::make_shared<LazyProgram>(
+      kVertexShader, kGeometryShader,
       header + kComputeMultipleScatteringShader);
 
-  const GLuint kDrawBuffers[4] = {
-    GL_COLOR_ATTACHMENT0,
-    GL_COLOR_ATTACHMENT1,
-    GL_COLOR_ATTACHMENT2,
-    GL_COLOR_ATTACHMENT3
+  // The textures computed by the passes below (the members may be swapped with
+  // other textures before the passes are run, see Init).
+  const GLuint transmittance_texture = transmittance_texture_;
+  const GLuint scattering_texture = scattering_texture_;
+  const GLuint single_mie_scattering_texture =
+      optional_single_mie_scattering_texture_;
+  const GLuint irradiance_texture = irradiance_texture_;
+
+  // Each pass starts by binding 'fbo' with the given color attachments (and no
+  // others), and by setting the viewport and the blend function used to
+  // accumulate the results in the final textures (blending is then enabled in
+  // DrawQuad for the desired attachments).
+  auto bind_framebuffer = [fbo](const std::vector<GLuint>& textures,
+      int width, int height) {
+    const GLuint kDrawBuffers[4] = {
+      GL_COLOR_ATTACHMENT0,
+      GL_COLOR_ATTACHMENT1,
+      GL_COLOR_ATTACHMENT2,
+      GL_COLOR_ATTACHMENT3
+    };
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    for (unsigned int i = 0; i < 4; ++i) {
+      glFramebufferTexture(GL_FRAMEBUFFER, kDrawBuffers[i],
+          i < textures.size() ? textures[i] : 0, 0);
+    }
+    glDrawBuffers(textures.size(), kDrawBuffers);
+    glViewport(0, 0, width, height);
+    glDisable(GL_BLEND);
+    glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
+  };
+  auto bind_irradiance_framebuffer = [=](const std::vector<GLuint>& textures) {
+    bind_framebuffer(textures, texture_sizes_.irradiance_width,
+        texture_sizes_.irradiance_height);
+  };
+  auto bind_scattering_framebuffer = [=](const std::vector<GLuint>& textures) {
+    bind_framebuffer(textures, texture_sizes_.scattering_width(),
+        texture_sizes_.scattering_height());
   };
-  glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
-  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
 
   // Compute the transmittance, and store it in transmittance_texture_.
-  glFramebufferTexture(
-      GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, transmittance_texture_, 0);
-  glDrawBuffer(GL_COLOR_ATTACHMENT0);
-  glViewport(0, 0, TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT);
-  compute_transmittance.Use();
-  DrawQuad({}, full_screen_quad_vao_);
+  passes->push_back({kComputeTransmittanceShader, [=]() {
+    bind_framebuffer({transmittance_texture},
+        texture_sizes_.transmittance_width,
+        texture_sizes_.transmittance_height);
+    const Program& program = compute_transmittance->Get();
+    program.Use();
+    program.BindTexture2d("density_texture", density_texture, 0);
+    DrawQuad({}, full_screen_quad_vao_);
+  }});
 
   // Compute the direct irradiance, store it in delta_irradiance_texture and,
   // depending on 'blend', either initialize irradiance_texture_ with zeros or
   // leave it unchanged (we don't want the direct irradiance in
   // irradiance_texture_, but only the irradiance from the sky).
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-      delta_irradiance_texture, 0);
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
-      irradiance_texture_, 0);
-  glDrawBuffers(2, kDrawBuffers);
-  glViewport(0, 0, IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
-  compute_direct_irradiance.Use();
-  compute_direct_irradiance.BindTexture2d(
-      "transmittance_texture", transmittance_texture_, 0);
-  DrawQuad({false, blend}, full_screen_quad_vao_);
+  passes->push_back({kComputeDirectIrradianceShader, [=]() {
+    bind_irradiance_framebuffer({delta_irradiance_texture, irradiance_texture});
+    const Program& program = compute_direct_irradiance->Get();
+    program.Use();
+    program.BindTexture2d("transmittance_texture", transmittance_texture, 0);
+    DrawQuad({false, blend}, full_screen_quad_vao_);
+  }});
 
   // Compute the rayleigh and mie single scattering, store them in
   // delta_rayleigh_scattering_texture and delta_mie_scattering_texture, and
   // either store them or accumulate them in scattering_texture_ and
   // optional_single_mie_scattering_texture_.
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-      delta_rayleigh_scattering_texture, 0);
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
-      delta_mie_scattering_texture, 0);
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
-      scattering_texture_, 0);
-  if (optional_single_mie_scattering_texture_ != 0) {
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3,
-        optional_single_mie_scattering_texture_, 0);
-    glDrawBuffers(4, kDrawBuffers);
-  } else {
-    glDrawBuffers(3, kDrawBuffers);
-  }
-  glViewport(0, 0, SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT);
-  compute_single_scattering.Use();
-  compute_single_scattering.BindMat3(
-      "luminance_from_radiance", luminance_from_radiance);
-  compute_single_scattering.BindTexture2d(
-      "transmittance_texture", transmittance_texture_, 0);
-  for (unsigned int layer = 0; layer < SCATTERING_TEXTURE_DEPTH; ++layer) {
-    compute_single_scattering.BindInt("layer", layer);
-    DrawQuad({false, false, blend, blend}, full_screen_quad_vao_);
+  for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+    passes->push_back({kComputeSingleScatteringShader, [=]() {
+      std::vector<GLuint> textures = {delta_rayleigh_scattering_texture,
+          delta_mie_scattering_texture, scattering_texture};
+      if (single_mie_scattering_texture != 0) {
+        textures.push_back(single_mie_scattering_texture);
+      }
+      bind_scattering_framebuffer(textures);
+      const Program& program = compute_single_scattering->Get();
+      program.Use();
+      program.BindMat3("luminance_from_radiance", luminance_from_radiance);
+      program.BindTexture2d("transmittance_texture", transmittance_texture, 0);
+      program.BindTexture2d("density_texture", density_texture, 1);
+      program.BindInt("layer", layer);
+      DrawQuad({false, false, blend, blend}, full_screen_quad_vao_);
+    }});
   }
 
-  // Compute the 2nd, 3rd and 4th order of scattering, in sequence.
-  for (unsigned int scattering_order = 2;
-       scattering_order <= num_scattering_orders;
-       ++scattering_order) {
-    // Compute the scattering density, and store it in
-    // delta_scattering_density_texture.
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-        delta_scattering_density_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, 0, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, 0, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, 0, 0);
-    glDrawBuffer(GL_COLOR_ATTACHMENT0);
-    glViewport(0, 0, SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT);
-    compute_scattering_density.Use();
-    compute_scattering_density.BindTexture2d(
-        "transmittance_texture", transmittance_texture_, 0);
-    compute_scattering_density.BindTexture3d(
-        "single_rayleigh_scattering_texture",
-        delta_rayleigh_scattering_texture,
-        1);
-    compute_scattering_density.BindTexture3d(
-        "single_mie_scattering_texture", delta_mie_scattering_texture, 2);
-    compute_scattering_density.BindTexture3d(
-        "multiple_scattering_texture", delta_multiple_scattering_texture, 3);
-    compute_scattering_density.BindTexture2d(
-        "irradiance_texture", delta_irradiance_texture, 4);
-    compute_scattering_density.BindInt("scattering_order", scattering_order);
-    for (unsigned int layer = 0; layer < SCATTERING_TEXTURE_DEPTH; ++layer) {
-      compute_scattering_density.BindInt("layer", layer);
+  // Computes the indirect irradiance for the given scattering order, stores it
+  // in delta_irradiance_texture and accumulates it in irradiance_texture_.
+  auto add_indirect_irradiance_pass = [=](int scattering_order) {
+    passes->push_back({kComputeIndirectIrradianceShader, [=]() {
+      bind_irradiance_framebuffer(
+          {delta_irradiance_texture, irradiance_texture});
+      const Program& program = compute_indirect_irradiance->Get();
+      program.Use();
+      program.BindMat3("luminance_from_radiance", luminance_from_radiance);
+      program.BindTexture3d("single_rayleigh_scattering_texture",
+          delta_rayleigh_scattering_texture, 0);
+      program.BindTexture3d(
+          "single_mie_scattering_texture", delta_mie_scattering_texture, 1);
+      program.BindTexture3d("multiple_scattering_texture",
+          delta_multiple_scattering_texture, 2);
+      program.BindInt("scattering_order", scattering_order);
+      DrawQuad({false, true}, full_screen_quad_vao_);
+    }});
+  };
+
+  // Computes the multiple scattering from delta_scattering_density_texture,
+  // stores it in delta_multiple_scattering_texture, and accumulates it in
+  // scattering_texture_.
+  auto add_multiple_scattering_passes = [=]() {
+    for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+      passes->push_back({kComputeMultipleScatteringShader, [=]() {
+        bind_scattering_framebuffer(
+            {delta_multiple_scattering_texture, scattering_texture});
+        const Program& program = compute_multiple_scattering->Get();
+        program.Use();
+        program.BindMat3("luminance_from_radiance", luminance_from_radiance);
+        program.BindTexture2d(
+            "transmittance_texture", transmittance_texture, 0);
+        program.BindTexture3d("scattering_density_texture",
+            delta_scattering_density_texture, 1);
+        program.BindInt("layer", layer);
+        DrawQuad({false, true}, full_screen_quad_vao_);
+      }});
+    }
+  };
+
+  // In approximate mode (see InitApproximate), compute all the scattering
+  // orders at once, instead of order by order below.
+  if (approximate_multiple_scattering) {
+    // Compute the indirect irradiance due to single scattering (this must be
+    // done before delta_rayleigh_scattering_texture is overwritten, since it
+    // is also delta_multiple_scattering_texture).
+    add_indirect_irradiance_pass(1);
+
+    // Compute the multiple scattering fluence, and store it in
+    // delta_irradiance_texture.
+    auto compute_multiple_scattering_fluence = std::make_shared<LazyProgram>(
+        kVertexShader, "", header + kComputeMultipleScatteringFluenceShader);
+    passes->push_back({kComputeMultipleScatteringFluenceShader, [=]() {
+      bind_irradiance_framebuffer({delta_irradiance_texture});
+      const Program& program = compute_multiple_scattering_fluence->Get();
+      program.Use();
+      program.BindTexture2d("transmittance_texture", transmittance_texture, 0);
+      program.BindTexture2d("density_texture", density_texture, 1);
       DrawQuad({}, full_screen_quad_vao_);
+    }});
+
+    // Compute the approximate scattering density of all the orders, and store
+    // it in delta_scattering_density_texture.
+    auto compute_approximate_scattering_density =
+        std::make_shared<LazyProgram>(kVertexShader, kGeometryShader,
+            header + kComputeApproximateScatteringDensityShader);
+    for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+      passes->push_back({kComputeApproximateScatteringDensityShader, [=]() {
+        bind_scattering_framebuffer({delta_scattering_density_texture});
+        const Program& program = compute_approximate_scattering_density->Get();
+        program.Use();
+        program.BindTexture2d("density_texture", density_texture, 0);
+        program.BindTexture2d("multiple_scattering_fluence_texture",
+            delta_irradiance_texture, 1);
+        program.BindInt("layer", layer);
+        DrawQuad({}, full_screen_quad_vao_);
+      }});
     }
 
-    // Compute the indirect irradiance, store it in delta_irradiance_texture and
-    // accumulate it in irradiance_texture_.
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-        delta_irradiance_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
-        irradiance_texture_, 0);
-    glDrawBuffers(2, kDrawBuffers);
-    glViewport(0, 0, IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT);
-    compute_indirect_irradiance.Use();
-    compute_indirect_irradiance.BindMat3(
-        "luminance_from_radiance", luminance_from_radiance);
-    compute_indirect_irradiance.BindTexture3d(
-        "single_rayleigh_scattering_texture",
-        delta_rayleigh_scattering_texture,
-        0);
-    compute_indirect_irradiance.BindTexture3d(
-        "single_mie_scattering_texture", delta_mie_scattering_texture, 1);
-    compute_indirect_irradiance.BindTexture3d(
-        "multiple_scattering_texture", delta_multiple_scattering_texture, 2);
-    compute_indirect_irradiance.BindInt("scattering_order",
-        scattering_order - 1);
-    DrawQuad({false, true}, full_screen_quad_vao_);
-
-    // Compute the multiple scattering, store it in
-    // delta_multiple_scattering_texture, and accumulate it in
-    // scattering_texture_.
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-        delta_multiple_scattering_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
-        scattering_texture_, 0);
-    glDrawBuffers(2, kDrawBuffers);
-    glViewport(0, 0, SCATTERING_TEXTURE_WIDTH, SCATTERING_TEXTURE_HEIGHT);
-    compute_multiple_scattering.Use();
-    compute_multiple_scattering.BindMat3(
-        "luminance_from_radiance", luminance_from_radiance);
-    compute_multiple_scattering.BindTexture2d(
-        "transmittance_texture", transmittance_texture_, 0);
-    compute_multiple_scattering.BindTexture3d(
-        "scattering_density_texture", delta_scattering_density_texture, 1);
-    for (unsigned int layer = 0; layer < SCATTERING_TEXTURE_DEPTH; ++layer) {
-      compute_multiple_scattering.BindInt("layer", layer);
-      DrawQuad({false, true}, full_screen_quad_vao_);
+    // Compute the multiple scattering, and the indirect irradiance due to it.
+    add_multiple_scattering_passes();
+    add_indirect_irradiance_pass(2);
+  } else {
+    // Otherwise, compute the scattering orders 2 to num_scattering_orders, in
+    // sequence.
+    for (unsigned int scattering_order = 2;
+         scattering_order <= num_scattering_orders; ++scattering_order) {
+      // Compute the scattering density, and store it in
+      // delta_scattering_density_texture.
+      for (int layer = 0; layer < texture_sizes_.scattering_depth(); ++layer) {
+        passes->push_back({kComputeScatteringDensityShader, [=]() {
+          bind_scattering_framebuffer({delta_scattering_density_texture});
+          const Program& program = compute_scattering_density->Get();
+          program.Use();
+          program.BindTexture2d(
+              "transmittance_texture", transmittance_texture, 0);
+          program.BindTexture3d("single_rayleigh_scattering_texture",
+              delta_rayleigh_scattering_texture, 1);
+          program.BindTexture3d(
+              "single_mie_scattering_texture", delta_mie_scattering_texture, 2);
+          program.BindTexture3d("multiple_scattering_texture",
+              delta_multiple_scattering_texture, 3);
+          program.BindTexture2d(
+              "irradiance_texture", delta_irradiance_texture, 4);
+          program.BindTexture2d("density_texture", density_texture, 5);
+          program.BindInt("scattering_order", scattering_order);
+          program.BindInt("layer", layer);
+          DrawQuad({}, full_screen_quad_vao_);
+        }});
+      }
+
+      // Compute the indirect irradiance, store it in delta_irradiance_texture
+      // and accumulate it in irradiance_texture_.
+      add_indirect_irradiance_pass(scattering_order - 1);
+
+      // Compute the multiple scattering, store it in
+      // delta_multiple_scattering_texture, and accumulate it in
+      // scattering_texture_.
+      add_multiple_scattering_passes();
     }
   }
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, 0, 0);
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, 0, 0);
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, 0, 0);
+
+  // Finally, detach the color attachments 1 to 3 (Update expects a single
+  // color attachment after the precomputations).
+  passes->push_back({nullptr, [fbo]() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, 0, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, 0, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, 0, 0);
+  }});
 }
 
 }  // namespace atmosphere
@@ -34,12 +34,40 @@ To use it:
 <ul>
 <li>create a <code>Model</code> instance with the desired atmosphere
 parameters.</li>
-<li>call <code>Init</code> to precompute the atmosphere textures,</li>
+<li>call <code>Init</code> to precompute the atmosphere textures (or, if the
+atmosphere parameters are close to those of a previously initialized model,
+call <code>Update</code> to precompute them faster from the textures of this
+previous model, or <code>Blend</code> to interpolate the textures of models
+precomputed on a grid of atmosphere parameters, or <code>SetTextures</code> to
+set textures interpolated from a <a href="grid_bundle.h.html">grid bundle</a>,
+or
+<code>InitApproximate</code> to precompute them much faster with an approximate
+multiple scattering, or <code>BeginInit</code> and <code>Step</code> to
+precompute them incrementally, over several frames),</li>
 <li>link <code>GetShader</code> with your shaders that need access to the
 atmosphere shading functions.</li>
 <li>for each GLSL program linked with <code>GetShader</code>, call
 <code>SetProgramUniforms</code> to bind the precomputed textures to this
 program (usually at each frame).</li>
+<li>optionally, if the model was created with the
+<code>runtime_solar_irradiance</code> option, call
+<code>SetSolarIrradiance</code> to change the solar spectrum without recomputing
+the precomputed textures.</li>
+<li>optionally, if the model was created with the
+<code>runtime_ground_albedo</code> option, call <code>SetGroundAlbedo</code> to
+change the ground albedo (e.g. for snow cover or seasonal changes) without
+recomputing the precomputed textures.</li>
+<li>optionally, call <code>BakeSkyView</code> at each frame to precompute the
+sky radiance seen from the camera in all directions in a small 2D texture, and
+bind it to your programs with <code>SetSkyViewUniforms</code>. The sky
+background can then be rendered with a single 2D texture lookup per pixel,
+instead of a call to <code>GetSkyRadiance</code>.</li>
+<li>optionally, call <code>BakeAerialPerspective</code> at each frame to
+precompute the sky radiance and transmittance between the camera and the
+points of its view frustum in a 3D texture, and bind it to your programs with
+<code>SetAerialPerspectiveUniforms</code>. The aerial perspective of each
+fragment can then be computed with a single 3D texture lookup, instead of a
+call to <code>GetSkyRadianceToPoint</code>.</li>
 <li>delete your <code>Model</code> when you no longer need its shader and
 precomputed textures (the destructor deletes these resources).</li>
 </ul>
@@ -86,6 +114,25 @@ vec3 GetSkyLuminanceToPoint(vec3 camera, vec3 p, double shadow_length,
 // 'p' and whose normal vector is 'normal'.
 vec3 GetSunAndSkyIlluminance(vec3 p, vec3 normal, vec3 sun_direction,
     out vec3 sky_illuminance);
+
+// Returns the sky radiance seen from the camera in direction 'view_ray', from
+// the sky view texture baked by BakeSkyView (see below). This is an
+// approximation of GetSkyRadiance with a zero shadow length.
+vec3 GetSkyViewRadiance(vec3 view_ray);
+
+// Same as GetSkyViewRadiance, but returning a sky luminance.
+vec3 GetSkyViewLuminance(vec3 view_ray);
+
+// Returns the sky radiance along the segment from the camera to the point at
+// 'distance' from it, in the view ray through 'screen_uv' (in [0,1]x[0,1]),
+// as well as the transmittance along this segment, from the aerial perspective
+// volume baked by BakeAerialPerspective (see below).
+vec3 GetAerialPerspectiveRadiance(vec2 screen_uv, double distance,
+    out vec3 transmittance);
+
+// Same as GetAerialPerspectiveRadiance, but returning a sky luminance.
+vec3 GetAerialPerspectiveLuminance(vec2 screen_uv, double distance,
+    out vec3 transmittance);
 </pre>
 
 <p>where
@@ -152,30 +199,14 @@ parameter):
 #include <glad/glad.h>
 #include <array>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
-namespace atmosphere {
+#include "atmosphere/parameters.h"
+#include "atmosphere/spectrum.h"
 
-// An atmosphere layer of width 'width' (in m), and whose density is defined as
-//   'exp_term' * exp('exp_scale' * h) + 'linear_term' * h + 'constant_term',
-// clamped to [0,1], and where h is the altitude (in m). 'exp_term' and
-// 'constant_term' are unitless, while 'exp_scale' and 'linear_term' are in
-// m^-1.
-class DensityProfileLayer {
- public:
-  DensityProfileLayer() : DensityProfileLayer(0.0, 0.0, 0.0, 0.0, 0.0) {}
-  DensityProfileLayer(double width, double exp_term, double exp_scale,
-                      double linear_term, double constant_term)
-      : width(width), exp_term(exp_term), exp_scale(exp_scale),
-        linear_term(linear_term), constant_term(constant_term) {
-  }
-  double width;
-  double exp_term;
-  double exp_scale;
-  double linear_term;
-  double constant_term;
-};
+namespace atmosphere {
 
 class Model {
  public:
@@ -278,14 +309,134 @@ class Model {
     // Whether to use half precision floats (16 bits) or single precision floats
     // (32 bits) for the precomputed textures. Half precision is sufficient for
     // most cases, except for very high exposure values.
-    bool half_precision);
+    bool half_precision,
+    // The sizes of the precomputed textures. Each size must be at least 2, and
+    // the scattering mu size must be even and at least 4 (otherwise this
+    // throws a std::invalid_argument exception).
+    const TextureSizes& texture_sizes = TextureSizes(),
+    // Whether to precompute the textures for a unit solar irradiance at each
+    // wavelength, and to apply the actual solar irradiance at runtime (via
+    // uniforms set by SetProgramUniforms), so that it can be changed with
+    // SetSolarIrradiance without recomputing the textures. In precomputed
+    // illuminance mode, this requires keeping the textures precomputed for
+    // each group of 3 wavelengths (i.e. (num_precomputed_wavelengths + 2) / 3
+    // times more GPU memory), in order to combine them again with the CIE
+    // color matching functions when the solar irradiance changes.
+    bool runtime_solar_irradiance = false,
+    // Whether to precompute the textures for several uniform ground albedo
+    // values, so that they can be combined at runtime for any ground albedo
+    // with SetGroundAlbedo, without recomputing them. The precomputed textures
+    // are polynomials of the ground albedo, of degree at most the number of
+    // scattering orders minus 1, so Init precomputes them for as many albedo
+    // values as scattering orders (and thus takes as many times longer), and
+    // keeps them in GPU memory (for each group of 3 wavelengths in
+    // precomputed illuminance mode).
+    bool runtime_ground_albedo = false,
+    // Optional tabulated density profiles (e.g. from measured ozone or aerosol
+    // soundings), replacing the above rayleigh_density, mie_density and
+    // absorption_density layers in all the precomputations. If not empty, this
+    // must contain 3 * DENSITY_TEXTURE_WIDTH values: the Rayleigh, Mie and
+    // absorption densities at DENSITY_TEXTURE_WIDTH altitudes uniformly
+    // spaced from the bottom (first values) to the top of the atmosphere
+    // (otherwise this throws a std::invalid_argument exception). The
+    // densities are linearly interpolated between these altitudes, at no
+    // extra cost compared to the analytic layers.
+    const std::vector<double>& tabulated_densities = std::vector<double>());
 
   ~Model();
 
   void Init(unsigned int num_scattering_orders = 4);
 
+  // Precomputes the atmosphere textures at the given coarse resolution, which
+  // is much faster, resamples them into the full resolution textures (which
+  // can be used as soon as this method returns, e.g. to render a first
+  // preview), and starts their precomputation at full resolution, as with
+  // BeginInit. This full resolution precomputation must then be completed with
+  // successive Step calls, while the coarse textures are used for rendering.
+  // The coarse texture sizes must satisfy the same constraints as those of the
+  // constructor.
+  void InitProgressive(const TextureSizes& coarse_texture_sizes,
+      unsigned int num_scattering_orders = 4);
+
+  // Same as Init, but replaces the order by order computation of multiple
+  // scattering with a much faster approximation of all the scattering orders
+  // (isotropic multiple scattering, computed from a 2D lookup table indexed by
+  // altitude and Sun zenith angle, in the style of Hillaire 2020). The
+  // precomputed textures have the same layout as with Init, but the multiple
+  // scattering is less accurate (see model.cc). With the
+  // runtime_ground_albedo option, this precomputes the textures for only 2
+  // ground albedo values.
+  void InitApproximate();
+
+  // Starts a time-sliced precomputation of the atmosphere textures, giving the
+  // same result as Init, but done incrementally by successive Step calls (e.g.
+  // one per frame) to avoid stalling the rendering thread. Until the last
+  // Step, the model keeps using its current textures (e.g. precomputed with
+  // Init for previous atmosphere parameters). No other method precomputing or
+  // changing these textures (Init, Update, Blend, SetSolarIrradiance, etc)
+  // must be called before the precomputation is complete.
+  void BeginInit(unsigned int num_scattering_orders = 4);
+
+  // Issues the next passes of the precomputation started with BeginInit (down
+  // to single layers of the 3D textures), until their estimated GPU time
+  // reaches 'budget_ms' milliseconds (at least one pass is issued at each
+  // call). The GPU time of each pass is estimated from the GPU time of the
+  // previous passes of the same kind, measured with timer queries. Returns
+  // true when the precomputation is complete, in which case the new textures
+  // have replaced the previous ones (SetProgramUniforms must then be called
+  // again, and the sky view and aerial perspective textures must be baked
+  // again). This changes the current program, the blend state, and the
+  // texture bindings of the texture units 0 to 4.
+  bool Step(double budget_ms);
+
+  // Same as Init, but for atmosphere parameters close to those of
+  // 'previous_model' (e.g. after a small change of the aerosol or ozone
+  // parameters), which must have been initialized with the same options and
+  // texture sizes. Only the precomputed radiance mode (i.e. at most 3
+  // precomputed wavelengths) is supported, without the runtime_ground_albedo
+  // option: in the other modes, and if num_iterations is 0, this throws a
+  // std::invalid_argument exception. The transmittance, direct irradiance and
+  // single scattering are computed exactly, while the multiple scattering of
+  // 'previous_model' is corrected with 'num_iterations' iterations. This
+  // costs as much as num_iterations scattering orders in Init, for any number
+  // of scattering orders in 'previous_model', plus one scattering order and
+  // the single scattering of 'previous_model' the first time it is used (to
+  // compute correction textures which are then kept in 'previous_model', until
+  // its textures change). See model.cc for the error bound.
+  void Update(const Model& previous_model, unsigned int num_iterations = 1);
+
+  // Sets the precomputed textures to the weighted sum of those of 'models',
+  // instead of precomputing them. For instance, with models precomputed at
+  // the points of a ParameterGrid, and with the weights computed by its
+  // GetBlendWeights method for the atmosphere parameters of this model, this
+  // gives an approximation of the textures precomputed by Init, in a few
+  // milliseconds. 'models' must have the same options and texture sizes as
+  // this model, and the runtime_ground_albedo option (as well as the
+  // runtime_solar_irradiance option, in precomputed illuminance mode) is not
+  // supported. This changes the current program and the texture bindings of
+  // the texture units 0 and 1.
+  void Blend(const std::vector<const Model*>& models,
+      const std::vector<double>& weights);
+
+  // Reads back the precomputed textures (e.g. to write them in a grid bundle,
+  // see grid_bundle.h). This changes the texture binding of the texture unit
+  // 0.
+  void GetTextures(PrecomputedTextures* textures) const;
+
+  // Sets the precomputed textures to the given ones (e.g. interpolated from a
+  // grid bundle with GridBundle::Blend), instead of precomputing them. They
+  // must have been computed by a model with the same options and texture
+  // sizes as this model. As with Blend, the runtime_ground_albedo option (as
+  // well as the runtime_solar_irradiance option, in precomputed illuminance
+  // mode) is not supported: in this case, or if the textures don't have the
+  // expected size, this throws a std::invalid_argument exception. This
+  // changes the texture binding of the texture unit 0.
+  void SetTextures(const PrecomputedTextures& textures);
+
   GLuint shader() const { return atmosphere_shader_; }
 
+  const TextureSizes& texture_sizes() const { return texture_sizes_; }
+
   void SetProgramUniforms(
       GLuint program,
       GLuint transmittance_texture_unit,
@@ -293,26 +444,105 @@ class Model {
       GLuint irradiance_texture_unit,
       GLuint optional_single_mie_scattering_texture_unit = 0) const;
 
+  // Changes the solar irradiance at the top of the atmosphere (in W/m^2/nm,
+  // for the wavelengths passed to the constructor), without recomputing the
+  // atmosphere textures. This requires the runtime_solar_irradiance
+  // constructor option. SetProgramUniforms must then be called again for each
+  // program linked with the shader. In radiance mode (at most 3 precomputed
+  // wavelengths), the sky view and aerial perspective textures do not need to
+  // be baked again (the new solar irradiance is applied when they are read).
+  // In precomputed illuminance mode, this changes the current program and the
+  // texture bindings of the texture units 0 and 1, and the sky view and aerial
+  // perspective textures must be baked again (they are computed from the
+  // illuminance textures, which include the solar irradiance).
+  void SetSolarIrradiance(const std::vector<double>& solar_irradiance);
+
+  // Changes the ground albedo (for the wavelengths passed to the constructor),
+  // by combining the textures precomputed by Init for several ground albedo
+  // values. This requires the runtime_ground_albedo constructor option, and
+  // changes the current program and the texture bindings of the texture units
+  // 0 and 1 (SetProgramUniforms must thus be called again). The sky view and
+  // aerial perspective textures must be baked again.
+  void SetGroundAlbedo(const std::vector<double>& ground_albedo);
+
+  // Computes the sky radiance (or illuminance, in precomputed illuminance
+  // mode) seen from 'camera' in all view directions, and stores it in a width
+  // x height texture (using a longitude/latitude mapping relatively to the
+  // Sun, with more texels near the horizon). 'camera' and 'sun_direction' are
+  // expressed as for the GLSL API functions. This changes the current program
+  // and the texture bindings of the texture units 0 to 3.
+  void BakeSkyView(const std::array<double, 3>& camera,
+      const std::array<double, 3>& sun_direction,
+      int width = 192, int height = 108);
+
+  // Binds the texture computed by the last BakeSkyView call to 'program', for
+  // use with the GetSkyView* GLSL functions.
+  void SetSkyViewUniforms(GLuint program, GLuint sky_view_texture_unit) const;
+
+  // Computes the sky radiance (or illuminance, in precomputed illuminance
+  // mode) and the transmittance between 'camera' and the points at distances
+  // 0 to 'max_distance' along the view rays model_from_clip * (x, y, 1), for
+  // clip coordinates x, y in [-1, 1] (model_from_clip is in row-major order),
+  // and stores them in a width x height x depth volume (the depth slices are
+  // distributed quadratically with the distance). 'camera', 'sun_direction'
+  // and 'max_distance' are expressed as for the GLSL API functions. This
+  // changes the current program and the texture bindings of the texture
+  // units 0 to 3.
+  void BakeAerialPerspective(const std::array<double, 3>& camera,
+      const std::array<double, 3>& sun_direction,
+      const std::array<float, 9>& model_from_clip, double max_distance,
+      int width = 32, int height = 32, int depth = 32);
+
+  // Binds the volume computed by the last BakeAerialPerspective call to
+  // 'program', for use with the GetAerialPerspective* GLSL functions.
+  void SetAerialPerspectiveUniforms(
+      GLuint program,
+      GLuint aerial_perspective_scattering_texture_unit,
+      GLuint aerial_perspective_transmittance_texture_unit) const;
+
   // Utility method to convert a function of the wavelength to linear sRGB.
   // 'wavelengths' and 'spectrum' must have the same size. The integral of
   // 'spectrum' times each CIE_2_DEG_COLOR_MATCHING_FUNCTIONS (and times
   // MAX_LUMINOUS_EFFICACY) is computed to get XYZ values, which are then
-  // converted to linear sRGB with the XYZ_TO_SRGB matrix.
+  // converted to linear sRGB with the XYZ_TO_SRGB matrix. To convert many
+  // spectra sampled at the same wavelengths, use a SpectrumToSrgbConverter.
   static void ConvertSpectrumToLinearSrgb(
       const std::vector<double>& wavelengths,
       const std::vector<double>& spectrum,
       double* r, double* g, double* b);
 
-  static constexpr double kLambdaR = 680.0;
-  static constexpr double kLambdaG = 550.0;
-  static constexpr double kLambdaB = 440.0;
+  static constexpr double kLambdaR = atmosphere::kLambdaR;
+  static constexpr double kLambdaG = atmosphere::kLambdaG;
+  static constexpr double kLambdaB = atmosphere::kLambdaB;
 
  private:
   typedef std::array<double, 3> vec3;
   typedef std::array<float, 9> mat3;
 
+  // A precomputation pass, i.e. a function issuing some GL commands, which sets
+  // all the GL state it needs (so that passes can be interleaved with other GL
+  // commands), with the fragment shader used by its draw calls (identifying
+  // the passes of similar cost), or null if it has no draw call.
+  struct Pass {
+    const char* shader;
+    std::function<void()> run;
+  };
+
+  // The state of a precomputation started by Init or BeginInit (defined in
+  // model.cc).
+  struct PendingInit;
+
+  void RunInit(unsigned int num_scattering_orders,
+      bool approximate_multiple_scattering);
+
+  void ScheduleInit(unsigned int num_scattering_orders,
+      bool approximate_multiple_scattering, PendingInit* init);
+
+  void SwapPendingInitTextures();
+
   void Precompute(
       GLuint fbo,
+      GLuint density_texture,
       GLuint delta_irradiance_texture,
       GLuint delta_rayleigh_scattering_texture,
       GLuint delta_mie_scattering_texture,
@@ -321,11 +551,48 @@ class Model {
       const vec3& lambdas,
       const mat3& luminance_from_radiance,
       bool blend,
-      unsigned int num_scattering_orders);
+      unsigned int num_scattering_orders,
+      bool approximate_multiple_scattering,
+      std::vector<Pass>* passes);
+
+  void ComputeSolarIrradianceFactors(
+      const std::vector<double>& solar_irradiance);
+
+  void CombineWavelengthGroups();
+
+  void DeleteWavelengthGroups();
+
+  void DeleteUpdateCorrections();
+
+  // Computes the density lookup table of this model in 'density_texture',
+  // from the tabulated densities if any, or otherwise with a shader using
+  // 'glsl_header' (the framebuffer used for this must be bound).
+  void ComputeDensityTexture(GLuint density_texture,
+      const std::string& glsl_header) const;
 
   unsigned int num_precomputed_wavelengths_;
   bool half_precision_;
+  TextureSizes texture_sizes_;
   bool rgb_format_supported_;
+  bool runtime_solar_irradiance_;
+  bool runtime_ground_albedo_;
+  std::vector<double> tabulated_densities_;
+  std::vector<double> wavelengths_;
+  std::vector<double> solar_irradiance_;
+  std::vector<double> ground_albedo_;
+  // The ground albedo used in the GLSL headers, i.e. ground_albedo_ or, during
+  // Init with the runtime_ground_albedo option, one of the uniform ground
+  // albedo values in ground_albedo_samples_.
+  std::vector<double> precomputed_ground_albedo_;
+  std::vector<double> ground_albedo_samples_;
+  // The values of the SKY_SPECTRAL_RADIANCE_TO_LUMINANCE,
+  // SUN_SPECTRAL_RADIANCE_TO_LUMINANCE, SKY_RADIANCE_SCALE and
+  // SUN_RADIANCE_SCALE shader constants (or uniforms, with the
+  // runtime_solar_irradiance option).
+  vec3 sky_spectral_radiance_to_luminance_;
+  vec3 sun_spectral_radiance_to_luminance_;
+  vec3 sky_radiance_scale_;
+  vec3 sun_radiance_scale_;
   std::function<std::string(const vec3&)> glsl_header_factory_;
   GLuint transmittance_texture_;
   GLuint scattering_texture_;
@@ -334,6 +601,46 @@ class Model {
   GLuint atmosphere_shader_;
   GLuint full_screen_quad_vao_;
   GLuint full_screen_quad_vbo_;
+
+  // In precomputed illuminance mode with the runtime_solar_irradiance option,
+  // the textures precomputed by Init for a unit solar irradiance, for each
+  // group of 3 wavelengths, with their wavelengths and their conversion matrix
+  // to luminance. With the runtime_ground_albedo option, the textures
+  // precomputed for each group and for each ground albedo sample, with this
+  // sample value.
+  std::vector<vec3> group_lambdas_;
+  std::vector<mat3> group_luminance_from_radiance_;
+  std::vector<double> group_ground_albedos_;
+  std::vector<GLuint> group_scattering_textures_;
+  std::vector<GLuint> group_single_mie_scattering_textures_;
+  std::vector<GLuint> group_irradiance_textures_;
+
+  // The precomputation started by BeginInit, if not yet complete.
+  std::unique_ptr<PendingInit> pending_init_;
+
+  // The next scattering order T' and the scattering and irradiance
+  // corrections computed by the first Update call using this model as
+  // previous model, and reused by the next ones (0 if not computed yet, or if
+  // the precomputed textures changed since).
+  mutable GLuint update_next_scattering_texture_;
+  mutable GLuint update_scattering_correction_texture_;
+  mutable GLuint update_irradiance_correction_texture_;
+
+  // The sky view texture, and the program used to compute it (both created on
+  // the first BakeSkyView call).
+  GLuint sky_view_program_;
+  GLuint sky_view_texture_;
+  std::array<int, 2> sky_view_size_;
+  vec3 sky_view_camera_;
+  vec3 sky_view_sun_direction_;
+
+  // The aerial perspective volume, and the program used to compute it (all
+  // created on the first BakeAerialPerspective call).
+  GLuint aerial_perspective_program_;
+  GLuint aerial_perspective_scattering_texture_;
+  GLuint aerial_perspective_transmittance_texture_;
+  std::array<int, 3> aerial_perspective_size_;
+  double aerial_perspective_max_distance_;
 };
 
 }  // namespace atmosphere
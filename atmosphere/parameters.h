@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/parameters.h</h2>
+
+<p>This file defines the classes used to specify the parameters of our
+atmosphere models (in addition to the wavelength dependent parameters, which
+are specified with vectors of samples). They do not depend on OpenGL, and are
+used by the <a href="model.h.html">GPU model</a> as well as by the
+<a href="cpu/model.h.html">RGB CPU model</a>.
+*/
+
+#ifndef ATMOSPHERE_PARAMETERS_H_
+#define ATMOSPHERE_PARAMETERS_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "atmosphere/constants.h"
+
+namespace atmosphere {
+
+// An atmosphere layer of width 'width' (in m), and whose density is defined as
+//   'exp_term' * exp('exp_scale' * h) + 'linear_term' * h + 'constant_term',
+// clamped to [0,1], and where h is the altitude (in m). 'exp_term' and
+// 'constant_term' are unitless, while 'exp_scale' and 'linear_term' are in
+// m^-1.
+class DensityProfileLayer {
+ public:
+  DensityProfileLayer() : DensityProfileLayer(0.0, 0.0, 0.0, 0.0, 0.0) {}
+  DensityProfileLayer(double width, double exp_term, double exp_scale,
+                      double linear_term, double constant_term)
+      : width(width), exp_term(exp_term), exp_scale(exp_scale),
+        linear_term(linear_term), constant_term(constant_term) {
+  }
+  double width;
+  double exp_term;
+  double exp_scale;
+  double linear_term;
+  double constant_term;
+};
+
+// The sizes of the precomputed textures. The default values are those defined
+// in constants.h. Smaller sizes reduce the precomputation time and the GPU
+// memory usage, at the cost of a lower precision. The scattering texture is a
+// 4D texture, stored in a 3D texture of width 'scattering_nu_size' *
+// 'scattering_mu_s_size', height 'scattering_mu_size' and depth
+// 'scattering_r_size'. Each size must be at least 2, and 'scattering_mu_size'
+// must be even and at least 4 (half of the mu coordinates are used for the rays
+// intersecting the ground, and half for the other rays).
+class TextureSizes {
+ public:
+  TextureSizes() : TextureSizes(
+      TRANSMITTANCE_TEXTURE_WIDTH, TRANSMITTANCE_TEXTURE_HEIGHT,
+      SCATTERING_TEXTURE_R_SIZE, SCATTERING_TEXTURE_MU_SIZE,
+      SCATTERING_TEXTURE_MU_S_SIZE, SCATTERING_TEXTURE_NU_SIZE,
+      IRRADIANCE_TEXTURE_WIDTH, IRRADIANCE_TEXTURE_HEIGHT) {}
+  TextureSizes(int transmittance_width, int transmittance_height,
+               int scattering_r_size, int scattering_mu_size,
+               int scattering_mu_s_size, int scattering_nu_size,
+               int irradiance_width, int irradiance_height)
+      : transmittance_width(transmittance_width),
+        transmittance_height(transmittance_height),
+        scattering_r_size(scattering_r_size),
+        scattering_mu_size(scattering_mu_size),
+        scattering_mu_s_size(scattering_mu_s_size),
+        scattering_nu_size(scattering_nu_size),
+        irradiance_width(irradiance_width),
+        irradiance_height(irradiance_height) {
+  }
+  int scattering_width() const {
+    return scattering_nu_size * scattering_mu_s_size;
+  }
+  int scattering_height() const { return scattering_mu_size; }
+  int scattering_depth() const { return scattering_r_size; }
+  int transmittance_width;
+  int transmittance_height;
+  int scattering_r_size;
+  int scattering_mu_size;
+  int scattering_mu_s_size;
+  int scattering_nu_size;
+  int irradiance_width;
+  int irradiance_height;
+};
+
+// A grid of atmosphere parameter values (e.g. Mie scale height x Mie
+// scattering coefficient x ozone density), defined by the increasing values of
+// each parameter in 'axes'. The grid points are indexed with the first
+// parameter varying fastest. Models precomputed at each grid point can be
+// blended to get a model for any parameter values in the grid range (see
+// Model::Blend), with the multilinear interpolation weights computed by
+// GetBlendWeights.
+class ParameterGrid {
+ public:
+  explicit ParameterGrid(const std::vector<std::vector<double>>& axes)
+      : axes(axes) {
+  }
+  unsigned int num_points() const {
+    unsigned int num_points = 1;
+    for (const std::vector<double>& axis : axes) {
+      num_points *= axis.size();
+    }
+    return num_points;
+  }
+  // The parameter values at the grid point of index 'index'.
+  std::vector<double> GetPoint(unsigned int index) const {
+    std::vector<double> point;
+    for (const std::vector<double>& axis : axes) {
+      point.push_back(axis[index % axis.size()]);
+      index /= axis.size();
+    }
+    return point;
+  }
+  // The indices of the (at most) 2^n grid points around 'values', where n is
+  // the number of parameters, and their multilinear interpolation weights.
+  // Values outside the grid range are clamped to this range.
+  void GetBlendWeights(const std::vector<double>& values,
+      std::vector<unsigned int>* indices, std::vector<double>* weights) const {
+    indices->assign(1, 0);
+    weights->assign(1, 1.0);
+    unsigned int stride = 1;
+    for (unsigned int i = 0; i < axes.size(); ++i) {
+      const std::vector<double>& axis = axes[i];
+      if (axis.size() > 1) {
+        const unsigned int j = std::upper_bound(axis.begin() + 1,
+            axis.end() - 1, values[i]) - axis.begin() - 1;
+        const double t = std::min(std::max(
+            (values[i] - axis[j]) / (axis[j + 1] - axis[j]), 0.0), 1.0);
+        const unsigned int size = indices->size();
+        for (unsigned int k = 0; k < size; ++k) {
+          indices->push_back((*indices)[k] + (j + 1) * stride);
+          weights->push_back((*weights)[k] * t);
+          (*indices)[k] += j * stride;
+          (*weights)[k] *= 1.0 - t;
+        }
+      }
+      stride *= axis.size();
+    }
+  }
+  std::vector<std::vector<double>> axes;
+};
+
+// The precomputed textures of a model, as RGBA float values, with the texels
+// in the same order as in the GPU textures (see Model::GetTextures), e.g. to
+// store them in a grid bundle (see grid_bundle.h).
+struct PrecomputedTextures {
+  std::vector<float> transmittance;
+  std::vector<float> scattering;
+  // Empty with the combine_scattering_textures option.
+  std::vector<float> single_mie_scattering;
+  std::vector<float> irradiance;
+};
+
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_PARAMETERS_H_
@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/aerial_perspective.cc</h2>
+
+<p>This file implements the <a href="aerial_perspective.h.html">aerial
+perspective baker</a>, with the same froxel parameterization as in the GPU
+model. The lookups use the same trilinear interpolation as the GPU texture
+units, with the following helper function to compute the two texels and the
+interpolation factor along one axis (with a "clamp to edge" behavior):
+*/
+
+#include "atmosphere/reference/aerial_perspective.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "atmosphere/spectrum.h"
+#include "util/progress_bar.h"
+
+namespace atmosphere {
+namespace reference {
+
+namespace {
+
+void GetTexels(double u, unsigned int size, unsigned int* i0,
+    unsigned int* i1, double* lerp) {
+  const double x = std::max(0.0, std::min(u * size - 0.5, size - 1.0));
+  *i0 = std::min(static_cast<unsigned int>(x), size - 1);
+  *i1 = std::min(*i0 + 1, size - 1);
+  *lerp = x - *i0;
+}
+
+}  // anonymous namespace
+
+/*
+<p>The lookup function interpolates the 8 froxels around the given point, and
+then interpolates linearly with the distance between the values at the camera
+(no scattering, full transmittance) and the interpolated values, for points
+before the first depth slice (like the <code>GetAerialPerspective</code>
+function of the GPU model):
+*/
+
+void AerialPerspectiveVolume::Lookup(double u, double v, Length distance,
+    double scattering_rgb[3], double transmittance_rgb[3]) const {
+  const double w2 = std::max((distance / max_distance)(), 0.0);
+  unsigned int i[2];
+  unsigned int j[2];
+  unsigned int k[2];
+  double lerp[3];
+  GetTexels(u, width, &i[0], &i[1], &lerp[0]);
+  GetTexels(v, height, &j[0], &j[1], &lerp[1]);
+  GetTexels(std::sqrt(w2), depth, &k[0], &k[1], &lerp[2]);
+  for (unsigned int c = 0; c < 3; ++c) {
+    scattering_rgb[c] = 0.0;
+    transmittance_rgb[c] = 0.0;
+  }
+  for (unsigned int dk = 0; dk < 2; ++dk) {
+    const double wk = dk == 0 ? 1.0 - lerp[2] : lerp[2];
+    for (unsigned int dj = 0; dj < 2; ++dj) {
+      const double wj = dj == 0 ? 1.0 - lerp[1] : lerp[1];
+      for (unsigned int di = 0; di < 2; ++di) {
+        const double w = wk * wj * (di == 0 ? 1.0 - lerp[0] : lerp[0]);
+        const unsigned int index =
+            3 * (i[di] + width * (j[dj] + height * k[dk]));
+        for (unsigned int c = 0; c < 3; ++c) {
+          scattering_rgb[c] += w * scattering[index + c];
+          transmittance_rgb[c] += w * transmittance[index + c];
+        }
+      }
+    }
+  }
+  const double fade = std::min(w2 * 4.0 * depth * depth, 1.0);
+  for (unsigned int c = 0; c < 3; ++c) {
+    scattering_rgb[c] *= fade;
+    transmittance_rgb[c] = 1.0 + (transmittance_rgb[c] - 1.0) * fade;
+  }
+}
+
+AerialPerspectiveBaker::AerialPerspectiveBaker(const Model& model,
+    bool use_luminance) : model_(model), use_luminance_(use_luminance) {}
+
+/*
+<p>The baking itself simply calls <code>GetSkyRadianceToPoint</code> (or
+<code>GetSkyLuminanceToPoint</code>) for the point corresponding to each froxel
+center, in parallel over the rows of all the depth slices:
+*/
+
+void AerialPerspectiveBaker::Bake(Position camera, Direction sun_direction,
+    const std::array<double, 9>& model_from_clip, Length max_distance,
+    unsigned int width, unsigned int height, unsigned int depth,
+    AerialPerspectiveVolume* volume) const {
+  volume->width = width;
+  volume->height = height;
+  volume->depth = depth;
+  volume->max_distance = max_distance;
+  volume->scattering.resize(3 * width * height * depth);
+  volume->transmittance.resize(3 * width * height * depth);
+  RunJobs([&](unsigned int row) {
+    const unsigned int j = row % height;
+    const unsigned int k = row / height;
+    const double y = 2.0 * (j + 0.5) / height - 1.0;
+    const double w = (k + 0.5) / depth;
+    for (unsigned int i = 0; i < width; ++i) {
+      const double x = 2.0 * (i + 0.5) / width - 1.0;
+      const Direction view_ray = normalize(Direction(
+          model_from_clip[0] * x + model_from_clip[1] * y + model_from_clip[2],
+          model_from_clip[3] * x + model_from_clip[4] * y + model_from_clip[5],
+          model_from_clip[6] * x + model_from_clip[7] * y +
+              model_from_clip[8]));
+      const Position point = camera + view_ray * (max_distance * w * w);
+      DimensionlessSpectrum transmittance;
+      double rgb[3];
+      if (use_luminance_) {
+        const Luminance3 luminance = model_.GetSkyLuminanceToPoint(
+            camera, point, 0.0 * m, sun_direction, &transmittance);
+        rgb[0] = luminance.x.to(cd_per_square_meter);
+        rgb[1] = luminance.y.to(cd_per_square_meter);
+        rgb[2] = luminance.z.to(cd_per_square_meter);
+      } else {
+        const RadianceSpectrum radiance = model_.GetSkyRadianceToPoint(
+            camera, point, 0.0 * m, sun_direction, &transmittance);
+        rgb[0] = radiance(kLambdaR * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+        rgb[1] = radiance(kLambdaG * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+        rgb[2] = radiance(kLambdaB * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+      }
+      const unsigned int index = 3 * (i + width * row);
+      volume->scattering[index] = static_cast<float>(rgb[0]);
+      volume->scattering[index + 1] = static_cast<float>(rgb[1]);
+      volume->scattering[index + 2] = static_cast<float>(rgb[2]);
+      volume->transmittance[index] =
+          static_cast<float>(transmittance(kLambdaR * nm)());
+      volume->transmittance[index + 1] =
+          static_cast<float>(transmittance(kLambdaG * nm)());
+      volume->transmittance[index + 2] =
+          static_cast<float>(transmittance(kLambdaB * nm)());
+    }
+  }, height * depth);
+}
+
+}  // namespace reference
+}  // namespace atmosphere
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/aerial_perspective.h</h2>
+
+<p>This file defines an API to precompute the aerial perspective seen from a
+camera with our <a href="model.h.html">CPU atmosphere model</a>, in a camera
+aligned 3D grid of "froxels" (frustum voxels), as done with the
+<code>BakeAerialPerspective</code> method of the
+<a href="../model.h.html">GPU model</a>. The aerial perspective for any point
+in the camera frustum can then be computed with a single trilinear lookup in
+this grid, instead of a call to <code>GetSkyRadianceToPoint</code>. To use it:
+<ul>
+<li>create an <code>AerialPerspectiveBaker</code> for an initialized
+<code>Model</code>, specifying if the volume should contain spectral radiance
+values at the 3 wavelengths <code>kLambdaR</code>, <code>kLambdaG</code> and
+<code>kLambdaB</code>, or sRGB luminance values,</li>
+<li>call <code>Bake</code> for each camera and sun direction,</li>
+<li>call <code>Lookup</code> on the resulting
+<code>AerialPerspectiveVolume</code>.</li>
+</ul>
+*/
+
+#ifndef ATMOSPHERE_REFERENCE_AERIAL_PERSPECTIVE_H_
+#define ATMOSPHERE_REFERENCE_AERIAL_PERSPECTIVE_H_
+
+#include <array>
+#include <vector>
+
+#include "atmosphere/reference/definitions.h"
+#include "atmosphere/reference/model.h"
+
+namespace atmosphere {
+namespace reference {
+
+// The sky radiance (or luminance) and transmittance between a camera and the
+// points of its view frustum, sampled on a width x height x depth grid. The
+// texel (i, j) of each depth slice corresponds to the view ray through the
+// screen coordinates u = (i + 0.5) / width, v = (j + 0.5) / height, and slice
+// k contains the values for the point at distance
+// max_distance * ((k + 0.5) / depth)^2 along this view ray.
+struct AerialPerspectiveVolume {
+  unsigned int width;
+  unsigned int height;
+  unsigned int depth;
+  Length max_distance;
+  // 3 values per froxel, stored slice by slice, and row by row in each slice.
+  std::vector<float> scattering;
+  std::vector<float> transmittance;
+
+  // Returns the sky radiance (or luminance) and the transmittance between the
+  // camera and the point at 'distance' from it along the view ray through the
+  // screen coordinates (u, v), with a trilinear interpolation of the volume
+  // (and a linear interpolation with the distance before the first slice).
+  void Lookup(double u, double v, Length distance, double scattering[3],
+      double transmittance[3]) const;
+};
+
+class AerialPerspectiveBaker {
+ public:
+  // If use_luminance is true, the volume contains sRGB luminance values in
+  // cd.m^-2 (this requires a Model constructed with the precompute_luminance
+  // option). Otherwise it contains spectral radiance values at kLambdaR,
+  // kLambdaG and kLambdaB, in W.m^-2.sr^-1.nm^-1. In both cases the
+  // transmittance is given at kLambdaR, kLambdaG and kLambdaB.
+  AerialPerspectiveBaker(const Model& model, bool use_luminance);
+
+  // Bakes the aerial perspective seen from 'camera', for the view rays
+  // model_from_clip * (x, y, 1), where x = 2u - 1 and y = 2v - 1 are clip
+  // coordinates and model_from_clip is a row-major matrix.
+  void Bake(Position camera, Direction sun_direction,
+      const std::array<double, 9>& model_from_clip, Length max_distance,
+      unsigned int width, unsigned int height, unsigned int depth,
+      AerialPerspectiveVolume* volume) const;
+
+ private:
+  const Model& model_;
+  const bool use_luminance_;
+};
+
+}  // namespace reference
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_REFERENCE_AERIAL_PERSPECTIVE_H_
@@ -50,11 +50,11 @@ and provided by the following included files:
 #define ATMOSPHERE_REFERENCE_DEFINITIONS_H_
 
 #include "atmosphere/constants.h"
+#include "atmosphere/reference/quaternary_function.h"
 #include "math/angle.h"
 #include "math/binary_function.h"
 #include "math/scalar.h"
 #include "math/scalar_function.h"
-#include "math/ternary_function.h"
 #include "math/vector.h"
 
 namespace atmosphere {
@@ -128,6 +128,8 @@ typedef WavelengthFunction<-1, 0, 0, 0, 0> ScatteringSpectrum;
 typedef dimensional::Vector3<Length> Position;
 // A unit direction vector in 3D (3 unitless values).
 typedef dimensional::Vector3<Number> Direction;
+// A vector of 3 length values.
+typedef dimensional::Vector3<Length> Length3;
 // A vector of 3 luminance values.
 typedef dimensional::Vector3<Luminance> Luminance3;
 // A vector of 3 illuminance values.
@@ -136,7 +138,9 @@ typedef dimensional::Vector3<Illuminance> Illuminance3;
 /*
 <p>Finally, we also need precomputed textures containing physical quantities in
 each texel (the texture sizes are defined in
-<a href="../constants.h.html"><code>constants.h</code></a>):
+<a href="../constants.h.html"><code>constants.h</code></a>). The 4D
+scattering textures are stored in <a href="quaternary_function.h.html">true 4D
+textures</a>, which can also be accessed as 3D textures:
 */
 
 typedef dimensional::BinaryFunction<
@@ -145,10 +149,11 @@ typedef dimensional::BinaryFunction<
     DimensionlessSpectrum> TransmittanceTexture;
 
 template<class T>
-using AbstractScatteringTexture = dimensional::TernaryFunction<
-    SCATTERING_TEXTURE_WIDTH,
-    SCATTERING_TEXTURE_HEIGHT,
-    SCATTERING_TEXTURE_DEPTH,
+using AbstractScatteringTexture = QuaternaryFunction<
+    SCATTERING_TEXTURE_NU_SIZE,
+    SCATTERING_TEXTURE_MU_S_SIZE,
+    SCATTERING_TEXTURE_MU_SIZE,
+    SCATTERING_TEXTURE_R_SIZE,
     T>;
 
 typedef AbstractScatteringTexture<IrradianceSpectrum>
@@ -165,6 +170,11 @@ typedef dimensional::BinaryFunction<
     IRRADIANCE_TEXTURE_HEIGHT,
     IrradianceSpectrum> IrradianceTexture;
 
+typedef dimensional::BinaryFunction<
+    DENSITY_TEXTURE_WIDTH,
+    DENSITY_TEXTURE_HEIGHT,
+    dimensional::vec3> DensityTexture;
+
 /*
 <h3>Physical units</h3>
 
@@ -0,0 +1,548 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/environment_map.cc</h2>
+
+<p>This file implements the <a href="environment_map.h.html">environment map
+baker</a>. The sky radiance is computed with the <code>Model</code> methods
+for each texel of the first level, in parallel over the texel rows. The other
+levels are then computed from this first level only, with a GGX filtered
+importance sampling, and the irradiance SH coefficients are computed with a
+projection of the first level on the first 9 spherical harmonics.
+
+<p>These computations use plain double precision 3D vectors, with the following
+helper functions:
+*/
+
+#include "atmosphere/reference/environment_map.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "atmosphere/spectrum.h"
+#include "util/progress_bar.h"
+
+namespace atmosphere {
+namespace reference {
+
+namespace {
+
+constexpr double kPi = 3.1415926535897932;
+constexpr unsigned int kNumGgxSamples = 64;
+
+struct Vec3 {
+  double x;
+  double y;
+  double z;
+};
+
+Vec3 operator+(const Vec3& a, const Vec3& b) {
+  return Vec3{a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+Vec3 operator*(double s, const Vec3& v) {
+  return Vec3{s * v.x, s * v.y, s * v.z};
+}
+
+double Dot(const Vec3& a, const Vec3& b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+Vec3 Cross(const Vec3& a, const Vec3& b) {
+  return Vec3{a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+      a.x * b.y - a.y * b.x};
+}
+
+Vec3 Normalize(const Vec3& v) {
+  return (1.0 / std::sqrt(Dot(v, v))) * v;
+}
+
+/*
+<p>The following functions give the size of a level, the number of rows of its
+image, and convert between texel coordinates and directions, for each layout.
+In the cube map layout, the row index y gives both the face (y / size) and the
+row inside this face (y % size), and the face directions follow the OpenGL
+cube map conventions. The mapping from directions to texel coordinates returns
+continuous coordinates, in texel units, and the face index for cube maps:
+*/
+
+unsigned int LevelSize(unsigned int size, unsigned int level) {
+  return std::max(size >> level, 1u);
+}
+
+FloatImage NewImage(EnvironmentMapLayout layout, unsigned int size) {
+  FloatImage image;
+  image.width =
+      layout == EnvironmentMapLayout::CUBE_MAP ? size : 2 * size;
+  image.height =
+      layout == EnvironmentMapLayout::CUBE_MAP ? 6 * size : size;
+  image.pixels.resize(3 * image.width * image.height);
+  return image;
+}
+
+Vec3 TexelDirection(EnvironmentMapLayout layout, unsigned int size,
+    double x, double y) {
+  if (layout == EnvironmentMapLayout::EQUIRECTANGULAR) {
+    const double phi = kPi * x / size - kPi;
+    const double theta = kPi * y / size;
+    return Vec3{std::sin(theta) * std::cos(phi),
+        std::sin(theta) * std::sin(phi), std::cos(theta)};
+  }
+  const unsigned int face = std::min(static_cast<unsigned int>(y / size), 5u);
+  const double s = 2.0 * x / size - 1.0;
+  const double t = 2.0 * (y - face * size) / size - 1.0;
+  switch (face) {
+    case 0: return Normalize(Vec3{1.0, -t, -s});
+    case 1: return Normalize(Vec3{-1.0, -t, s});
+    case 2: return Normalize(Vec3{s, 1.0, t});
+    case 3: return Normalize(Vec3{s, -1.0, -t});
+    case 4: return Normalize(Vec3{s, -t, 1.0});
+    default: return Normalize(Vec3{-s, -t, -1.0});
+  }
+}
+
+void DirectionToTexel(EnvironmentMapLayout layout, unsigned int size,
+    const Vec3& d, double* x, double* y, unsigned int* face) {
+  if (layout == EnvironmentMapLayout::EQUIRECTANGULAR) {
+    *x = size * (std::atan2(d.y, d.x) + kPi) / kPi;
+    *y = size * std::acos(std::max(-1.0, std::min(d.z, 1.0))) / kPi;
+    *face = 0;
+    return;
+  }
+  const double ax = std::abs(d.x);
+  const double ay = std::abs(d.y);
+  const double az = std::abs(d.z);
+  double sc;
+  double tc;
+  double ma;
+  if (ax >= ay && ax >= az) {
+    *face = d.x > 0.0 ? 0 : 1;
+    sc = d.x > 0.0 ? -d.z : d.z;
+    tc = -d.y;
+    ma = ax;
+  } else if (ay >= az) {
+    *face = d.y > 0.0 ? 2 : 3;
+    sc = d.x;
+    tc = d.y > 0.0 ? d.z : -d.z;
+    ma = ay;
+  } else {
+    *face = d.z > 0.0 ? 4 : 5;
+    sc = d.z > 0.0 ? d.x : -d.x;
+    tc = -d.y;
+    ma = az;
+  }
+  *x = 0.5 * size * (sc / ma + 1.0);
+  *y = 0.5 * size * (tc / ma + 1.0);
+}
+
+// Returns the solid angle subtended by the texel (i, j) of a level.
+double TexelSolidAngle(EnvironmentMapLayout layout, unsigned int size,
+    unsigned int i, unsigned int j) {
+  if (layout == EnvironmentMapLayout::CUBE_MAP) {
+    const double s = 2.0 * (i + 0.5) / size - 1.0;
+    const double t = 2.0 * (j % size + 0.5) / size - 1.0;
+    return 4.0 / (size * size) / std::pow(1.0 + s * s + t * t, 1.5);
+  }
+  return std::sin(kPi * (j + 0.5) / size) * (kPi / size) * (kPi / size);
+}
+
+/*
+<p>The lookups in a level use a bilinear interpolation, clamped at the cube
+map face edges, and wrapping around in azimuth for the equirectangular layout.
+The lookups between levels use a linear interpolation between the two nearest
+levels:
+*/
+
+void Lookup(EnvironmentMapLayout layout, const FloatImage& image,
+    const Vec3& d, double rgb[3]) {
+  const unsigned int size = image.height /
+      (layout == EnvironmentMapLayout::CUBE_MAP ? 6 : 1);
+  double x;
+  double y;
+  unsigned int face;
+  DirectionToTexel(layout, size, d, &x, &y, &face);
+  x -= 0.5;
+  y = std::max(0.0, std::min(y - 0.5, size - 1.0));
+  const bool wrap = layout == EnvironmentMapLayout::EQUIRECTANGULAR;
+  if (!wrap) {
+    x = std::max(0.0, std::min(x, size - 1.0));
+  }
+  const int x0 = static_cast<int>(std::floor(x));
+  const int y0 = static_cast<int>(std::floor(y));
+  const double fx = x - x0;
+  const double fy = y - y0;
+  const int width = image.width;
+  const int height = size;
+  rgb[0] = rgb[1] = rgb[2] = 0.0;
+  for (int j = 0; j < 2; ++j) {
+    const int row = std::min(y0 + j, height - 1) + face * size;
+    const double wy = j == 0 ? 1.0 - fy : fy;
+    for (int i = 0; i < 2; ++i) {
+      const int col = wrap ? ((x0 + i) % width + width) % width :
+          std::min(x0 + i, width - 1);
+      const double w = wy * (i == 0 ? 1.0 - fx : fx);
+      const float* texel = &image.pixels[3 * (col + row * width)];
+      rgb[0] += w * texel[0];
+      rgb[1] += w * texel[1];
+      rgb[2] += w * texel[2];
+    }
+  }
+}
+
+void LookupLod(EnvironmentMapLayout layout,
+    const std::vector<FloatImage>& levels, const Vec3& d, double lod,
+    double rgb[3]) {
+  lod = std::max(0.0, std::min(lod, levels.size() - 1.0));
+  const unsigned int l0 = static_cast<unsigned int>(lod);
+  const unsigned int l1 = std::min(l0 + 1,
+      static_cast<unsigned int>(levels.size() - 1));
+  const double f = lod - l0;
+  double rgb0[3];
+  double rgb1[3];
+  Lookup(layout, levels[l0], d, rgb0);
+  Lookup(layout, levels[l1], d, rgb1);
+  for (unsigned int c = 0; c < 3; ++c) {
+    rgb[c] = rgb0[c] * (1.0 - f) + rgb1[c] * f;
+  }
+}
+
+/*
+<p>The 2x2 box filter used to compute the mip chain of the unfiltered radiance
+(from which the GGX filtered levels are computed) is the following:
+*/
+
+FloatImage Downsample(EnvironmentMapLayout layout, const FloatImage& image,
+    unsigned int size) {
+  FloatImage result = NewImage(layout, size);
+  const unsigned int source_size = image.height /
+      (layout == EnvironmentMapLayout::CUBE_MAP ? 6 : 1);
+  const unsigned int num_faces =
+      layout == EnvironmentMapLayout::CUBE_MAP ? 6 : 1;
+  const unsigned int sx = image.width / result.width;
+  const unsigned int sy = source_size / size;
+  for (unsigned int face = 0; face < num_faces; ++face) {
+    for (unsigned int j = 0; j < size; ++j) {
+      for (unsigned int i = 0; i < result.width; ++i) {
+        float* texel =
+            &result.pixels[3 * (i + (j + face * size) * result.width)];
+        for (unsigned int dj = 0; dj < sy; ++dj) {
+          const unsigned int row = j * sy + dj + face * source_size;
+          for (unsigned int di = 0; di < sx; ++di) {
+            const float* source =
+                &image.pixels[3 * (i * sx + di + row * image.width)];
+            for (unsigned int c = 0; c < 3; ++c) {
+              texel[c] += source[c] / (sx * sy);
+            }
+          }
+        }
+      }
+    }
+  }
+  return result;
+}
+
+/*
+<p>The GGX filtered levels are computed with the usual split sum approximation
+(assuming that the normal, view and reflected directions are equal), with a
+Hammersley sequence to importance sample the GGX distribution, and with
+<a href="https://developer.nvidia.com/gpugems/gpugems3/part-iii-rendering/
+chapter-20-gpu-based-importance-sampling">filtered importance sampling</a> to
+reduce the noise (i.e. each sample is looked up in the box filtered mip chain,
+at a level depending on the solid angle associated with this sample):
+*/
+
+double RadicalInverse(unsigned int bits) {
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return bits * 2.3283064365386963e-10;
+}
+
+void PrefilterGgx(EnvironmentMapLayout layout,
+    const std::vector<FloatImage>& box_levels, double roughness,
+    FloatImage* image) {
+  const unsigned int size = image->height /
+      (layout == EnvironmentMapLayout::CUBE_MAP ? 6 : 1);
+  const double alpha = roughness * roughness;
+  const double alpha2 = alpha * alpha;
+  const double texel_solid_angle =
+      4.0 * kPi / (box_levels[0].width * box_levels[0].height);
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < image->width; ++i) {
+      const Vec3 n = TexelDirection(layout, size, i + 0.5, j + 0.5);
+      const Vec3 up =
+          std::abs(n.z) < 0.999 ? Vec3{0.0, 0.0, 1.0} : Vec3{1.0, 0.0, 0.0};
+      const Vec3 tangent = Normalize(Cross(up, n));
+      const Vec3 bitangent = Cross(n, tangent);
+      double sum[3] = {0.0, 0.0, 0.0};
+      double weight = 0.0;
+      for (unsigned int k = 0; k < kNumGgxSamples; ++k) {
+        const double phi = 2.0 * kPi * (k + 0.5) / kNumGgxSamples;
+        const double xi = RadicalInverse(k);
+        const double cos_theta =
+            std::sqrt((1.0 - xi) / (1.0 + (alpha2 - 1.0) * xi));
+        const double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+        const Vec3 h = sin_theta * std::cos(phi) * tangent +
+            sin_theta * std::sin(phi) * bitangent + cos_theta * n;
+        const double n_dot_h = Dot(n, h);
+        const Vec3 l = 2.0 * n_dot_h * h + -1.0 * n;
+        const double n_dot_l = Dot(n, l);
+        if (n_dot_l <= 0.0) {
+          continue;
+        }
+        // With n = v, the pdf of l is D(n_dot_h) / 4.
+        const double denominator = n_dot_h * n_dot_h * (alpha2 - 1.0) + 1.0;
+        const double pdf = alpha2 / (4.0 * kPi * denominator * denominator);
+        const double sample_solid_angle = 1.0 / (kNumGgxSamples * pdf);
+        const double lod =
+            0.5 * std::log2(sample_solid_angle / texel_solid_angle) + 1.0;
+        double rgb[3];
+        LookupLod(layout, box_levels, Normalize(l), lod, rgb);
+        for (unsigned int c = 0; c < 3; ++c) {
+          sum[c] += rgb[c] * n_dot_l;
+        }
+        weight += n_dot_l;
+      }
+      float* texel = &image->pixels[3 * (i + j * image->width)];
+      for (unsigned int c = 0; c < 3; ++c) {
+        texel[c] = static_cast<float>(weight > 0.0 ? sum[c] / weight : 0.0);
+      }
+    }
+  }, image->height);
+}
+
+/*
+<p>Finally, the irradiance SH coefficients are computed by projecting the
+radiance on the first 9 real spherical harmonics, with the solid angle of each
+texel as weight, and then by multiplying each band with the corresponding
+coefficient of the clamped cosine lobe (see <a href=
+"https://cseweb.ucsd.edu/~ravir/papers/envmap/envmap.pdf">An Efficient
+Representation for Irradiance Environment Maps</a>):
+*/
+
+void EvaluateSh9(const Vec3& d, double sh[9]) {
+  sh[0] = 0.282095;
+  sh[1] = 0.488603 * d.y;
+  sh[2] = 0.488603 * d.z;
+  sh[3] = 0.488603 * d.x;
+  sh[4] = 1.092548 * d.x * d.y;
+  sh[5] = 1.092548 * d.y * d.z;
+  sh[6] = 0.315392 * (3.0 * d.z * d.z - 1.0);
+  sh[7] = 1.092548 * d.x * d.z;
+  sh[8] = 0.546274 * (d.x * d.x - d.y * d.y);
+}
+
+std::array<double, 27> ComputeIrradianceSh9(EnvironmentMapLayout layout,
+    const FloatImage& image) {
+  const unsigned int size = image.height /
+      (layout == EnvironmentMapLayout::CUBE_MAP ? 6 : 1);
+  // The projection of each row, summed at the end in a fixed order to get a
+  // deterministic result.
+  std::vector<std::array<double, 27>> row_sums(image.height);
+  RunJobs([&](unsigned int j) {
+    std::array<double, 27>& row_sum = row_sums[j];
+    row_sum.fill(0.0);
+    for (unsigned int i = 0; i < image.width; ++i) {
+      const Vec3 d = TexelDirection(layout, size, i + 0.5, j + 0.5);
+      const double solid_angle = TexelSolidAngle(layout, size, i, j);
+      double sh[9];
+      EvaluateSh9(d, sh);
+      const float* texel = &image.pixels[3 * (i + j * image.width)];
+      for (unsigned int k = 0; k < 9; ++k) {
+        for (unsigned int c = 0; c < 3; ++c) {
+          row_sum[3 * k + c] += texel[c] * sh[k] * solid_angle;
+        }
+      }
+    }
+  }, image.height);
+
+  std::array<double, 27> result;
+  result.fill(0.0);
+  for (const std::array<double, 27>& row_sum : row_sums) {
+    for (unsigned int k = 0; k < 27; ++k) {
+      result[k] += row_sum[k];
+    }
+  }
+  constexpr double kCosineLobe[3] = {kPi, 2.0 * kPi / 3.0, kPi / 4.0};
+  for (unsigned int k = 0; k < 9; ++k) {
+    const double a = kCosineLobe[k == 0 ? 0 : (k < 4 ? 1 : 2)];
+    for (unsigned int c = 0; c < 3; ++c) {
+      result[3 * k + c] *= a;
+    }
+  }
+  return result;
+}
+
+}  // anonymous namespace
+
+/*
+<p>With these helper functions, the implementation of the public API is
+straightforward. The irradiance is reconstructed from its SH coefficients as
+follows:
+*/
+
+void EnvironmentMap::GetIrradiance(Direction normal, double* r, double* g,
+    double* b) const {
+  double sh[9];
+  EvaluateSh9(Vec3{normal.x(), normal.y(), normal.z()}, sh);
+  double rgb[3] = {0.0, 0.0, 0.0};
+  for (unsigned int k = 0; k < 9; ++k) {
+    for (unsigned int c = 0; c < 3; ++c) {
+      rgb[c] += irradiance_sh[3 * k + c] * sh[k];
+    }
+  }
+  *r = rgb[0];
+  *g = rgb[1];
+  *b = rgb[2];
+}
+
+EnvironmentMapBaker::EnvironmentMapBaker(const Model& model,
+    bool use_luminance) : model_(model), use_luminance_(use_luminance) {}
+
+/*
+<p>The sky radiance, including the sun disk attenuated by the transmittance
+from the camera to the top of the atmosphere, is computed for each texel of
+the first level as follows (the ground is not included, i.e. the view rays
+intersecting the ground only contain the in-scattered light between the
+camera and the ground). When the sun disk is smaller than a texel, which is
+the case for most map sizes, testing if the texel centers are in this disk
+would miss the sun, or make it much too bright. Instead, we add the sun to the
+texel containing its center, with a radiance scaled to preserve its energy:
+*/
+
+void EnvironmentMapBaker::BakeRadiance(EnvironmentMapLayout layout,
+    Length altitude, Direction sun_direction, FloatImage* image) const {
+  const unsigned int size = image->height /
+      (layout == EnvironmentMapLayout::CUBE_MAP ? 6 : 1);
+  const Position camera(0.0 * m, 0.0 * m,
+      model_.atmosphere().bottom_radius + altitude);
+  const double cos_sun_radius =
+      std::cos(model_.atmosphere().sun_angular_radius.to(rad));
+  const double sun_solid_angle = 2.0 * kPi * (1.0 - cos_sun_radius);
+  double sun_x;
+  double sun_y;
+  unsigned int sun_face;
+  DirectionToTexel(layout, size,
+      Vec3{sun_direction.x(), sun_direction.y(), sun_direction.z()},
+      &sun_x, &sun_y, &sun_face);
+  const unsigned int sun_i =
+      std::min(static_cast<unsigned int>(sun_x), image->width - 1);
+  const unsigned int sun_j =
+      std::min(static_cast<unsigned int>(sun_y), size - 1) + sun_face * size;
+  const double sun_texel_solid_angle =
+      TexelSolidAngle(layout, size, sun_i, sun_j);
+  const bool sun_in_one_texel = sun_solid_angle < sun_texel_solid_angle;
+  const double sun_scale =
+      sun_in_one_texel ? sun_solid_angle / sun_texel_solid_angle : 1.0;
+
+  RadianceSpectrum solar_radiance = model_.GetSolarRadiance() * sun_scale;
+  Luminance3 solar_luminance;
+  if (use_luminance_) {
+    solar_luminance = model_.GetSolarLuminance();
+    solar_luminance = Luminance3(solar_luminance.x * sun_scale,
+        solar_luminance.y * sun_scale, solar_luminance.z * sun_scale);
+  }
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < image->width; ++i) {
+      const Vec3 d = TexelDirection(layout, size, i + 0.5, j + 0.5);
+      const Direction view_ray(d.x, d.y, d.z);
+      const bool sun_visible = sun_in_one_texel ?
+          i == sun_i && j == sun_j :
+          dot(view_ray, sun_direction)() > cos_sun_radius;
+      DimensionlessSpectrum transmittance;
+      double rgb[3];
+      if (use_luminance_) {
+        Luminance3 luminance = model_.GetSkyLuminance(
+            camera, view_ray, 0.0 * m, sun_direction, &transmittance);
+        if (sun_visible) {
+          luminance = luminance + Luminance3(
+              solar_luminance.x * transmittance(kLambdaR * nm),
+              solar_luminance.y * transmittance(kLambdaG * nm),
+              solar_luminance.z * transmittance(kLambdaB * nm));
+        }
+        rgb[0] = luminance.x.to(cd_per_square_meter);
+        rgb[1] = luminance.y.to(cd_per_square_meter);
+        rgb[2] = luminance.z.to(cd_per_square_meter);
+      } else {
+        RadianceSpectrum radiance = model_.GetSkyRadiance(
+            camera, view_ray, 0.0 * m, sun_direction, &transmittance);
+        if (sun_visible) {
+          radiance = radiance + transmittance * solar_radiance;
+        }
+        rgb[0] = radiance(kLambdaR * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+        rgb[1] = radiance(kLambdaG * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+        rgb[2] = radiance(kLambdaB * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+      }
+      float* texel = &image->pixels[3 * (i + j * image->width)];
+      for (unsigned int c = 0; c < 3; ++c) {
+        texel[c] = static_cast<float>(rgb[c]);
+      }
+    }
+  }, image->height);
+}
+
+/*
+<p>and the other levels and the SH coefficients are computed from this first
+level, with the above helper functions:
+*/
+
+void EnvironmentMapBaker::Bake(EnvironmentMapLayout layout, unsigned int size,
+    unsigned int num_levels, Length altitude, Direction sun_direction,
+    EnvironmentMap* environment_map) const {
+  assert(size > 0 && num_levels > 0);
+  environment_map->layout = layout;
+  environment_map->levels.clear();
+
+  std::vector<FloatImage> box_levels;
+  box_levels.push_back(NewImage(layout, size));
+  BakeRadiance(layout, altitude, sun_direction, &box_levels[0]);
+  for (unsigned int l = 1; LevelSize(size, l - 1) > 1; ++l) {
+    box_levels.push_back(
+        Downsample(layout, box_levels.back(), LevelSize(size, l)));
+  }
+
+  environment_map->levels.push_back(box_levels[0]);
+  for (unsigned int l = 1; l < num_levels; ++l) {
+    FloatImage level = NewImage(layout, LevelSize(size, l));
+    PrefilterGgx(layout, box_levels,
+        static_cast<double>(l) / (num_levels - 1), &level);
+    environment_map->levels.push_back(std::move(level));
+  }
+  environment_map->irradiance_sh =
+      ComputeIrradianceSh9(layout, box_levels[0]);
+}
+
+}  // namespace reference
+}  // namespace atmosphere
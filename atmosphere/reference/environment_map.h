@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/environment_map.h</h2>
+
+<p>This file defines an API to bake sky environment maps, for image based
+lighting, with our <a href="model.h.html">CPU atmosphere model</a>. To use it:
+<ul>
+<li>create an <code>EnvironmentMapBaker</code> for an initialized
+<code>Model</code>, specifying if the maps should contain spectral radiance
+values at the 3 wavelengths <code>kLambdaR</code>, <code>kLambdaG</code> and
+<code>kLambdaB</code>, or sRGB luminance values,</li>
+<li>call <code>Bake</code> for each desired camera altitude and sun direction
+(the baker can be used for many sun directions, and from several threads).</li>
+</ul>
+<p>Each baked <code>EnvironmentMap</code> contains the sky radiance, including
+the attenuated sun disk, in a cube map or in an equirectangular map, together
+with a mip chain of this map prefiltered with the GGX distribution for
+increasing roughness values, and with the SH9 coefficients of the irradiance
+(i.e. of the radiance convolved with a cosine lobe).
+*/
+
+#ifndef ATMOSPHERE_REFERENCE_ENVIRONMENT_MAP_H_
+#define ATMOSPHERE_REFERENCE_ENVIRONMENT_MAP_H_
+
+#include <array>
+#include <vector>
+
+#include "atmosphere/reference/definitions.h"
+#include "atmosphere/reference/model.h"
+
+namespace atmosphere {
+namespace reference {
+
+// A float RGB image, with 3 values per pixel, stored row by row from top to
+// bottom.
+struct FloatImage {
+  unsigned int width;
+  unsigned int height;
+  std::vector<float> pixels;
+};
+
+// The layout of an environment map. In CUBE_MAP layout, each image contains
+// the 6 faces of the cube map, in the +X, -X, +Y, -Y, +Z, -Z order, stacked
+// vertically (with the OpenGL cube map face orientations). In EQUIRECTANGULAR
+// layout, the columns correspond to azimuth angles from -pi to pi (starting
+// from the -X axis), and the rows to zenith angles from 0 to pi (z is up).
+enum class EnvironmentMapLayout { CUBE_MAP, EQUIRECTANGULAR };
+
+struct EnvironmentMap {
+  EnvironmentMapLayout layout;
+  // levels[0] contains the sky radiance, and levels[i] contains this radiance
+  // prefiltered with the GGX distribution, for a roughness of
+  // i / (levels.size() - 1). Each level is half the size of the previous one.
+  std::vector<FloatImage> levels;
+  // The SH9 coefficients of the irradiance (cosine convolved radiance), with
+  // the 3 color channels of coefficient i in irradiance_sh[3 * i + c].
+  std::array<double, 27> irradiance_sh;
+
+  // Returns the irradiance received by a surface with the given normal, from
+  // the SH9 coefficients.
+  void GetIrradiance(Direction normal, double* r, double* g, double* b) const;
+};
+
+class EnvironmentMapBaker {
+ public:
+  // If use_luminance is true, the maps contain sRGB luminance values in
+  // cd.m^-2 (this requires a Model constructed with the precompute_luminance
+  // option). Otherwise they contain
+  // spectral radiance values at kLambdaR, kLambdaG and kLambdaB, in
+  // W.m^-2.sr^-1.nm^-1.
+  EnvironmentMapBaker(const Model& model, bool use_luminance);
+
+  // Bakes the sky seen from a camera at the given altitude, for the given sun
+  // direction, in a map of the given layout and with num_levels levels (at
+  // least 1). The size of the first level is size x size per cube map face, or
+  // 2 size x size for the equirectangular layout.
+  void Bake(EnvironmentMapLayout layout, unsigned int size,
+      unsigned int num_levels, Length altitude, Direction sun_direction,
+      EnvironmentMap* environment_map) const;
+
+ private:
+  void BakeRadiance(EnvironmentMapLayout layout, Length altitude,
+      Direction sun_direction, FloatImage* image) const;
+
+  const Model& model_;
+  const bool use_luminance_;
+};
+
+}  // namespace reference
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_REFERENCE_ENVIRONMENT_MAP_H_
@@ -44,6 +44,7 @@ GLSL code as C++.
 #define OUT(x) x&
 #define TEMPLATE(x) template<class x>
 #define TEMPLATE_ARGUMENT(x) <x>
+#define NATIVE_4D_SCATTERING_TEXTURES
 
 namespace atmosphere {
 namespace reference {
@@ -50,6 +50,8 @@ typedef dimensional::vec4 vec4;
 
 // Transmittance.
 
+Length ClampRadius(const AtmosphereParameters& atmosphere, Length r);
+
 Length DistanceToTopAtmosphereBoundary(
     const AtmosphereParameters& atmosphere, Length r, Number mu);
 
@@ -83,6 +85,23 @@ void GetRMuFromTransmittanceTextureUv(const AtmosphereParameters& atmosphere,
 DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundaryTexture(
     const AtmosphereParameters& atmosphere, const vec2& gl_frag_coord);
 
+Number GetDensityTextureUFromAltitude(const AtmosphereParameters& atmosphere,
+    Length altitude);
+
+vec3 ComputeDensityTexture(const AtmosphereParameters& atmosphere,
+    const vec2& gl_frag_coord);
+
+vec3 GetProfileDensities(const AtmosphereParameters& atmosphere,
+    const DensityTexture& density_texture, Length altitude);
+
+DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundary(
+    const AtmosphereParameters& atmosphere,
+    const DensityTexture& density_texture, Length r, Number mu);
+
+DimensionlessSpectrum ComputeTransmittanceToTopAtmosphereBoundaryTexture(
+    const AtmosphereParameters& atmosphere,
+    const DensityTexture& density_texture, const vec2& gl_frag_coord);
+
 DimensionlessSpectrum GetTransmittanceToTopAtmosphereBoundary(
     const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
@@ -93,11 +112,17 @@ DimensionlessSpectrum GetTransmittance(
     const TransmittanceTexture& transmittance_texture,
     Length r, Number mu, Length d, bool ray_r_mu_intersects_ground);
 
+DimensionlessSpectrum GetTransmittanceToSun(
+    const AtmosphereParameters& atmosphere,
+    const TransmittanceTexture& transmittance_texture,
+    Length r, Number mu_s);
+
 // Single scattering.
 
 void ComputeSingleScatteringIntegrand(
     const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
+    const DensityTexture& density_texture,
     Length r, Number mu, Number mu_s, Number nu, Length d,
     bool ray_r_mu_intersects_ground,
     DimensionlessSpectrum& rayleigh, DimensionlessSpectrum& mie);
@@ -109,6 +134,7 @@ Length DistanceToNearestAtmosphereBoundary(
 void ComputeSingleScattering(
     const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
+    const DensityTexture& density_texture,
     Length r, Number mu, Number mu_s, Number nu,
     bool ray_r_mu_intersects_ground,
     IrradianceSpectrum& rayleigh, IrradianceSpectrum& mie);
@@ -128,8 +154,8 @@ void GetRMuMuSNuFromScatteringTextureUvwz(
 
 void ComputeSingleScatteringTexture(const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
-    const vec3& gl_frag_coord, IrradianceSpectrum& rayleigh,
-    IrradianceSpectrum& mie);
+    const DensityTexture& density_texture, const vec3& gl_frag_coord,
+    IrradianceSpectrum& rayleigh, IrradianceSpectrum& mie);
 
 template<class T>
 T GetScattering(
@@ -152,6 +178,7 @@ RadianceSpectrum GetScattering(
 RadianceDensitySpectrum ComputeScatteringDensity(
     const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
+    const DensityTexture& density_texture,
     const ReducedScatteringTexture& single_rayleigh_scattering_texture,
     const ReducedScatteringTexture& single_mie_scattering_texture,
     const ScatteringTexture& multiple_scattering_texture,
@@ -169,6 +196,7 @@ RadianceSpectrum ComputeMultipleScattering(
 RadianceDensitySpectrum ComputeScatteringDensityTexture(
     const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
+    const DensityTexture& density_texture,
     const ReducedScatteringTexture& single_rayleigh_scattering_texture,
     const ReducedScatteringTexture& single_mie_scattering_texture,
     const ScatteringTexture& multiple_scattering_texture,
@@ -228,6 +256,44 @@ RadianceSpectrum GetSkyRadiance(
     Position camera, const Direction& view_ray, Length shadow_length,
     const Direction& sun_direction, DimensionlessSpectrum& transmittance);
 
+bool GetCameraInAtmosphere(
+    const AtmosphereParameters& atmosphere,
+    const Position& camera, const Direction& view_ray,
+    Position& camera_in_atmosphere, Length& r, Length& rmu);
+
+bool GetViewRayTerms(
+    const AtmosphereParameters& atmosphere,
+    const TransmittanceTexture& transmittance_texture,
+    Position camera, const Direction& view_ray,
+    Position& camera_in_atmosphere, Length& r, Number& mu,
+    bool& ray_r_mu_intersects_ground, DimensionlessSpectrum& transmittance);
+
+RadianceSpectrum GetSkyRadianceFromViewRayTerms(
+    const AtmosphereParameters& atmosphere,
+    const ReducedScatteringTexture& scattering_texture,
+    const ReducedScatteringTexture& single_mie_scattering_texture,
+    const Position& camera_in_atmosphere, const Direction& view_ray,
+    Length r, Number mu, bool ray_r_mu_intersects_ground,
+    const Direction& sun_direction);
+
+void GetRMuMuSAtDistance(
+    const AtmosphereParameters& atmosphere,
+    Length r, Number mu, Number mu_s, Number nu, Length d,
+    Length& r_d, Number& mu_d, Number& mu_s_d);
+
+vec2 GetSkyViewUvFromRMuMuSNu(const AtmosphereParameters& atmosphere,
+    Length r, Number mu, Number mu_s, Number nu);
+
+void GetMuNuFromSkyViewUv(const AtmosphereParameters& atmosphere,
+    Length r, Number mu_s, const vec2& uv, Number& mu, Number& nu);
+
+RadianceSpectrum ComputeSkyViewTexture(
+    const AtmosphereParameters& atmosphere,
+    const TransmittanceTexture& transmittance_texture,
+    const ReducedScatteringTexture& scattering_texture,
+    const ReducedScatteringTexture& single_mie_scattering_texture,
+    Length r, Number mu_s, const vec2& uv);
+
 RadianceSpectrum GetSkyRadianceToPoint(
     const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
@@ -236,6 +302,11 @@ RadianceSpectrum GetSkyRadianceToPoint(
     Position camera, const Position& point, Length shadow_length,
     const Direction& sun_direction, DimensionlessSpectrum& transmittance);
 
+void GetSunAndSkyIrradianceTerms(
+    const Position& point, const Direction& normal,
+    const Direction& sun_direction, Length& r, Number& mu_s,
+    Number& sun_factor, Number& sky_factor);
+
 IrradianceSpectrum GetSunAndSkyIrradiance(
     const AtmosphereParameters& atmosphere,
     const TransmittanceTexture& transmittance_texture,
@@ -37,6 +37,7 @@ of some (arbitrary) values for the atmosphere parameters:
 #include "atmosphere/reference/functions.h"
 
 #include <limits>
+#include <memory>
 #include <string>
 
 #include "atmosphere/reference/definitions.h"
@@ -111,23 +112,53 @@ class LazyTransmittanceTexture :
   const AtmosphereParameters& atmosphere_parameters_;
 };
 
+/*
+<p>a lazy density lookup table:
+*/
+
+class LazyDensityTexture : public DensityTexture {
+ public:
+  explicit LazyDensityTexture(const AtmosphereParameters& atmosphere_parameters)
+    : BinaryFunction(vec3(-1.0, -1.0, -1.0)),
+      atmosphere_parameters_(atmosphere_parameters) {
+  }
+
+  virtual const vec3& Get(int i, int j) const {
+    int index = i + j * DENSITY_TEXTURE_WIDTH;
+    if (value_[index].x < 0.0) {
+      value_[index] = ComputeDensityTexture(
+          atmosphere_parameters_, vec2(i + 0.5, j + 0.5));
+    }
+    return value_[index];
+  }
+
+  void Clear() {
+    constexpr unsigned int n = DENSITY_TEXTURE_WIDTH * DENSITY_TEXTURE_HEIGHT;
+    for (unsigned int i = 0; i < n; ++i) {
+      value_[i] = vec3(-1.0, -1.0, -1.0);
+    }
+  }
+
+ private:
+  const AtmosphereParameters& atmosphere_parameters_;
+};
+
 /*
 <p>We also need a lazy single scattering texture:
 */
 
 class LazySingleScatteringTexture :
-    public dimensional::TernaryFunction<SCATTERING_TEXTURE_WIDTH,
-                                        SCATTERING_TEXTURE_HEIGHT,
-                                        SCATTERING_TEXTURE_DEPTH,
-                                        IrradianceSpectrum> {
+    public AbstractScatteringTexture<IrradianceSpectrum> {
  public:
   LazySingleScatteringTexture(
       const AtmosphereParameters& atmosphere_parameters,
       const TransmittanceTexture& transmittance_texture,
+      const DensityTexture& density_texture,
       bool rayleigh)
-      : TernaryFunction(IrradianceSpectrum(-watt_per_square_meter_per_nm)),
+      : QuaternaryFunction(IrradianceSpectrum(-watt_per_square_meter_per_nm)),
         atmosphere_parameters_(atmosphere_parameters),
         transmittance_texture_(transmittance_texture),
+        density_texture_(density_texture),
         rayleigh_(rayleigh) {
   }
 
@@ -138,8 +169,8 @@ class LazySingleScatteringTexture :
       IrradianceSpectrum rayleigh;
       IrradianceSpectrum mie;
       ComputeSingleScatteringTexture(atmosphere_parameters_,
-          transmittance_texture_, vec3(i + 0.5, j + 0.5, k + 0.5),
-          rayleigh, mie);
+          transmittance_texture_, density_texture_,
+          vec3(i + 0.5, j + 0.5, k + 0.5), rayleigh, mie);
       value_[index] = rayleigh_ ? rayleigh : mie;
     }
     return value_[index];
@@ -148,6 +179,7 @@ class LazySingleScatteringTexture :
  private:
   const AtmosphereParameters& atmosphere_parameters_;
   const TransmittanceTexture& transmittance_texture_;
+  const DensityTexture& density_texture_;
   const bool rayleigh_;
 };
 
@@ -156,23 +188,22 @@ class LazySingleScatteringTexture :
 */
 
 class LazyScatteringDensityTexture :
-    public dimensional::TernaryFunction<SCATTERING_TEXTURE_WIDTH,
-                                        SCATTERING_TEXTURE_HEIGHT,
-                                        SCATTERING_TEXTURE_DEPTH,
-                                        RadianceDensitySpectrum> {
+    public AbstractScatteringTexture<RadianceDensitySpectrum> {
  public:
   LazyScatteringDensityTexture(
       const AtmosphereParameters& atmosphere_parameters,
       const TransmittanceTexture& transmittance_texture,
+      const DensityTexture& density_texture,
       const ReducedScatteringTexture& single_rayleigh_scattering_texture,
       const ReducedScatteringTexture& single_mie_scattering_texture,
       const ScatteringTexture& multiple_scattering_texture,
       const IrradianceTexture& irradiance_texture,
       const int order)
-      : TernaryFunction(
+      : QuaternaryFunction(
             RadianceDensitySpectrum(-watt_per_cubic_meter_per_sr_per_nm)),
         atmosphere_parameters_(atmosphere_parameters),
         transmittance_texture_(transmittance_texture),
+        density_texture_(density_texture),
         single_rayleigh_scattering_texture_(single_rayleigh_scattering_texture),
         single_mie_scattering_texture_(single_mie_scattering_texture),
         multiple_scattering_texture_(multiple_scattering_texture),
@@ -185,7 +216,7 @@ class LazyScatteringDensityTexture :
         i + SCATTERING_TEXTURE_WIDTH * (j + SCATTERING_TEXTURE_HEIGHT * k);
     if (value_[index][0] < 0.0 * watt_per_cubic_meter_per_sr_per_nm) {
       value_[index] = ComputeScatteringDensityTexture(
-          atmosphere_parameters_, transmittance_texture_,
+          atmosphere_parameters_, transmittance_texture_, density_texture_,
           single_rayleigh_scattering_texture_, single_mie_scattering_texture_,
           multiple_scattering_texture_, irradiance_texture_,
           vec3(i + 0.5, j + 0.5, k + 0.5), order_);
@@ -196,6 +227,7 @@ class LazyScatteringDensityTexture :
  private:
   const AtmosphereParameters& atmosphere_parameters_;
   const TransmittanceTexture& transmittance_texture_;
+  const DensityTexture& density_texture_;
   const ReducedScatteringTexture& single_rayleigh_scattering_texture_;
   const ReducedScatteringTexture& single_mie_scattering_texture_;
   const ScatteringTexture& multiple_scattering_texture_;
@@ -209,16 +241,14 @@ class LazyScatteringDensityTexture :
 */
 
 class LazyMultipleScatteringTexture :
-    public dimensional::TernaryFunction<SCATTERING_TEXTURE_WIDTH,
-                                        SCATTERING_TEXTURE_HEIGHT,
-                                        SCATTERING_TEXTURE_DEPTH,
-                                        RadianceSpectrum> {
+    public AbstractScatteringTexture<RadianceSpectrum> {
  public:
   LazyMultipleScatteringTexture(
       const AtmosphereParameters& atmosphere_parameters,
       const TransmittanceTexture& transmittance_texture,
       const ScatteringDensityTexture& scattering_density_texture)
-      : TernaryFunction(RadianceSpectrum(-watt_per_square_meter_per_sr_per_nm)),
+      : QuaternaryFunction(
+            RadianceSpectrum(-watt_per_square_meter_per_sr_per_nm)),
         atmosphere_parameters_(atmosphere_parameters),
         transmittance_texture_(transmittance_texture),
         scattering_density_texture_(scattering_density_texture) {
@@ -631,6 +661,41 @@ coefficient times the distance travelled in the atmosphere).
         Number(kEpsilon));
   }
 
+/*
+<p><i>Density lookup table</i>: check that we get the same densities and
+transmittance (more or less $\epsilon$) whether we compute them directly with
+the analytic density profiles, or via linearly interpolated lookups in the
+precomputed density texture.
+*/
+
+  void TestComputeAndGetProfileDensities() {
+    LazyDensityTexture density_texture(atmosphere_parameters_);
+
+    const Length r = kBottomRadius * 0.7 + kTopRadius * 0.3;
+    const Length altitude = r - kBottomRadius;
+    vec3 densities = GetProfileDensities(
+        atmosphere_parameters_, density_texture, altitude);
+    ExpectNear(
+        GetProfileDensity(atmosphere_parameters_.rayleigh_density, altitude),
+        densities.x,
+        Number(kEpsilon));
+    ExpectNear(
+        GetProfileDensity(atmosphere_parameters_.mie_density, altitude),
+        densities.y,
+        Number(kEpsilon));
+
+    const Number mu_values[3] = {1.0, 0.2, CosineOfHorizonZenithAngle(r)};
+    for (Number mu : mu_values) {
+      ExpectNear(
+          1.0,
+          (ComputeTransmittanceToTopAtmosphereBoundary(
+              atmosphere_parameters_, density_texture, r, mu) /
+           ComputeTransmittanceToTopAtmosphereBoundary(
+              atmosphere_parameters_, r, mu))[0](),
+          kEpsilon);
+    }
+  }
+
 /*
 <p><i>Single scattering integrand</i>: check that the computation in
 <code>ComputeSingleScatteringIntegrand</code> (which uses a precomputed
@@ -675,6 +740,7 @@ in <code>TestComputeTransmittanceToTopAtmosphereBoundary</code>).</li>
 
   void TestComputeSingleScatteringIntegrand() {
     LazyTransmittanceTexture transmittance_texture(atmosphere_parameters_);
+    LazyDensityTexture density_texture(atmosphere_parameters_);
 
     // Vertical ray, from bottom to top atmosphere boundary, scattering at
     // middle of ray, scattering angle equal to 0.
@@ -683,7 +749,7 @@ in <code>TestComputeTransmittanceToTopAtmosphereBoundary</code>).</li>
     DimensionlessSpectrum rayleigh;
     DimensionlessSpectrum mie;
     ComputeSingleScatteringIntegrand(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kBottomRadius, 1.0, 1.0, 1.0, h, false, rayleigh, mie);
     Number rayleigh_optical_depth = kRayleighScattering * kRayleighScaleHeight *
         (1.0 - exp(-h_top / kRayleighScaleHeight));
@@ -702,7 +768,7 @@ in <code>TestComputeTransmittanceToTopAtmosphereBoundary</code>).</li>
 
     // Vertical ray, top to middle of atmosphere, scattering angle 180 degrees.
     ComputeSingleScatteringIntegrand(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kTopRadius, -1.0, 1.0, -1.0, h, true, rayleigh, mie);
     rayleigh_optical_depth = 2.0 * kRayleighScattering * kRayleighScaleHeight *
         (exp(-h / kRayleighScaleHeight) - exp(-h_top / kRayleighScaleHeight));
@@ -722,10 +788,11 @@ in <code>TestComputeTransmittanceToTopAtmosphereBoundary</code>).</li>
     // Horizontal ray, from bottom to top atmosphere boundary, scattering at
     // 50km, scattering angle equal to 0, uniform atmosphere, no aerosols.
     transmittance_texture.Clear();
+    density_texture.Clear();
     SetUniformAtmosphere();
     RemoveAerosols();
     ComputeSingleScatteringIntegrand(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kBottomRadius, 0.0, 0.0, 1.0, 50.0 * km, false, rayleigh, mie);
     rayleigh_optical_depth = kRayleighScattering * sqrt(
         kTopRadius * kTopRadius - kBottomRadius * kBottomRadius);
@@ -817,13 +884,14 @@ $$
 
   void TestComputeSingleScattering() {
     LazyTransmittanceTexture transmittance_texture(atmosphere_parameters_);
+    LazyDensityTexture density_texture(atmosphere_parameters_);
 
     // Vertical ray, from bottom atmosphere boundary, scattering angle 0.
     const Length h_top = kTopRadius - kBottomRadius;
     IrradianceSpectrum rayleigh;
     IrradianceSpectrum mie;
     ComputeSingleScattering(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kBottomRadius, 1.0, 1.0, 1.0, false, rayleigh, mie);
     Number rayleigh_optical_depth = kRayleighScattering * kRayleighScaleHeight *
         (1.0 - exp(-h_top / kRayleighScaleHeight));
@@ -844,9 +912,10 @@ $$
     // Vertical ray, from top atmosphere boundary, scattering angle 180 degrees,
     // no aerosols.
     transmittance_texture.Clear();
+    density_texture.Clear();
     RemoveAerosols();
     ComputeSingleScattering(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kTopRadius, -1.0, 1.0, -1.0, true, rayleigh, mie);
     ExpectNear(
         Number(1.0),
@@ -1059,6 +1128,97 @@ check that the mapping function and its inverse are really inverse of each other
     ExpectFalse(ray_r_mu_intersects_ground);
   }
 
+/*
+<p><i>4D texture lookups</i>: check that a quadrilinear lookup in a
+<a href="quaternary_function.h.html">true 4D texture</a> exactly reproduces a
+function which is linear in each texel coordinate, including near the $\mu_s$
+boundaries (where the emulation of 4D lookups with 3D textures mixes texels
+from different $\nu$ slices).
+*/
+
+  void TestQuadrilinearScatteringLookup() {
+    std::unique_ptr<ReducedScatteringTexture> scattering_texture(
+        new ReducedScatteringTexture);
+    for (unsigned int x = 0; x < scattering_texture->size_x(); ++x) {
+      double nu = x / SCATTERING_TEXTURE_MU_S_SIZE;
+      double mu_s = x % SCATTERING_TEXTURE_MU_S_SIZE;
+      for (unsigned int y = 0; y < scattering_texture->size_y(); ++y) {
+        for (unsigned int z = 0; z < scattering_texture->size_z(); ++z) {
+          double v = nu + 2.0 * mu_s + 3.0 * y + 4.0 * z;
+          scattering_texture->Set(x, y, z,
+              IrradianceSpectrum(v * watt_per_square_meter_per_nm));
+        }
+      }
+    }
+    ExpectNear(1.0 + 2.0 * 3.0 + 3.0 * 4.0 + 4.0 * 5.0,
+        scattering_texture->Get(SCATTERING_TEXTURE_MU_S_SIZE + 3, 4, 5)[0].to(
+            watt_per_square_meter_per_nm),
+        kEpsilon);
+
+    // Interior lookup.
+    vec4 uvwz = vec4(0.3, 0.4, 0.6, 0.7);
+    double expected = 0.3 * (SCATTERING_TEXTURE_NU_SIZE - 1.0) +
+        2.0 * (0.4 * SCATTERING_TEXTURE_MU_S_SIZE - 0.5) +
+        3.0 * (0.6 * SCATTERING_TEXTURE_MU_SIZE - 0.5) +
+        4.0 * (0.7 * SCATTERING_TEXTURE_R_SIZE - 0.5);
+    ExpectNear(expected,
+        texture(*scattering_texture, uvwz)[0].to(watt_per_square_meter_per_nm),
+        kEpsilon);
+
+    // Lookups at the mu_s boundaries, which must be clamped in the current nu
+    // slice.
+    uvwz = vec4(0.3, 0.0, 0.6, 0.7);
+    expected = 0.3 * (SCATTERING_TEXTURE_NU_SIZE - 1.0) +
+        3.0 * (0.6 * SCATTERING_TEXTURE_MU_SIZE - 0.5) +
+        4.0 * (0.7 * SCATTERING_TEXTURE_R_SIZE - 0.5);
+    ExpectNear(expected,
+        texture(*scattering_texture, uvwz)[0].to(watt_per_square_meter_per_nm),
+        kEpsilon);
+    uvwz = vec4(0.3, 1.0, 0.6, 0.7);
+    expected += 2.0 * (SCATTERING_TEXTURE_MU_S_SIZE - 1.0);
+    ExpectNear(expected,
+        texture(*scattering_texture, uvwz)[0].to(watt_per_square_meter_per_nm),
+        kEpsilon);
+  }
+
+/*
+<p><i>4D texture layouts</i>: check that the <code>LINEAR</code> and
+<code>TILED</code> memory layouts of the scattering textures give the same
+texel values and lookup results, and that they can be mixed in additions.
+*/
+
+  void TestScatteringTextureLayouts() {
+    std::unique_ptr<ReducedScatteringTexture> linear_texture(
+        new ReducedScatteringTexture(TextureLayout::LINEAR));
+    std::unique_ptr<ReducedScatteringTexture> tiled_texture(
+        new ReducedScatteringTexture(TextureLayout::TILED));
+    for (unsigned int z = 0; z < linear_texture->size_z(); ++z) {
+      for (unsigned int y = 0; y < linear_texture->size_y(); ++y) {
+        for (unsigned int x = 0; x < linear_texture->size_x(); ++x) {
+          double v = x + linear_texture->size_x() *
+              (y + linear_texture->size_y() * z);
+          linear_texture->Set(x, y, z,
+              IrradianceSpectrum(v * watt_per_square_meter_per_nm));
+          tiled_texture->Set(x, y, z,
+              IrradianceSpectrum(v * watt_per_square_meter_per_nm));
+        }
+      }
+    }
+    ExpectEquals(
+        linear_texture->Get(37, 45, 13)[0].to(watt_per_square_meter_per_nm),
+        tiled_texture->Get(37, 45, 13)[0].to(watt_per_square_meter_per_nm));
+    vec4 uvwz = vec4(0.6, 0.3, 0.2, 0.9);
+    ExpectEquals(
+        texture(*linear_texture, uvwz)[0].to(watt_per_square_meter_per_nm),
+        texture(*tiled_texture, uvwz)[0].to(watt_per_square_meter_per_nm));
+
+    *tiled_texture += *linear_texture;
+    ExpectEquals(
+        2.0 * linear_texture->Get(37, 45, 13)[0].to(
+            watt_per_square_meter_per_nm),
+        tiled_texture->Get(37, 45, 13)[0].to(watt_per_square_meter_per_nm));
+  }
+
 /*
 <p><i>Single scattering texture</i>: check that we get the same single
 scattering value (more or less $\epsilon$) whether we compute it directly
@@ -1068,10 +1228,11 @@ quadrilinearly interpolated lookup in the precomputed single scattering texture.
 
   void TestComputeAndGetSingleScattering() {
     LazyTransmittanceTexture transmittance_texture(atmosphere_parameters_);
+    LazyDensityTexture density_texture(atmosphere_parameters_);
     LazySingleScatteringTexture single_rayleigh_scattering_texture(
-        atmosphere_parameters_, transmittance_texture, true);
+        atmosphere_parameters_, transmittance_texture, density_texture, true);
     LazySingleScatteringTexture single_mie_scattering_texture(
-        atmosphere_parameters_, transmittance_texture, false);
+        atmosphere_parameters_, transmittance_texture, density_texture, false);
 
     // Vertical ray, from bottom atmosphere boundary, scattering angle 0.
     IrradianceSpectrum rayleigh = GetScattering(
@@ -1083,7 +1244,7 @@ quadrilinearly interpolated lookup in the precomputed single scattering texture.
     IrradianceSpectrum expected_rayleigh;
     IrradianceSpectrum expected_mie;
     ComputeSingleScattering(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kBottomRadius, 1.0, 1.0, 1.0, false, expected_rayleigh, expected_mie);
     ExpectNear(1.0, (rayleigh / expected_rayleigh)[0](), kEpsilon);
     ExpectNear(1.0, (mie / expected_mie)[0](), kEpsilon);
@@ -1096,7 +1257,7 @@ quadrilinearly interpolated lookup in the precomputed single scattering texture.
         atmosphere_parameters_, single_mie_scattering_texture,
         kTopRadius, -1.0, 1.0, -1.0, true);
     ComputeSingleScattering(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kTopRadius, -1.0, 1.0, -1.0, true, expected_rayleigh, expected_mie);
     ExpectNear(1.0, (rayleigh / expected_rayleigh)[0](), kEpsilon);
     ExpectNear(1.0, (mie / expected_mie)[0](), kEpsilon);
@@ -1109,7 +1270,7 @@ quadrilinearly interpolated lookup in the precomputed single scattering texture.
         atmosphere_parameters_, single_mie_scattering_texture,
         kBottomRadius, 0.0, 0.0, 0.0, false);
     ComputeSingleScattering(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kBottomRadius, 0.0, 0.0, 0.0, false, expected_rayleigh, expected_mie);
     // The relative error is quite large in this case, i.e. between 6 to 8%.
     ExpectNear(1.0, (rayleigh / expected_rayleigh)[0](), 1e-1);
@@ -1124,7 +1285,7 @@ quadrilinearly interpolated lookup in the precomputed single scattering texture.
         atmosphere_parameters_, single_mie_scattering_texture,
         kTopRadius, mu, 1.0, mu, false);
     ComputeSingleScattering(
-        atmosphere_parameters_, transmittance_texture,
+        atmosphere_parameters_, transmittance_texture, density_texture,
         kTopRadius, mu, 1.0, mu, false, expected_rayleigh, expected_mie);
     ExpectNear(1.0, (rayleigh / expected_rayleigh)[0](), kEpsilon);
     ExpectNear(1.0, (mie / expected_mie)[0](), kEpsilon);
@@ -1155,6 +1316,7 @@ horizontal direction for the scattered radiance).</li>
   void TestComputeScatteringDensity() {
     RadianceSpectrum kRadiance(13.0 * watt_per_square_meter_per_sr_per_nm);
     TransmittanceTexture full_transmittance(DimensionlessSpectrum(1.0));
+    LazyDensityTexture density_texture(atmosphere_parameters_);
     ReducedScatteringTexture no_single_scattering(
         IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm));
     ScatteringTexture uniform_multiple_scattering(kRadiance);
@@ -1162,9 +1324,9 @@ horizontal direction for the scattered radiance).</li>
         IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm));
 
     RadianceDensitySpectrum scattering_density = ComputeScatteringDensity(
-        atmosphere_parameters_, full_transmittance,  no_single_scattering,
-        no_single_scattering, uniform_multiple_scattering, no_irradiance,
-        kBottomRadius, 0.0, 0.0, 1.0, 3);
+        atmosphere_parameters_, full_transmittance, density_texture,
+        no_single_scattering, no_single_scattering, uniform_multiple_scattering,
+        no_irradiance, kBottomRadius, 0.0, 0.0, 1.0, 3);
     SpectralRadianceDensity kExpectedScatteringDensity =
         (kRayleighScattering + kMieScattering) * kRadiance[0];
     ExpectNear(
@@ -1177,9 +1339,9 @@ horizontal direction for the scattered radiance).</li>
     ScatteringTexture no_multiple_scattering(
         RadianceSpectrum(0.0 * watt_per_square_meter_per_sr_per_nm));
     scattering_density = ComputeScatteringDensity(
-        atmosphere_parameters_, full_transmittance, no_single_scattering,
-        no_single_scattering, no_multiple_scattering, uniform_irradiance,
-        kBottomRadius, 0.0, 0.0, 1.0, 3);
+        atmosphere_parameters_, full_transmittance, density_texture,
+        no_single_scattering, no_single_scattering, no_multiple_scattering,
+        uniform_irradiance, kBottomRadius, 0.0, 0.0, 1.0, 3);
     kExpectedScatteringDensity = (kRayleighScattering + kMieScattering) *
         kGroundAlbedo / (2.0 * PI * sr) * kIrradiance[0];
     ExpectNear(
@@ -1237,14 +1399,15 @@ analytically.
   void TestComputeAndGetScatteringDensity() {
     RadianceSpectrum kRadiance(13.0 * watt_per_square_meter_per_sr_per_nm);
     TransmittanceTexture full_transmittance(DimensionlessSpectrum(1.0));
+    LazyDensityTexture density_texture(atmosphere_parameters_);
     ReducedScatteringTexture no_single_scattering(
         IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm));
     ScatteringTexture uniform_multiple_scattering(kRadiance);
     IrradianceTexture no_irradiance(
         IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm));
     LazyScatteringDensityTexture multiple_scattering1(atmosphere_parameters_,
-        full_transmittance, no_single_scattering, no_single_scattering,
-        uniform_multiple_scattering, no_irradiance, 3);
+        full_transmittance, density_texture, no_single_scattering,
+        no_single_scattering, uniform_multiple_scattering, no_irradiance, 3);
 
     RadianceDensitySpectrum scattering_density = GetScattering(
         atmosphere_parameters_, multiple_scattering1,
@@ -1262,8 +1425,8 @@ analytically.
         RadianceSpectrum(0.0 * watt_per_square_meter_per_sr_per_nm));
 
     LazyScatteringDensityTexture multiple_scattering2(atmosphere_parameters_,
-        full_transmittance, no_single_scattering, no_single_scattering,
-        no_multiple_scattering, uniform_irradiance, 3);
+        full_transmittance, density_texture, no_single_scattering,
+        no_single_scattering, no_multiple_scattering, uniform_irradiance, 3);
     scattering_density = GetScattering(
         atmosphere_parameters_, multiple_scattering2,
         kBottomRadius, 0.0, 0.0, 1.0, false);
@@ -1442,6 +1605,45 @@ in the precomputed ground irradiance texture.
         kEpsilon);
   }
 
+/*
+<h3>Rendering</h3>
+
+<p><i>Sky view texture mapping</i>: check that the zenith, horizon and nadir
+directions are mapped to the top, middle and bottom of the sky view texture,
+that the Sun azimuth is mapped to its left border, and that the inverse mapping
+gives back the original $\mu$ and $\nu$ values.
+*/
+
+  void TestGetSkyViewUvFromRMuMuSNu() {
+    const Length r = kBottomRadius * 0.8 + kTopRadius * 0.2;
+    const Number mu_s = 0.3;
+    const Number mu_horizon = CosineOfHorizonZenithAngle(r);
+    ExpectNear(0.0, GetSkyViewUvFromRMuMuSNu(
+        atmosphere_parameters_, r, 1.0, mu_s, mu_s).y(), kEpsilon);
+    ExpectNear(0.5, GetSkyViewUvFromRMuMuSNu(
+        atmosphere_parameters_, r, mu_horizon, mu_s, 0.0).y(), kEpsilon);
+    ExpectNear(1.0, GetSkyViewUvFromRMuMuSNu(
+        atmosphere_parameters_, r, -1.0, mu_s, -mu_s).y(), kEpsilon);
+
+    const Number sin_s = sqrt(1.0 - mu_s * mu_s);
+    for (Number mu : {-0.9, -0.2, 0.0, 0.4, 0.95}) {
+      const Number sin_theta = sqrt(1.0 - mu * mu);
+      for (Number cos_phi : {-1.0, -0.3, 0.5, 1.0}) {
+        const Number nu = mu * mu_s + sin_theta * sin_s * cos_phi;
+        const vec2 uv =
+            GetSkyViewUvFromRMuMuSNu(atmosphere_parameters_, r, mu, mu_s, nu);
+        if (cos_phi == 1.0) {
+          ExpectNear(0.0, uv.x(), kEpsilon);
+        }
+        Number mu_p;
+        Number nu_p;
+        GetMuNuFromSkyViewUv(atmosphere_parameters_, r, mu_s, uv, mu_p, nu_p);
+        ExpectNear(mu, mu_p, Number(kEpsilon));
+        ExpectNear(nu, nu_p, Number(kEpsilon));
+      }
+    }
+  }
+
 /*
 <p>And that's it for the unit tests! We just need to implement the two methods
 that we used above to set a uniform density of air molecules and aerosols, and
@@ -1507,6 +1709,9 @@ FunctionsTest get_transmittance_to_top_atmosphere_boundary(
 FunctionsTest compute_and_get_transmittance(
     "ComputeAndGetTransmittance",
     &FunctionsTest::TestComputeAndGetTransmittance);
+FunctionsTest compute_and_get_profile_densities(
+    "ComputeAndGetProfileDensities",
+    &FunctionsTest::TestComputeAndGetProfileDensities);
 
 FunctionsTest compute_single_scattering_integrand(
     "ComputeSingleScatteringIntegrand",
@@ -1526,6 +1731,12 @@ FunctionsTest get_scattering_texture_uvwz_from_rmumusnu(
 FunctionsTest get_rmumusnu_from_scattering_texture_uvwz(
     "GetRMuMuSNuFromScatteringTextureUvwz",
     &FunctionsTest::TestGetRMuMuSNuFromScatteringTextureUvwz);
+FunctionsTest quadrilinear_scattering_lookup(
+    "QuadrilinearScatteringLookup",
+    &FunctionsTest::TestQuadrilinearScatteringLookup);
+FunctionsTest scattering_texture_layouts(
+    "ScatteringTextureLayouts",
+    &FunctionsTest::TestScatteringTextureLayouts);
 FunctionsTest compute_and_get_scattering(
     "ComputeAndGetSingleScattering",
     &FunctionsTest::TestComputeAndGetSingleScattering);
@@ -1556,6 +1767,10 @@ FunctionsTest get_irradiance(
     "GetComputeAndGetIrradiance",
     &FunctionsTest::TestComputeAndGetIrradiance);
 
+FunctionsTest get_sky_view_uv_from_rmumusnu(
+    "GetSkyViewUvFromRMuMuSNu",
+    &FunctionsTest::TestGetSkyViewUvFromRMuMuSNu);
+
 }  // anonymous namespace
 
 }  // namespace reference
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/layout_benchmark.cc</h2>
+
+<p>This file measures the time taken by a multiple scattering precomputation
+pass on CPU, with the <code>LINEAR</code> and <code>TILED</code>
+<a href="quaternary_function.h.html">scattering texture layouts</a>. Each pass
+computes the multiple scattering for a few $r$ slices of the scattering texture,
+which requires many lookups in the scattering density texture along rays where
+$r$, $\mu$ and $\mu_s$ change simultaneously. The layout to benchmark can be
+given on the command line ("linear" or "tiled"). By default both layouts are
+benchmarked. For each layout, the pass time is reported with the number of
+cache references and cache misses during the pass (measured with the Linux
+<code>perf_event_open</code> system call, if available). These counts exclude
+the initialization of the textures, unlike those given by <code>perf
+stat</code> for the whole process (see the <code>benchmark</code> target of the
+Makefile).
+*/
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "atmosphere/reference/definitions.h"
+#include "atmosphere/reference/functions.h"
+
+namespace atmosphere {
+namespace reference {
+
+namespace {
+
+constexpr unsigned int kNumSlices = 2;
+
+AtmosphereParameters GetAtmosphereParameters() {
+  AtmosphereParameters atmosphere;
+  atmosphere.bottom_radius = 6360.0 * km;
+  atmosphere.top_radius = 6420.0 * km;
+  atmosphere.rayleigh_density.layers[1] =
+      DensityProfileLayer(0.0 * m, 1.0, -1.0 / (8.0 * km), 0.0 / m, 0.0);
+  atmosphere.rayleigh_scattering[0] = 0.0058 / km;
+  atmosphere.mie_density.layers[1] =
+      DensityProfileLayer(0.0 * m, 1.0, -1.0 / (1.2 * km), 0.0 / m, 0.0);
+  atmosphere.mie_scattering[0] = 0.004 / km;
+  atmosphere.mie_extinction[0] = 0.0044 / km;
+  atmosphere.mu_s_min = -0.2;
+  return atmosphere;
+}
+
+// A counter of hardware events, for the calling thread. The count returned by
+// Stop is -1 if the counter could not be opened (e.g. if the perf events are
+// not supported, or not allowed by /proc/sys/kernel/perf_event_paranoid).
+class HardwareEventCounter {
+ public:
+  explicit HardwareEventCounter(std::uint64_t event) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = event;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    file_descriptor_ = syscall(__NR_perf_event_open, &attr, 0 /* pid */,
+        -1 /* cpu */, -1 /* group_fd */, 0 /* flags */);
+  }
+
+  HardwareEventCounter(const HardwareEventCounter&) = delete;
+  HardwareEventCounter& operator=(const HardwareEventCounter&) = delete;
+
+  ~HardwareEventCounter() {
+    if (file_descriptor_ != -1) {
+      close(file_descriptor_);
+    }
+  }
+
+  void Start() {
+    if (file_descriptor_ != -1) {
+      ioctl(file_descriptor_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(file_descriptor_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  std::int64_t Stop() {
+    std::int64_t count = -1;
+    if (file_descriptor_ != -1) {
+      ioctl(file_descriptor_, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(file_descriptor_, &count, sizeof(count)) != sizeof(count)) {
+        count = -1;
+      }
+    }
+    return count;
+  }
+
+ private:
+  int file_descriptor_;
+};
+
+struct PassResult {
+  double seconds;
+  std::int64_t cache_references;
+  std::int64_t cache_misses;
+};
+
+PassResult RunMultipleScatteringPass(TextureLayout layout) {
+  const AtmosphereParameters atmosphere = GetAtmosphereParameters();
+  std::unique_ptr<TransmittanceTexture> transmittance_texture(
+      new TransmittanceTexture(DimensionlessSpectrum(1.0)));
+  std::unique_ptr<ScatteringDensityTexture> scattering_density_texture(
+      new ScatteringDensityTexture(layout));
+  for (unsigned int k = 0; k < SCATTERING_TEXTURE_DEPTH; ++k) {
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        double v = 1.0 + i + 2.0 * j + 3.0 * k;
+        scattering_density_texture->Set(i, j, k,
+            RadianceDensitySpectrum(v * watt_per_cubic_meter_per_sr_per_nm));
+      }
+    }
+  }
+
+  HardwareEventCounter cache_references(PERF_COUNT_HW_CACHE_REFERENCES);
+  HardwareEventCounter cache_misses(PERF_COUNT_HW_CACHE_MISSES);
+  cache_references.Start();
+  cache_misses.Start();
+  auto start = std::chrono::steady_clock::now();
+  RadianceSpectrum sum(0.0 * watt_per_square_meter_per_sr_per_nm);
+  for (unsigned int s = 0; s < kNumSlices; ++s) {
+    unsigned int k = (s + 1) * SCATTERING_TEXTURE_DEPTH / (kNumSlices + 1);
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        Number nu;
+        sum = sum + ComputeMultipleScatteringTexture(atmosphere,
+            *transmittance_texture, *scattering_density_texture,
+            vec3(i + 0.5, j + 0.5, k + 0.5), nu);
+      }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  PassResult result;
+  result.cache_misses = cache_misses.Stop();
+  result.cache_references = cache_references.Stop();
+  result.seconds = std::chrono::duration<double>(end - start).count();
+  // Print the result to make sure the computations are not optimized away.
+  std::cout << "(checksum " << sum[0].to(watt_per_square_meter_per_sr_per_nm)
+            << ") ";
+  return result;
+}
+
+void Benchmark(TextureLayout layout, const std::string& name) {
+  std::cout << name << " layout: ";
+  PassResult result = RunMultipleScatteringPass(layout);
+  std::cout << result.seconds << " s, ";
+  if (result.cache_references >= 0 && result.cache_misses >= 0) {
+    std::cout << result.cache_references << " cache references, "
+              << result.cache_misses << " cache misses";
+    if (result.cache_references > 0) {
+      std::cout << " (" << 100.0 * result.cache_misses /
+          result.cache_references << "%)";
+    }
+  } else {
+    std::cout << "cache counters not available";
+  }
+  std::cout << std::endl;
+}
+
+}  // anonymous namespace
+
+}  // namespace reference
+}  // namespace atmosphere
+
+int main(int argc, char** argv) {
+  using atmosphere::reference::Benchmark;
+  using atmosphere::reference::TextureLayout;
+  const std::string layout = argc > 1 ? argv[1] : "";
+  if (layout.empty() || layout == "linear") {
+    Benchmark(TextureLayout::LINEAR, "linear");
+  }
+  if (layout.empty() || layout == "tiled") {
+    Benchmark(TextureLayout::TILED, "tiled");
+  }
+  return 0;
+}
@@ -0,0 +1,291 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/mesh_irradiance.cc</h2>
+
+<p>This file implements the <a href="mesh_irradiance.h.html">mesh irradiance
+calculator</a>. Its <code>MappedFloatFile</code> helper class simply uses the
+POSIX <code>mmap</code> function:
+*/
+
+#include "atmosphere/reference/mesh_irradiance.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "atmosphere/spectrum.h"
+#include "util/progress_bar.h"
+
+namespace atmosphere {
+namespace reference {
+
+MappedFloatFile::MappedFloatFile(const std::string& filename)
+    : data_(nullptr), size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 &&
+      static_cast<size_t>(file_stat.st_size) >= sizeof(float)) {
+    const size_t num_bytes = file_stat.st_size;
+    void* data = mmap(nullptr, num_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, num_bytes, MADV_SEQUENTIAL);
+      data_ = static_cast<const float*>(data);
+      size_ = num_bytes / sizeof(float);
+    }
+  }
+  close(fd);
+}
+
+MappedFloatFile::~MappedFloatFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<float*>(data_), size_ * sizeof(float));
+  }
+}
+
+/*
+<p>The sun irradiance received by a vertex at distance $r$ from the planet
+center is the product of a spectrum which depends only on $r$ and on the cosine
+$\mu_s$ of the sun zenith angle (the solar irradiance times the transmittance to
+the Sun), and of the cosine factor $\max(\boldsymbol{n}\cdot \boldsymbol{s},0)$.
+Likewise, the sky irradiance is the product of the irradiance texture value at
+$(r,\mu_s)$, and of a factor depending on the normal. To share the texture
+lookups between vertices, we thus tabulate the first terms of these products in
+a small 2D table for each chunk of vertices, covering the range of $r$ and
+$\mu_s$ values in this chunk. Note that this table has a fixed size, and is thus
+not always denser than the precomputed textures: for a chunk spanning the whole
+atmosphere and all the Sun zenith angles, its $64\times 64$ samples have the
+same resolution in $\mu_s$ as the irradiance texture, and a lower one than the
+transmittance texture. Its bilinear interpolation is therefore only an
+approximation of a direct evaluation with the textures, which is accurate when
+the vertices of each chunk span a small range of $r$ and $\mu_s$ values (e.g.
+for spatially coherent chunks of a terrain mesh). For this, we use the following
+helper class to map $r$ or $\mu_s$ values to table coordinates:
+*/
+
+namespace {
+
+constexpr unsigned int kTableSize = 64;
+constexpr unsigned int kBlockSize = 4096;
+
+class TableAxis {
+ public:
+  TableAxis(double min_value, double max_value)
+      : min_value_(min_value),
+        step_((max_value - min_value) / (kTableSize - 1)) {}
+
+  double GetValue(unsigned int i) const { return min_value_ + step_ * i; }
+
+  void GetTexels(double value, unsigned int* i0, unsigned int* i1,
+      double* lerp) const {
+    double x = step_ > 0.0 ? (value - min_value_) / step_ : 0.0;
+    x = std::max(0.0, std::min(x, kTableSize - 1.0));
+    *i0 = std::min(static_cast<unsigned int>(x), kTableSize - 2);
+    *i1 = *i0 + 1;
+    *lerp = x - *i0;
+  }
+
+ private:
+  double min_value_;
+  double step_;
+};
+
+void ToRgb(const IrradianceSpectrum& irradiance, double rgb[3]) {
+  rgb[0] = irradiance(kLambdaR * nm).to(watt_per_square_meter_per_nm);
+  rgb[1] = irradiance(kLambdaG * nm).to(watt_per_square_meter_per_nm);
+  rgb[2] = irradiance(kLambdaB * nm).to(watt_per_square_meter_per_nm);
+}
+
+void ToRgb(const Illuminance3& illuminance, double rgb[3]) {
+  rgb[0] = illuminance.x.to(lm / m2);
+  rgb[1] = illuminance.y.to(lm / m2);
+  rgb[2] = illuminance.z.to(lm / m2);
+}
+
+}  // anonymous namespace
+
+MeshIrradianceCalculator::MeshIrradianceCalculator(const Model& model,
+    bool use_luminance, size_t chunk_size)
+    : model_(model), use_luminance_(use_luminance), chunk_size_(chunk_size) {}
+
+/*
+<p>The computations for each chunk are done in three steps. First, we compute
+the range of $r$ and $\mu_s$ values in the chunk, in parallel for blocks of
+consecutive vertices. We then compute the above table over this range, and
+finally evaluate the irradiance of each vertex with a bilinear interpolation of
+this table, again in parallel for blocks of consecutive vertices (these blocks
+are large enough to amortize the job scheduling cost, and are read and written
+sequentially). These computations use plain double values, instead of the
+dimensional types used elsewhere. Note also that $r$ is clamped to the
+atmosphere bounds for the table lookups (but not for the computation of
+$\mu_s$), as in the GLSL functions:
+*/
+
+void MeshIrradianceCalculator::Compute(const MeshVertices& mesh,
+    Position origin, Direction sun_direction,
+    const ChunkCallback& chunk_ready) const {
+  const AtmosphereParameters& atmosphere = model_.atmosphere();
+  const double bottom_radius = atmosphere.bottom_radius.to(m);
+  const double top_radius = atmosphere.top_radius.to(m);
+  const double o[3] = {origin.x.to(m), origin.y.to(m), origin.z.to(m)};
+  const double s[3] = {sun_direction.x(), sun_direction.y(),
+      sun_direction.z()};
+  auto get_r_mu_s = [&](const float* p, double* r, double* mu_s) {
+    const double x = o[0] + p[0];
+    const double y = o[1] + p[1];
+    const double z = o[2] + p[2];
+    const double length = std::sqrt(x * x + y * y + z * z);
+    *r = std::max(bottom_radius, std::min(length, top_radius));
+    *mu_s = (x * s[0] + y * s[1] + z * s[2]) / length;
+  };
+
+  const size_t max_chunk_size = std::min(chunk_size_, mesh.num_vertices);
+  std::vector<float> sun_irradiance(3 * max_chunk_size);
+  std::vector<float> sky_irradiance(3 * max_chunk_size);
+  std::vector<double> sun_table(3 * kTableSize * kTableSize);
+  std::vector<double> sky_table(3 * kTableSize * kTableSize);
+  for (size_t first = 0; first < mesh.num_vertices; first += chunk_size_) {
+    const size_t size = std::min(chunk_size_, mesh.num_vertices - first);
+    const float* positions = mesh.positions + 3 * first;
+    const float* normals = mesh.normals + 3 * first;
+    const unsigned int num_blocks = (size + kBlockSize - 1) / kBlockSize;
+
+    std::vector<double> block_ranges(4 * num_blocks);
+    RunJobs([&](unsigned int block) {
+      double range[4] = {std::numeric_limits<double>::max(),
+          std::numeric_limits<double>::lowest(),
+          std::numeric_limits<double>::max(),
+          std::numeric_limits<double>::lowest()};
+      const size_t end = std::min(size, (block + 1) * size_t{kBlockSize});
+      for (size_t i = block * size_t{kBlockSize}; i < end; ++i) {
+        double r;
+        double mu_s;
+        get_r_mu_s(positions + 3 * i, &r, &mu_s);
+        range[0] = std::min(range[0], r);
+        range[1] = std::max(range[1], r);
+        range[2] = std::min(range[2], mu_s);
+        range[3] = std::max(range[3], mu_s);
+      }
+      std::copy(range, range + 4, block_ranges.begin() + 4 * block);
+    }, num_blocks);
+    double range[4] = {block_ranges[0], block_ranges[1], block_ranges[2],
+        block_ranges[3]};
+    for (unsigned int block = 1; block < num_blocks; ++block) {
+      range[0] = std::min(range[0], block_ranges[4 * block]);
+      range[1] = std::max(range[1], block_ranges[4 * block + 1]);
+      range[2] = std::min(range[2], block_ranges[4 * block + 2]);
+      range[3] = std::max(range[3], block_ranges[4 * block + 3]);
+    }
+    const TableAxis r_axis(range[0], range[1]);
+    const TableAxis mu_s_axis(range[2], range[3]);
+
+    RunJobs([&](unsigned int j) {
+      const Position point(0.0 * m, 0.0 * m, r_axis.GetValue(j) * m);
+      const Direction up(0.0, 0.0, 1.0);
+      for (unsigned int i = 0; i < kTableSize; ++i) {
+        const Number mu_s = mu_s_axis.GetValue(i);
+        const Direction sun(sqrt(max(1.0 - mu_s * mu_s, 0.0)), 0.0, mu_s);
+        double* sun_rgb = sun_table.data() + 3 * (i + kTableSize * j);
+        double* sky_rgb = sky_table.data() + 3 * (i + kTableSize * j);
+        // With a normal equal to the sun direction for the sun irradiance,
+        // and to the zenith direction for the sky irradiance, the factors
+        // depending on the normal are equal to 1.
+        if (use_luminance_) {
+          Illuminance3 sky;
+          ToRgb(model_.GetSunAndSkyIlluminance(point, sun, sun, &sky),
+              sun_rgb);
+          model_.GetSunAndSkyIlluminance(point, up, sun, &sky);
+          ToRgb(sky, sky_rgb);
+        } else {
+          IrradianceSpectrum sky;
+          ToRgb(model_.GetSunAndSkyIrradiance(point, sun, sun, &sky),
+              sun_rgb);
+          model_.GetSunAndSkyIrradiance(point, up, sun, &sky);
+          ToRgb(sky, sky_rgb);
+        }
+      }
+    }, kTableSize);
+
+    RunJobs([&](unsigned int block) {
+      const size_t end = std::min(size, (block + 1) * size_t{kBlockSize});
+      for (size_t i = block * size_t{kBlockSize}; i < end; ++i) {
+        const float* p = positions + 3 * i;
+        const float* n = normals + 3 * i;
+        double r;
+        double mu_s;
+        get_r_mu_s(p, &r, &mu_s);
+        const double x = o[0] + p[0];
+        const double y = o[1] + p[1];
+        const double z = o[2] + p[2];
+        const double sun_factor =
+            std::max(n[0] * s[0] + n[1] * s[1] + n[2] * s[2], 0.0);
+        const double sky_factor = 0.5 * (1.0 + (n[0] * x + n[1] * y +
+            n[2] * z) / std::sqrt(x * x + y * y + z * z));
+        unsigned int i0;
+        unsigned int i1;
+        unsigned int j0;
+        unsigned int j1;
+        double u;
+        double v;
+        mu_s_axis.GetTexels(mu_s, &i0, &i1, &u);
+        r_axis.GetTexels(r, &j0, &j1, &v);
+        const double w00 = (1.0 - u) * (1.0 - v);
+        const double w10 = u * (1.0 - v);
+        const double w01 = (1.0 - u) * v;
+        const double w11 = u * v;
+        const unsigned int t00 = 3 * (i0 + kTableSize * j0);
+        const unsigned int t10 = 3 * (i1 + kTableSize * j0);
+        const unsigned int t01 = 3 * (i0 + kTableSize * j1);
+        const unsigned int t11 = 3 * (i1 + kTableSize * j1);
+        for (unsigned int c = 0; c < 3; ++c) {
+          sun_irradiance[3 * i + c] = static_cast<float>(sun_factor * (
+              w00 * sun_table[t00 + c] + w10 * sun_table[t10 + c] +
+              w01 * sun_table[t01 + c] + w11 * sun_table[t11 + c]));
+          sky_irradiance[3 * i + c] = static_cast<float>(sky_factor * (
+              w00 * sky_table[t00 + c] + w10 * sky_table[t10 + c] +
+              w01 * sky_table[t01 + c] + w11 * sky_table[t11 + c]));
+        }
+      }
+    }, num_blocks);
+
+    chunk_ready(first, size, sun_irradiance.data(), sky_irradiance.data());
+  }
+}
+
+}  // namespace reference
+}  // namespace atmosphere
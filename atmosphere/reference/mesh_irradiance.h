@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/mesh_irradiance.h</h2>
+
+<p>This file defines an API to compute the sun and sky irradiance received by
+each vertex of a (possibly very large) mesh with our
+<a href="model.h.html">CPU atmosphere model</a>, e.g. for solar exposure
+studies on terrain meshes. Compared to calling
+<code>GetSunAndSkyIrradiance</code> for each vertex, it
+<ul>
+<li>reads the vertex positions and normals directly from float arrays, which
+can be memory mapped from files with <code>MappedFloatFile</code>,</li>
+<li>shares the precomputed texture lookups between vertices (they only depend
+on the altitude and on the sun zenith angle),</li>
+<li>processes the vertices in chunks, evaluated in parallel in several
+threads, and returns the results of each chunk to the caller as soon as it is
+ready, so that the results for the whole mesh never need to be in memory.</li>
+</ul>
+To use it, create a <code>MeshIrradianceCalculator</code> for an initialized
+<code>Model</code>, and call <code>Compute</code> for each sun direction.
+*/
+
+#ifndef ATMOSPHERE_REFERENCE_MESH_IRRADIANCE_H_
+#define ATMOSPHERE_REFERENCE_MESH_IRRADIANCE_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "atmosphere/reference/definitions.h"
+#include "atmosphere/reference/model.h"
+
+namespace atmosphere {
+namespace reference {
+
+// A read-only memory mapping of a binary file containing float values in the
+// native byte order (e.g. a vertex buffer dumped to disk). If the file can't be
+// opened or mapped, data() is null and size() is 0.
+class MappedFloatFile {
+ public:
+  explicit MappedFloatFile(const std::string& filename);
+  MappedFloatFile(const MappedFloatFile&) = delete;
+  MappedFloatFile& operator=(const MappedFloatFile&) = delete;
+  ~MappedFloatFile();
+
+  const float* data() const { return data_; }
+  // The number of floats in the file.
+  size_t size() const { return size_; }
+
+ private:
+  const float* data_;
+  size_t size_;
+};
+
+// The vertices of a mesh, given by 3 consecutive floats per vertex for the
+// positions and for the normals. The positions are in meters, relatively to
+// an origin specified separately (so that they can be stored with floats
+// without losing precision), and the normals must be unit vectors.
+struct MeshVertices {
+  size_t num_vertices;
+  const float* positions;
+  const float* normals;
+};
+
+class MeshIrradianceCalculator {
+ public:
+  // If use_luminance is true, the results are sRGB illuminance values in
+  // lm.m^-2 (this requires a Model constructed with the precompute_luminance
+  // option). Otherwise they are spectral irradiance values at kLambdaR,
+  // kLambdaG and kLambdaB, in W.m^-2.nm^-1. The vertices are processed in
+  // chunks of chunk_size vertices.
+  MeshIrradianceCalculator(const Model& model, bool use_luminance,
+      size_t chunk_size = 1 << 20);
+
+  // Called with the sun and sky irradiance of the vertices first_vertex to
+  // first_vertex + num_vertices - 1 (3 floats per vertex in each array, valid
+  // only during the call).
+  typedef std::function<void(size_t first_vertex, size_t num_vertices,
+      const float* sun_irradiance, const float* sky_irradiance)> ChunkCallback;
+
+  // Computes the sun and sky irradiance of each vertex of 'mesh', whose
+  // positions are relative to 'origin' (expressed in the model's reference
+  // frame, i.e. relatively to the planet center), for the given sun direction.
+  // 'chunk_ready' is called for each chunk, in order, from the calling thread.
+  void Compute(const MeshVertices& mesh, Position origin,
+      Direction sun_direction, const ChunkCallback& chunk_ready) const;
+
+ private:
+  const Model& model_;
+  const bool use_luminance_;
+  const size_t chunk_size_;
+};
+
+}  // namespace reference
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_REFERENCE_MESH_IRRADIANCE_H_
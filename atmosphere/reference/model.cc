@@ -44,70 +44,671 @@ This is the role of the following code.
 
 #include "atmosphere/reference/model.h"
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "atmosphere/constants.h"
 #include "atmosphere/reference/functions.h"
+#include "atmosphere/spectrum.h"
 #include "util/progress_bar.h"
 
 /*
 <p>The constructor of the <code>Model</code> class allocates the precomputed
-textures, but does not initialize them.
+textures, but does not initialize them (the luminance textures are allocated
+only if the <code>precompute_luminance</code> option is set).
 */
 
 namespace atmosphere {
 namespace reference {
 
 Model::Model(const AtmosphereParameters& atmosphere,
-             const std::string& cache_directory)
+             const std::string& cache_directory,
+             bool precompute_luminance,
+             TextureLayout scattering_texture_layout,
+             std::int64_t max_cache_size)
     : atmosphere_(atmosphere),
-      cache_directory_(cache_directory) {
+      cache_directory_(cache_directory),
+      max_cache_size_(max_cache_size),
+      precompute_luminance_(precompute_luminance),
+      scattering_texture_layout_(scattering_texture_layout),
+      init_task_(nullptr),
+      init_running_(false),
+      initialized_(false) {
   transmittance_texture_.reset(new TransmittanceTexture());
-  scattering_texture_.reset(new ReducedScatteringTexture());
-  single_mie_scattering_texture_.reset(new ReducedScatteringTexture());
+  scattering_texture_.reset(
+      new ReducedScatteringTexture(scattering_texture_layout_));
+  single_mie_scattering_texture_.reset(
+      new ReducedScatteringTexture(scattering_texture_layout_));
   irradiance_texture_.reset(new IrradianceTexture());
+  if (precompute_luminance) {
+    luminance_scattering_texture_.reset(
+        new ReducedScatteringLuminanceTexture(scattering_texture_layout_));
+    luminance_single_mie_scattering_texture_.reset(
+        new ReducedScatteringLuminanceTexture(scattering_texture_layout_));
+    luminance_irradiance_texture_.reset(new IrradianceLuminanceTexture());
+  }
 }
 
 /*
-<p>The initialization is done in the following method, which first tries to load
-the textures from disk, if they have already been precomputed.
+<p>Since the precomputations write the model textures, they must not overlap. We
+check this in the initialization methods with the following helper class, which
+marks a precomputation as running during its lifetime (for
+<code>InitAsync</code>, it is created in the calling thread, so that overlapping
+calls fail immediately, and destroyed in the precomputation thread):
+*/
+
+class Model::InitGuard {
+ public:
+  explicit InitGuard(Model* model) : model_(model) {
+    std::lock_guard<std::mutex> lock(model_->init_mutex_);
+    if (model_->init_running_) {
+      throw std::logic_error("A precomputation of this model is running");
+    }
+    model_->init_running_ = true;
+  }
+
+  ~InitGuard() {
+    std::lock_guard<std::mutex> lock(model_->init_mutex_);
+    model_->init_running_ = false;
+  }
+
+ private:
+  Model* model_;
+};
+
+/*
+<p>The initialization is done in the following method, which precomputes the
+textures, reusing the precomputation stages which have already been computed
+and cached on disk (see below). The luminance textures, which are cheap to
+compute from the spectral ones, are not cached.
 */
 
 void Model::Init(unsigned int num_scattering_orders) {
-  std::ifstream file;
-  file.open(cache_directory_ + "transmittance.dat");
+  InitGuard guard(this);
+  RunInit(num_scattering_orders);
+}
+
+void Model::RunInit(unsigned int num_scattering_orders) {
+  initialized_ = false;
+  Precompute(num_scattering_orders, 1 /* lattice_step */, true /* use_cache */);
+  if (precompute_luminance_) {
+    PrecomputeLuminance();
+  }
+  initialized_ = true;
+}
+
+/*
+<p>The asynchronous initialization does the same precomputation as
+<code>Init</code>, in a separate thread. The only difference is in the way the
+texels of each precomputation stage are computed in parallel, in tiles (i.e.
+rows or layers of texels), and in the way the progress is reported. This is
+implemented in the following class, used by <code>RunPrecomputationJobs</code>
+instead of the <code>RunJobs</code> function, and by <code>Precompute</code>
+instead of the terminal progress bar. It runs the jobs (one per tile) in the
+requested number of threads, checks the cancellation flag before each job, and
+calls the progress callback after each job (except for the density table and the
+luminance textures, which are not precomputation stages). All the texels
+computed by <code>InitAsync</code> go through this class, so that they all use
+the requested number of threads (the other users of <code>RunJobs</code>, such
+as the coarse lattice interpolation of <code>InitProgressive</code>, are never
+called by <code>InitAsync</code>). If the precomputation is cancelled, it throws
+an exception after the threads have finished their current tile, which unwinds
+<code>Precompute</code> before the results of the current stage are cached:
+*/
+
+class Model::InitTask {
+ public:
+  struct Cancelled {};
+
+  explicit InitTask(const InitOptions& options)
+      : options_(options), total_progress_(0), progress_(0), num_texels_(0) {}
+
+  void Start(unsigned int total_progress) {
+    total_progress_ = total_progress;
+    start_time_ = std::chrono::steady_clock::now();
+  }
+
+  void Increment(unsigned int progress) {
+    progress_ += progress;
+    ++num_texels_;
+  }
+
+  void RunJobs(const char* phase, unsigned int scattering_order,
+      const std::function<void(unsigned int)>& job, unsigned int num_jobs) {
+    const unsigned int num_threads = options_.num_threads > 0 ?
+        options_.num_threads :
+        std::max(std::thread::hardware_concurrency(), 1u);
+    std::atomic<unsigned int> next_job(0);
+    auto run_jobs = [&]() {
+      while (!IsCancelled()) {
+        const unsigned int job_index = next_job++;
+        if (job_index >= num_jobs) {
+          break;
+        }
+        job(job_index);
+        ReportProgress(phase, scattering_order);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < num_threads; ++i) {
+      threads.emplace_back(run_jobs);
+    }
+    run_jobs();
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    if (IsCancelled()) {
+      throw Cancelled();
+    }
+  }
+
+ private:
+  bool IsCancelled() const {
+    return options_.cancelled != nullptr && options_.cancelled->load();
+  }
+
+  void ReportProgress(const char* phase, unsigned int scattering_order) {
+    if (!options_.progress_callback || phase == nullptr) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const double elapsed_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start_time_).count();
+    InitProgress progress;
+    progress.phase = phase;
+    progress.scattering_order = scattering_order;
+    progress.fraction = total_progress_ == 0 ? 1.0 :
+        std::min(static_cast<double>(progress_) / total_progress_, 1.0);
+    progress.texels_per_second =
+        elapsed_seconds > 0.0 ? num_texels_ / elapsed_seconds : 0.0;
+    progress.remaining_seconds = progress.fraction > 0.0 ?
+        elapsed_seconds * (1.0 - progress.fraction) / progress.fraction : 0.0;
+    options_.progress_callback(progress);
+  }
+
+  const InitOptions options_;
+  unsigned int total_progress_;
+  std::atomic<unsigned int> progress_;
+  std::atomic<unsigned int> num_texels_;
+  std::chrono::steady_clock::time_point start_time_;
+  std::mutex mutex_;
+};
+
+std::future<bool> Model::InitAsync(const InitOptions& options) {
+  std::shared_ptr<InitGuard> guard = std::make_shared<InitGuard>(this);
+  return std::async(std::launch::async, [this, options, guard]() {
+    InitTask init_task(options);
+    init_task_ = &init_task;
+    bool completed = true;
+    try {
+      RunInit(options.num_scattering_orders);
+    } catch (const InitTask::Cancelled&) {
+      completed = false;
+    }
+    init_task_ = nullptr;
+    return completed;
+  });
+}
+
+void Model::RunPrecomputationJobs(const char* phase,
+    unsigned int scattering_order,
+    const std::function<void(unsigned int)>& job,
+    unsigned int num_jobs) const {
+  if (init_task_ == nullptr) {
+    RunJobs(job, num_jobs);
+  } else {
+    init_task_->RunJobs(phase, scattering_order, job, num_jobs);
+  }
+}
+
+/*
+<p>In the progressive mode (see below), a first approximation of the scattering
+textures is computed on a coarse lattice of texels, and the other texels are
+interpolated from it. This lattice is defined by the following helper class,
+with one set of lattice indices per axis, every <code>step</code> texels, plus
+the last texel of each axis (to avoid extrapolations). Along the $\mu$ axis we
+also include the last texel of the first half of the texture and the first texel
+of the second half, so that the rays intersecting the ground and the other ones
+are never mixed together. The $\nu$ axis, which is small and not texel
+centered, is not subsampled. Note that with <code>step</code> equal to 1, all
+the texels are in the lattice, and <code>Interpolate</code> does nothing:
+*/
+
+namespace {
+
+class ScatteringLattice {
+ public:
+  explicit ScatteringLattice(unsigned int step)
+      : step_(step),
+        mu_s_(NewAxis(SCATTERING_TEXTURE_MU_S_SIZE, step, {})),
+        mu_(NewAxis(SCATTERING_TEXTURE_MU_SIZE, step,
+            {SCATTERING_TEXTURE_MU_SIZE / 2 - 1,
+             SCATTERING_TEXTURE_MU_SIZE / 2})),
+        r_(NewAxis(SCATTERING_TEXTURE_R_SIZE, step, {})) {}
+
+  unsigned int num_texels() const {
+    return SCATTERING_TEXTURE_NU_SIZE * NumLatticeIndices(mu_s_) *
+        NumLatticeIndices(mu_) * NumLatticeIndices(r_);
+  }
+
+  bool Contains(unsigned int i, unsigned int j, unsigned int k) const {
+    return mu_s_[i % SCATTERING_TEXTURE_MU_S_SIZE].weight == 0.0 &&
+        mu_[j].weight == 0.0 && r_[k].weight == 0.0;
+  }
+
+  template<class T>
+  void Interpolate(AbstractScatteringTexture<T>* texture) const {
+    if (step_ == 1) {
+      return;
+    }
+    RunJobs([&](unsigned int k) {
+      for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+        for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          if (Contains(i, j, k)) {
+            continue;
+          }
+          unsigned int nu_offset = i - i % SCATTERING_TEXTURE_MU_S_SIZE;
+          const Sample* samples[3] = {
+              &mu_s_[i % SCATTERING_TEXTURE_MU_S_SIZE], &mu_[j], &r_[k]};
+          T value;
+          for (unsigned int corner = 0; corner < 8; ++corner) {
+            double weight = 1.0;
+            unsigned int indices[3];
+            for (unsigned int d = 0; d < 3; ++d) {
+              bool upper = (corner >> d) & 1;
+              weight *=
+                  upper ? samples[d]->weight : 1.0 - samples[d]->weight;
+              indices[d] = upper ? samples[d]->upper : samples[d]->lower;
+            }
+            T texel = texture->Get(nu_offset + indices[0], indices[1],
+                indices[2]) * Number(weight);
+            value = corner == 0 ? texel : value + texel;
+          }
+          texture->Set(i, j, k, value);
+        }
+      }
+    }, SCATTERING_TEXTURE_DEPTH);
+  }
+
+ private:
+  // The two lattice indices surrounding a texel index, and the interpolation
+  // weight of the upper one (0 if and only if the texel is in the lattice).
+  struct Sample {
+    unsigned int lower;
+    unsigned int upper;
+    double weight;
+  };
+
+  static std::vector<Sample> NewAxis(unsigned int size, unsigned int step,
+      const std::vector<unsigned int>& extra_indices) {
+    std::vector<bool> is_lattice_index(size, false);
+    for (unsigned int i = 0; i < size; i += step) {
+      is_lattice_index[i] = true;
+    }
+    is_lattice_index[size - 1] = true;
+    for (unsigned int i : extra_indices) {
+      is_lattice_index[i] = true;
+    }
+    std::vector<Sample> axis(size);
+    unsigned int lower = 0;
+    for (unsigned int i = 0; i < size; ++i) {
+      if (is_lattice_index[i]) {
+        lower = i;
+      }
+      unsigned int upper = i;
+      while (!is_lattice_index[upper]) {
+        ++upper;
+      }
+      axis[i].lower = lower;
+      axis[i].upper = upper;
+      axis[i].weight = upper == lower ?
+          0.0 : (i - lower) / static_cast<double>(upper - lower);
+    }
+    return axis;
+  }
+
+  static unsigned int NumLatticeIndices(const std::vector<Sample>& axis) {
+    unsigned int count = 0;
+    for (const Sample& sample : axis) {
+      if (sample.weight == 0.0) {
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  const unsigned int step_;
+  const std::vector<Sample> mu_s_;
+  const std::vector<Sample> mu_;
+  const std::vector<Sample> r_;
+};
+
+}  // anonymous namespace
+
+/*
+<p>The precomputation is organized in stages, following the dependencies
+between the precomputed textures: the transmittance only depends on the
+densities and extinction coefficients, the direct irradiance and the single
+scattering additionally depend on the solar irradiance (and on the Sun angular
+radius or on the scattering coefficients), and each scattering order $n \ge 2$
+depends on the previous ones, as well as on the Mie phase function and on the
+ground albedo. The outputs of each stage which can be reused by a later
+<code>Init</code> are cached on disk in files whose names contain a fingerprint
+of all the parameters on which they depend (including the fingerprints of the
+stages they depend on), so that changing some parameters (e.g.
+<code>mie_phase_function_g</code> or <code>ground_albedo</code>) only recomputes
+the stages which depend on them. These outputs are the transmittance, the direct
+irradiance, the single scattering and, for each scattering order $n$, the
+irradiance and scattering textures accumulated up to this order (which are the
+final textures of an <code>Init</code> with $n$ scattering orders). The delta
+textures of the scattering orders, needed only to compute the next order, are
+not cached. To bound the disk space used by the cache, the least recently used
+files are deleted when their total size exceeds the <code>max_cache_size</code>
+constructor argument (8 GiB by default, while each scattering texture file uses
+about 400 MB):
+*/
+
+constexpr std::int64_t Model::kDefaultMaxCacheSize;
+
+namespace {
+
+/*
+<p>The fingerprints are computed with the following helper class, which
+computes a 64 bits <a href=
+"https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function">
+FNV-1a hash</a> of the given values:
+*/
+
+class Fingerprint {
+ public:
+  Fingerprint() : hash_(14695981039346656037ull) {}
+
+  Fingerprint& Add(const void* data, unsigned int size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (unsigned int i = 0; i < size; ++i) {
+      hash_ = (hash_ ^ bytes[i]) * 1099511628211ull;
+    }
+    return *this;
+  }
+
+  Fingerprint& Add(double value) { return Add(&value, sizeof(value)); }
+
+  Fingerprint& Add(const std::vector<double>& values) {
+    return Add(values.data(), values.size() * sizeof(double));
+  }
+
+  Fingerprint& Add(const std::string& value) {
+    return Add(value.data(), value.size());
+  }
+
+  Fingerprint& Add(const DensityProfile& profile) {
+    for (const DensityProfileLayer& layer : profile.layers) {
+      Add(layer.width.to(m));
+      Add(layer.exp_term());
+      Add(layer.exp_scale.to(1.0 / m));
+      Add(layer.linear_term.to(1.0 / m));
+      Add(layer.constant_term());
+    }
+    return *this;
+  }
+
+  std::string ToString() const {
+    std::ostringstream result;
+    result << std::hex << std::setw(16) << std::setfill('0') << hash_;
+    return result.str();
+  }
+
+ private:
+  uint64_t hash_;
+};
+
+bool IsCached(const std::string& filename) {
+  std::ifstream file(filename);
+  return file.good();
+}
+
+std::string GetCacheFilename(const std::string& cache_directory,
+    const std::string& name, const std::string& fingerprint) {
+  return cache_directory + name + "_" + fingerprint + ".dat";
+}
+
+/*
+<p>The least recently used files are found with an index file, in the cache
+directory, which lists the cached files from the least to the most recently
+used one. The following functions move a file at the end of this list (adding it
+if necessary), and delete the least recently used files while the total size of
+the cached files exceeds <code>max_cache_size</code>, except the given ones. A
+mutex protects the index file from concurrent updates by several models using
+the same cache directory:
+*/
+
+std::mutex cache_index_mutex;
+
+std::vector<std::string> ReadCacheIndex(const std::string& cache_directory) {
+  std::vector<std::string> files;
+  std::ifstream index(cache_directory + "cache_index.txt");
+  std::string line;
+  while (std::getline(index, line)) {
+    if (IsCached(line)) {
+      files.push_back(line);
+    }
+  }
+  return files;
+}
+
+void WriteCacheIndex(const std::string& cache_directory,
+    const std::vector<std::string>& files) {
+  std::ofstream index(cache_directory + "cache_index.txt");
+  for (const std::string& file : files) {
+    index << file << std::endl;
+  }
+}
+
+void TouchCacheFile(const std::string& cache_directory,
+    const std::string& filename) {
+  std::lock_guard<std::mutex> lock(cache_index_mutex);
+  std::vector<std::string> files = ReadCacheIndex(cache_directory);
+  files.erase(std::remove(files.begin(), files.end(), filename), files.end());
+  files.push_back(filename);
+  WriteCacheIndex(cache_directory, files);
+}
+
+void EvictCacheFiles(const std::string& cache_directory,
+    std::int64_t max_cache_size, const std::vector<std::string>& used_files) {
+  std::lock_guard<std::mutex> lock(cache_index_mutex);
+  auto file_size = [](const std::string& filename) {
+    std::ifstream file(filename, std::ifstream::binary | std::ifstream::ate);
+    return file.good() ? std::streamoff(file.tellg()) : std::streamoff(0);
+  };
+  std::vector<std::string> files = ReadCacheIndex(cache_directory);
+  std::streamoff total_size = 0;
+  for (const std::string& file : files) {
+    total_size += file_size(file);
+  }
+  std::vector<std::string> kept_files;
+  for (const std::string& file : files) {
+    if (total_size > max_cache_size &&
+        std::find(used_files.begin(), used_files.end(), file) ==
+            used_files.end()) {
+      total_size -= file_size(file);
+      std::remove(file.c_str());
+    } else {
+      kept_files.push_back(file);
+    }
+  }
+  WriteCacheIndex(cache_directory, kept_files);
+}
+
+}  // anonymous namespace
+
+/*
+<p>The fingerprints of the stages are computed in the following method. The
+density lookup table, which is cheap to compute, is not considered as a stage
+with cached outputs, but its fingerprint is computed from its parameters or,
+if a tabulated one is provided in the cache directory (see below), from the
+content of this file:
+*/
+
+Model::StageFingerprints Model::GetStageFingerprints(
+    unsigned int num_scattering_orders) const {
+  Fingerprint density;
+  std::ifstream file(cache_directory_ + "density.dat",
+      std::ifstream::binary);
   if (file.good()) {
-    file.close();
-    transmittance_texture_->Load(cache_directory_ + "transmittance.dat");
-    scattering_texture_->Load(cache_directory_ + "scattering.dat");
-    single_mie_scattering_texture_->Load(
-        cache_directory_ + "single_mie_scattering.dat");
-    irradiance_texture_->Load(cache_directory_ + "irradiance.dat");
-    return;
+    std::string content((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    density.Add(content);
+  } else {
+    density.Add(atmosphere_.bottom_radius.to(m))
+        .Add(atmosphere_.top_radius.to(m))
+        .Add(atmosphere_.rayleigh_density)
+        .Add(atmosphere_.mie_density)
+        .Add(atmosphere_.absorption_density);
   }
+  density.Add(DENSITY_TEXTURE_WIDTH).Add(DENSITY_TEXTURE_HEIGHT);
+
+  StageFingerprints fingerprints;
+  Fingerprint transmittance;
+  transmittance.Add("transmittance")
+      .Add(density.ToString())
+      .Add(atmosphere_.bottom_radius.to(m))
+      .Add(atmosphere_.top_radius.to(m))
+      .Add(atmosphere_.rayleigh_scattering.to(1.0 / m))
+      .Add(atmosphere_.mie_extinction.to(1.0 / m))
+      .Add(atmosphere_.absorption_extinction.to(1.0 / m))
+      .Add(TRANSMITTANCE_TEXTURE_WIDTH)
+      .Add(TRANSMITTANCE_TEXTURE_HEIGHT);
+  fingerprints.transmittance = transmittance.ToString();
+
+  Fingerprint direct_irradiance;
+  direct_irradiance.Add("direct_irradiance")
+      .Add(fingerprints.transmittance)
+      .Add(atmosphere_.solar_irradiance.to(watt_per_square_meter_per_nm))
+      .Add(atmosphere_.sun_angular_radius.to(rad))
+      .Add(IRRADIANCE_TEXTURE_WIDTH)
+      .Add(IRRADIANCE_TEXTURE_HEIGHT);
+  fingerprints.direct_irradiance = direct_irradiance.ToString();
+
+  Fingerprint single_scattering;
+  single_scattering.Add("single_scattering")
+      .Add(fingerprints.transmittance)
+      .Add(atmosphere_.solar_irradiance.to(watt_per_square_meter_per_nm))
+      .Add(atmosphere_.rayleigh_scattering.to(1.0 / m))
+      .Add(atmosphere_.mie_scattering.to(1.0 / m))
+      .Add(atmosphere_.mu_s_min())
+      .Add(SCATTERING_TEXTURE_R_SIZE)
+      .Add(SCATTERING_TEXTURE_MU_SIZE)
+      .Add(SCATTERING_TEXTURE_MU_S_SIZE)
+      .Add(SCATTERING_TEXTURE_NU_SIZE);
+  fingerprints.single_scattering = single_scattering.ToString();
+
+  std::string previous_order =
+      fingerprints.single_scattering + fingerprints.direct_irradiance;
+  for (unsigned int scattering_order = 2;
+       scattering_order <= num_scattering_orders;
+       ++scattering_order) {
+    Fingerprint order;
+    order.Add("scattering_order")
+        .Add(previous_order)
+        .Add(atmosphere_.mie_phase_function_g())
+        .Add(atmosphere_.ground_albedo.to(Number::Unit()))
+        .Add(scattering_order);
+    fingerprints.scattering_orders.push_back(order.ToString());
+    previous_order = fingerprints.scattering_orders.back();
+  }
+  return fingerprints;
+}
 
 /*
-<p>If they have not already been precomputed, we must compute them here. This
-computation requires some temporary textures, in particular to store the
-contribution of one scattering order, which is needed to compute the next order
-of scattering (the final precomputed textures store the sum of all the
-scattering orders). We allocate these textures here (they are automatically
-destroyed at the end of this method).
+<p>The precomputation itself is done in the following method, which is also
+used by <code>InitProgressive</code> below. It requires some temporary textures,
+in particular to store the contribution of one scattering order, which is
+needed to compute the next order of scattering (the final precomputed textures
+store the sum of all the scattering orders). We allocate these textures here
+(they are automatically destroyed at the end of this method). The stage outputs
+are loaded from, and saved to the cache directory only if <code>use_cache</code>
+is true, which requires a full resolution (i.e. a <code>lattice_step</code> of
+1):
 */
 
+void Model::Precompute(unsigned int num_scattering_orders,
+                       unsigned int lattice_step, bool use_cache) {
   std::unique_ptr<IrradianceTexture>
       delta_irradiance_texture(new IrradianceTexture());
-  std::unique_ptr<ReducedScatteringTexture>
-      delta_rayleigh_scattering_texture(new ReducedScatteringTexture());
+  std::unique_ptr<ReducedScatteringTexture> delta_rayleigh_scattering_texture(
+      new ReducedScatteringTexture(scattering_texture_layout_));
   ReducedScatteringTexture* delta_mie_scattering_texture =
       single_mie_scattering_texture_.get();
-  std::unique_ptr<ScatteringDensityTexture>
-      delta_scattering_density_texture(new ScatteringDensityTexture());
-  std::unique_ptr<ScatteringTexture>
-      delta_multiple_scattering_texture(new ScatteringTexture());
+  std::unique_ptr<ScatteringDensityTexture> delta_scattering_density_texture(
+      new ScatteringDensityTexture(scattering_texture_layout_));
+  std::unique_ptr<ScatteringTexture> delta_multiple_scattering_texture(
+      new ScatteringTexture(scattering_texture_layout_));
+
+/*
+<p>We first find the stages whose outputs are cached. Since the delta textures
+of the scattering orders are not cached, the scattering orders are either all
+loaded from the cache (if the final textures of the last one are cached), or
+all recomputed. The files used by this precomputation are marked as the most
+recently used ones when they are loaded or saved, and the least recently used
+files are evicted at the end of the precomputation:
+*/
+
+  assert(!use_cache || lattice_step == 1);
+  const StageFingerprints fingerprints =
+      GetStageFingerprints(num_scattering_orders);
+  auto filename = [this](const std::string& name,
+      const std::string& fingerprint) {
+    return GetCacheFilename(cache_directory_, name, fingerprint);
+  };
+  std::vector<std::string> used_files;
+  auto cache_file = [this, &filename, &used_files](const std::string& name,
+      const std::string& fingerprint) {
+    const std::string result = filename(name, fingerprint);
+    TouchCacheFile(cache_directory_, result);
+    used_files.push_back(result);
+    return result;
+  };
+  const bool transmittance_cached = use_cache &&
+      IsCached(filename("transmittance", fingerprints.transmittance));
+  const bool single_mie_scattering_cached = use_cache &&
+      IsCached(filename("single_mie_scattering",
+          fingerprints.single_scattering));
+  // The direct irradiance and single Rayleigh scattering are not needed if the
+  // scattering orders are cached (the single Mie scattering is still needed,
+  // and might have been evicted from the cache independently).
+  const bool orders_cached = single_mie_scattering_cached &&
+      !fingerprints.scattering_orders.empty() &&
+      IsCached(filename("irradiance",
+          fingerprints.scattering_orders.back())) &&
+      IsCached(filename("scattering",
+          fingerprints.scattering_orders.back()));
+  const unsigned int first_scattering_order =
+      orders_cached ? num_scattering_orders + 1 : 2;
+  const bool single_scattering_cached = orders_cached ||
+      (single_mie_scattering_cached &&
+          IsCached(filename("single_rayleigh_scattering",
+              fingerprints.single_scattering)));
+  const bool direct_irradiance_cached = orders_cached || (use_cache &&
+      IsCached(filename("direct_irradiance", fingerprints.direct_irradiance)));
 
 /*
 <p>Since the computation phase takes several minutes, we show a progress bar to
 provide feedback to the user. The following constants roughly represent the
 relative duration of each computation phase, and are used to display a progress
-value which is roughly proportional to the elapsed time.
+value which is roughly proportional to the elapsed time (of the stages which
+are not cached).
 */
 
   constexpr unsigned int kTransmittanceProgress = 1;
@@ -116,92 +717,183 @@ value which is roughly proportional to the elapsed time.
   constexpr unsigned int kScatteringDensityProgress = 100;
   constexpr unsigned int kIndirectIrradianceProgress = 10;
   constexpr unsigned int kMultipleScatteringProgress = 10;
+  const ScatteringLattice lattice(lattice_step);
+  const unsigned int num_computed_orders =
+      num_scattering_orders + 1 - first_scattering_order;
   const unsigned int kTotalProgress =
       TRANSMITTANCE_TEXTURE_WIDTH * TRANSMITTANCE_TEXTURE_HEIGHT *
-          kTransmittanceProgress +
+          (transmittance_cached ? 0 : kTransmittanceProgress) +
       IRRADIANCE_TEXTURE_WIDTH * IRRADIANCE_TEXTURE_HEIGHT * (
-          kDirectIrradianceProgress +
-          kIndirectIrradianceProgress * (num_scattering_orders - 1)) +
-      SCATTERING_TEXTURE_WIDTH * SCATTERING_TEXTURE_HEIGHT *
-          SCATTERING_TEXTURE_DEPTH * (
-              kSingleScatteringProgress +
+          (direct_irradiance_cached ? 0 : kDirectIrradianceProgress) +
+          kIndirectIrradianceProgress * num_computed_orders) +
+      lattice.num_texels() * (
+              (single_scattering_cached ? 0 : kSingleScatteringProgress) +
               (kScatteringDensityProgress + kMultipleScatteringProgress) *
-                  (num_scattering_orders - 1));
+                  num_computed_orders);
 
-  ProgressBar progress_bar(kTotalProgress);
+  std::unique_ptr<ProgressBar> progress_bar;
+  if (init_task_ == nullptr) {
+    progress_bar.reset(new ProgressBar(kTotalProgress));
+  } else {
+    init_task_->Start(kTotalProgress);
+  }
+  auto increment_progress = [&](unsigned int progress) {
+    if (init_task_ == nullptr) {
+      progress_bar->Increment(progress);
+    } else {
+      init_task_->Increment(progress);
+    }
+  };
 
 /*
 <p>The remaining code of this method implements Algorithm 4.1 of our paper,
 using several threads to speed up computations (by computing several texels of
-a texture in parallel).
+a texture in parallel), for the stages which are not cached.
 */
 
+  // Compute the density lookup table, used by the transmittance, single
+  // scattering and scattering density stages, unless a tabulated one is
+  // provided in the cache directory (e.g. from measured soundings).
+  std::unique_ptr<DensityTexture> density_texture(new DensityTexture());
+  if (IsCached(cache_directory_ + "density.dat")) {
+    density_texture->Load(cache_directory_ + "density.dat");
+  } else {
+    RunPrecomputationJobs(nullptr, 0, [&](unsigned int j) {
+      for (unsigned int i = 0; i < DENSITY_TEXTURE_WIDTH; ++i) {
+        density_texture->Set(i, j,
+            ComputeDensityTexture(atmosphere_, vec2(i + 0.5, j + 0.5)));
+      }
+    }, DENSITY_TEXTURE_HEIGHT);
+  }
+
   // Compute the transmittance, and store it in transmittance_texture_.
-  RunJobs([&](unsigned int j) {
-    for (unsigned int i = 0; i < TRANSMITTANCE_TEXTURE_WIDTH; ++i) {
-      transmittance_texture_->Set(i, j,
-          ComputeTransmittanceToTopAtmosphereBoundaryTexture(
-              atmosphere_, vec2(i + 0.5, j + 0.5)));
-      progress_bar.Increment(kTransmittanceProgress);
+  if (transmittance_cached) {
+    transmittance_texture_->Load(
+        cache_file("transmittance", fingerprints.transmittance));
+  } else {
+    RunPrecomputationJobs("transmittance", 0, [&](unsigned int j) {
+      for (unsigned int i = 0; i < TRANSMITTANCE_TEXTURE_WIDTH; ++i) {
+        transmittance_texture_->Set(i, j,
+            ComputeTransmittanceToTopAtmosphereBoundaryTexture(
+                atmosphere_, *density_texture, vec2(i + 0.5, j + 0.5)));
+        increment_progress(kTransmittanceProgress);
+      }
+    }, TRANSMITTANCE_TEXTURE_HEIGHT);
+    if (use_cache) {
+      transmittance_texture_->Save(
+          cache_file("transmittance", fingerprints.transmittance));
     }
-  }, TRANSMITTANCE_TEXTURE_HEIGHT);
+  }
 
-  // Compute the direct irradiance, store it in delta_irradiance_texture, and
-  // initialize irradiance_texture_ with zeros (we don't want the direct
-  // irradiance in irradiance_texture_, but only the irradiance from the sky).
-  RunJobs([&](unsigned int j) {
-    for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
-      delta_irradiance_texture->Set(i, j,
-          ComputeDirectIrradianceTexture(
-              atmosphere_, *transmittance_texture_, vec2(i + 0.5, j + 0.5)));
-      irradiance_texture_->Set(
-          i, j, IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm));
-      progress_bar.Increment(kDirectIrradianceProgress);
+  // If the scattering orders are cached, load the final textures of the last
+  // one, as well as the single Mie scattering, and skip the next stages.
+  if (orders_cached) {
+    const std::string& fingerprint = fingerprints.scattering_orders.back();
+    delta_mie_scattering_texture->Load(
+        cache_file("single_mie_scattering", fingerprints.single_scattering));
+    irradiance_texture_->Load(cache_file("irradiance", fingerprint));
+    scattering_texture_->Load(cache_file("scattering", fingerprint));
+  } else {
+    // Compute the direct irradiance, store it in delta_irradiance_texture, and
+    // initialize irradiance_texture_ with zeros (we don't want the direct
+    // irradiance in irradiance_texture_, but only the irradiance from the
+    // sky).
+    if (direct_irradiance_cached) {
+      delta_irradiance_texture->Load(
+          cache_file("direct_irradiance", fingerprints.direct_irradiance));
+    } else {
+      RunPrecomputationJobs("direct_irradiance", 1, [&](unsigned int j) {
+        for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+          delta_irradiance_texture->Set(i, j,
+              ComputeDirectIrradianceTexture(atmosphere_,
+                  *transmittance_texture_, vec2(i + 0.5, j + 0.5)));
+          increment_progress(kDirectIrradianceProgress);
+        }
+      }, IRRADIANCE_TEXTURE_HEIGHT);
+      if (use_cache) {
+        delta_irradiance_texture->Save(
+            cache_file("direct_irradiance", fingerprints.direct_irradiance));
+      }
     }
-  }, IRRADIANCE_TEXTURE_HEIGHT);
+    RunPrecomputationJobs(nullptr, 0, [&](unsigned int j) {
+      for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+        irradiance_texture_->Set(
+            i, j, IrradianceSpectrum(0.0 * watt_per_square_meter_per_nm));
+      }
+    }, IRRADIANCE_TEXTURE_HEIGHT);
 
-  // Compute the rayleigh and mie single scattering, and store them in
-  // delta_rayleigh_scattering_texture and delta_mie_scattering_texture, as well
-  // as in scattering_texture.
-  RunJobs([&](unsigned int k) {
-    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
-      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
-        IrradianceSpectrum rayleigh;
-        IrradianceSpectrum mie;
-        ComputeSingleScatteringTexture(atmosphere_, *transmittance_texture_,
-            vec3(i + 0.5, j + 0.5, k + 0.5), rayleigh, mie);
-        delta_rayleigh_scattering_texture->Set(i, j, k, rayleigh);
-        delta_mie_scattering_texture->Set(i, j, k, mie);
-        scattering_texture_->Set(i, j, k, rayleigh);
-        progress_bar.Increment(kSingleScatteringProgress);
+    // Compute the rayleigh and mie single scattering, and store them in
+    // delta_rayleigh_scattering_texture and delta_mie_scattering_texture, as
+    // well as in scattering_texture.
+    if (single_scattering_cached) {
+      delta_rayleigh_scattering_texture->Load(cache_file(
+          "single_rayleigh_scattering", fingerprints.single_scattering));
+      delta_mie_scattering_texture->Load(
+          cache_file("single_mie_scattering", fingerprints.single_scattering));
+      scattering_texture_->Load(filename(
+          "single_rayleigh_scattering", fingerprints.single_scattering));
+    } else {
+      RunPrecomputationJobs("single_scattering", 1, [&](unsigned int k) {
+        for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+          for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+            if (!lattice.Contains(i, j, k)) {
+              continue;
+            }
+            IrradianceSpectrum rayleigh;
+            IrradianceSpectrum mie;
+            ComputeSingleScatteringTexture(atmosphere_,
+                *transmittance_texture_, *density_texture,
+                vec3(i + 0.5, j + 0.5, k + 0.5), rayleigh, mie);
+            delta_rayleigh_scattering_texture->Set(i, j, k, rayleigh);
+            delta_mie_scattering_texture->Set(i, j, k, mie);
+            scattering_texture_->Set(i, j, k, rayleigh);
+            increment_progress(kSingleScatteringProgress);
+          }
+        }
+      }, SCATTERING_TEXTURE_DEPTH);
+      lattice.Interpolate(delta_rayleigh_scattering_texture.get());
+      lattice.Interpolate(delta_mie_scattering_texture);
+      if (use_cache) {
+        delta_rayleigh_scattering_texture->Save(cache_file(
+            "single_rayleigh_scattering", fingerprints.single_scattering));
+        delta_mie_scattering_texture->Save(cache_file(
+            "single_mie_scattering", fingerprints.single_scattering));
       }
     }
-  }, SCATTERING_TEXTURE_DEPTH);
+  }
 
-  // Compute the 2nd, 3rd and 4th order of scattering, in sequence.
-  for (unsigned int scattering_order = 2;
+  // Compute the 2nd, 3rd and 4th order of scattering, in sequence (unless they
+  // are cached).
+  for (unsigned int scattering_order = first_scattering_order;
        scattering_order <= num_scattering_orders;
        ++scattering_order) {
     // Compute the scattering density, and store it in
     // delta_scattering_density_texture.
-    RunJobs([&](unsigned int k) {
+    RunPrecomputationJobs("scattering_density", scattering_order,
+        [&](unsigned int k) {
       for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
         for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          if (!lattice.Contains(i, j, k)) {
+            continue;
+          }
           RadianceDensitySpectrum scattering_density;
           scattering_density = ComputeScatteringDensityTexture(atmosphere_,
-              *transmittance_texture_, *delta_rayleigh_scattering_texture,
+              *transmittance_texture_, *density_texture,
+              *delta_rayleigh_scattering_texture,
               *delta_mie_scattering_texture,
               *delta_multiple_scattering_texture, *delta_irradiance_texture,
               vec3(i + 0.5, j + 0.5, k + 0.5), scattering_order);
           delta_scattering_density_texture->Set(i, j, k, scattering_density);
-          progress_bar.Increment(kScatteringDensityProgress);
+          increment_progress(kScatteringDensityProgress);
         }
       }
     }, SCATTERING_TEXTURE_DEPTH);
+    lattice.Interpolate(delta_scattering_density_texture.get());
 
     // Compute the indirect irradiance, store it in delta_irradiance_texture and
     // accumulate it in irradiance_texture_.
-    RunJobs([&](unsigned int j) {
+    RunPrecomputationJobs("indirect_irradiance", scattering_order,
+        [&](unsigned int j) {
       for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
         IrradianceSpectrum delta_irradiance;
         delta_irradiance = ComputeIndirectIrradianceTexture(
@@ -209,7 +901,7 @@ a texture in parallel).
             *delta_mie_scattering_texture, *delta_multiple_scattering_texture,
             vec2(i + 0.5, j + 0.5), scattering_order - 1);
         delta_irradiance_texture->Set(i, j, delta_irradiance);
-        progress_bar.Increment(kIndirectIrradianceProgress);
+        increment_progress(kIndirectIrradianceProgress);
       }
     }, IRRADIANCE_TEXTURE_HEIGHT);
     (*irradiance_texture_) += *delta_irradiance_texture;
@@ -217,9 +909,13 @@ a texture in parallel).
     // Compute the multiple scattering, store it in
     // delta_multiple_scattering_texture, and accumulate it in
     // scattering_texture_.
-    RunJobs([&](unsigned int k) {
+    RunPrecomputationJobs("multiple_scattering", scattering_order,
+        [&](unsigned int k) {
       for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
         for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+          if (!lattice.Contains(i, j, k)) {
+            continue;
+          }
           RadianceSpectrum delta_multiple_scattering;
           Number nu;
           delta_multiple_scattering = ComputeMultipleScatteringTexture(
@@ -231,17 +927,282 @@ a texture in parallel).
           scattering_texture_->Set(i, j, k,
               scattering_texture_->Get(i, j, k) +
               delta_multiple_scattering * (1.0 / RayleighPhaseFunction(nu)));
-          progress_bar.Increment(kMultipleScatteringProgress);
+          increment_progress(kMultipleScatteringProgress);
         }
       }
     }, SCATTERING_TEXTURE_DEPTH);
+    lattice.Interpolate(delta_multiple_scattering_texture.get());
+    if (use_cache) {
+      const std::string& fingerprint =
+          fingerprints.scattering_orders[scattering_order - 2];
+      irradiance_texture_->Save(cache_file("irradiance", fingerprint));
+      scattering_texture_->Save(cache_file("scattering", fingerprint));
+    }
   }
+  lattice.Interpolate(scattering_texture_.get());
+  if (use_cache) {
+    EvictCacheFiles(cache_directory_, max_cache_size_, used_files);
+  }
+}
+
+/*
+<p>The progressive mode first computes a coarse approximation of the scattering
+textures, on the lattice defined above with a step of
+<code>kCoarseLatticeStep</code> texels (which contains about 45 times fewer
+texels than the full textures), notifies the caller that these approximate
+textures can be used, and then recomputes them at full resolution. Note that
+the coarse textures can not be used to speed up the full precomputation, because
+each scattering order depends on the previous one at the same resolution (the
+transmittance and irradiance textures, which are cheap to compute, are always
+computed at full resolution). If the final textures are found in the cache,
+this method simply loads them, without calling
+<code>coarse_textures_ready</code>:
+*/
 
-  transmittance_texture_->Save(cache_directory_ + "transmittance.dat");
-  scattering_texture_->Save(cache_directory_ + "scattering.dat");
-  single_mie_scattering_texture_->Save(
-      cache_directory_ + "single_mie_scattering.dat");
-  irradiance_texture_->Save(cache_directory_ + "irradiance.dat");
+void Model::InitProgressive(const std::function<void()>& coarse_textures_ready,
+                            unsigned int num_scattering_orders) {
+  InitGuard guard(this);
+  constexpr unsigned int kCoarseLatticeStep = 4;
+  const StageFingerprints fingerprints =
+      GetStageFingerprints(num_scattering_orders);
+  const bool cached = fingerprints.scattering_orders.empty() ?
+      IsCached(GetCacheFilename(cache_directory_, "single_mie_scattering",
+          fingerprints.single_scattering)) :
+      IsCached(GetCacheFilename(cache_directory_, "scattering",
+          fingerprints.scattering_orders.back()));
+  if (!cached) {
+    Precompute(num_scattering_orders, kCoarseLatticeStep,
+        false /* use_cache */);
+    if (precompute_luminance_) {
+      PrecomputeLuminance();
+    }
+    coarse_textures_ready();
+  }
+  RunInit(num_scattering_orders);
+}
+
+/*
+<p>The derivatives of the precomputed textures with respect to the scalar
+parameters defined in <code>Model::Parameter</code> are computed with central
+finite differences, i.e. as $(T(\theta+h)-T(\theta-h))/2h$, where $T(\theta)$
+are the textures precomputed with the same integrators as in <code>Init</code>,
+for the parameter value $\theta$. For this we need the following helper
+functions, which return the atmosphere parameters for the given parameter
+changes, and compute linear combinations of textures, texel by texel:
+*/
+
+namespace {
+
+AtmosphereParameters ChangeParameters(const AtmosphereParameters& atmosphere,
+    const std::vector<Model::Parameter>& parameters,
+    const std::vector<double>& parameter_changes) {
+  AtmosphereParameters result = atmosphere;
+  for (unsigned int i = 0; i < parameters.size(); ++i) {
+    const Number scale = 1.0 + parameter_changes[i];
+    switch (parameters[i]) {
+      case Model::Parameter::RAYLEIGH_DENSITY_SCALE:
+        result.rayleigh_scattering = result.rayleigh_scattering * scale;
+        break;
+      case Model::Parameter::MIE_DENSITY_SCALE:
+        result.mie_scattering = result.mie_scattering * scale;
+        result.mie_extinction = result.mie_extinction * scale;
+        break;
+      case Model::Parameter::OZONE_DENSITY_SCALE:
+        result.absorption_extinction = result.absorption_extinction * scale;
+        break;
+      case Model::Parameter::MIE_PHASE_FUNCTION_G:
+        result.mie_phase_function_g = result.mie_phase_function_g * scale;
+        break;
+    }
+  }
+  return result;
+}
+
+// Sets 'texture' to 'texture1' * 'scale1' + 'texture2' * 'scale2' ('texture'
+// can be one of the input textures).
+template<unsigned int NX, unsigned int NY, class T>
+void LinearCombination(const dimensional::BinaryFunction<NX, NY, T>& texture1,
+    const Number scale1,
+    const dimensional::BinaryFunction<NX, NY, T>& texture2,
+    const Number scale2, dimensional::BinaryFunction<NX, NY, T>* texture) {
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < NX; ++i) {
+      texture->Set(i, j,
+          texture1.Get(i, j) * scale1 + texture2.Get(i, j) * scale2);
+    }
+  }, NY);
+}
+
+template<class T>
+void LinearCombination(const AbstractScatteringTexture<T>& texture1,
+    const Number scale1, const AbstractScatteringTexture<T>& texture2,
+    const Number scale2, AbstractScatteringTexture<T>* texture) {
+  RunJobs([&](unsigned int k) {
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        texture->Set(i, j, k, texture1.Get(i, j, k) * scale1 +
+            texture2.Get(i, j, k) * scale2);
+      }
+    }
+  }, SCATTERING_TEXTURE_DEPTH);
+}
+
+}  // anonymous namespace
+
+/*
+<p>The <code>InitSensitivities</code> method first checks that the textures
+have been precomputed, and that no other precomputation is running (the
+derivatives are computed at the current textures, and this method replaces the
+sensitivity textures used by <code>ApplySensitivities</code>). It then stores a
+copy of the current textures, and computes the derivatives with respect to each
+parameter from two temporary models, precomputed with the parameter value
+multiplied by $1+h$ and $1-h$, where $h$ is a small relative step, the same for
+all parameters (so that the truncation error of the central differences, in
+$O(h^2)$, is similar for all parameters). The precomputation stages of these
+models are not cached on disk: they are only used once, and would otherwise fill
+the cache and evict the cached stages of this model.
+
+<p>Note that this is a deliberate choice of finite differences over forward
+mode automatic differentiation through the precomputation functions. The latter
+would be more accurate, and would cost about as much as one precomputation per
+parameter (instead of two), but it would require a dual number type for each
+physical quantity type of the <a href="definitions.h.html">dimensional
+types</a> used by these functions (which are shared with the GPU shaders). The
+finite differences are sufficient in practice, because the textures are smooth
+functions of the parameters. In both cases, the cost is in this method, which
+is done once; the per parameter change cost is in
+<code>ApplySensitivities</code>:
+*/
+
+void Model::InitSensitivities(const std::vector<Parameter>& parameters,
+    unsigned int num_scattering_orders) {
+  InitGuard guard(this);
+  if (!initialized_) {
+    throw std::logic_error(
+        "Model::InitSensitivities requires a precomputed model");
+  }
+  for (Parameter parameter : parameters) {
+    if (parameter == Parameter::MIE_PHASE_FUNCTION_G &&
+        atmosphere_.mie_phase_function_g() == 0.0) {
+      throw std::invalid_argument("Model::InitSensitivities requires a non "
+          "zero Mie phase function g parameter, since its changes are "
+          "relative");
+    }
+  }
+  constexpr double kStep = 1e-2;
+  sensitivities_.reset(new Sensitivities());
+  sensitivities_->atmosphere = atmosphere_;
+  sensitivities_->parameters = parameters;
+  sensitivities_->transmittance_texture.reset(new TransmittanceTexture());
+  sensitivities_->scattering_texture.reset(
+      new ReducedScatteringTexture(scattering_texture_layout_));
+  sensitivities_->single_mie_scattering_texture.reset(
+      new ReducedScatteringTexture(scattering_texture_layout_));
+  sensitivities_->irradiance_texture.reset(new IrradianceTexture());
+  LinearCombination(*transmittance_texture_, 1.0, *transmittance_texture_,
+      0.0, sensitivities_->transmittance_texture.get());
+  LinearCombination(*scattering_texture_, 1.0, *scattering_texture_, 0.0,
+      sensitivities_->scattering_texture.get());
+  LinearCombination(*single_mie_scattering_texture_, 1.0,
+      *single_mie_scattering_texture_, 0.0,
+      sensitivities_->single_mie_scattering_texture.get());
+  LinearCombination(*irradiance_texture_, 1.0, *irradiance_texture_, 0.0,
+      sensitivities_->irradiance_texture.get());
+
+  const Number kScale = 1.0 / (2.0 * kStep);
+  for (unsigned int i = 0; i < parameters.size(); ++i) {
+    std::vector<double> parameter_changes(parameters.size(), 0.0);
+    parameter_changes[i] = kStep;
+    Model plus_model(
+        ChangeParameters(atmosphere_, parameters, parameter_changes),
+        cache_directory_, false /* precompute_luminance */,
+        scattering_texture_layout_);
+    plus_model.Precompute(
+        num_scattering_orders, 1 /* lattice_step */, false /* use_cache */);
+    parameter_changes[i] = -kStep;
+    Model minus_model(
+        ChangeParameters(atmosphere_, parameters, parameter_changes),
+        cache_directory_, false /* precompute_luminance */,
+        scattering_texture_layout_);
+    minus_model.Precompute(
+        num_scattering_orders, 1 /* lattice_step */, false /* use_cache */);
+
+    // Compute the derivatives in the textures of plus_model, and move them
+    // to sensitivities_.
+    LinearCombination(*plus_model.transmittance_texture_, kScale,
+        *minus_model.transmittance_texture_, -kScale,
+        plus_model.transmittance_texture_.get());
+    LinearCombination(*plus_model.scattering_texture_, kScale,
+        *minus_model.scattering_texture_, -kScale,
+        plus_model.scattering_texture_.get());
+    LinearCombination(*plus_model.single_mie_scattering_texture_, kScale,
+        *minus_model.single_mie_scattering_texture_, -kScale,
+        plus_model.single_mie_scattering_texture_.get());
+    LinearCombination(*plus_model.irradiance_texture_, kScale,
+        *minus_model.irradiance_texture_, -kScale,
+        plus_model.irradiance_texture_.get());
+    sensitivities_->transmittance_derivatives.push_back(
+        std::move(plus_model.transmittance_texture_));
+    sensitivities_->scattering_derivatives.push_back(
+        std::move(plus_model.scattering_texture_));
+    sensitivities_->single_mie_scattering_derivatives.push_back(
+        std::move(plus_model.single_mie_scattering_texture_));
+    sensitivities_->irradiance_derivatives.push_back(
+        std::move(plus_model.irradiance_texture_));
+  }
+}
+
+/*
+<p>The <code>ApplySensitivities</code> method then simply computes the first
+order Taylor expansion of each texture, from the above textures (the luminance
+textures, if any, are recomputed from the new spectral textures). This is much
+faster than a precomputation, but still requires several passes over all the
+texels on the CPU, so it is not suitable for per frame updates. Note that the
+transmittance texture is an exponential function of the density scales, so that
+its first order approximation is only accurate for small changes (this is also
+the case, to a lesser extent, of the other textures):
+*/
+
+void Model::ApplySensitivities(const std::vector<double>& parameter_changes) {
+  InitGuard guard(this);
+  if (!sensitivities_) {
+    throw std::logic_error(
+        "Model::ApplySensitivities requires InitSensitivities");
+  }
+  if (parameter_changes.size() != sensitivities_->parameters.size()) {
+    throw std::invalid_argument("Model::ApplySensitivities requires one "
+        "change per parameter passed to InitSensitivities");
+  }
+  atmosphere_ = ChangeParameters(sensitivities_->atmosphere,
+      sensitivities_->parameters, parameter_changes);
+  const Sensitivities& sensitivities = *sensitivities_;
+  LinearCombination(*sensitivities.transmittance_texture, 1.0,
+      *sensitivities.transmittance_texture, 0.0, transmittance_texture_.get());
+  LinearCombination(*sensitivities.scattering_texture, 1.0,
+      *sensitivities.scattering_texture, 0.0, scattering_texture_.get());
+  LinearCombination(*sensitivities.single_mie_scattering_texture, 1.0,
+      *sensitivities.single_mie_scattering_texture, 0.0,
+      single_mie_scattering_texture_.get());
+  LinearCombination(*sensitivities.irradiance_texture, 1.0,
+      *sensitivities.irradiance_texture, 0.0, irradiance_texture_.get());
+  for (unsigned int i = 0; i < parameter_changes.size(); ++i) {
+    const Number change = parameter_changes[i];
+    LinearCombination(*transmittance_texture_, 1.0,
+        *sensitivities.transmittance_derivatives[i], change,
+        transmittance_texture_.get());
+    LinearCombination(*scattering_texture_, 1.0,
+        *sensitivities.scattering_derivatives[i], change,
+        scattering_texture_.get());
+    LinearCombination(*single_mie_scattering_texture_, 1.0,
+        *sensitivities.single_mie_scattering_derivatives[i], change,
+        single_mie_scattering_texture_.get());
+    LinearCombination(*irradiance_texture_, 1.0,
+        *sensitivities.irradiance_derivatives[i], change,
+        irradiance_texture_.get());
+  }
+  if (precompute_luminance_) {
+    PrecomputeLuminance();
+  }
 }
 
 /*
@@ -249,13 +1210,20 @@ a texture in parallel).
 used to compute the sky radiance and the sun and sky irradiance. The functions
 for doing that are provided in <a href="functions.h.html">functions.h</a> and we
 just need here to wrap them in their corresponding methods (except for the solar
-radiance, which can be directly computed from the model parameters):
+radiance, which can be directly computed from the model parameters and from the
+solid angle of the Sun, also used for the solar luminance):
 */
 
+namespace {
+
+SolidAngle GetSunSolidAngle(const AtmosphereParameters& atmosphere) {
+  return 2.0 * PI * (1.0 - cos(atmosphere.sun_angular_radius)) * sr;
+}
+
+}  // anonymous namespace
+
 RadianceSpectrum Model::GetSolarRadiance() const {
-  SolidAngle sun_solid_angle = 2.0 * PI *
-      (1.0 - cos(atmosphere_.sun_angular_radius)) * sr;
-  return atmosphere_.solar_irradiance * (1.0 / sun_solid_angle);
+  return atmosphere_.solar_irradiance * (1.0 / GetSunSolidAngle(atmosphere_));
 }
 
 RadianceSpectrum Model::GetSkyRadiance(Position camera, Direction view_ray,
@@ -281,5 +1249,367 @@ IrradianceSpectrum Model::GetSunAndSkyIrradiance(Position point,
       *irradiance_texture_, point, normal, sun_direction, *sky_irradiance);
 }
 
+/*
+<p>With the <code>precompute_luminance</code> option, the spectral textures are
+converted to sRGB luminance textures once they have been precomputed, in order
+to avoid a spectral integration for each luminance query. Since the conversion
+from a spectrum to its sRGB value is linear, it commutes with the linear
+interpolations done in the texture lookups. We can thus fold the CIE color
+matching functions and the XYZ to sRGB matrix into 3 weight functions, and
+integrate each texel with them (like the GPU model does with its
+<code>luminance_from_radiance</code> matrix, but here with all the precomputed
+wavelengths at once). For this we use the following helper class:
+*/
+
+namespace {
+
+class SrgbConverter {
+ public:
+  SrgbConverter() {
+    std::vector<Wavelength> wavelengths;
+    std::vector<Number> r_values;
+    std::vector<Number> g_values;
+    std::vector<Number> b_values;
+    for (unsigned int i = 0; i < 95 * 4; i += 4) {
+      const double x = CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i + 1];
+      const double y = CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i + 2];
+      const double z = CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i + 3];
+      wavelengths.push_back(CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i] * nm);
+      r_values.push_back(
+          XYZ_TO_SRGB[0] * x + XYZ_TO_SRGB[1] * y + XYZ_TO_SRGB[2] * z);
+      g_values.push_back(
+          XYZ_TO_SRGB[3] * x + XYZ_TO_SRGB[4] * y + XYZ_TO_SRGB[5] * z);
+      b_values.push_back(
+          XYZ_TO_SRGB[6] * x + XYZ_TO_SRGB[7] * y + XYZ_TO_SRGB[8] * z);
+    }
+    r_bar_ = DimensionlessSpectrum(wavelengths, r_values);
+    g_bar_ = DimensionlessSpectrum(wavelengths, g_values);
+    b_bar_ = DimensionlessSpectrum(wavelengths, b_values);
+  }
+
+  Illuminance3 operator()(const IrradianceSpectrum& irradiance) const {
+    constexpr auto kMaxLuminousEfficacy = MAX_LUMINOUS_EFFICACY * lm / watt;
+    return Illuminance3(
+        kMaxLuminousEfficacy * Integral(irradiance * r_bar_),
+        kMaxLuminousEfficacy * Integral(irradiance * g_bar_),
+        kMaxLuminousEfficacy * Integral(irradiance * b_bar_));
+  }
+
+ private:
+  DimensionlessSpectrum r_bar_;
+  DimensionlessSpectrum g_bar_;
+  DimensionlessSpectrum b_bar_;
+};
+
+}  // anonymous namespace
+
+void Model::PrecomputeLuminance() {
+  const SrgbConverter to_srgb;
+  solar_illuminance_ = to_srgb(atmosphere_.solar_irradiance);
+  RunPrecomputationJobs(nullptr, 0, [&](unsigned int k) {
+    for (unsigned int j = 0; j < SCATTERING_TEXTURE_HEIGHT; ++j) {
+      for (unsigned int i = 0; i < SCATTERING_TEXTURE_WIDTH; ++i) {
+        luminance_scattering_texture_->Set(i, j, k,
+            to_srgb(scattering_texture_->Get(i, j, k)));
+        luminance_single_mie_scattering_texture_->Set(i, j, k,
+            to_srgb(single_mie_scattering_texture_->Get(i, j, k)));
+      }
+    }
+  }, SCATTERING_TEXTURE_DEPTH);
+  RunPrecomputationJobs(nullptr, 0, [&](unsigned int j) {
+    for (unsigned int i = 0; i < IRRADIANCE_TEXTURE_WIDTH; ++i) {
+      luminance_irradiance_texture_->Set(i, j,
+          to_srgb(irradiance_texture_->Get(i, j)));
+    }
+  }, IRRADIANCE_TEXTURE_HEIGHT);
+}
+
+/*
+<p>The luminance methods then use the same
+<a href="../functions.glsl.html#rendering">rendering functions</a> as the
+spectral ones for all the geometric computations (<code>GetViewRayTerms</code>,
+<code>GetCameraInAtmosphere</code>, <code>GetRMuMuSAtDistance</code> and
+<code>GetSunAndSkyIrradianceTerms</code>), and only replace the spectral texture
+lookups with lookups in the luminance textures. The transmittance terms,
+which are not linear in the spectrum, are approximated as in the GPU model by
+their values at <code>kLambdaR</code>, <code>kLambdaG</code> and
+<code>kLambdaB</code>, with the following helper function:
+*/
+
+namespace {
+
+Illuminance3 Attenuate(const Illuminance3& illuminance,
+    const DimensionlessSpectrum& transmittance) {
+  return Illuminance3(
+      illuminance.x * transmittance(atmosphere::kLambdaR * nm),
+      illuminance.y * transmittance(atmosphere::kLambdaG * nm),
+      illuminance.z * transmittance(atmosphere::kLambdaB * nm));
+}
+
+Luminance3 ToLuminance(const Illuminance3& illuminance, InverseSolidAngle f) {
+  return Luminance3(
+      illuminance.x * f, illuminance.y * f, illuminance.z * f);
+}
+
+}  // anonymous namespace
+
+Illuminance3 Model::GetCombinedScatteringLuminance(Length r, Number mu,
+    Number mu_s, Number nu, bool ray_r_mu_intersects_ground,
+    Illuminance3* single_mie_scattering) const {
+  vec4 uvwz = GetScatteringTextureUvwzFromRMuMuSNu(
+      atmosphere_, r, mu, mu_s, nu, ray_r_mu_intersects_ground);
+  *single_mie_scattering =
+      texture(*luminance_single_mie_scattering_texture_, uvwz);
+  return texture(*luminance_scattering_texture_, uvwz);
+}
+
+Luminance3 Model::GetSolarLuminance() const {
+  assert(precompute_luminance_);
+  return ToLuminance(solar_illuminance_, 1.0 / GetSunSolidAngle(atmosphere_));
+}
+
+Luminance3 Model::GetSkyLuminanceFromViewRayTerms(
+    const Position& camera_in_atmosphere, const Direction& view_ray,
+    Length r, Number mu, bool ray_r_mu_intersects_ground,
+    const Direction& sun_direction) const {
+  Number mu_s = dot(camera_in_atmosphere, sun_direction) / r;
+  Number nu = dot(view_ray, sun_direction);
+  Illuminance3 single_mie_scattering;
+  Illuminance3 scattering = GetCombinedScatteringLuminance(r, mu, mu_s, nu,
+      ray_r_mu_intersects_ground, &single_mie_scattering);
+  return ToLuminance(scattering, RayleighPhaseFunction(nu)) +
+      ToLuminance(single_mie_scattering,
+          MiePhaseFunction(atmosphere_.mie_phase_function_g, nu));
+}
+
+Luminance3 Model::GetSkyLuminance(Position camera, Direction view_ray,
+    Length shadow_length, Direction sun_direction,
+    DimensionlessSpectrum* transmittance) const {
+  assert(precompute_luminance_);
+  Position camera_in_atmosphere;
+  Length r;
+  Number mu;
+  bool ray_r_mu_intersects_ground;
+  if (!GetViewRayTerms(atmosphere_, *transmittance_texture_, camera, view_ray,
+          camera_in_atmosphere, r, mu, ray_r_mu_intersects_ground,
+          *transmittance)) {
+    return Luminance3(0.0 * cd_per_square_meter, 0.0 * cd_per_square_meter,
+        0.0 * cd_per_square_meter);
+  }
+  if (shadow_length == 0.0 * m) {
+    return GetSkyLuminanceFromViewRayTerms(camera_in_atmosphere, view_ray, r,
+        mu, ray_r_mu_intersects_ground, sun_direction);
+  }
+  Number mu_s = dot(camera_in_atmosphere, sun_direction) / r;
+  Number nu = dot(view_ray, sun_direction);
+  Length r_p;
+  Number mu_p;
+  Number mu_s_p;
+  GetRMuMuSAtDistance(
+      atmosphere_, r, mu, mu_s, nu, shadow_length, r_p, mu_p, mu_s_p);
+  Illuminance3 single_mie_scattering;
+  Illuminance3 scattering = GetCombinedScatteringLuminance(r_p, mu_p, mu_s_p,
+      nu, ray_r_mu_intersects_ground, &single_mie_scattering);
+  DimensionlessSpectrum shadow_transmittance =
+      GetTransmittance(atmosphere_, *transmittance_texture_,
+          r, mu, shadow_length, ray_r_mu_intersects_ground);
+  scattering = Attenuate(scattering, shadow_transmittance);
+  single_mie_scattering =
+      Attenuate(single_mie_scattering, shadow_transmittance);
+  return ToLuminance(scattering, RayleighPhaseFunction(nu)) +
+      ToLuminance(single_mie_scattering,
+          MiePhaseFunction(atmosphere_.mie_phase_function_g, nu));
+}
+
+Luminance3 Model::GetSkyLuminanceToPoint(Position camera, Position point,
+    Length shadow_length, Direction sun_direction,
+    DimensionlessSpectrum* transmittance) const {
+  assert(precompute_luminance_);
+  Direction view_ray = normalize(point - camera);
+  Position camera_in_atmosphere;
+  Length r;
+  Length rmu;
+  GetCameraInAtmosphere(
+      atmosphere_, camera, view_ray, camera_in_atmosphere, r, rmu);
+
+  Number mu = rmu / r;
+  Number mu_s = dot(camera_in_atmosphere, sun_direction) / r;
+  Number nu = dot(view_ray, sun_direction);
+  Length d = length(point - camera_in_atmosphere);
+  bool ray_r_mu_intersects_ground = RayIntersectsGround(atmosphere_, r, mu);
+
+  *transmittance = GetTransmittance(atmosphere_, *transmittance_texture_,
+      r, mu, d, ray_r_mu_intersects_ground);
+
+  Illuminance3 single_mie_scattering;
+  Illuminance3 scattering = GetCombinedScatteringLuminance(r, mu, mu_s, nu,
+      ray_r_mu_intersects_ground, &single_mie_scattering);
+
+  d = max(d - shadow_length, 0.0 * m);
+  Length r_p;
+  Number mu_p;
+  Number mu_s_p;
+  GetRMuMuSAtDistance(atmosphere_, r, mu, mu_s, nu, d, r_p, mu_p, mu_s_p);
+
+  Illuminance3 single_mie_scattering_p;
+  Illuminance3 scattering_p = GetCombinedScatteringLuminance(r_p, mu_p,
+      mu_s_p, nu, ray_r_mu_intersects_ground, &single_mie_scattering_p);
+
+  DimensionlessSpectrum shadow_transmittance = *transmittance;
+  if (shadow_length > 0.0 * m) {
+    shadow_transmittance = GetTransmittance(atmosphere_,
+        *transmittance_texture_, r, mu, d, ray_r_mu_intersects_ground);
+  }
+  scattering = scattering - Attenuate(scattering_p, shadow_transmittance);
+  single_mie_scattering = single_mie_scattering -
+      Attenuate(single_mie_scattering_p, shadow_transmittance);
+
+  // Hack to avoid rendering artifacts when the sun is below the horizon.
+  Number mie_factor = smoothstep(Number(0.0), Number(0.01), mu_s);
+  return ToLuminance(scattering, RayleighPhaseFunction(nu)) +
+      ToLuminance(single_mie_scattering, mie_factor *
+          MiePhaseFunction(atmosphere_.mie_phase_function_g, nu));
+}
+
+Illuminance3 Model::GetSunAndSkyIlluminance(Position point,
+    Direction normal, Direction sun_direction,
+    Illuminance3* sky_illuminance) const {
+  assert(precompute_luminance_);
+  Length r;
+  Number mu_s;
+  Number sun_factor;
+  Number sky_factor;
+  GetSunAndSkyIrradianceTerms(
+      point, normal, sun_direction, r, mu_s, sun_factor, sky_factor);
+
+  // Indirect illuminance (approximated if the surface is not horizontal).
+  Illuminance3 illuminance = texture(*luminance_irradiance_texture_,
+      GetIrradianceTextureUvFromRMuS(atmosphere_, r, mu_s));
+  *sky_illuminance = Illuminance3(illuminance.x * sky_factor,
+      illuminance.y * sky_factor, illuminance.z * sky_factor);
+
+  // Direct illuminance.
+  Illuminance3 sun_illuminance = Attenuate(solar_illuminance_,
+      GetTransmittanceToSun(atmosphere_, *transmittance_texture_, r, mu_s));
+  return Illuminance3(sun_illuminance.x * sun_factor,
+      sun_illuminance.y * sun_factor, sun_illuminance.z * sun_factor);
+}
+
+/*
+<p>The batch versions of these methods simply call the above functions for each
+ray or point. They are evaluated in parallel, in several threads, each thread
+processing a contiguous chunk of the input and output arrays at a time (in order
+to read and write them sequentially, and to amortize the job scheduling cost).
+For this we use the following helper functions:
+*/
+
+namespace {
+
+constexpr unsigned int kBatchChunkSize = 256;
+
+template<class F>
+void RunBatch(unsigned int size, const F& query) {
+  RunJobs([&](unsigned int chunk) {
+    unsigned int end = std::min(size, (chunk + 1) * kBatchChunkSize);
+    for (unsigned int i = chunk * kBatchChunkSize; i < end; ++i) {
+      query(i);
+    }
+  }, (size + kBatchChunkSize - 1) / kBatchChunkSize);
+}
+
+Position GetPosition(const Model::Vector3Array& positions, unsigned int i) {
+  return Position(positions.x[i] * m, positions.y[i] * m, positions.z[i] * m);
+}
+
+Direction GetDirection(const Model::Vector3Array& directions, unsigned int i) {
+  return Direction(directions.x[i], directions.y[i], directions.z[i]);
+}
+
+Length GetShadowLength(const double* shadow_length, unsigned int i) {
+  return shadow_length == nullptr ? 0.0 * m : shadow_length[i] * m;
+}
+
+}  // anonymous namespace
+
+void Model::GetSkyRadiance(unsigned int size, const Vector3Array& camera,
+    const Vector3Array& view_ray, const double* shadow_length,
+    const Vector3Array& sun_direction, RadianceSpectrum* radiance,
+    DimensionlessSpectrum* transmittance) const {
+  RunBatch(size, [&](unsigned int i) {
+    radiance[i] = GetSkyRadiance(GetPosition(camera, i),
+        GetDirection(view_ray, i), GetShadowLength(shadow_length, i),
+        GetDirection(sun_direction, i), &transmittance[i]);
+  });
+}
+
+void Model::GetSkyRadianceToPoint(unsigned int size,
+    const Vector3Array& camera, const Vector3Array& point,
+    const double* shadow_length, const Vector3Array& sun_direction,
+    RadianceSpectrum* radiance, DimensionlessSpectrum* transmittance) const {
+  RunBatch(size, [&](unsigned int i) {
+    radiance[i] = GetSkyRadianceToPoint(GetPosition(camera, i),
+        GetPosition(point, i), GetShadowLength(shadow_length, i),
+        GetDirection(sun_direction, i), &transmittance[i]);
+  });
+}
+
+void Model::GetSunAndSkyIrradiance(unsigned int size,
+    const Vector3Array& point, const Vector3Array& normal,
+    const Vector3Array& sun_direction, IrradianceSpectrum* sun_irradiance,
+    IrradianceSpectrum* sky_irradiance) const {
+  RunBatch(size, [&](unsigned int i) {
+    sun_irradiance[i] = GetSunAndSkyIrradiance(GetPosition(point, i),
+        GetDirection(normal, i), GetDirection(sun_direction, i),
+        &sky_irradiance[i]);
+  });
+}
+
+/*
+<p>The view cache methods use the same helper functions. The cache is computed
+with <code>GetViewRayTerms</code>, in parallel, and then used with
+<code>GetSkyRadianceFromViewRayTerms</code>, or with its luminance version
+(which is also used by <code>GetSkyLuminance</code>):
+*/
+
+void Model::ComputeViewCache(Position camera, unsigned int size,
+    const Vector3Array& view_ray, ViewCache* cache) const {
+  cache->view_rays_.resize(size);
+  RunBatch(size, [&](unsigned int i) {
+    ViewCache::ViewRay& ray = cache->view_rays_[i];
+    ray.view_ray = GetDirection(view_ray, i);
+    ray.ray_intersects_atmosphere = GetViewRayTerms(atmosphere_,
+        *transmittance_texture_, camera, ray.view_ray,
+        ray.camera_in_atmosphere, ray.r, ray.mu,
+        ray.ray_r_mu_intersects_ground, ray.transmittance);
+  });
+}
+
+void Model::GetSkyRadiance(const ViewCache& cache, Direction sun_direction,
+    RadianceSpectrum* radiance) const {
+  RunBatch(cache.size(), [&](unsigned int i) {
+    const ViewCache::ViewRay& ray = cache.view_rays_[i];
+    radiance[i] = !ray.ray_intersects_atmosphere ?
+        RadianceSpectrum(0.0 * watt_per_square_meter_per_sr_per_nm) :
+        GetSkyRadianceFromViewRayTerms(atmosphere_, *scattering_texture_,
+            *single_mie_scattering_texture_, ray.camera_in_atmosphere,
+            ray.view_ray, ray.r, ray.mu, ray.ray_r_mu_intersects_ground,
+            sun_direction);
+  });
+}
+
+void Model::GetSkyLuminance(const ViewCache& cache, Direction sun_direction,
+    Luminance3* luminance) const {
+  assert(precompute_luminance_);
+  RunBatch(cache.size(), [&](unsigned int i) {
+    const ViewCache::ViewRay& ray = cache.view_rays_[i];
+    luminance[i] = !ray.ray_intersects_atmosphere ?
+        Luminance3(0.0 * cd_per_square_meter, 0.0 * cd_per_square_meter,
+            0.0 * cd_per_square_meter) :
+        GetSkyLuminanceFromViewRayTerms(ray.camera_in_atmosphere,
+            ray.view_ray, ray.r, ray.mu, ray.ray_r_mu_intersects_ground,
+            sun_direction);
+  });
+}
+
 }  // namespace reference
 }  // namespace atmosphere
@@ -35,10 +35,21 @@ To use it:
 <li>create a <code>Model</code> instance with the desired atmosphere
 parameters, and a directory where the precomputed textures can be cached,</li>
 <li>call <code>Init</code> to precompute the atmosphere textures (or read
-them from the cache directory if they have already been precomputed),</li>
+them from the cache directory if they have already been precomputed - the
+intermediate results are also cached, so that only the precomputation stages
+depending on the parameters which changed since a previous precomputation are
+recomputed), or <code>InitProgressive</code> to get a coarse approximation of
+them first, or <code>InitAsync</code> to precompute them in the background, with
+progress notifications and cancellation,</li>
+<li>optionally, call <code>InitSensitivities</code> to precompute the
+derivatives of these textures with respect to some scalar parameters, and
+<code>ApplySensitivities</code> to update the textures for small changes of
+these parameters, without any integration,</li>
 <li>call <code>GetSolarRadiance</code>, <code>GetSkyRadiance</code>,
 <code>GetSkyRadianceToPoint</code> and <code>GetSunAndSkyIrradiance</code> as
-desired,</li>
+desired (these methods also exist in batch versions, to evaluate many rays or
+points at once), or their luminance versions if the model was created with the
+<code>precompute_luminance</code> option,</li>
 <li>delete your <code>Model</code> when you no longer need it (the destructor
 deletes the precomputed textures from memory).</li>
 </ul>
@@ -47,7 +58,12 @@ deletes the precomputed textures from memory).</li>
 #ifndef ATMOSPHERE_REFERENCE_MODEL_H_
 #define ATMOSPHERE_REFERENCE_MODEL_H_
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -58,11 +74,124 @@ namespace reference {
 
 class Model {
  public:
+  // The default maximum size of the cache directory (8 GiB), i.e. about 20
+  // scattering texture files.
+  static constexpr std::int64_t kDefaultMaxCacheSize = std::int64_t(8) << 30;
+
+  // If precompute_luminance is true, Init also converts the precomputed
+  // spectral textures to sRGB luminance textures, used by the Get*Luminance
+  // and GetSunAndSkyIlluminance methods below. scattering_texture_layout is
+  // the memory layout of all the scattering textures of this model (see
+  // quaternary_function.h). It does not change the results, only the memory
+  // locality of the texel lookups. If the cache directory contains a
+  // density.dat file, it is used as a tabulated density profile (e.g. from
+  // measured ozone or aerosol soundings), replacing the density profile
+  // layers of 'atmosphere' in all the precomputations. This file must contain
+  // a DensityTexture, as saved by its Save method, whose texel i contains the
+  // Rayleigh, Mie and absorption densities at the altitude
+  // i / (DENSITY_TEXTURE_WIDTH - 1) times the atmosphere thickness. The least
+  // recently used files of the cache directory are deleted when their total
+  // size exceeds max_cache_size bytes (see model.cc).
   Model(const AtmosphereParameters& atmosphere,
-        const std::string& cache_directory);
+        const std::string& cache_directory,
+        bool precompute_luminance = false,
+        TextureLayout scattering_texture_layout = TextureLayout::LINEAR,
+        std::int64_t max_cache_size = kDefaultMaxCacheSize);
+
 
   void Init(unsigned int num_scattering_orders = 4);
 
+  // Same as Init, but first computes a coarse approximation of the scattering
+  // textures, then calls coarse_textures_ready (from which the Get* methods
+  // can be used), and finally computes the full resolution textures.
+  void InitProgressive(const std::function<void()>& coarse_textures_ready,
+      unsigned int num_scattering_orders = 4);
+
+  // The progress of a precomputation started with InitAsync.
+  struct InitProgress {
+    // The current precomputation stage: "transmittance", "direct_irradiance",
+    // "single_scattering", "scattering_density", "indirect_irradiance" or
+    // "multiple_scattering".
+    std::string phase;
+    // The scattering order computed by the current stage (0 for the
+    // transmittance, 1 for the direct irradiance and single scattering).
+    unsigned int scattering_order;
+    // The fraction of the precomputation done so far, between 0 and 1 (the
+    // stages loaded from the cache are not taken into account).
+    double fraction;
+    // The average number of texels computed per second so far.
+    double texels_per_second;
+    // The estimated remaining time, extrapolated from the elapsed time and
+    // from 'fraction'.
+    double remaining_seconds;
+  };
+
+  struct InitOptions {
+    unsigned int num_scattering_orders = 4;
+    // The number of threads used to compute the texels, or 0 to use one
+    // thread per hardware thread.
+    unsigned int num_threads = 0;
+    // If not null, the precomputation stops as soon as this flag is set. It is
+    // checked before each tile, i.e. each row or layer of texels. It must
+    // remain valid until the precomputation stops.
+    const std::atomic<bool>* cancelled = nullptr;
+    // If not empty, called after each tile, from one of the precomputation
+    // threads (but never concurrently).
+    std::function<void(const InitProgress&)> progress_callback;
+  };
+
+  // Same as Init, but in a separate thread, and with the above options. The
+  // returned future is true if the precomputation completed, or false if it
+  // was cancelled (the precomputed textures are then invalid, but the stages
+  // completed before the cancellation are cached, like with Init). The model
+  // must not be used before this future is ready. Init, InitProgressive and
+  // InitAsync throw a std::logic_error if they are called while another of
+  // these precomputations is running.
+  std::future<bool> InitAsync(const InitOptions& options);
+
+  // The scalar parameters for which the derivatives of the precomputed
+  // textures can be precomputed. The density scales are factors multiplying
+  // the Rayleigh scattering coefficient, the Mie scattering and extinction
+  // coefficients, and the ozone absorption coefficient (i.e. the ozone
+  // column), respectively. They are equal to 1 for the atmosphere parameters
+  // of the model. The changes of all these parameters, including the Mie
+  // phase function g parameter, are relative (a change c multiplies the
+  // parameter by 1 + c).
+  enum class Parameter {
+    RAYLEIGH_DENSITY_SCALE,
+    MIE_DENSITY_SCALE,
+    OZONE_DENSITY_SCALE,
+    MIE_PHASE_FUNCTION_G
+  };
+
+  // Precomputes the derivatives of the precomputed textures with respect to
+  // the given parameters, at the current atmosphere parameters, with central
+  // finite differences (with the same relative step for all parameters). This
+  // requires two precomputations per parameter (with the given number of
+  // scattering orders). Their stages are not cached on disk, so this does not
+  // evict the cached stages of Init. This throws a std::logic_error if the
+  // model has not been initialized, or if a precomputation is running (e.g.
+  // with InitAsync), and a std::invalid_argument if MIE_PHASE_FUNCTION_G is
+  // requested while this parameter is 0.
+  void InitSensitivities(const std::vector<Parameter>& parameters,
+      unsigned int num_scattering_orders = 4);
+
+  // Sets the precomputed textures to their first order Taylor expansion for
+  // the given changes of the parameters passed to InitSensitivities (one
+  // change per parameter, relatively to the atmosphere parameters at the time
+  // of this call), i.e. to the textures precomputed by InitSensitivities plus
+  // the sum of each parameter change times the corresponding derivative
+  // textures. The atmosphere parameters are changed accordingly. This does
+  // not integrate anything, but still makes several full passes over the
+  // textures on the CPU (and recomputes the luminance textures, if any), so it
+  // is not meant to be called at each frame of a real-time application. This
+  // throws a std::logic_error if InitSensitivities has not been called, or if
+  // a precomputation is running, and a std::invalid_argument if the number of
+  // changes is not the number of parameters passed to InitSensitivities.
+  void ApplySensitivities(const std::vector<double>& parameter_changes);
+
+  const AtmosphereParameters& atmosphere() const { return atmosphere_; }
+
   RadianceSpectrum GetSolarRadiance() const;
 
   RadianceSpectrum GetSkyRadiance(Position camera, Direction view_ray,
@@ -76,13 +205,191 @@ class Model {
   IrradianceSpectrum GetSunAndSkyIrradiance(Position p, Direction normal,
       Direction sun_direction, IrradianceSpectrum* sky_irradiance) const;
 
+  // Same as the above methods, but returning sRGB luminance values, computed
+  // with a single RGB lookup per texture instead of a spectral integration. As
+  // in the GPU model, the transmittance used to attenuate these values is
+  // sampled at kLambdaR, kLambdaG and kLambdaB (the returned transmittance is
+  // the full spectral one). These methods require the precompute_luminance
+  // constructor option.
+  Luminance3 GetSolarLuminance() const;
+
+  Luminance3 GetSkyLuminance(Position camera, Direction view_ray,
+      Length shadow_length, Direction sun_direction,
+      DimensionlessSpectrum* transmittance) const;
+
+  Luminance3 GetSkyLuminanceToPoint(Position camera, Position point,
+      Length shadow_length, Direction sun_direction,
+      DimensionlessSpectrum* transmittance) const;
+
+  Illuminance3 GetSunAndSkyIlluminance(Position p, Direction normal,
+      Direction sun_direction, Illuminance3* sky_illuminance) const;
+
+  // A structure of arrays of 3D vectors (positions, in meters, or directions).
+  struct Vector3Array {
+    const double* x;
+    const double* y;
+    const double* z;
+  };
+
+  // Batch versions of the above methods, for 'size' rays or points given as
+  // structures of arrays (shadow_length can be null, meaning 0 for all rays).
+  // The results are written in caller-owned arrays of 'size' elements, without
+  // any other memory allocation. The arrays are split in contiguous chunks,
+  // evaluated in parallel in several threads (each ray is evaluated with the
+  // same scalar code as the above methods, without SIMD vectorization).
+  void GetSkyRadiance(unsigned int size, const Vector3Array& camera,
+      const Vector3Array& view_ray, const double* shadow_length,
+      const Vector3Array& sun_direction, RadianceSpectrum* radiance,
+      DimensionlessSpectrum* transmittance) const;
+
+  void GetSkyRadianceToPoint(unsigned int size, const Vector3Array& camera,
+      const Vector3Array& point, const double* shadow_length,
+      const Vector3Array& sun_direction, RadianceSpectrum* radiance,
+      DimensionlessSpectrum* transmittance) const;
+
+  void GetSunAndSkyIrradiance(unsigned int size, const Vector3Array& point,
+      const Vector3Array& normal, const Vector3Array& sun_direction,
+      IrradianceSpectrum* sun_irradiance,
+      IrradianceSpectrum* sky_irradiance) const;
+
+  // The terms of GetSkyRadiance and GetSkyLuminance which do not depend on the
+  // Sun direction, for a fixed camera and a fixed set of view rays (without
+  // light shafts). Computed once with ComputeViewCache, they can then be used
+  // to evaluate the sky for many Sun directions (e.g. for a time-lapse
+  // sequence) with the batch methods below.
+  class ViewCache {
+   public:
+    unsigned int size() const { return view_rays_.size(); }
+
+    // The transmittance along the i-th view ray (1 if it does not intersect
+    // the atmosphere, 0 if it intersects the ground).
+    const DimensionlessSpectrum& transmittance(unsigned int i) const {
+      return view_rays_[i].transmittance;
+    }
+
+   private:
+    friend class Model;
+
+    struct ViewRay {
+      Position camera_in_atmosphere;
+      Direction view_ray;
+      Length r;
+      Number mu;
+      bool ray_r_mu_intersects_ground;
+      bool ray_intersects_atmosphere;
+      DimensionlessSpectrum transmittance;
+    };
+    std::vector<ViewRay> view_rays_;
+  };
+
+  void ComputeViewCache(Position camera, unsigned int size,
+      const Vector3Array& view_ray, ViewCache* cache) const;
+
+  // Writes the sky radiance (or luminance) for each view ray of 'cache' in a
+  // caller-owned array of cache.size() elements.
+  void GetSkyRadiance(const ViewCache& cache, Direction sun_direction,
+      RadianceSpectrum* radiance) const;
+
+  void GetSkyLuminance(const ViewCache& cache, Direction sun_direction,
+      Luminance3* luminance) const;
+
  private:
-  const AtmosphereParameters atmosphere_;
+  typedef AbstractScatteringTexture<Illuminance3>
+      ReducedScatteringLuminanceTexture;
+  typedef dimensional::BinaryFunction<
+      IRRADIANCE_TEXTURE_WIDTH,
+      IRRADIANCE_TEXTURE_HEIGHT,
+      Illuminance3> IrradianceLuminanceTexture;
+
+  // The fingerprints of the inputs of each precomputation stage, used to name
+  // the files where their outputs are cached.
+  struct StageFingerprints {
+    std::string transmittance;
+    std::string direct_irradiance;
+    std::string single_scattering;
+    // For the scattering orders 2 to num_scattering_orders.
+    std::vector<std::string> scattering_orders;
+  };
+
+  // The state of a precomputation started with InitAsync (defined in
+  // model.cc).
+  class InitTask;
+
+  // Marks a precomputation as running during its lifetime, or throws a
+  // std::logic_error if one is already running (defined in model.cc).
+  class InitGuard;
+
+  void RunInit(unsigned int num_scattering_orders);
+
+  // Runs the given jobs with RunJobs or, during an InitAsync precomputation,
+  // with its threads and cancellation flag (and reports its progress, unless
+  // 'phase' is null).
+  void RunPrecomputationJobs(const char* phase, unsigned int scattering_order,
+      const std::function<void(unsigned int)>& job,
+      unsigned int num_jobs) const;
+
+  StageFingerprints GetStageFingerprints(
+      unsigned int num_scattering_orders) const;
+
+  void Precompute(unsigned int num_scattering_orders,
+      unsigned int lattice_step, bool use_cache);
+
+  void PrecomputeLuminance();
+
+  Illuminance3 GetCombinedScatteringLuminance(Length r, Number mu,
+      Number mu_s, Number nu, bool ray_r_mu_intersects_ground,
+      Illuminance3* single_mie_scattering) const;
+  Luminance3 GetSkyLuminanceFromViewRayTerms(
+      const Position& camera_in_atmosphere, const Direction& view_ray,
+      Length r, Number mu, bool ray_r_mu_intersects_ground,
+      const Direction& sun_direction) const;
+
+  // The textures precomputed by InitSensitivities, and their derivatives with
+  // respect to each parameter.
+  struct Sensitivities {
+    AtmosphereParameters atmosphere;
+    std::vector<Parameter> parameters;
+    std::unique_ptr<TransmittanceTexture> transmittance_texture;
+    std::unique_ptr<ReducedScatteringTexture> scattering_texture;
+    std::unique_ptr<ReducedScatteringTexture> single_mie_scattering_texture;
+    std::unique_ptr<IrradianceTexture> irradiance_texture;
+    std::vector<std::unique_ptr<TransmittanceTexture>>
+        transmittance_derivatives;
+    std::vector<std::unique_ptr<ReducedScatteringTexture>>
+        scattering_derivatives;
+    std::vector<std::unique_ptr<ReducedScatteringTexture>>
+        single_mie_scattering_derivatives;
+    std::vector<std::unique_ptr<IrradianceTexture>> irradiance_derivatives;
+  };
+
+  AtmosphereParameters atmosphere_;
   const std::string cache_directory_;
+  const std::int64_t max_cache_size_;
   std::unique_ptr<TransmittanceTexture> transmittance_texture_;
   std::unique_ptr<ReducedScatteringTexture> scattering_texture_;
   std::unique_ptr<ReducedScatteringTexture> single_mie_scattering_texture_;
   std::unique_ptr<IrradianceTexture> irradiance_texture_;
+
+  const bool precompute_luminance_;
+  const TextureLayout scattering_texture_layout_;
+  Illuminance3 solar_illuminance_;
+  std::unique_ptr<ReducedScatteringLuminanceTexture>
+      luminance_scattering_texture_;
+  std::unique_ptr<ReducedScatteringLuminanceTexture>
+      luminance_single_mie_scattering_texture_;
+  std::unique_ptr<IrradianceLuminanceTexture> luminance_irradiance_texture_;
+
+  std::unique_ptr<Sensitivities> sensitivities_;
+
+  // The precomputation started with InitAsync, if it is running.
+  InitTask* init_task_;
+  // Whether a precomputation started with Init, InitProgressive or InitAsync
+  // is running, protected by init_mutex_.
+  bool init_running_;
+  std::mutex init_mutex_;
+  // Whether the textures have been completely precomputed, by the last call
+  // to Init, InitProgressive or InitAsync.
+  bool initialized_;
 };
 
 }  // namespace reference
@@ -64,12 +64,26 @@ model definitions:
 #include <glad/glad.h>
 #include <GL/freeglut.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <fstream>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "atmosphere/cpu/model.h"
+#include "atmosphere/grid_bundle.h"
 #include "atmosphere/model.h"
+#include "atmosphere/reference/aerial_perspective.h"
 #include "atmosphere/reference/definitions.h"
+#include "atmosphere/reference/environment_map.h"
+#include "atmosphere/reference/functions.h"
+#include "atmosphere/reference/mesh_irradiance.h"
+#include "atmosphere/reference/sky_view.h"
+#include "atmosphere/reference/solar_time_series.h"
 #include "minpng/minpng.h"
 #include "test/test_case.h"
 #include "util/progress_bar.h"
@@ -184,6 +198,27 @@ void WritePngArgb(const std::string& name, void* pixels) {
   write_png((std::string(kOutputDir) + name).c_str(), pixels, kWidth, kHeight);
 }
 
+/*
+<p>Some test cases compare two methods for many view directions and sun
+directions, which they get with the following functions. The first one returns
+the i-th of n directions on a spiral, whose zenith angle increases from 0 to
+<code>max_theta</code>, and whose azimuth winds 37 times around the zenith
+axis. The second one returns the i-th of n sun directions in the x-z plane,
+whose zenith angle decreases from $\pi$ to 0:
+*/
+
+Direction GetTestDirection(unsigned int i, unsigned int n,
+    double max_theta = PI) {
+  const double theta = max_theta * (i + 0.5) / n;
+  const double phi = 37.0 * theta;
+  return Direction(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+}
+
+Direction GetTestSunDirection(unsigned int i, unsigned int n) {
+  const double sun_theta = PI * (n - i - 0.5) / n;
+  return Direction(sin(sun_theta), 0.0, cos(sun_theta));
+}
+
 }  // anonymous namespace
 
 /*
@@ -379,6 +414,22 @@ provide a separate method to initialize it:
       }
     }
 
+    model_.reset(NewModel<atmosphere::Model>(
+        precomputed_luminance ? 15 : 3 /* num_computed_wavelengths */,
+        combine_textures,
+        true /* half_precision */));
+    model_->Init();
+    glutSwapBuffers();
+  }
+
+/*
+<p>where the following helper method creates a GPU model, or an <a href=
+"../cpu/model.h.html">RGB CPU model</a>, with our atmosphere parameters (the
+constructor arguments specific to each model type are passed as is):
+*/
+
+  template<typename T, typename... Args>
+  T* NewModel(Args... model_specific_args) {
     std::vector<double> wavelengths;
     const auto& spectrum = atmosphere_parameters_.solar_irradiance;
     for (unsigned int i = 0; i < spectrum.size(); ++i) {
@@ -389,7 +440,7 @@ provide a separate method to initialize it:
           layer.exp_term(), layer.exp_scale.to(1.0 / m),
           layer.linear_term.to(1.0 / m), layer.constant_term());
     };
-    model_.reset(new atmosphere::Model(
+    return new T(
         wavelengths,
         atmosphere_parameters_.solar_irradiance.to(
             watt_per_square_meter_per_nm),
@@ -408,11 +459,7 @@ provide a separate method to initialize it:
         atmosphere_parameters_.ground_albedo.to(Number::Unit()),
         acos(atmosphere_parameters_.mu_s_min()),
         kLengthUnit.to(m),
-        precomputed_luminance ? 15 : 3 /* num_computed_wavelengths */,
-        combine_textures,
-        true /* half_precision */));
-    model_->Init();
-    glutSwapBuffers();
+        model_specific_args...);
   }
 
 /*
@@ -420,12 +467,24 @@ provide a separate method to initialize it:
 a separate method to initialize it:
 */
 
-  void InitCpuModel() {
-    reference_model_.reset(
-        new reference::Model(atmosphere_parameters_, "output/"));
+  void InitCpuModel(bool precompute_luminance = false) {
+    reference_model_.reset(new reference::Model(
+        atmosphere_parameters_, "output/", precompute_luminance));
     reference_model_->Init();
   }
 
+/*
+<p>Some test cases use the <a href="../cpu/model.h.html">RGB CPU model</a>
+instead of the full spectral CPU model. If it is initialized, with the
+following method, it is used instead of the latter to render CPU images:
+*/
+
+  void InitRgbCpuModel(bool combine_textures) {
+    rgb_model_.reset(NewModel<atmosphere::cpu::Model>(
+        3 /* num_computed_wavelengths */, combine_textures));
+    rgb_model_->Init();
+  }
+
 /*
 <p>Finally, before rendering an image with the GPU or CPU model, we must
 initialize the camera (position, transform matrix, exposure) and the sun
@@ -485,6 +544,7 @@ allocated during the test:
   void TearDown() override {
     model_ = nullptr;
     reference_model_ = nullptr;
+    rgb_model_ = nullptr;
     if (program_) {
      glDeleteProgram(program_);
     }
@@ -573,31 +633,7 @@ with the GPU program, and then read back the framebuffer pixels.
     InitShader();
 
     glViewport(0, 0, kWidth, kHeight);
-    {
-      GLuint full_screen_quad_vao;
-      glGenVertexArrays(1, &full_screen_quad_vao);
-      glBindVertexArray(full_screen_quad_vao);
-      GLuint full_screen_quad_vbo;
-      glGenBuffers(1, &full_screen_quad_vbo);
-      glBindBuffer(GL_ARRAY_BUFFER, full_screen_quad_vbo);
-      const GLfloat vertices[] = {
-        -1.0, -1.0, 0.0, 1.0,
-        +1.0, -1.0, 0.0, 1.0,
-        -1.0, +1.0, 0.0, 1.0,
-        +1.0, +1.0, 0.0, 1.0,
-      };
-      glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices, GL_STATIC_DRAW);
-      constexpr GLuint kAttribIndex = 0;
-      constexpr int kCoordsPerVertex = 4;
-      glVertexAttribPointer(kAttribIndex, kCoordsPerVertex, GL_FLOAT,
-                            false, 0, 0);
-      glEnableVertexAttribArray(kAttribIndex);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
-      glDeleteBuffers(1, &full_screen_quad_vbo);
-      glBindVertexArray(0);
-      glDeleteVertexArrays(1, &full_screen_quad_vao);
-    }
+    DrawFullScreenQuad();
     glutSwapBuffers();
 
     std::unique_ptr<unsigned char[]> gl_pixels(
@@ -619,6 +655,37 @@ with the GPU program, and then read back the framebuffer pixels.
     return pixels;
   }
 
+/*
+<p>where the full screen quad is drawn with the following method (also used
+below, to test the textures baked by the GPU model):
+*/
+
+  void DrawFullScreenQuad() {
+    GLuint full_screen_quad_vao;
+    glGenVertexArrays(1, &full_screen_quad_vao);
+    glBindVertexArray(full_screen_quad_vao);
+    GLuint full_screen_quad_vbo;
+    glGenBuffers(1, &full_screen_quad_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, full_screen_quad_vbo);
+    const GLfloat vertices[] = {
+      -1.0, -1.0, 0.0, 1.0,
+      +1.0, -1.0, 0.0, 1.0,
+      -1.0, +1.0, 0.0, 1.0,
+      +1.0, +1.0, 0.0, 1.0,
+    };
+    glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices, GL_STATIC_DRAW);
+    constexpr GLuint kAttribIndex = 0;
+    constexpr int kCoordsPerVertex = 4;
+    glVertexAttribPointer(kAttribIndex, kCoordsPerVertex, GL_FLOAT,
+                          false, 0, 0);
+    glEnableVertexAttribArray(kAttribIndex);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDeleteBuffers(1, &full_screen_quad_vbo);
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &full_screen_quad_vao);
+  }
+
 /*
 <p>In order to render an image with the CPU model, we must first provide its
 CPU implementation. For this, as for the unit tests of the GPU model, we simply
@@ -630,12 +697,27 @@ end of this file):
 */
 
   RadianceSpectrum GetSolarRadiance() {
+    if (rgb_model_) {
+      return ToSpectrum<RadianceSpectrum>(rgb_model_->GetSolarRadiance(),
+          watt_per_square_meter_per_sr_per_nm);
+    }
     return reference_model_->GetSolarRadiance();
   }
 
   RadianceSpectrum GetSkyRadiance(Position camera, Direction view_ray,
       Length shadow_length, Direction sun_direction,
       DimensionlessSpectrum& transmittance) {
+    if (rgb_model_) {
+      atmosphere::cpu::vec3 rgb_transmittance;
+      RadianceSpectrum radiance = ToSpectrum<RadianceSpectrum>(
+          rgb_model_->GetSkyRadiance(ToVec3(camera), ToVec3(view_ray),
+              shadow_length.to(kLengthUnit), ToVec3(sun_direction),
+              &rgb_transmittance),
+          watt_per_square_meter_per_sr_per_nm);
+      transmittance =
+          ToSpectrum<DimensionlessSpectrum>(rgb_transmittance, Number::Unit());
+      return radiance;
+    }
     return reference_model_->GetSkyRadiance(
         camera, view_ray, shadow_length, sun_direction, &transmittance);
   }
@@ -643,16 +725,59 @@ end of this file):
   RadianceSpectrum GetSkyRadianceToPoint(Position camera, Position point,
       Length shadow_length, Direction sun_direction,
       DimensionlessSpectrum& transmittance) {
+    if (rgb_model_) {
+      atmosphere::cpu::vec3 rgb_transmittance;
+      RadianceSpectrum radiance = ToSpectrum<RadianceSpectrum>(
+          rgb_model_->GetSkyRadianceToPoint(ToVec3(camera), ToVec3(point),
+              shadow_length.to(kLengthUnit), ToVec3(sun_direction),
+              &rgb_transmittance),
+          watt_per_square_meter_per_sr_per_nm);
+      transmittance =
+          ToSpectrum<DimensionlessSpectrum>(rgb_transmittance, Number::Unit());
+      return radiance;
+    }
     return reference_model_->GetSkyRadianceToPoint(
         camera, point, shadow_length, sun_direction, &transmittance);
   }
 
   IrradianceSpectrum GetSunAndSkyIrradiance(Position point, Direction normal,
       Direction sun_direction, IrradianceSpectrum& sky_irradiance) {
+    if (rgb_model_) {
+      atmosphere::cpu::vec3 rgb_sky_irradiance;
+      IrradianceSpectrum sun_irradiance = ToSpectrum<IrradianceSpectrum>(
+          rgb_model_->GetSunAndSkyIrradiance(ToVec3(point), ToVec3(normal),
+              ToVec3(sun_direction), &rgb_sky_irradiance),
+          watt_per_square_meter_per_nm);
+      sky_irradiance = ToSpectrum<IrradianceSpectrum>(
+          rgb_sky_irradiance, watt_per_square_meter_per_nm);
+      return sun_irradiance;
+    }
     return reference_model_->GetSunAndSkyIrradiance(
         point, normal, sun_direction, &sky_irradiance);
   }
 
+/*
+<p>where the conversions between the RGB CPU model values and the dimensional
+types are done with the following helpers (the spectra returned by
+<code>ToSpectrum</code> are exact at the 3 wavelengths used for rendering, which
+is all we need since the RGB model is only used in radiance test cases):
+*/
+
+  static atmosphere::cpu::vec3 ToVec3(const Position& p) {
+    return atmosphere::cpu::vec3(p.x.to(kLengthUnit), p.y.to(kLengthUnit),
+        p.z.to(kLengthUnit));
+  }
+
+  static atmosphere::cpu::vec3 ToVec3(const Direction& d) {
+    return atmosphere::cpu::vec3(d.x(), d.y(), d.z());
+  }
+
+  template<typename S, typename U>
+  static S ToSpectrum(const atmosphere::cpu::vec3& rgb, const U& unit) {
+    return S({kLambdaB, kLambdaG, kLambdaR},
+        {rgb.z * unit, rgb.y * unit, rgb.x * unit});
+  }
+
 #define OUT(x) x&
 #include "atmosphere/reference/model_test.glsl"
 
@@ -787,6 +912,30 @@ returns the computed PSNR.
     return psnr;
   }
 
+/*
+<p>The test cases comparing two methods which should give the same spectra, up
+to rounding errors, use the following methods. They check that the two spectra
+are equal at the 3 predefined wavelengths, up to a relative error of
+$10^{-9}$ (or an absolute error of $10^{-9}$ for dimensionless spectra):
+*/
+
+  template<typename S, typename U>
+  void ExpectNearAtRgbWavelengths(const S& expected, const S& actual,
+      const U& unit) {
+    for (Wavelength lambda : {kLambdaR, kLambdaG, kLambdaB}) {
+      const double expected_value = expected(lambda).to(unit);
+      ExpectNear(expected_value, actual(lambda).to(unit),
+          1e-9 * (1.0 + expected_value));
+    }
+  }
+
+  void ExpectNearAtRgbWavelengths(const DimensionlessSpectrum& expected,
+      const DimensionlessSpectrum& actual) {
+    for (Wavelength lambda : {kLambdaR, kLambdaG, kLambdaB}) {
+      ExpectNear(expected(lambda)(), actual(lambda)(), 1e-9);
+    }
+  }
+
 /*
 <h3 id="cases">Test cases</h3>
 
@@ -1063,10 +1212,10 @@ XYZ and then to sRGB only at the very end).
   }
 
 /*
-<p>The last test case compares the sRGB luminance computations, done on GPU
-vs CPU, in a "worst case" situation: combined textures on GPU and a sunset scene
-(leading to large differences in the single Mie component), and wavelength
-dependent albedo values (see the previous test case):
+<p>The following test case compares the sRGB luminance computations, done on
+GPU vs CPU, in a "worst case" situation: combined textures on GPU and a sunset
+scene (leading to large differences in the single Mie component), and
+wavelength dependent albedo values (see the previous test case):
 */
 
   void TestPrecomputedLuminanceCombineTexturesSpectralAlbedoSunSet() {
@@ -1082,6 +1231,1423 @@ dependent albedo values (see the previous test case):
         40.0, Compare(RenderGpuImage(), RenderCpuImage(), kCaption, true));
   }
 
+/*
+<p>The following test case checks that the CPU model reuses its cached
+intermediate results, and still gives correct results with them. For this we
+first initialize a CPU model with the default parameters, which caches all its
+stages (or loads them from the cache). The transmittance, direct irradiance and
+single scattering stages do not depend on the Mie phase function asymmetry
+parameter nor on the ground albedo, so a second CPU model with different values
+for these parameters must load them from the cache, instead of recomputing them
+(which is checked with the progress notifications, sent only for the computed
+stages). Its multiple scattering orders are recomputed (or loaded from a
+previous run of this test case), and we thus expect the same results as with a
+GPU model using these new parameter values:
+*/
+
+  void TestCachedStages() {
+    const std::string kCaption = "Left: GPU model, combine_textures = false. "
+        "Right: CPU model, with cached intermediate results. Both images show "
+        "the spectral radiance at 3 predefined wavelengths.";
+    InitCpuModel();
+    atmosphere_parameters_.mie_phase_function_g = 0.7;
+    atmosphere_parameters_.ground_albedo = DimensionlessSpectrum(0.3);
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    reference_model_.reset(
+        new reference::Model(atmosphere_parameters_, "output/"));
+    bool single_scattering_stages_computed = false;
+    reference::Model::InitOptions options;
+    options.progress_callback =
+        [&](const reference::Model::InitProgress& progress) {
+      if (progress.scattering_order <= 1) {
+        single_scattering_stages_computed = true;
+      }
+    };
+    ExpectTrue(reference_model_->InitAsync(options).get());
+    ExpectFalse(single_scattering_stages_computed);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    ExpectLess(
+        47.0, Compare(RenderGpuImage(), RenderCpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case checks that the first order update of the CPU model
+textures, for a 10% increase of the Mie density, gives almost the same results
+as a CPU model precomputed with this increased density. The differences come
+from the second order terms, and from the finite differences used to compute
+the derivatives. It also checks that the derivatives can not be computed before
+the model is initialized:
+*/
+
+  void TestSensitivities() {
+    reference_model_.reset(
+        new reference::Model(atmosphere_parameters_, "output/"));
+    bool uninitialized_model_rejected = false;
+    try {
+      reference_model_->InitSensitivities(
+          {reference::Model::Parameter::MIE_DENSITY_SCALE});
+    } catch (const std::logic_error&) {
+      uninitialized_model_rejected = true;
+    }
+    ExpectTrue(uninitialized_model_rejected);
+
+    const std::string kCaption = "Left: CPU model, precomputed with a 10% "
+        "larger Mie density. Right: CPU model, with the first order update of "
+        "its textures for this Mie density change. Both images show the "
+        "spectral radiance at 3 predefined wavelengths.";
+    const AtmosphereParameters atmosphere_parameters = atmosphere_parameters_;
+    atmosphere_parameters_.mie_scattering =
+        atmosphere_parameters.mie_scattering * (1.1 * Number::Unit());
+    atmosphere_parameters_.mie_extinction =
+        atmosphere_parameters.mie_extinction * (1.1 * Number::Unit());
+    InitCpuModel();
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderCpuImage();
+
+    atmosphere_parameters_ = atmosphere_parameters;
+    InitCpuModel();
+    reference_model_->InitSensitivities(
+        {reference::Model::Parameter::MIE_DENSITY_SCALE});
+    reference_model_->ApplySensitivities({0.1});
+    ExpectLess(50.0,
+        Compare(std::move(expected), RenderCpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case checks that a GPU model precomputed with a unit
+solar irradiance, and rescaled at runtime with the actual solar irradiance
+(with the <code>runtime_solar_irradiance</code> option), gives the same results
+as a GPU model precomputed with the actual solar irradiance. We use the
+precomputed luminance mode, where the textures precomputed for each group of
+wavelengths must be combined again when the solar irradiance changes. The only
+differences come from the half precision textures:
+*/
+
+  void TestRuntimeSolarIrradiance() {
+    const std::string kCaption = "Left: GPU model, precomputed with the solar "
+        "irradiance. Right: GPU model, precomputed with a unit solar "
+        "irradiance and rescaled at runtime. Both images show the sRGB "
+        "luminance (using 15 wavelengths).";
+    InitGpuModel(true /* combine_textures */,
+        true /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, true /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    model_.reset(NewModel<atmosphere::Model>(
+        15 /* num_computed_wavelengths */,
+        true /* combine_textures */,
+        true /* half_precision */,
+        atmosphere::TextureSizes(),
+        true /* runtime_solar_irradiance */));
+    model_->Init();
+    const std::vector<double> solar_irradiance =
+        atmosphere_parameters_.solar_irradiance.to(
+            watt_per_square_meter_per_nm);
+    model_->SetSolarIrradiance(
+        std::vector<double>(solar_irradiance.size(), 1.5));
+    model_->SetSolarIrradiance(solar_irradiance);
+    ExpectLess(50.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, true));
+  }
+
+/*
+<p>The following test case checks that a GPU model precomputed for several
+uniform ground albedo values, and combined at runtime for the actual ground
+albedo (with the <code>runtime_ground_albedo</code> option), gives the same
+results as a GPU model precomputed with the actual ground albedo. The only
+differences come from the half precision textures:
+*/
+
+  void TestRuntimeGroundAlbedo() {
+    const std::string kCaption = "Left: GPU model, precomputed with the ground "
+        "albedo. Right: GPU model, precomputed for several ground albedo "
+        "values and combined at runtime. Both images show the spectral "
+        "radiance at 3 predefined wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    model_.reset(NewModel<atmosphere::Model>(
+        3 /* num_computed_wavelengths */,
+        false /* combine_textures */,
+        true /* half_precision */,
+        atmosphere::TextureSizes(),
+        false /* runtime_solar_irradiance */,
+        true /* runtime_ground_albedo */));
+    model_->Init();
+    const std::vector<double> ground_albedo =
+        atmosphere_parameters_.ground_albedo.to(Number::Unit());
+    model_->SetGroundAlbedo(std::vector<double>(ground_albedo.size(), 0.8));
+    model_->SetGroundAlbedo(ground_albedo);
+    ExpectLess(50.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case checks that a GPU model precomputed with
+<code>Update</code>, from a previous model with a 20% different Mie scattering
+and ozone absorption, gives almost the same results as a GPU model precomputed
+with <code>Init</code>. The differences come from the half precision textures,
+and from the error of the previous multiple scattering which remains after one
+correction iteration (several times smaller than the difference between the
+two atmospheres):
+*/
+
+  void TestWarmStartedUpdate() {
+    const std::string kCaption = "Left: GPU model, precomputed with Init. "
+        "Right: GPU model, precomputed with Update from a model with a "
+        "different Mie scattering and ozone absorption. Both images show the "
+        "spectral radiance at 3 predefined wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    const AtmosphereParameters atmosphere_parameters = atmosphere_parameters_;
+    atmosphere_parameters_.mie_scattering =
+        atmosphere_parameters.mie_scattering * (1.2 * Number::Unit());
+    atmosphere_parameters_.mie_extinction =
+        atmosphere_parameters.mie_extinction * (1.2 * Number::Unit());
+    atmosphere_parameters_.absorption_extinction =
+        atmosphere_parameters.absorption_extinction * (0.8 * Number::Unit());
+    std::unique_ptr<atmosphere::Model> previous_model(
+        NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+            false /* combine_textures */, true /* half_precision */));
+    previous_model->Init();
+    atmosphere_parameters_ = atmosphere_parameters;
+
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */));
+    model_->Update(*previous_model);
+    ExpectLess(50.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case does the same with the <a href=
+"../cpu/model.h.html">RGB CPU model</a>. It also checks that a second
+<code>Update</code> from the same previous model, which reuses the corrections
+computed and cached in this model by the first one, gives exactly the same
+results as the first one:
+*/
+
+  void TestRgbCpuModelWarmStartedUpdate() {
+    const std::string kCaption = "Left: RGB CPU model, precomputed with Init. "
+        "Right: RGB CPU model, precomputed with Update from a model with a "
+        "different Mie scattering and ozone absorption. Both images show the "
+        "spectral radiance at 3 predefined wavelengths.";
+    InitRgbCpuModel(false /* combine_textures */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderCpuImage();
+
+    const AtmosphereParameters atmosphere_parameters = atmosphere_parameters_;
+    atmosphere_parameters_.mie_scattering =
+        atmosphere_parameters.mie_scattering * (1.2 * Number::Unit());
+    atmosphere_parameters_.mie_extinction =
+        atmosphere_parameters.mie_extinction * (1.2 * Number::Unit());
+    atmosphere_parameters_.absorption_extinction =
+        atmosphere_parameters.absorption_extinction * (0.8 * Number::Unit());
+    std::unique_ptr<atmosphere::cpu::Model> previous_model(
+        NewModel<atmosphere::cpu::Model>(3 /* num_computed_wavelengths */,
+            false /* combine_textures */));
+    previous_model->Init();
+    atmosphere_parameters_ = atmosphere_parameters;
+
+    rgb_model_.reset(NewModel<atmosphere::cpu::Model>(
+        3 /* num_computed_wavelengths */, false /* combine_textures */));
+    rgb_model_->Update(*previous_model);
+    Image first_update = RenderCpuImage();
+    rgb_model_.reset(NewModel<atmosphere::cpu::Model>(
+        3 /* num_computed_wavelengths */, false /* combine_textures */));
+    rgb_model_->Update(*previous_model);
+    Image second_update = RenderCpuImage();
+
+    unsigned int num_different_pixels = 0;
+    for (unsigned int i = 0; i < kWidth * kHeight; ++i) {
+      if (first_update[i] != second_update[i]) {
+        ++num_different_pixels;
+      }
+    }
+    ExpectEquals(0u, num_different_pixels);
+    ExpectLess(50.0,
+        Compare(std::move(expected), std::move(first_update), kCaption, false));
+  }
+
+/*
+<p>The following test case checks that a GPU model obtained with
+<code>Blend</code>, from models precomputed on a 2x3 grid of Mie scattering and
+ozone absorption values, with 20% and 40% steps around ours, gives almost the
+same results as a GPU model precomputed with <code>Init</code>. It also checks
+that the same is true with the textures interpolated from a <a href=
+"../grid_bundle.h.html">grid bundle</a> containing the textures of these grid
+models. The differences come from the half precision textures, and from the
+multilinear interpolation:
+*/
+
+  void TestParameterGridBlend() {
+    const std::string kCaption = "Left: GPU model, precomputed with Init. "
+        "Right: GPU model, interpolated between models precomputed on a grid "
+        "of Mie scattering and ozone absorption values. Both images show the "
+        "spectral radiance at 3 predefined wavelengths.";
+    const std::string kBundleCaption = "Left: GPU model, precomputed with "
+        "Init. Right: GPU model, with textures interpolated from a grid "
+        "bundle. Both images show the spectral radiance at 3 predefined "
+        "wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+    Image bundle_expected(new unsigned int[kWidth * kHeight]);
+    std::copy(expected.get(), expected.get() + kWidth * kHeight,
+        bundle_expected.get());
+
+    const AtmosphereParameters atmosphere_parameters = atmosphere_parameters_;
+    const atmosphere::ParameterGrid grid({{0.8, 1.2}, {0.4, 0.8, 1.2}});
+    const std::string bundle_filename =
+        std::string(kOutputDir) + "grid_bundle.dat";
+    std::vector<std::unique_ptr<atmosphere::Model>> grid_models;
+    atmosphere::GridBundle::Write(bundle_filename, grid,
+        atmosphere::TextureSizes(), false /* combine_scattering_textures */,
+        [&](const std::vector<double>& point,
+            atmosphere::PrecomputedTextures* textures) {
+      atmosphere_parameters_.mie_scattering =
+          atmosphere_parameters.mie_scattering * (point[0] * Number::Unit());
+      atmosphere_parameters_.mie_extinction =
+          atmosphere_parameters.mie_extinction * (point[0] * Number::Unit());
+      atmosphere_parameters_.absorption_extinction =
+          atmosphere_parameters.absorption_extinction *
+          (point[1] * Number::Unit());
+      grid_models.emplace_back(NewModel<atmosphere::Model>(
+          3 /* num_computed_wavelengths */, false /* combine_textures */,
+          true /* half_precision */));
+      grid_models.back()->Init();
+      grid_models.back()->GetTextures(textures);
+    });
+    atmosphere_parameters_ = atmosphere_parameters;
+
+    std::vector<unsigned int> indices;
+    std::vector<double> weights;
+    grid.GetBlendWeights({1.0, 1.0}, &indices, &weights);
+    std::vector<const atmosphere::Model*> models;
+    for (unsigned int index : indices) {
+      models.push_back(grid_models[index].get());
+    }
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */));
+    model_->Blend(models, weights);
+    ExpectLess(50.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, false));
+
+    grid_models.clear();
+    const atmosphere::GridBundle bundle(bundle_filename);
+    atmosphere::PrecomputedTextures textures;
+    bundle.Blend({1.0, 1.0}, &textures);
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */));
+    model_->SetTextures(textures);
+    ExpectLess(50.0, Compare(std::move(bundle_expected), RenderGpuImage(),
+        kBundleCaption, false));
+  }
+
+/*
+<p>The following test case checks that a GPU model precomputed with
+<code>InitApproximate</code> gives results close to those of a GPU model
+precomputed with <code>Init</code>. The differences come from the isotropic
+approximation of the multiple scattering, and are thus larger than in the
+previous tests (but the precomputations are more than 10 times faster):
+*/
+
+  void TestApproximateMultipleScattering() {
+    const std::string kCaption = "Left: GPU model, precomputed with Init. "
+        "Right: GPU model, precomputed with InitApproximate. Both images show "
+        "the spectral radiance at 3 predefined wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */));
+    model_->InitApproximate();
+    ExpectLess(40.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case checks that a GPU model precomputed with
+<code>BeginInit</code> and several <code>Step</code> calls gives the same
+results as a GPU model precomputed with <code>Init</code> (the passes being the
+same, the only differences could come from a wrong order of the passes, or from
+GL state changes between them):
+*/
+
+  void TestTimeSlicedInit() {
+    const std::string kCaption = "Left: GPU model, precomputed with Init. "
+        "Right: GPU model, precomputed with BeginInit and Step. Both images "
+        "show the spectral radiance at 3 predefined wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */));
+    model_->BeginInit();
+    // Blending is enabled between the steps, as it could be by the rendering
+    // code of an application, to check that the passes do not depend on the
+    // GL state left by the previous ones.
+    while (!model_->Step(5.0 /* budget_ms */)) {
+      glEnable(GL_BLEND);
+    }
+    glDisable(GL_BLEND);
+    ExpectLess(50.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case checks that a GPU model precomputed with
+<code>InitProgressive</code> can be used, before the end of its full resolution
+precomputation, with the coarse textures resampled at full resolution. The
+resulting image must be close to the one obtained with <code>Init</code> (but
+not as close as with full resolution textures, hence the lower threshold). It
+also checks that, after the last <code>Step</code>, the full resolution
+textures give the same results as <code>Init</code>:
+*/
+
+  void TestProgressiveInit() {
+    const std::string kCaption = "Left: GPU model, precomputed with Init. "
+        "Right: GPU model, precomputed with InitProgressive and Step. Both "
+        "images show the spectral radiance at 3 predefined wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */));
+    model_->InitProgressive(
+        atmosphere::TextureSizes(64, 16, 8, 32, 8, 8, 16, 4));
+    Image coarse = RenderGpuImage();
+    ExpectLess(35.0, ComputePSNR(expected.get(), coarse.get()));
+    while (!model_->Step(5.0 /* budget_ms */)) {}
+    ExpectLess(50.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, false));
+  }
+
+/*
+<p>Likewise, the following test case checks that a CPU model precomputed with
+<code>InitProgressive</code> can be used from its callback, with the coarse
+textures, and that it gives the same results as the GPU model at the end of
+this method. It uses a cache directory which does not exist, so that the coarse
+precomputation is not skipped because of the stages cached by the previous
+tests (nothing is saved in this directory either):
+*/
+
+  void TestProgressiveCpuInit() {
+    const std::string kCaption = "Left: GPU model, combine_textures = false. "
+        "Right: CPU model, precomputed with InitProgressive. Both images show "
+        "the spectral radiance at 3 predefined wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    reference_model_.reset(new reference::Model(
+        atmosphere_parameters_, std::string(kOutputDir) + "no_cache/"));
+    Image coarse;
+    reference_model_->InitProgressive([&]() { coarse = RenderCpuImage(); });
+    ExpectTrue(coarse != nullptr);
+    ExpectLess(35.0, ComputePSNR(RenderGpuImage().get(), coarse.get()));
+    ExpectLess(
+        47.0, Compare(RenderGpuImage(), RenderCpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case checks that a GPU model with non default texture
+sizes (half of the default ones, except for the nu size of the scattering
+texture) gives almost the same results as a GPU model with the default sizes
+(the differences come from the lower texture resolution):
+*/
+
+  void TestNonDefaultTextureSizes() {
+    const std::string kCaption = "Left: GPU model, default texture sizes. "
+        "Right: GPU model, half texture sizes. Both images show the spectral "
+        "radiance at 3 predefined wavelengths.";
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    Image expected = RenderGpuImage();
+
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */,
+        atmosphere::TextureSizes(128, 32, 16, 64, 16, 8, 32, 8)));
+    model_->Init();
+    ExpectLess(40.0,
+        Compare(std::move(expected), RenderGpuImage(), kCaption, false));
+  }
+
+/*
+<p>and the following one checks that invalid texture sizes are rejected, both
+by the constructor and by <code>InitProgressive</code>:
+*/
+
+  void TestInvalidTextureSizes() {
+    const atmosphere::TextureSizes kInvalidSizes[] = {
+      atmosphere::TextureSizes(1, 64, 32, 128, 32, 8, 64, 16),
+      atmosphere::TextureSizes(256, 64, 1, 128, 32, 8, 64, 16),
+      atmosphere::TextureSizes(256, 64, 32, 2, 32, 8, 64, 16),
+      atmosphere::TextureSizes(256, 64, 32, 127, 32, 8, 64, 16),
+      atmosphere::TextureSizes(256, 64, 32, 128, 32, 1, 64, 16),
+      atmosphere::TextureSizes(256, 64, 32, 128, 32, 8, 64, 0)
+    };
+    for (const atmosphere::TextureSizes& texture_sizes : kInvalidSizes) {
+      bool rejected = false;
+      try {
+        std::unique_ptr<atmosphere::Model> model(
+            NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+                false /* combine_textures */, true /* half_precision */,
+                texture_sizes));
+      } catch (const std::invalid_argument&) {
+        rejected = true;
+      }
+      ExpectTrue(rejected);
+    }
+
+    model_.reset(NewModel<atmosphere::Model>(3 /* num_computed_wavelengths */,
+        false /* combine_textures */, true /* half_precision */));
+    for (const atmosphere::TextureSizes& texture_sizes : kInvalidSizes) {
+      bool rejected = false;
+      try {
+        model_->InitProgressive(texture_sizes);
+      } catch (const std::invalid_argument&) {
+        rejected = true;
+      }
+      ExpectTrue(rejected);
+    }
+  }
+
+/*
+<p>The following test cases check that the sky view texture and the aerial
+perspective volume baked by the GPU model contain the values computed by its
+<code>GetSkyRadiance</code> and <code>GetSkyRadianceToPoint</code> GLSL
+functions, at a few texel centers. These values are read back from a 1x1
+framebuffer, rendered with a program created by the following method (the
+reference values are computed with <code>GetSkyRadianceToPoint</code> if the
+<code>to_point</code> uniform is true, and with <code>GetSkyRadiance</code>
+otherwise):
+*/
+
+  void InitSkyRadianceShader() {
+    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    const char* const vertex_shader_source = kVertexShader;
+    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
+    glCompileShader(vertex_shader);
+
+    const char* const fragment_shader_source = R"(
+        #version 330
+        uniform vec3 camera;
+        uniform vec3 direction;
+        uniform float distance;
+        uniform vec3 sun_direction;
+        uniform bool to_point;
+        layout(location = 0) out vec3 radiance;
+        layout(location = 1) out vec3 transmittance;
+        vec3 GetSkyRadiance(vec3 camera, vec3 view_ray, float shadow_length,
+            vec3 sun_direction, out vec3 transmittance);
+        vec3 GetSkyRadianceToPoint(vec3 camera, vec3 point,
+            float shadow_length, vec3 sun_direction, out vec3 transmittance);
+        void main() {
+          if (to_point) {
+            radiance = GetSkyRadianceToPoint(camera,
+                camera + direction * distance, 0.0, sun_direction,
+                transmittance);
+          } else {
+            radiance = GetSkyRadiance(camera, direction, 0.0, sun_direction,
+                transmittance);
+          }
+        })";
+    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
+    glCompileShader(fragment_shader);
+
+    if (program_) {
+      glDeleteProgram(program_);
+    }
+    program_ = glCreateProgram();
+    glAttachShader(program_, vertex_shader);
+    glAttachShader(program_, fragment_shader);
+    glAttachShader(program_, model_->shader());
+    glLinkProgram(program_);
+    glDetachShader(program_, vertex_shader);
+    glDetachShader(program_, fragment_shader);
+    glDetachShader(program_, model_->shader());
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    glUseProgram(program_);
+    model_->SetProgramUniforms(program_, 0, 1, 2, 3);
+  }
+
+/*
+<p>The sky radiance (and transmittance) from <code>camera</code> in direction
+<code>view_ray</code> is then computed with this program as follows (the
+<code>distance</code> argument is only used if <code>to_point</code> is true):
+*/
+
+  void ComputeGpuSkyRadiance(const Position& camera, const Direction& view_ray,
+      bool to_point, Length distance, const Direction& sun_direction,
+      float radiance[3], float transmittance[3]) {
+    glUseProgram(program_);
+    glUniform3f(glGetUniformLocation(program_, "camera"),
+        camera.x.to(kLengthUnit),
+        camera.y.to(kLengthUnit),
+        camera.z.to(kLengthUnit));
+    glUniform3f(glGetUniformLocation(program_, "direction"),
+        view_ray.x(), view_ray.y(), view_ray.z());
+    glUniform1f(glGetUniformLocation(program_, "distance"),
+        distance.to(kLengthUnit));
+    glUniform3f(glGetUniformLocation(program_, "sun_direction"),
+        sun_direction.x(), sun_direction.y(), sun_direction.z());
+    glUniform1i(glGetUniformLocation(program_, "to_point"), to_point);
+
+    GLuint renderbuffers[2];
+    glGenRenderbuffers(2, renderbuffers);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    for (unsigned int i = 0; i < 2; ++i) {
+      glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[i]);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, 1, 1);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+          GL_RENDERBUFFER, renderbuffers[i]);
+    }
+    const GLenum kDrawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, kDrawBuffers);
+    glViewport(0, 0, 1, 1);
+    DrawFullScreenQuad();
+
+    float rgba[4];
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, rgba);
+    std::copy(rgba, rgba + 3, radiance);
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, rgba);
+    std::copy(rgba, rgba + 3, transmittance);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(2, renderbuffers);
+  }
+
+/*
+<p>The first test case bakes a small sky view texture, with the Sun direction
+in the xz plane (so that, as in <code>ComputeSkyViewTexture</code>, the view
+ray of each texel is directly given by its azimuth and zenith angles), and
+compares some of its texels with the corresponding <code>GetSkyRadiance</code>
+values. Both are computed by the same GLSL code, with single precision floats,
+hence the small tolerance. The horizon texels are skipped, because the radiance
+is discontinuous at the horizon, and the view rays computed here and in the
+baking shader differ by rounding errors:
+*/
+
+  void TestGpuSkyViewTexture() {
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    const Position camera(0.0 * m, 0.0 * m,
+        atmosphere_parameters_.bottom_radius + 1.0 * km);
+    const Direction sun_direction(0.8, 0.0, 0.6);
+    constexpr int kWidth = 8;
+    constexpr int kHeight = 9;
+    model_->BakeSkyView({{camera.x.to(kLengthUnit), camera.y.to(kLengthUnit),
+        camera.z.to(kLengthUnit)}}, {{0.8, 0.0, 0.6}}, kWidth, kHeight);
+
+    InitSkyRadianceShader();
+    model_->SetSkyViewUniforms(program_, 4);
+    std::vector<float> texels(3 * kWidth * kHeight);
+    glActiveTexture(GL_TEXTURE4);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, texels.data());
+
+    float radiance[3];
+    float transmittance[3];
+    for (int j = 0; j < kHeight; j += 2) {
+      if (j == kHeight / 2) {
+        continue;
+      }
+      for (int i = 0; i < kWidth; i += 3) {
+        const vec2 uv(i / (kWidth - 1.0), j / (kHeight - 1.0));
+        Number mu;
+        Number nu;
+        GetMuNuFromSkyViewUv(atmosphere_parameters_, length(camera), 0.6, uv,
+            mu, nu);
+        const Number sin_theta = sqrt(1.0 - mu * mu);
+        const Angle phi = uv.x * pi;
+        const Direction view_ray(
+            sin_theta * cos(phi), sin_theta * sin(phi), mu);
+        ComputeGpuSkyRadiance(camera, view_ray, false /* to_point */,
+            0.0 * m, sun_direction, radiance, transmittance);
+        for (unsigned int c = 0; c < 3; ++c) {
+          ExpectNear(radiance[c], texels[3 * (i + kWidth * j) + c],
+              1e-3 * radiance[c]);
+        }
+      }
+    }
+  }
+
+/*
+<p>Likewise, the second test case bakes a small aerial perspective volume,
+for a camera looking horizontally with a 90 degrees field of view, and compares
+some of its froxels with the corresponding <code>GetSkyRadianceToPoint</code>
+values, at the froxel centers. The tolerance is larger than above because the
+volume is stored with half precision floats:
+*/
+
+  void TestGpuAerialPerspectiveVolume() {
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    const Position camera(0.0 * m, 0.0 * m,
+        atmosphere_parameters_.bottom_radius + 1.0 * km);
+    const Direction sun_direction(0.0, 0.8, 0.6);
+    const std::array<float, 9> model_from_clip{{
+        1.0, 0.0, 0.0,
+        0.0, 0.0, 1.0,
+        0.0, 1.0, 0.0}};
+    const Length max_distance = 50.0 * km;
+    constexpr int kSize = 8;
+    model_->BakeAerialPerspective({{camera.x.to(kLengthUnit),
+        camera.y.to(kLengthUnit), camera.z.to(kLengthUnit)}},
+        {{0.0, 0.8, 0.6}}, model_from_clip, max_distance.to(kLengthUnit),
+        kSize, kSize, kSize);
+
+    InitSkyRadianceShader();
+    model_->SetAerialPerspectiveUniforms(program_, 4, 5);
+    std::vector<float> scattering(3 * kSize * kSize * kSize);
+    std::vector<float> transmittance(3 * kSize * kSize * kSize);
+    glActiveTexture(GL_TEXTURE4);
+    glGetTexImage(GL_TEXTURE_3D, 0, GL_RGB, GL_FLOAT, scattering.data());
+    glActiveTexture(GL_TEXTURE5);
+    glGetTexImage(GL_TEXTURE_3D, 0, GL_RGB, GL_FLOAT, transmittance.data());
+
+    float expected[3];
+    float expected_transmittance[3];
+    for (int k = 0; k < kSize; k += 3) {
+      for (int j = 0; j < kSize; j += 3) {
+        for (int i = 0; i < kSize; i += 3) {
+          const double u = (i + 0.5) / kSize;
+          const double v = (j + 0.5) / kSize;
+          const double w = (k + 0.5) / kSize;
+          const Direction view_ray =
+              normalize(Direction(2.0 * u - 1.0, 1.0, 2.0 * v - 1.0));
+          ComputeGpuSkyRadiance(camera, view_ray, true /* to_point */,
+              max_distance * w * w, sun_direction, expected,
+              expected_transmittance);
+          const int offset = 3 * (i + kSize * (j + kSize * k));
+          for (unsigned int c = 0; c < 3; ++c) {
+            ExpectNear(expected[c], scattering[offset + c],
+                5e-3 * expected[c]);
+            ExpectNear(expected_transmittance[c], transmittance[offset + c],
+                5e-3);
+          }
+        }
+      }
+    }
+  }
+
+/*
+<p>The following test case checks that a CPU model precomputed with
+<code>InitAsync</code>, after a first asynchronous precomputation cancelled
+during the second scattering order (the previous stages are cached by the
+previous tests), gives the same results as the GPU model. It also checks that
+the progress notifications are monotonic, and end with the last stage:
+*/
+
+  void TestAsyncInit() {
+    const std::string kCaption = "Left: GPU model, combine_textures = false. "
+        "Right: CPU model, precomputed asynchronously after a cancelled "
+        "precomputation. Both images show the spectral radiance at 3 "
+        "predefined wavelengths.";
+    atmosphere_parameters_.mie_phase_function_g = 0.75;
+    atmosphere_parameters_.ground_albedo = DimensionlessSpectrum(0.2);
+    InitGpuModel(false /* combine_textures */,
+        false /* precomputed_luminance */);
+    reference_model_.reset(
+        new reference::Model(atmosphere_parameters_, "output/"));
+
+    std::atomic<bool> cancelled(false);
+    std::string last_phase;
+    double last_fraction = 0.0;
+    reference::Model::InitOptions options;
+    options.cancelled = &cancelled;
+    options.progress_callback =
+        [&](const reference::Model::InitProgress& progress) {
+      ExpectTrue(progress.fraction >= last_fraction);
+      last_phase = progress.phase;
+      last_fraction = progress.fraction;
+      if (progress.phase == "scattering_density") {
+        cancelled = true;
+      }
+    };
+    ExpectFalse(reference_model_->InitAsync(options).get());
+    ExpectEquals(std::string("scattering_density"), last_phase);
+
+    cancelled = false;
+    last_fraction = 0.0;
+    options.progress_callback =
+        [&](const reference::Model::InitProgress& progress) {
+      ExpectTrue(progress.fraction >= last_fraction);
+      last_phase = progress.phase;
+      last_fraction = progress.fraction;
+    };
+    ExpectTrue(reference_model_->InitAsync(options).get());
+    ExpectEquals(std::string("multiple_scattering"), last_phase);
+    ExpectNear(1.0, last_fraction, 1e-9);
+
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    ExpectLess(
+        47.0, Compare(RenderGpuImage(), RenderCpuImage(), kCaption, false));
+  }
+
+/*
+<p>The following test case compares the GPU model with the <a href=
+"../cpu/model.h.html">RGB CPU model</a>, which is supposed to compute the same
+values, in single precision, with the same approximations. We thus expect the
+two images to be almost identical (the only differences come from the half
+precision textures and the different texture filtering implementations on GPU):
+*/
+
+  void TestRgbCpuModelCombineTextures() {
+    const std::string kCaption = "Left: GPU model, combine_textures = true. "
+        "Right: RGB CPU model, combine_textures = true. Both images show the "
+        "spectral radiance at 3 predefined wavelengths.";
+    InitGpuModel(true /* combine_textures */,
+        false /* precomputed_luminance */);
+    InitRgbCpuModel(true /* combine_textures */);
+    SetViewParameters(65.0 * deg, 90.0 * deg, false /* use_luminance */);
+    ExpectLess(
+        50.0, Compare(RenderGpuImage(), RenderCpuImage(), kCaption, true));
+  }
+
+/*
+<p>The following test case checks that the precomputed luminance textures of the
+CPU model give the same results as the spectral integration of the
+corresponding spectral values, for sky rays without light shafts and for the
+sky illuminance (in these cases the luminance is a linear function of the
+spectral textures, and no approximation is involved):
+*/
+
+  void TestPrecomputedLuminanceCpuModel() {
+    InitCpuModel(true /* precompute_luminance */);
+    constexpr auto kMaxLuminousEfficacy = MAX_LUMINOUS_EFFICACY * lm / watt;
+    std::vector<Wavelength> wavelengths;
+    std::vector<Number> x_values;
+    std::vector<Number> y_values;
+    std::vector<Number> z_values;
+    for (unsigned int i = 0; i < 95 * 4; i += 4) {
+      wavelengths.push_back(CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i] * nm);
+      x_values.push_back(CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i + 1]);
+      y_values.push_back(CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i + 2]);
+      z_values.push_back(CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[i + 3]);
+    }
+    const auto cie_x_bar = DimensionlessSpectrum(wavelengths, x_values);
+    const auto cie_y_bar = DimensionlessSpectrum(wavelengths, y_values);
+    const auto cie_z_bar = DimensionlessSpectrum(wavelengths, z_values);
+    auto expect_srgb = [&](const IrradianceSpectrum& irradiance,
+        const Illuminance3& illuminance) {
+      Illuminance x = kMaxLuminousEfficacy * Integral(irradiance * cie_x_bar);
+      Illuminance y = kMaxLuminousEfficacy * Integral(irradiance * cie_y_bar);
+      Illuminance z = kMaxLuminousEfficacy * Integral(irradiance * cie_z_bar);
+      const Illuminance expected[3] = {
+        XYZ_TO_SRGB[0] * x + XYZ_TO_SRGB[1] * y + XYZ_TO_SRGB[2] * z,
+        XYZ_TO_SRGB[3] * x + XYZ_TO_SRGB[4] * y + XYZ_TO_SRGB[5] * z,
+        XYZ_TO_SRGB[6] * x + XYZ_TO_SRGB[7] * y + XYZ_TO_SRGB[8] * z
+      };
+      const Illuminance actual[3] = {
+        illuminance.x, illuminance.y, illuminance.z
+      };
+      for (int i = 0; i < 3; ++i) {
+        const double value = expected[i].to(lm / m2);
+        ExpectNear(
+            value, actual[i].to(lm / m2), 1e-9 * (1.0 + std::abs(value)));
+      }
+    };
+
+    constexpr unsigned int kSize = 100;
+    for (unsigned int i = 0; i < kSize; ++i) {
+      Position camera(0.0 * m, 0.0 * m, atmosphere_parameters_.bottom_radius +
+          5000.0 * (i % 10) * m);
+      Direction view_ray = GetTestDirection(i, kSize);
+      Direction sun_direction = GetTestSunDirection(i, kSize);
+
+      DimensionlessSpectrum transmittance;
+      RadianceSpectrum radiance = reference_model_->GetSkyRadiance(
+          camera, view_ray, 0.0 * m, sun_direction, &transmittance);
+      Luminance3 luminance = reference_model_->GetSkyLuminance(
+          camera, view_ray, 0.0 * m, sun_direction, &transmittance);
+      expect_srgb(radiance * (1.0 * sr), Illuminance3(luminance.x * sr,
+          luminance.y * sr, luminance.z * sr));
+
+      IrradianceSpectrum sky_irradiance;
+      Illuminance3 sky_illuminance;
+      reference_model_->GetSunAndSkyIrradiance(
+          camera, view_ray, sun_direction, &sky_irradiance);
+      reference_model_->GetSunAndSkyIlluminance(
+          camera, view_ray, sun_direction, &sky_illuminance);
+      expect_srgb(sky_irradiance, sky_illuminance);
+    }
+  }
+
+/*
+<p>The next test case checks that the <code>SpectrumToSrgbConverter</code>
+used by the GPU model, which precomputes a weight matrix, gives the same results
+as a direct integration of the linearly interpolated spectrum with the CIE color
+matching functions, with its single and batch <code>Convert</code> methods and
+via <code>ConvertSpectrumToLinearSrgb</code>, for a few spectra:
+*/
+
+  void TestSpectrumToSrgbConverter() {
+    std::vector<double> wavelengths;
+    for (int lambda = 360; lambda <= 830; lambda += 10) {
+      wavelengths.push_back(lambda);
+    }
+    const unsigned int n = wavelengths.size();
+    constexpr unsigned int kNumSpectra = 4;
+    std::vector<double> spectra;
+    for (unsigned int i = 0; i < n; ++i) {
+      spectra.push_back(1.0);
+    }
+    for (unsigned int i = 0; i < n; ++i) {
+      spectra.push_back(wavelengths[i] / 360.0);
+    }
+    for (unsigned int i = 0; i < n; ++i) {
+      spectra.push_back(atmosphere_parameters_.solar_irradiance(
+          wavelengths[i] * nm).to(watt_per_square_meter_per_nm));
+    }
+    for (unsigned int i = 0; i < n; ++i) {
+      spectra.push_back(1.0 + sin(0.1 * wavelengths[i]));
+    }
+
+    const SpectrumToSrgbConverter converter(wavelengths);
+    ExpectEquals(n, converter.size());
+    std::vector<double> batch_rgb(3 * kNumSpectra);
+    converter.Convert(kNumSpectra, spectra.data(), batch_rgb.data());
+    for (unsigned int k = 0; k < kNumSpectra; ++k) {
+      const std::vector<double> spectrum(
+          spectra.begin() + k * n, spectra.begin() + (k + 1) * n);
+      double x = 0.0;
+      double y = 0.0;
+      double z = 0.0;
+      for (int lambda = kLambdaMin; lambda < kLambdaMax; ++lambda) {
+        const double value =
+            atmosphere::Interpolate(wavelengths, spectrum, lambda);
+        x += CieColorMatchingFunctionTableValue(lambda, 1) * value;
+        y += CieColorMatchingFunctionTableValue(lambda, 2) * value;
+        z += CieColorMatchingFunctionTableValue(lambda, 3) * value;
+      }
+      double rgb[3];
+      double model_rgb[3];
+      atmosphere::Model::ConvertSpectrumToLinearSrgb(wavelengths, spectrum,
+          &model_rgb[0], &model_rgb[1], &model_rgb[2]);
+      converter.Convert(spectrum.data(), &rgb[0], &rgb[1], &rgb[2]);
+      for (int c = 0; c < 3; ++c) {
+        const double expected = MAX_LUMINOUS_EFFICACY * (XYZ_TO_SRGB[3 * c] *
+            x + XYZ_TO_SRGB[3 * c + 1] * y + XYZ_TO_SRGB[3 * c + 2] * z);
+        const double tolerance = 1e-9 * (1.0 + std::abs(expected));
+        ExpectNear(expected, rgb[c], tolerance);
+        ExpectNear(expected, batch_rgb[3 * k + c], tolerance);
+        ExpectNear(expected, model_rgb[c], tolerance);
+      }
+    }
+  }
+
+/*
+<p>The next test case checks that the batch version of
+<code>GetSkyRadiance</code> gives the same results as the scalar one, for
+cameras at various altitudes, and view rays and sun directions covering the
+whole sphere of directions:
+*/
+
+  void TestBatchSkyRadiance() {
+    InitCpuModel();
+    constexpr unsigned int kSize = 1000;
+    std::vector<double> camera[3];
+    std::vector<double> view_ray[3];
+    std::vector<double> sun_direction[3];
+    for (unsigned int i = 0; i < kSize; ++i) {
+      const Direction direction = GetTestDirection(i, kSize);
+      const Direction sun = GetTestSunDirection(i, kSize);
+      camera[0].push_back(0.0);
+      camera[1].push_back(0.0);
+      camera[2].push_back(atmosphere_parameters_.bottom_radius.to(m) +
+          50000.0 * (i % 10) / 10.0);
+      view_ray[0].push_back(direction.x());
+      view_ray[1].push_back(direction.y());
+      view_ray[2].push_back(direction.z());
+      sun_direction[0].push_back(sun.x());
+      sun_direction[1].push_back(sun.y());
+      sun_direction[2].push_back(sun.z());
+    }
+    std::vector<RadianceSpectrum> radiance(kSize);
+    std::vector<DimensionlessSpectrum> transmittance(kSize);
+    reference_model_->GetSkyRadiance(kSize,
+        {camera[0].data(), camera[1].data(), camera[2].data()},
+        {view_ray[0].data(), view_ray[1].data(), view_ray[2].data()},
+        nullptr /* shadow_length */,
+        {sun_direction[0].data(), sun_direction[1].data(),
+            sun_direction[2].data()},
+        radiance.data(), transmittance.data());
+
+    for (unsigned int i = 0; i < kSize; ++i) {
+      DimensionlessSpectrum expected_transmittance;
+      RadianceSpectrum expected_radiance = reference_model_->GetSkyRadiance(
+          Position(camera[0][i] * m, camera[1][i] * m, camera[2][i] * m),
+          Direction(view_ray[0][i], view_ray[1][i], view_ray[2][i]),
+          0.0 * m,
+          Direction(sun_direction[0][i], sun_direction[1][i],
+              sun_direction[2][i]),
+          &expected_transmittance);
+      ExpectNearAtRgbWavelengths(expected_radiance, radiance[i],
+          watt_per_square_meter_per_sr_per_nm);
+      ExpectNearAtRgbWavelengths(expected_transmittance, transmittance[i]);
+    }
+  }
+
+/*
+<p>The next test case does the same for the batch version of
+<code>GetSkyRadianceToPoint</code>, with points at various distances from the
+cameras (in directions above their horizon, and below the top atmosphere
+boundary), and with non zero shadow lengths:
+*/
+
+  void TestBatchSkyRadianceToPoint() {
+    InitCpuModel();
+    constexpr unsigned int kSize = 1000;
+    std::vector<double> camera[3];
+    std::vector<double> point[3];
+    std::vector<double> shadow_length;
+    std::vector<double> sun_direction[3];
+    for (unsigned int i = 0; i < kSize; ++i) {
+      const Direction direction = GetTestDirection(i, kSize, 0.5 * PI);
+      const Direction sun = GetTestSunDirection(i, kSize);
+      const double distance = 1000.0 + 3000.0 * (i % 7);
+      camera[0].push_back(0.0);
+      camera[1].push_back(0.0);
+      camera[2].push_back(atmosphere_parameters_.bottom_radius.to(m) +
+          1000.0 + 30000.0 * (i % 10) / 10.0);
+      point[0].push_back(camera[0][i] + distance * direction.x());
+      point[1].push_back(camera[1][i] + distance * direction.y());
+      point[2].push_back(camera[2][i] + distance * direction.z());
+      shadow_length.push_back(500.0 * (i % 3));
+      sun_direction[0].push_back(sun.x());
+      sun_direction[1].push_back(sun.y());
+      sun_direction[2].push_back(sun.z());
+    }
+    std::vector<RadianceSpectrum> radiance(kSize);
+    std::vector<DimensionlessSpectrum> transmittance(kSize);
+    reference_model_->GetSkyRadianceToPoint(kSize,
+        {camera[0].data(), camera[1].data(), camera[2].data()},
+        {point[0].data(), point[1].data(), point[2].data()},
+        shadow_length.data(),
+        {sun_direction[0].data(), sun_direction[1].data(),
+            sun_direction[2].data()},
+        radiance.data(), transmittance.data());
+
+    for (unsigned int i = 0; i < kSize; ++i) {
+      DimensionlessSpectrum expected_transmittance;
+      RadianceSpectrum expected_radiance =
+          reference_model_->GetSkyRadianceToPoint(
+              Position(camera[0][i] * m, camera[1][i] * m, camera[2][i] * m),
+              Position(point[0][i] * m, point[1][i] * m, point[2][i] * m),
+              shadow_length[i] * m,
+              Direction(sun_direction[0][i], sun_direction[1][i],
+                  sun_direction[2][i]),
+              &expected_transmittance);
+      ExpectNearAtRgbWavelengths(expected_radiance, radiance[i],
+          watt_per_square_meter_per_sr_per_nm);
+      ExpectNearAtRgbWavelengths(expected_transmittance, transmittance[i]);
+    }
+  }
+
+/*
+<p>and for the batch version of <code>GetSunAndSkyIrradiance</code>, with points
+at various altitudes, and normals and sun directions covering the whole sphere
+of directions:
+*/
+
+  void TestBatchSunAndSkyIrradiance() {
+    InitCpuModel();
+    constexpr unsigned int kSize = 1000;
+    std::vector<double> point[3];
+    std::vector<double> normal[3];
+    std::vector<double> sun_direction[3];
+    for (unsigned int i = 0; i < kSize; ++i) {
+      const Direction direction = GetTestDirection(i, kSize);
+      const Direction sun = GetTestSunDirection(i, kSize);
+      point[0].push_back(0.0);
+      point[1].push_back(0.0);
+      point[2].push_back(atmosphere_parameters_.bottom_radius.to(m) +
+          50000.0 * (i % 10) / 10.0);
+      normal[0].push_back(direction.x());
+      normal[1].push_back(direction.y());
+      normal[2].push_back(direction.z());
+      sun_direction[0].push_back(sun.x());
+      sun_direction[1].push_back(sun.y());
+      sun_direction[2].push_back(sun.z());
+    }
+    std::vector<IrradianceSpectrum> sun_irradiance(kSize);
+    std::vector<IrradianceSpectrum> sky_irradiance(kSize);
+    reference_model_->GetSunAndSkyIrradiance(kSize,
+        {point[0].data(), point[1].data(), point[2].data()},
+        {normal[0].data(), normal[1].data(), normal[2].data()},
+        {sun_direction[0].data(), sun_direction[1].data(),
+            sun_direction[2].data()},
+        sun_irradiance.data(), sky_irradiance.data());
+
+    for (unsigned int i = 0; i < kSize; ++i) {
+      IrradianceSpectrum expected_sky_irradiance;
+      IrradianceSpectrum expected_sun_irradiance =
+          reference_model_->GetSunAndSkyIrradiance(
+              Position(point[0][i] * m, point[1][i] * m, point[2][i] * m),
+              Direction(normal[0][i], normal[1][i], normal[2][i]),
+              Direction(sun_direction[0][i], sun_direction[1][i],
+                  sun_direction[2][i]),
+              &expected_sky_irradiance);
+      ExpectNearAtRgbWavelengths(expected_sun_irradiance, sun_irradiance[i],
+          watt_per_square_meter_per_nm);
+      ExpectNearAtRgbWavelengths(expected_sky_irradiance, sky_irradiance[i],
+          watt_per_square_meter_per_nm);
+    }
+  }
+
+/*
+<p>The next test case checks that a view cache gives the same sky radiance,
+luminance and transmittance as <code>GetSkyRadiance</code> and
+<code>GetSkyLuminance</code>, for a camera in the atmosphere and a camera in
+space, and for several sun directions:
+*/
+
+  void TestViewCache() {
+    InitCpuModel(true /* precompute_luminance */);
+    constexpr unsigned int kSize = 200;
+    std::vector<double> view_ray[3];
+    for (unsigned int i = 0; i < kSize; ++i) {
+      const Direction direction = GetTestDirection(i, kSize);
+      view_ray[0].push_back(direction.x());
+      view_ray[1].push_back(direction.y());
+      view_ray[2].push_back(direction.z());
+    }
+    std::vector<RadianceSpectrum> radiance(kSize);
+    std::vector<Luminance3> luminance(kSize);
+    for (Length altitude : {1.0 * km, 100.0 * km}) {
+      const Position camera(0.0 * m, 0.0 * m,
+          atmosphere_parameters_.bottom_radius + altitude);
+      reference::Model::ViewCache cache;
+      reference_model_->ComputeViewCache(camera, kSize,
+          {view_ray[0].data(), view_ray[1].data(), view_ray[2].data()},
+          &cache);
+      ExpectEquals(kSize, cache.size());
+      for (double sun_theta : {0.2, 1.5, 1.7}) {
+        const Direction sun_direction(sin(sun_theta), 0.0, cos(sun_theta));
+        reference_model_->GetSkyRadiance(cache, sun_direction,
+            radiance.data());
+        reference_model_->GetSkyLuminance(cache, sun_direction,
+            luminance.data());
+        for (unsigned int i = 0; i < kSize; ++i) {
+          const Direction direction(view_ray[0][i], view_ray[1][i],
+              view_ray[2][i]);
+          DimensionlessSpectrum transmittance;
+          RadianceSpectrum expected_radiance = reference_model_->GetSkyRadiance(
+              camera, direction, 0.0 * m, sun_direction, &transmittance);
+          Luminance3 expected_luminance = reference_model_->GetSkyLuminance(
+              camera, direction, 0.0 * m, sun_direction, &transmittance);
+          ExpectNearAtRgbWavelengths(expected_radiance, radiance[i],
+              watt_per_square_meter_per_sr_per_nm);
+          ExpectNearAtRgbWavelengths(transmittance, cache.transmittance(i));
+          ExpectNear(expected_luminance.x.to(cd_per_square_meter),
+              luminance[i].x.to(cd_per_square_meter), 1e-9 *
+                  (1.0 + expected_luminance.x.to(cd_per_square_meter)));
+          ExpectNear(expected_luminance.y.to(cd_per_square_meter),
+              luminance[i].y.to(cd_per_square_meter), 1e-9 *
+                  (1.0 + expected_luminance.y.to(cd_per_square_meter)));
+          ExpectNear(expected_luminance.z.to(cd_per_square_meter),
+              luminance[i].z.to(cd_per_square_meter), 1e-9 *
+                  (1.0 + expected_luminance.z.to(cd_per_square_meter)));
+        }
+      }
+    }
+  }
+
+/*
+<p>The next test case checks that the lookups in a baked
+<a href="aerial_perspective.h.html">aerial perspective volume</a> give the
+values computed by <code>GetSkyRadianceToPoint</code> at the froxel centers,
+and no aerial perspective at the camera:
+*/
+
+  void TestAerialPerspectiveVolume() {
+    InitCpuModel();
+    const Position camera(0.0 * m, 0.0 * m,
+        atmosphere_parameters_.bottom_radius + 1.0 * km);
+    const Direction sun_direction(0.0, 0.8, 0.6);
+    // A camera looking horizontally towards +y, with a 90 degrees field of
+    // view.
+    const std::array<double, 9> model_from_clip{{
+        1.0, 0.0, 0.0,
+        0.0, 0.0, 1.0,
+        0.0, 1.0, 0.0}};
+    const Length max_distance = 50.0 * km;
+    constexpr unsigned int kSize = 8;
+    AerialPerspectiveVolume volume;
+    AerialPerspectiveBaker(*reference_model_, false /* use_luminance */).Bake(
+        camera, sun_direction, model_from_clip, max_distance, kSize, kSize,
+        kSize, &volume);
+
+    const Wavelength lambdas[3] = {kLambdaR, kLambdaG, kLambdaB};
+    double scattering[3];
+    double transmittance[3];
+    for (unsigned int k = 0; k < kSize; k += 3) {
+      for (unsigned int j = 0; j < kSize; j += 3) {
+        for (unsigned int i = 0; i < kSize; i += 3) {
+          const double u = (i + 0.5) / kSize;
+          const double v = (j + 0.5) / kSize;
+          const double w = (k + 0.5) / kSize;
+          const Direction view_ray =
+              normalize(Direction(2.0 * u - 1.0, 1.0, 2.0 * v - 1.0));
+          const Length distance = max_distance * w * w;
+          DimensionlessSpectrum expected_transmittance;
+          RadianceSpectrum expected = reference_model_->GetSkyRadianceToPoint(
+              camera, camera + view_ray * distance, 0.0 * m, sun_direction,
+              &expected_transmittance);
+          volume.Lookup(u, v, distance, scattering, transmittance);
+          for (unsigned int c = 0; c < 3; ++c) {
+            const double value =
+                expected(lambdas[c]).to(watt_per_square_meter_per_sr_per_nm);
+            ExpectNear(value, scattering[c], 1e-6 * value);
+            ExpectNear(expected_transmittance(lambdas[c])(), transmittance[c],
+                1e-6);
+          }
+        }
+      }
+    }
+    volume.Lookup(0.5, 0.5, 0.0 * m, scattering, transmittance);
+    for (unsigned int c = 0; c < 3; ++c) {
+      ExpectNear(0.0, scattering[c], 1e-9);
+      ExpectNear(1.0, transmittance[c], 1e-9);
+    }
+  }
+
+/*
+<p>The next test case checks that the lookups in a baked
+<a href="sky_view.h.html">sky view texture</a> give the values computed by
+<code>GetSkyRadiance</code> at the texel centers, for view rays on both sides
+of the vertical plane containing the Sun:
+*/
+
+  void TestSkyViewTexture() {
+    InitCpuModel();
+    const Position camera(0.0 * m, 0.0 * m,
+        atmosphere_parameters_.bottom_radius + 1.0 * km);
+    const Direction sun_direction(0.0, 0.8, 0.6);
+    constexpr unsigned int kWidth = 8;
+    constexpr unsigned int kHeight = 9;
+    SkyViewTexture texture;
+    SkyViewBaker(*reference_model_, false /* use_luminance */).Bake(
+        camera, sun_direction, kWidth, kHeight, &texture);
+
+    const Wavelength lambdas[3] = {kLambdaR, kLambdaG, kLambdaB};
+    double radiance[3];
+    for (unsigned int j = 0; j < kHeight; j += 2) {
+      for (unsigned int i = 0; i < kWidth; i += 3) {
+        const vec2 uv(i / (kWidth - 1.0), j / (kHeight - 1.0));
+        Number mu;
+        Number nu;
+        GetMuNuFromSkyViewUv(atmosphere_parameters_, length(camera), 0.6, uv,
+            mu, nu);
+        const Number sin_theta = sqrt(1.0 - mu * mu);
+        const Angle phi = uv.x * pi;
+        for (double side : {-1.0, 1.0}) {
+          const Direction view_ray(side * sin_theta * sin(phi),
+              sin_theta * cos(phi), mu);
+          DimensionlessSpectrum transmittance;
+          RadianceSpectrum expected = reference_model_->GetSkyRadiance(
+              camera, view_ray, 0.0 * m, sun_direction, &transmittance);
+          texture.Lookup(view_ray, radiance);
+          for (unsigned int c = 0; c < 3; ++c) {
+            const double value =
+                expected(lambdas[c]).to(watt_per_square_meter_per_sr_per_nm);
+            ExpectNear(value, radiance[c], 1e-5 * value);
+          }
+        }
+      }
+    }
+  }
+
+/*
+<p>The next test case checks that the <a href="mesh_irradiance.h.html">mesh
+irradiance calculator</a> gives the same results as
+<code>GetSunAndSkyIrradiance</code> for each vertex of a small terrain mesh,
+read from a memory mapped file and processed in several chunks, which must be
+returned in order:
+*/
+
+  void TestMeshIrradiance() {
+    InitCpuModel();
+    constexpr unsigned int kGridSize = 32;
+    std::vector<float> positions;
+    std::vector<float> normals;
+    for (unsigned int j = 0; j < kGridSize; ++j) {
+      for (unsigned int i = 0; i < kGridSize; ++i) {
+        const double x = (i - 0.5 * kGridSize) * 200.0;
+        const double y = (j - 0.5 * kGridSize) * 200.0;
+        const double dh_dx = 0.5 * std::cos(x / 1000.0);
+        const double dh_dy = -0.3 * std::sin(y / 800.0);
+        const double norm = std::sqrt(dh_dx * dh_dx + dh_dy * dh_dy + 1.0);
+        positions.insert(positions.end(), {static_cast<float>(x),
+            static_cast<float>(y), static_cast<float>(300.0 +
+                500.0 * std::sin(x / 1000.0) + 240.0 * std::cos(y / 800.0))});
+        normals.insert(normals.end(), {static_cast<float>(-dh_dx / norm),
+            static_cast<float>(-dh_dy / norm), static_cast<float>(1.0 / norm)});
+      }
+    }
+    const std::string filename =
+        std::string(kOutputDir) + "mesh_irradiance_positions.bin";
+    std::ofstream(filename, std::ofstream::binary).write(
+        reinterpret_cast<const char*>(positions.data()),
+        positions.size() * sizeof(float));
+    MappedFloatFile mapped_positions(filename);
+    ExpectTrue(mapped_positions.size() == positions.size());
+
+    const MeshVertices mesh{kGridSize * kGridSize, mapped_positions.data(),
+        normals.data()};
+    const Position origin(0.0 * m, 0.0 * m,
+        atmosphere_parameters_.bottom_radius);
+    const Direction sun_direction(0.3, 0.4, std::sqrt(0.75));
+    const Wavelength lambdas[3] = {kLambdaR, kLambdaG, kLambdaB};
+    size_t next_vertex = 0;
+    MeshIrradianceCalculator(*reference_model_, false /* use_luminance */,
+        300 /* chunk_size */).Compute(mesh, origin, sun_direction,
+            [&](size_t first_vertex, size_t num_vertices,
+                const float* sun_irradiance, const float* sky_irradiance) {
+      ExpectTrue(first_vertex == next_vertex);
+      next_vertex = first_vertex + num_vertices;
+      for (size_t k = 0; k < num_vertices; k += 7) {
+        const float* p = positions.data() + 3 * (first_vertex + k);
+        const float* n = normals.data() + 3 * (first_vertex + k);
+        IrradianceSpectrum sky_irradiance_spectrum;
+        IrradianceSpectrum sun_irradiance_spectrum =
+            reference_model_->GetSunAndSkyIrradiance(
+                origin + Position(p[0] * m, p[1] * m, p[2] * m),
+                Direction(n[0], n[1], n[2]), sun_direction,
+                &sky_irradiance_spectrum);
+        for (unsigned int c = 0; c < 3; ++c) {
+          const double sun = sun_irradiance_spectrum(lambdas[c]).to(
+              watt_per_square_meter_per_nm);
+          const double sky = sky_irradiance_spectrum(lambdas[c]).to(
+              watt_per_square_meter_per_nm);
+          ExpectNear(sun, sun_irradiance[3 * k + c], 1e-4 * sun);
+          ExpectNear(sky, sky_irradiance[3 * k + c], 1e-4 * sky);
+        }
+      }
+    });
+    ExpectTrue(next_vertex == kGridSize * kGridSize);
+  }
+
+/*
+<p>The next test case checks that the solar position calculator gives the
+expected sun elevation and azimuth at noon on the summer solstice, and that the
+<a href="solar_time_series.h.html">solar time series API</a> gives the same
+results as <code>GetSunAndSkyIrradiance</code> for a tilted surface, for each
+hour of this day:
+*/
+
+  void TestSolarTimeSeries() {
+    InitCpuModel();
+    // 2021-06-21 12:00:00 UTC.
+    constexpr double kSummerSolsticeNoon = 1624276800.0;
+    const Direction noon_sun_direction =
+        GetSunDirection(kSummerSolsticeNoon, 45.0 * deg, 0.0 * deg);
+    ExpectNear(90.0 - 45.0 + 23.44, asin(noon_sun_direction.z).to(deg), 0.2);
+    ExpectNear(0.0, noon_sun_direction.x(), 0.02);
+    ExpectTrue(noon_sun_direction.y() < 0.0);
+
+    const Length altitude = 300.0 * m;
+    const Direction normal(0.0, -sin(30.0 * deg), cos(30.0 * deg));
+    std::vector<double> unix_times;
+    for (unsigned int hour = 0; hour < 24; ++hour) {
+      unix_times.push_back(kSummerSolsticeNoon + (hour - 12.0) * 3600.0);
+    }
+    std::vector<double> direct_irradiance;
+    std::vector<double> diffuse_irradiance;
+    SolarTimeSeries(*reference_model_, false /* use_luminance */, altitude,
+        normal).Compute(unix_times, 45.0 * deg, 0.0 * deg, &direct_irradiance,
+            &diffuse_irradiance);
+    ExpectTrue(direct_irradiance.size() == 3 * unix_times.size());
+
+    const Wavelength lambdas[3] = {kLambdaR, kLambdaG, kLambdaB};
+    for (unsigned int i = 0; i < unix_times.size(); ++i) {
+      const Direction sun_direction =
+          GetSunDirection(unix_times[i], 45.0 * deg, 0.0 * deg);
+      IrradianceSpectrum sky_irradiance;
+      IrradianceSpectrum sun_irradiance =
+          reference_model_->GetSunAndSkyIrradiance(
+              Position(0.0 * m, 0.0 * m,
+                  atmosphere_parameters_.bottom_radius + altitude),
+              normal, sun_direction, &sky_irradiance);
+      for (unsigned int c = 0; c < 3; ++c) {
+        const double direct =
+            sun_irradiance(lambdas[c]).to(watt_per_square_meter_per_nm);
+        const double diffuse =
+            sky_irradiance(lambdas[c]).to(watt_per_square_meter_per_nm);
+        ExpectNear(direct, direct_irradiance[3 * i + c], 1e-3 * direct + 1e-4);
+        ExpectNear(
+            diffuse, diffuse_irradiance[3 * i + c], 1e-3 * diffuse + 1e-4);
+      }
+    }
+  }
+
+/*
+<p>Finally, the last test case checks that the irradiance computed from the SH
+coefficients of a baked <a href="environment_map.h.html">environment map</a>
+(with the sun at 30 degrees from the zenith) is close to the sun and sky
+irradiance computed by the model, for a horizontal surface (the tolerance
+takes into account the discretization of the map, and the approximation of
+the cosine lobe with 9 spherical harmonics):
+*/
+
+  void TestEnvironmentMapIrradiance() {
+    InitCpuModel();
+    const Angle sun_zenith_angle = 30.0 * deg;
+    const Direction sun_direction(
+        sin(sun_zenith_angle), 0.0, cos(sun_zenith_angle));
+    EnvironmentMapBaker baker(*reference_model_, false /* use_luminance */);
+    for (EnvironmentMapLayout layout :
+         {EnvironmentMapLayout::CUBE_MAP,
+          EnvironmentMapLayout::EQUIRECTANGULAR}) {
+      EnvironmentMap environment_map;
+      baker.Bake(layout, 32, 3 /* num_levels */, 0.0 * m, sun_direction,
+          &environment_map);
+      ExpectTrue(environment_map.levels.size() == 3);
+      ExpectTrue(environment_map.levels[2].width ==
+          (layout == EnvironmentMapLayout::CUBE_MAP ? 8 : 16));
+
+      IrradianceSpectrum sky_irradiance;
+      IrradianceSpectrum sun_irradiance =
+          reference_model_->GetSunAndSkyIrradiance(
+              Position(0.0 * m, 0.0 * m, atmosphere_parameters_.bottom_radius),
+              Direction(0.0, 0.0, 1.0), sun_direction, &sky_irradiance);
+      double rgb[3];
+      environment_map.GetIrradiance(
+          Direction(0.0, 0.0, 1.0), &rgb[0], &rgb[1], &rgb[2]);
+      const Wavelength lambdas[3] = {kLambdaR, kLambdaG, kLambdaB};
+      for (unsigned int c = 0; c < 3; ++c) {
+        const double expected =
+            (sun_irradiance + sky_irradiance)(lambdas[c]).to(
+                watt_per_square_meter_per_nm);
+        ExpectNear(expected, rgb[c], 0.05 * expected);
+      }
+    }
+  }
+
 /*
 <p> The rest of the code simply declares the fields of our test fixture class,
 and registers the test cases in the test framework:
@@ -1097,6 +2663,7 @@ and registers the test cases in the test framework:
 
   std::unique_ptr<atmosphere::Model> model_;
   std::unique_ptr<reference::Model> reference_model_;
+  std::unique_ptr<atmosphere::cpu::Model> rgb_model_;
   GLuint program_;
 
   std::array<float, 9> model_from_clip_;
@@ -1147,6 +2714,90 @@ ModelTest precomputed_luminance4(
 ModelTest precomputed_luminance5(
     "PrecomputedLuminanceCombineTexturesSpectralAlbedoSunSet",
     &ModelTest::TestPrecomputedLuminanceCombineTexturesSpectralAlbedoSunSet);
+ModelTest cached_stages(
+    "CachedStages",
+    &ModelTest::TestCachedStages);
+ModelTest sensitivities(
+    "Sensitivities",
+    &ModelTest::TestSensitivities);
+ModelTest runtime_solar_irradiance(
+    "RuntimeSolarIrradiance",
+    &ModelTest::TestRuntimeSolarIrradiance);
+ModelTest runtime_ground_albedo(
+    "RuntimeGroundAlbedo",
+    &ModelTest::TestRuntimeGroundAlbedo);
+ModelTest warm_started_update(
+    "WarmStartedUpdate",
+    &ModelTest::TestWarmStartedUpdate);
+ModelTest rgb_cpu_model_warm_started_update(
+    "RgbCpuModelWarmStartedUpdate",
+    &ModelTest::TestRgbCpuModelWarmStartedUpdate);
+ModelTest parameter_grid_blend(
+    "ParameterGridBlend",
+    &ModelTest::TestParameterGridBlend);
+ModelTest approximate_multiple_scattering(
+    "ApproximateMultipleScattering",
+    &ModelTest::TestApproximateMultipleScattering);
+ModelTest time_sliced_init(
+    "TimeSlicedInit",
+    &ModelTest::TestTimeSlicedInit);
+ModelTest progressive_init(
+    "ProgressiveInit",
+    &ModelTest::TestProgressiveInit);
+ModelTest progressive_cpu_init(
+    "ProgressiveCpuInit",
+    &ModelTest::TestProgressiveCpuInit);
+ModelTest non_default_texture_sizes(
+    "NonDefaultTextureSizes",
+    &ModelTest::TestNonDefaultTextureSizes);
+ModelTest invalid_texture_sizes(
+    "InvalidTextureSizes",
+    &ModelTest::TestInvalidTextureSizes);
+ModelTest gpu_sky_view(
+    "GpuSkyViewTexture",
+    &ModelTest::TestGpuSkyViewTexture);
+ModelTest gpu_aerial_perspective(
+    "GpuAerialPerspectiveVolume",
+    &ModelTest::TestGpuAerialPerspectiveVolume);
+ModelTest async_init(
+    "AsyncInit",
+    &ModelTest::TestAsyncInit);
+ModelTest rgb_cpu_model(
+    "RgbCpuModelCombineTextures",
+    &ModelTest::TestRgbCpuModelCombineTextures);
+ModelTest precomputed_luminance_cpu_model(
+    "PrecomputedLuminanceCpuModel",
+    &ModelTest::TestPrecomputedLuminanceCpuModel);
+ModelTest spectrum_to_srgb_converter(
+    "SpectrumToSrgbConverter",
+    &ModelTest::TestSpectrumToSrgbConverter);
+ModelTest batch(
+    "BatchSkyRadiance",
+    &ModelTest::TestBatchSkyRadiance);
+ModelTest batch_to_point(
+    "BatchSkyRadianceToPoint",
+    &ModelTest::TestBatchSkyRadianceToPoint);
+ModelTest batch_irradiance(
+    "BatchSunAndSkyIrradiance",
+    &ModelTest::TestBatchSunAndSkyIrradiance);
+ModelTest view_cache(
+    "ViewCache",
+    &ModelTest::TestViewCache);
+ModelTest aerial_perspective(
+    "AerialPerspectiveVolume",
+    &ModelTest::TestAerialPerspectiveVolume);
+ModelTest sky_view(
+    "SkyViewTexture",
+    &ModelTest::TestSkyViewTexture);
+ModelTest mesh_irradiance(
+    "MeshIrradiance",
+    &ModelTest::TestMeshIrradiance);
+ModelTest solar_time_series(
+    "SolarTimeSeries",
+    &ModelTest::TestSolarTimeSeries);
+ModelTest environment_map(
+    "EnvironmentMapIrradiance",
+    &ModelTest::TestEnvironmentMapIrradiance);
 
 }  // anonymous namespace
 
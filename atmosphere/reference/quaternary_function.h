@@ -0,0 +1,298 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/quaternary_function.h</h2>
+
+<p>This file defines the C++ type used to store the 4D scattering textures of
+the <a href="model.h.html">CPU model</a>. On GPU these textures are emulated
+with 3D textures, whose x coordinate packs the $\nu$ and $\mu_s$ coordinates
+(see <a href="../functions.glsl.html#single_scattering_precomputation">
+<code>GetRMuMuSNuFromScatteringTextureFragCoord</code></a>), and a 4D lookup
+requires two 3D lookups, i.e. 16 texel fetches, some of which are wasted or
+even wrong near the $\mu_s$ boundaries (where the bilinear filter mixes texels
+from two different $\nu$ slices). On CPU we can do better: the
+<code>QuaternaryFunction</code> class below stores a true 4D texture, and
+provides a single quadrilinear lookup function, used by the C++ version of
+<a href="../functions.glsl.html#single_scattering_lookup">
+<code>GetScattering</code></a>.
+
+<p>For compatibility with the other functions of our model, which see this
+texture as a 3D texture, this class also provides the same API as a
+<code>dimensional::TernaryFunction</code>, i.e. texel accessors with packed
+$(\nu,\mu_s)$ x coordinates, as well as <code>Load</code> and
+<code>Save</code> methods using the same file format. Like the latter, its texel
+accessor is virtual, so that the <a href="functions_test.cc.html">unit
+tests</a> can compute the texels lazily. The lookups are therefore done one
+texel at a time, without SIMD vectorization (which would not help much anyway,
+since each texel is a spectrum of several cache lines).
+*/
+
+#ifndef ATMOSPHERE_REFERENCE_QUATERNARY_FUNCTION_H_
+#define ATMOSPHERE_REFERENCE_QUATERNARY_FUNCTION_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "math/scalar.h"
+#include "math/vector.h"
+
+namespace atmosphere {
+namespace reference {
+
+/*
+<p>The texels can be stored in memory with two different layouts. In both
+cases $\nu$ varies fastest, so that the texels needed for the bilinear
+interpolation in $\nu$ and $\mu_s$ (the innermost part of a quadrilinear lookup)
+are stored in two contiguous pairs of texels, instead of four texels separated
+by <code>MU_S_SIZE</code> texels with the packed 3D layout. Then:
+<ul>
+<li>with the <code>LINEAR</code> layout, $\mu_s$ varies faster than $\mu$,
+which varies faster than $r$. Texels which are neighbors in $\mu$ or $r$ are
+thus far apart in memory.</li>
+<li>with the <code>TILED</code> layout, the texture is divided in tiles of
+$4\times 4\times 4$ texels in $\mu_s$, $\mu$ and $r$ (each containing all the
+$\nu$ values), stored contiguously. This improves the memory locality of the
+lookups along rays where $r$, $\mu$ and $\mu_s$ change simultaneously, as in
+<a href="../functions.glsl.html#multiple_scattering_precomputation">
+<code>ComputeMultipleScattering</code></a> (use <code>make benchmark</code> to
+compare the two layouts).</li>
+</ul>
+<p>The layout is an implementation detail: it does not change the texel values
+nor the file format used in <code>Load</code> and <code>Save</code>. The
+default is the <code>LINEAR</code> layout. The layout is chosen at construction
+time (e.g. via the <a href="model.h.html">Model</a> constructor), which
+precomputes the memory offset of each $\mu_s$, $\mu$ and $r$ index. The memory
+index of a texel is then the sum of its $\nu$ index and of these 3 offsets, for
+both layouts, so that the texel accessors do not depend on the layout.
+*/
+
+enum class TextureLayout { LINEAR, TILED };
+
+template<unsigned int NU_SIZE, unsigned int MU_S_SIZE, unsigned int MU_SIZE,
+    unsigned int R_SIZE, class T>
+class QuaternaryFunction {
+ public:
+  explicit QuaternaryFunction(TextureLayout layout = TextureLayout::LINEAR)
+      : layout_(layout),
+        size_(StorageSize(layout)),
+        value_(new T[size_]) {
+    InitOffsets();
+  }
+
+  explicit QuaternaryFunction(const T& value,
+      TextureLayout layout = TextureLayout::LINEAR)
+      : layout_(layout),
+        size_(StorageSize(layout)),
+        value_(new T[size_]) {
+    InitOffsets();
+    std::fill(value_.get(), value_.get() + size_, value);
+  }
+
+  QuaternaryFunction(const QuaternaryFunction&) = delete;
+  QuaternaryFunction& operator=(const QuaternaryFunction&) = delete;
+
+  virtual ~QuaternaryFunction() {}
+
+  static constexpr unsigned int size_x() { return NU_SIZE * MU_S_SIZE; }
+  static constexpr unsigned int size_y() { return MU_SIZE; }
+  static constexpr unsigned int size_z() { return R_SIZE; }
+
+  TextureLayout layout() const { return layout_; }
+
+  // Returns the texel at the given packed 3D coordinates, where i is equal to
+  // nu * MU_S_SIZE + mu_s. Subclasses can override this method to compute the
+  // texels lazily.
+  virtual const T& Get(int i, int j, int k) const {
+    return value_[Index(i, j, k)];
+  }
+
+  void Set(int i, int j, int k, const T& value) {
+    value_[Index(i, j, k)] = value;
+  }
+
+  QuaternaryFunction& operator+=(const QuaternaryFunction& other) {
+    if (other.layout_ == layout_) {
+      for (unsigned int i = 0; i < size_; ++i) {
+        value_[i] = value_[i] + other.value_[i];
+      }
+      return *this;
+    }
+    for (unsigned int k = 0; k < R_SIZE; ++k) {
+      for (unsigned int j = 0; j < MU_SIZE; ++j) {
+        for (unsigned int i = 0; i < NU_SIZE * MU_S_SIZE; ++i) {
+          T& value = value_[Index(i, j, k)];
+          value = value + other.value_[other.Index(i, j, k)];
+        }
+      }
+    }
+    return *this;
+  }
+
+  // Loads and saves the texels in packed 3D order, i.e. in the same format as
+  // a dimensional::TernaryFunction of size size_x() * size_y() * size_z().
+  void Load(const std::string& filename) {
+    std::ifstream file(filename, std::ifstream::binary);
+    for (unsigned int k = 0; k < R_SIZE; ++k) {
+      for (unsigned int j = 0; j < MU_SIZE; ++j) {
+        for (unsigned int i = 0; i < NU_SIZE * MU_S_SIZE; ++i) {
+          file.read(reinterpret_cast<char*>(&value_[Index(i, j, k)]),
+              sizeof(T));
+        }
+      }
+    }
+    file.close();
+  }
+
+  void Save(const std::string& filename) const {
+    std::ofstream file(filename, std::ofstream::binary);
+    for (unsigned int k = 0; k < R_SIZE; ++k) {
+      for (unsigned int j = 0; j < MU_SIZE; ++j) {
+        for (unsigned int i = 0; i < NU_SIZE * MU_S_SIZE; ++i) {
+          file.write(reinterpret_cast<const char*>(&value_[Index(i, j, k)]),
+              sizeof(T));
+        }
+      }
+    }
+    file.close();
+  }
+
+ protected:
+  static constexpr unsigned int kTileSize = 4;
+
+  // The number of tiles in each dimension, rounded up. Partial tiles at the
+  // texture boundaries are padded with unused texels.
+  static constexpr unsigned int NumTiles(unsigned int size) {
+    return (size + kTileSize - 1) / kTileSize;
+  }
+
+  static unsigned int StorageSize(TextureLayout layout) {
+    return layout == TextureLayout::LINEAR ?
+        NU_SIZE * MU_S_SIZE * MU_SIZE * R_SIZE :
+        NU_SIZE * kTileSize * kTileSize * kTileSize *
+            NumTiles(MU_S_SIZE) * NumTiles(MU_SIZE) * NumTiles(R_SIZE);
+  }
+
+  // Computes the memory offsets of the mu_s, mu and r indices. With the tiled
+  // layout, the offset of an index is the sum of the offset of its tile and of
+  // its offset inside this tile, and the tile index is a linear combination
+  // of the tile coordinates, so that the offsets can be summed too.
+  void InitOffsets() {
+    const unsigned int tile_size = NU_SIZE * kTileSize * kTileSize * kTileSize;
+    for (unsigned int mu_s = 0; mu_s < MU_S_SIZE; ++mu_s) {
+      mu_s_offset_[mu_s] = layout_ == TextureLayout::LINEAR ?
+          NU_SIZE * mu_s :
+          NU_SIZE * (mu_s % kTileSize) + tile_size * (mu_s / kTileSize);
+    }
+    for (unsigned int mu = 0; mu < MU_SIZE; ++mu) {
+      mu_offset_[mu] = layout_ == TextureLayout::LINEAR ?
+          NU_SIZE * MU_S_SIZE * mu :
+          NU_SIZE * kTileSize * (mu % kTileSize) +
+              tile_size * NumTiles(MU_S_SIZE) * (mu / kTileSize);
+    }
+    for (unsigned int r = 0; r < R_SIZE; ++r) {
+      r_offset_[r] = layout_ == TextureLayout::LINEAR ?
+          NU_SIZE * MU_S_SIZE * MU_SIZE * r :
+          NU_SIZE * kTileSize * kTileSize * (r % kTileSize) + tile_size *
+              NumTiles(MU_S_SIZE) * NumTiles(MU_SIZE) * (r / kTileSize);
+    }
+  }
+
+  unsigned int Index(int i, int j, int k) const {
+    return i / MU_S_SIZE + mu_s_offset_[i % MU_S_SIZE] + mu_offset_[j] +
+        r_offset_[k];
+  }
+
+  const TextureLayout layout_;
+  const unsigned int size_;
+  mutable std::unique_ptr<T[]> value_;
+  std::array<unsigned int, MU_S_SIZE> mu_s_offset_;
+  std::array<unsigned int, MU_SIZE> mu_offset_;
+  std::array<unsigned int, R_SIZE> r_offset_;
+};
+
+/*
+<p>The quadrilinear lookup function takes the 4D texture coordinates computed
+by <a href="../functions.glsl.html#single_scattering_lookup">
+<code>GetScatteringTextureUvwzFromRMuMuSNu</code></a>. As in the GPU version,
+the $\nu$ coordinate is mapped linearly to $[0,\mathtt{NU\_SIZE}-1]$, while the
+other coordinates follow the usual convention that texel centers are at
+$(i+0.5)/n$. Texel coordinates are clamped in each dimension separately, and
+texels with a null weight are skipped:
+*/
+
+template<unsigned int NU_SIZE, unsigned int MU_S_SIZE, unsigned int MU_SIZE,
+    unsigned int R_SIZE, class T>
+T texture(
+    const QuaternaryFunction<NU_SIZE, MU_S_SIZE, MU_SIZE, R_SIZE, T>& function,
+    const dimensional::vec4& uvwz) {
+  double coords[4] = {
+    uvwz.x() * (NU_SIZE - 1.0),
+    uvwz.y() * MU_S_SIZE - 0.5,
+    uvwz.z() * MU_SIZE - 0.5,
+    uvwz.w() * R_SIZE - 0.5
+  };
+  const int sizes[4] = { NU_SIZE, MU_S_SIZE, MU_SIZE, R_SIZE };
+  int indices[4][2];
+  double weights[4][2];
+  for (int d = 0; d < 4; ++d) {
+    double floor_coord = std::floor(coords[d]);
+    int index = static_cast<int>(floor_coord);
+    indices[d][0] = std::max(0, std::min(sizes[d] - 1, index));
+    indices[d][1] = std::max(0, std::min(sizes[d] - 1, index + 1));
+    weights[d][1] = coords[d] - floor_coord;
+    weights[d][0] = 1.0 - weights[d][1];
+  }
+  T result;
+  bool first = true;
+  for (int corner = 0; corner < 16; ++corner) {
+    int b0 = corner & 1;
+    int b1 = (corner >> 1) & 1;
+    int b2 = (corner >> 2) & 1;
+    int b3 = (corner >> 3) & 1;
+    double weight =
+        weights[0][b0] * weights[1][b1] * weights[2][b2] * weights[3][b3];
+    if (weight == 0.0) {
+      continue;
+    }
+    T texel = function.Get(indices[0][b0] * MU_S_SIZE + indices[1][b1],
+        indices[2][b2], indices[3][b3]) * dimensional::Number(weight);
+    result = first ? texel : result + texel;
+    first = false;
+  }
+  return result;
+}
+
+}  // namespace reference
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_REFERENCE_QUATERNARY_FUNCTION_H_
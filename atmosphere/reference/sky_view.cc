@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/sky_view.cc</h2>
+
+<p>This file implements the <a href="sky_view.h.html">sky view baker</a>, with
+the same <a href="functions.glsl.html#rendering_sky_view">texture mapping</a>
+as in the GPU model. The lookups use the same bilinear interpolation as the GPU
+texture units, with the following helper function to compute the two texels
+and the interpolation factor along one axis:
+*/
+
+#include "atmosphere/reference/sky_view.h"
+
+#include <algorithm>
+
+#include "atmosphere/reference/functions.h"
+#include "atmosphere/spectrum.h"
+#include "util/progress_bar.h"
+
+namespace atmosphere {
+namespace reference {
+
+namespace {
+
+void GetTexels(double x, unsigned int size, unsigned int* i0,
+    unsigned int* i1, double* lerp) {
+  x = std::max(0.0, std::min(x * (size - 1), size - 1.0));
+  *i0 = std::min(static_cast<unsigned int>(x), size - 1);
+  *i1 = std::min(*i0 + 1, size - 1);
+  *lerp = x - *i0;
+}
+
+}  // anonymous namespace
+
+/*
+<p>The lookup function computes the $r,\mu,\mu_s,\nu$ parameters of the view
+ray, maps them to texture coordinates, and interpolates the 4 texels around
+them:
+*/
+
+void SkyViewTexture::Lookup(Direction view_ray, double radiance_rgb[3]) const {
+  const Length r = length(camera);
+  const Direction up = camera / r;
+  const vec2 uv = GetSkyViewUvFromRMuMuSNu(atmosphere,
+      std::max(r, atmosphere.bottom_radius), dot(view_ray, up),
+      dot(sun_direction, up), dot(view_ray, sun_direction));
+  unsigned int i[2];
+  unsigned int j[2];
+  double lerp[2];
+  GetTexels(uv.x(), width, &i[0], &i[1], &lerp[0]);
+  GetTexels(uv.y(), height, &j[0], &j[1], &lerp[1]);
+  for (unsigned int c = 0; c < 3; ++c) {
+    radiance_rgb[c] = 0.0;
+  }
+  for (unsigned int dj = 0; dj < 2; ++dj) {
+    const double wj = dj == 0 ? 1.0 - lerp[1] : lerp[1];
+    for (unsigned int di = 0; di < 2; ++di) {
+      const double w = wj * (di == 0 ? 1.0 - lerp[0] : lerp[0]);
+      const unsigned int index = 3 * (i[di] + width * j[dj]);
+      for (unsigned int c = 0; c < 3; ++c) {
+        radiance_rgb[c] += w * radiance[index + c];
+      }
+    }
+  }
+}
+
+SkyViewBaker::SkyViewBaker(const Model& model, bool use_luminance)
+    : model_(model), use_luminance_(use_luminance) {}
+
+/*
+<p>The baking itself calls <code>GetSkyRadiance</code> (or
+<code>GetSkyLuminance</code>) for the view ray corresponding to each texel, in
+parallel over the rows of the texture. Like in the
+<code>ComputeSkyViewTexture</code> GLSL function, we use a reference frame
+where the camera is on the z axis and the Sun direction is in the xz plane:
+*/
+
+void SkyViewBaker::Bake(Position camera, Direction sun_direction,
+    unsigned int width, unsigned int height, SkyViewTexture* texture) const {
+  const AtmosphereParameters& atmosphere = model_.atmosphere();
+  texture->atmosphere = atmosphere;
+  texture->camera = camera;
+  texture->sun_direction = sun_direction;
+  texture->width = width;
+  texture->height = height;
+  texture->radiance.resize(3 * width * height);
+
+  const Length r = length(camera);
+  const Number mu_s = dot(camera, sun_direction) / r;
+  const Number sin_theta_s = sqrt(max(1.0 - mu_s * mu_s, 0.0));
+  const Position local_camera(0.0 * m, 0.0 * m, r);
+  const Direction local_sun_direction(sin_theta_s, 0.0, mu_s);
+  RunJobs([&](unsigned int j) {
+    for (unsigned int i = 0; i < width; ++i) {
+      const vec2 uv(i / (width - 1.0), j / (height - 1.0));
+      Number mu;
+      Number nu;
+      GetMuNuFromSkyViewUv(atmosphere, std::max(r, atmosphere.bottom_radius),
+          mu_s, uv, mu, nu);
+      const Number sin_theta = sqrt(max(1.0 - mu * mu, 0.0));
+      const Angle phi = uv.x * pi;
+      const Direction view_ray(
+          sin_theta * cos(phi), sin_theta * sin(phi), mu);
+      DimensionlessSpectrum transmittance;
+      double rgb[3];
+      if (use_luminance_) {
+        const Luminance3 luminance = model_.GetSkyLuminance(local_camera,
+            view_ray, 0.0 * m, local_sun_direction, &transmittance);
+        rgb[0] = luminance.x.to(cd_per_square_meter);
+        rgb[1] = luminance.y.to(cd_per_square_meter);
+        rgb[2] = luminance.z.to(cd_per_square_meter);
+      } else {
+        const RadianceSpectrum radiance = model_.GetSkyRadiance(local_camera,
+            view_ray, 0.0 * m, local_sun_direction, &transmittance);
+        rgb[0] = radiance(kLambdaR * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+        rgb[1] = radiance(kLambdaG * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+        rgb[2] = radiance(kLambdaB * nm).to(
+            watt_per_square_meter_per_sr_per_nm);
+      }
+      const unsigned int index = 3 * (i + width * j);
+      texture->radiance[index] = static_cast<float>(rgb[0]);
+      texture->radiance[index + 1] = static_cast<float>(rgb[1]);
+      texture->radiance[index + 2] = static_cast<float>(rgb[2]);
+    }
+  }, height);
+}
+
+}  // namespace reference
+}  // namespace atmosphere
@@ -0,0 +1,97 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/sky_view.h</h2>
+
+<p>This file defines an API to precompute the sky seen from a camera with our
+<a href="model.h.html">CPU atmosphere model</a>, in a small 2D "sky view"
+texture, as done with the <code>BakeSkyView</code> method of the
+<a href="../model.h.html">GPU model</a>. The sky radiance in any view direction
+can then be computed with a single bilinear lookup in this texture, instead of
+a call to <code>GetSkyRadiance</code>. To use it:
+<ul>
+<li>create a <code>SkyViewBaker</code> for an initialized <code>Model</code>,
+specifying if the texture should contain spectral radiance values at the 3
+wavelengths <code>kLambdaR</code>, <code>kLambdaG</code> and
+<code>kLambdaB</code>, or sRGB luminance values,</li>
+<li>call <code>Bake</code> for each camera and sun direction,</li>
+<li>call <code>Lookup</code> on the resulting <code>SkyViewTexture</code>.</li>
+</ul>
+*/
+
+#ifndef ATMOSPHERE_REFERENCE_SKY_VIEW_H_
+#define ATMOSPHERE_REFERENCE_SKY_VIEW_H_
+
+#include <vector>
+
+#include "atmosphere/reference/definitions.h"
+#include "atmosphere/reference/model.h"
+
+namespace atmosphere {
+namespace reference {
+
+// The sky radiance (or luminance) seen from a camera, sampled on a width x
+// height grid with the sky view mapping of GetSkyViewUvFromRMuMuSNu (see
+// functions.glsl): the texel (i, j) contains the value for the unit range
+// texture coordinates u = i / (width - 1), v = j / (height - 1).
+struct SkyViewTexture {
+  AtmosphereParameters atmosphere;
+  Position camera;
+  Direction sun_direction;
+  unsigned int width;
+  unsigned int height;
+  // 3 values per texel, stored row by row.
+  std::vector<float> radiance;
+
+  // Returns the sky radiance (or luminance) seen from the camera in direction
+  // 'view_ray', with a bilinear interpolation of the texture.
+  void Lookup(Direction view_ray, double radiance[3]) const;
+};
+
+class SkyViewBaker {
+ public:
+  // If use_luminance is true, the texture contains sRGB luminance values in
+  // cd.m^-2 (this requires a Model constructed with the precompute_luminance
+  // option). Otherwise it contains spectral radiance values at kLambdaR,
+  // kLambdaG and kLambdaB, in W.m^-2.sr^-1.nm^-1.
+  SkyViewBaker(const Model& model, bool use_luminance);
+
+  // Bakes the sky seen from 'camera', for the given sun direction.
+  void Bake(Position camera, Direction sun_direction, unsigned int width,
+      unsigned int height, SkyViewTexture* texture) const;
+
+ private:
+  const Model& model_;
+  const bool use_luminance_;
+};
+
+}  // namespace reference
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_REFERENCE_SKY_VIEW_H_
@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/solar_time_series.cc</h2>
+
+<p>This file implements the <a href="solar_time_series.h.html">solar time
+series API</a>. The solar position calculator needs the day of the year of
+each timestamp, which we compute with the following helper function (from
+<a href="http://howardhinnant.github.io/date_algorithms.html">chrono-Compatible
+Low-Level Date Algorithms</a>), returning the number of days between
+1970-01-01 and the given date of the proleptic Gregorian calendar:
+*/
+
+#include "atmosphere/reference/solar_time_series.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "atmosphere/spectrum.h"
+#include "util/progress_bar.h"
+
+namespace atmosphere {
+namespace reference {
+
+namespace {
+
+constexpr unsigned int kTableSize = 1024;
+
+int DaysFromCivil(int year, int month, int day) {
+  year -= month <= 2 ? 1 : 0;
+  const int era = (year >= 0 ? year : year - 399) / 400;
+  const int year_of_era = year - era * 400;
+  const int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 +
+      day - 1;
+  const int day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+void ToRgb(const IrradianceSpectrum& irradiance, double rgb[3]) {
+  rgb[0] = irradiance(kLambdaR * nm).to(watt_per_square_meter_per_nm);
+  rgb[1] = irradiance(kLambdaG * nm).to(watt_per_square_meter_per_nm);
+  rgb[2] = irradiance(kLambdaB * nm).to(watt_per_square_meter_per_nm);
+}
+
+void ToRgb(const Illuminance3& illuminance, double rgb[3]) {
+  rgb[0] = illuminance.x.to(lm / m2);
+  rgb[1] = illuminance.y.to(lm / m2);
+  rgb[2] = illuminance.z.to(lm / m2);
+}
+
+}  // anonymous namespace
+
+/*
+<p>The solar position calculator first computes the fractional year $\gamma$,
+from which it gets the equation of time and the solar declination $\delta$
+with Fourier series approximations. The equation of time and the longitude
+give the true solar time, and thus the hour angle $h$. The sun direction in the
+local east-north-zenith frame at latitude $\phi$ is then
+$(-\cos\delta\sin h, \cos\phi\sin\delta - \sin\phi\cos\delta\cos h,
+\sin\phi\sin\delta + \cos\phi\cos\delta\cos h)$:
+*/
+
+Direction GetSunDirection(double unix_time, Angle latitude, Angle longitude) {
+  constexpr double kSecondsPerDay = 86400.0;
+  const int days = static_cast<int>(std::floor(unix_time / kSecondsPerDay));
+  int year = 1970 + static_cast<int>(std::floor(days / 365.2425));
+  while (DaysFromCivil(year, 1, 1) > days) {
+    --year;
+  }
+  while (DaysFromCivil(year + 1, 1, 1) <= days) {
+    ++year;
+  }
+  const int day_of_year = days - DaysFromCivil(year, 1, 1);
+  const int days_in_year =
+      DaysFromCivil(year + 1, 1, 1) - DaysFromCivil(year, 1, 1);
+  const double seconds = unix_time - days * kSecondsPerDay;
+
+  const double gamma = 2.0 * PI / days_in_year *
+      (day_of_year + (seconds / 3600.0 - 12.0) / 24.0);
+  const double equation_of_time_minutes = 229.18 * (0.000075 +
+      0.001868 * std::cos(gamma) - 0.032077 * std::sin(gamma) -
+      0.014615 * std::cos(2.0 * gamma) - 0.040849 * std::sin(2.0 * gamma));
+  const double declination = 0.006918 - 0.399912 * std::cos(gamma) +
+      0.070257 * std::sin(gamma) - 0.006758 * std::cos(2.0 * gamma) +
+      0.000907 * std::sin(2.0 * gamma) - 0.002697 * std::cos(3.0 * gamma) +
+      0.00148 * std::sin(3.0 * gamma);
+  const double true_solar_time_minutes = seconds / 60.0 +
+      equation_of_time_minutes + 4.0 * longitude.to(deg);
+  const double hour_angle =
+      (true_solar_time_minutes / 4.0 - 180.0) * PI / 180.0;
+
+  const double sin_phi = std::sin(latitude.to(rad));
+  const double cos_phi = std::cos(latitude.to(rad));
+  const double sin_delta = std::sin(declination);
+  const double cos_delta = std::cos(declination);
+  return Direction(-cos_delta * std::sin(hour_angle),
+      cos_phi * sin_delta - sin_phi * cos_delta * std::cos(hour_angle),
+      sin_phi * sin_delta + cos_phi * cos_delta * std::cos(hour_angle));
+}
+
+/*
+<p>The constructor precomputes the table of direct and diffuse irradiance
+values, by calling <code>GetSunAndSkyIrradiance</code> (or
+<code>GetSunAndSkyIlluminance</code>) for each $\mu_s$ value, with a normal
+equal to the sun direction for the direct irradiance, and to the zenith
+direction for the diffuse irradiance (the factors depending on the normal are
+then equal to 1). We use a table much denser than the precomputed textures, so
+that its linear interpolation is very close to a direct evaluation with these
+textures:
+*/
+
+SolarTimeSeries::SolarTimeSeries(const Model& model, bool use_luminance,
+    Length altitude, Direction normal)
+    : normal_(normal),
+      direct_table_(3 * kTableSize),
+      diffuse_table_(3 * kTableSize) {
+  const Position point(0.0 * m, 0.0 * m,
+      model.atmosphere().bottom_radius + altitude);
+  const Direction up(0.0, 0.0, 1.0);
+  constexpr unsigned int kEntriesPerJob = 32;
+  RunJobs([&](unsigned int job) {
+    for (unsigned int i = job * kEntriesPerJob;
+         i < (job + 1) * kEntriesPerJob; ++i) {
+      const Number mu_s = -1.0 + 2.0 * i / (kTableSize - 1.0);
+      const Direction sun(sqrt(max(1.0 - mu_s * mu_s, 0.0)), 0.0, mu_s);
+      if (use_luminance) {
+        Illuminance3 sky;
+        ToRgb(model.GetSunAndSkyIlluminance(point, sun, sun, &sky),
+            &direct_table_[3 * i]);
+        model.GetSunAndSkyIlluminance(point, up, sun, &sky);
+        ToRgb(sky, &diffuse_table_[3 * i]);
+      } else {
+        IrradianceSpectrum sky;
+        ToRgb(model.GetSunAndSkyIrradiance(point, sun, sun, &sky),
+            &direct_table_[3 * i]);
+        model.GetSunAndSkyIrradiance(point, up, sun, &sky);
+        ToRgb(sky, &diffuse_table_[3 * i]);
+      }
+    }
+  }, kTableSize / kEntriesPerJob);
+}
+
+/*
+<p>The irradiance for each sun direction is then the product of the linearly
+interpolated table values at $\mu_s$, and of the same factors depending on the
+normal as in <code>GetSunAndSkyIrradiance</code>:
+*/
+
+void SolarTimeSeries::Compute(const std::vector<Direction>& sun_directions,
+    std::vector<double>* direct_irradiance,
+    std::vector<double>* diffuse_irradiance) const {
+  direct_irradiance->resize(3 * sun_directions.size());
+  diffuse_irradiance->resize(3 * sun_directions.size());
+  const double diffuse_factor = 0.5 * (1.0 + normal_.z());
+  for (unsigned int k = 0; k < sun_directions.size(); ++k) {
+    const Direction& sun_direction = sun_directions[k];
+    const double direct_factor = std::max(dot(normal_, sun_direction)(), 0.0);
+    const double x = std::max(0.0, std::min(
+        (sun_direction.z() + 1.0) * 0.5 * (kTableSize - 1), kTableSize - 1.0));
+    const unsigned int i = std::min(static_cast<unsigned int>(x),
+        kTableSize - 2);
+    const double lerp = x - i;
+    for (unsigned int c = 0; c < 3; ++c) {
+      (*direct_irradiance)[3 * k + c] = direct_factor * (
+          direct_table_[3 * i + c] * (1.0 - lerp) +
+          direct_table_[3 * (i + 1) + c] * lerp);
+      (*diffuse_irradiance)[3 * k + c] = diffuse_factor * (
+          diffuse_table_[3 * i + c] * (1.0 - lerp) +
+          diffuse_table_[3 * (i + 1) + c] * lerp);
+    }
+  }
+}
+
+void SolarTimeSeries::Compute(const std::vector<double>& unix_times,
+    Angle latitude, Angle longitude, std::vector<double>* direct_irradiance,
+    std::vector<double>* diffuse_irradiance) const {
+  std::vector<Direction> sun_directions;
+  sun_directions.reserve(unix_times.size());
+  for (double unix_time : unix_times) {
+    sun_directions.push_back(GetSunDirection(unix_time, latitude, longitude));
+  }
+  Compute(sun_directions, direct_irradiance, diffuse_irradiance);
+}
+
+}  // namespace reference
+}  // namespace atmosphere
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/reference/solar_time_series.h</h2>
+
+<p>This file defines an API to compute the direct and diffuse irradiance
+received by a surface at a fixed location, for many sun positions (e.g. for
+each hour of a year, for solar energy yield studies), with our
+<a href="model.h.html">CPU atmosphere model</a>. Since the location is fixed,
+these irradiance values only depend on the cosine $\mu_s$ of the sun zenith
+angle, and on the angle between the surface normal and the sun direction.
+Instead of calling <code>GetSunAndSkyIrradiance</code> for each sun position,
+we can thus precompute a small 1D table over $\mu_s$ once per location, and
+then compute the irradiance for each sun position with a single linear
+interpolation in this table. To use it:
+<ul>
+<li>create a <code>SolarTimeSeries</code> for an initialized
+<code>Model</code>, a site altitude and a surface normal,</li>
+<li>call <code>Compute</code> with a list of sun directions, or with a list of
+timestamps and the latitude and longitude of the site (the sun directions are
+then computed with <code>GetSunDirection</code>).</li>
+</ul>
+*/
+
+#ifndef ATMOSPHERE_REFERENCE_SOLAR_TIME_SERIES_H_
+#define ATMOSPHERE_REFERENCE_SOLAR_TIME_SERIES_H_
+
+#include <vector>
+
+#include "atmosphere/reference/definitions.h"
+#include "atmosphere/reference/model.h"
+
+namespace atmosphere {
+namespace reference {
+
+// Returns the direction of the Sun at the given time (in seconds since
+// 1970-01-01 00:00:00 UTC), seen from the given location, in a local reference
+// frame whose x, y and z axes point towards the east, the north and the
+// zenith, respectively. This uses the approximate solar position equations
+// from NOAA's "General Solar Position Calculations" (accurate to about 0.1
+// degree, without atmospheric refraction).
+Direction GetSunDirection(double unix_time, Angle latitude, Angle longitude);
+
+class SolarTimeSeries {
+ public:
+  // If use_luminance is true, the results are sRGB illuminance values in
+  // lm.m^-2 (this requires a Model constructed with the precompute_luminance
+  // option). Otherwise they are spectral irradiance values at kLambdaR,
+  // kLambdaG and kLambdaB, in W.m^-2.nm^-1. 'normal' is the surface normal,
+  // in the local reference frame defined above (i.e. with z pointing towards
+  // the zenith).
+  SolarTimeSeries(const Model& model, bool use_luminance, Length altitude,
+      Direction normal);
+
+  // Computes the direct (sun) and diffuse (sky) irradiance received by the
+  // surface for each sun direction (in the local reference frame defined
+  // above), with 3 values per sun direction in each output array.
+  void Compute(const std::vector<Direction>& sun_directions,
+      std::vector<double>* direct_irradiance,
+      std::vector<double>* diffuse_irradiance) const;
+
+  // Same as above, for the sun directions at the given times, seen from the
+  // given location.
+  void Compute(const std::vector<double>& unix_times, Angle latitude,
+      Angle longitude, std::vector<double>* direct_irradiance,
+      std::vector<double>* diffuse_irradiance) const;
+
+ private:
+  const Direction normal_;
+  // The direct irradiance for a surface facing the Sun, and the diffuse
+  // irradiance for a horizontal surface, for kTableSize values of mu_s
+  // uniformly distributed between -1 and 1 (3 values per entry).
+  std::vector<double> direct_table_;
+  std::vector<double> diffuse_table_;
+};
+
+}  // namespace reference
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_REFERENCE_SOLAR_TIME_SERIES_H_
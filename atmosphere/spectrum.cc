@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/spectrum.cc</h2>
+
+<p>This file implements the <a href="spectrum.h.html">spectrum utility
+functions</a> shared by our atmosphere models.
+*/
+
+#include "atmosphere/spectrum.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+
+#include "atmosphere/constants.h"
+
+namespace atmosphere {
+
+/*
+<p>The main function of this file computes the value of the conversion
+constants *<code>_RADIANCE_TO_LUMINANCE</code>, used in the atmosphere models to
+convert the spectral results into luminance values. These are the constants k_r,
+k_g, k_b described in Section 14.3 of <a href="https://arxiv.org/pdf/1612.04336.pdf">A
+Qualitative and Quantitative Evaluation of 8 Clear Sky Models</a>.
+
+<p>Computing their value requires an integral of a function times a CIE color
+matching function. Thus, we first need functions to interpolate an arbitrary
+function (specified by some samples), and a CIE color matching function
+(specified by tabulated values), at an arbitrary wavelength. This is the purpose
+of the following two functions:
+*/
+
+double CieColorMatchingFunctionTableValue(double wavelength, int column) {
+  if (wavelength <= kLambdaMin || wavelength >= kLambdaMax) {
+    return 0.0;
+  }
+  double u = (wavelength - kLambdaMin) / 5.0;
+  int row = static_cast<int>(std::floor(u));
+  assert(row >= 0 && row + 1 < 95);
+  assert(CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * row] <= wavelength &&
+         CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * (row + 1)] >= wavelength);
+  u -= row;
+  return CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * row + column] * (1.0 - u) +
+      CIE_2_DEG_COLOR_MATCHING_FUNCTIONS[4 * (row + 1) + column] * u;
+}
+
+double Interpolate(
+    const std::vector<double>& wavelengths,
+    const std::vector<double>& wavelength_function,
+    double wavelength) {
+  assert(wavelength_function.size() == wavelengths.size());
+  if (wavelength < wavelengths[0]) {
+    return wavelength_function[0];
+  }
+  for (unsigned int i = 0; i < wavelengths.size() - 1; ++i) {
+    if (wavelength < wavelengths[i + 1]) {
+      double u =
+          (wavelength - wavelengths[i]) / (wavelengths[i + 1] - wavelengths[i]);
+      return
+          wavelength_function[i] * (1.0 - u) + wavelength_function[i + 1] * u;
+    }
+  }
+  return wavelength_function[wavelength_function.size() - 1];
+}
+
+/*
+<p>We can then implement a utility function to compute the "spectral radiance to
+luminance" conversion constants (see Section 14.3 in <a
+href="https://arxiv.org/pdf/1612.04336.pdf">A Qualitative and Quantitative
+Evaluation of 8 Clear Sky Models</a> for their definitions):
+*/
+
+void ComputeSpectralRadianceToLuminanceFactors(
+    const std::vector<double>& wavelengths,
+    const std::vector<double>& solar_irradiance,
+    double lambda_power, double* k_r, double* k_g, double* k_b) {
+  *k_r = 0.0;
+  *k_g = 0.0;
+  *k_b = 0.0;
+  double solar_r = Interpolate(wavelengths, solar_irradiance, kLambdaR);
+  double solar_g = Interpolate(wavelengths, solar_irradiance, kLambdaG);
+  double solar_b = Interpolate(wavelengths, solar_irradiance, kLambdaB);
+  int dlambda = 1;
+  for (int lambda = kLambdaMin; lambda < kLambdaMax; lambda += dlambda) {
+    double x_bar = CieColorMatchingFunctionTableValue(lambda, 1);
+    double y_bar = CieColorMatchingFunctionTableValue(lambda, 2);
+    double z_bar = CieColorMatchingFunctionTableValue(lambda, 3);
+    const double* xyz2srgb = XYZ_TO_SRGB;
+    double r_bar =
+        xyz2srgb[0] * x_bar + xyz2srgb[1] * y_bar + xyz2srgb[2] * z_bar;
+    double g_bar =
+        xyz2srgb[3] * x_bar + xyz2srgb[4] * y_bar + xyz2srgb[5] * z_bar;
+    double b_bar =
+        xyz2srgb[6] * x_bar + xyz2srgb[7] * y_bar + xyz2srgb[8] * z_bar;
+    double irradiance = Interpolate(wavelengths, solar_irradiance, lambda);
+    *k_r += r_bar * irradiance / solar_r *
+        pow(lambda / kLambdaR, lambda_power);
+    *k_g += g_bar * irradiance / solar_g *
+        pow(lambda / kLambdaG, lambda_power);
+    *k_b += b_bar * irradiance / solar_b *
+        pow(lambda / kLambdaB, lambda_power);
+  }
+  *k_r *= MAX_LUMINOUS_EFFICACY * dlambda;
+  *k_g *= MAX_LUMINOUS_EFFICACY * dlambda;
+  *k_b *= MAX_LUMINOUS_EFFICACY * dlambda;
+}
+
+/*
+<p>Finally, the <code>SpectrumToSrgbConverter</code> constructor precomputes the
+weight of each input sample in the numerical integration done in
+<code>ConvertSpectrumToLinearSrgb</code> (see <a href="model.cc.html">
+model.cc</a>). For this we note that, at each integration step, the
+<code>Interpolate</code> function returns a linear combination of at most two
+consecutive samples, with weights which do not depend on the sample values.
+Combining them with the CIE color matching functions and the XYZ to sRGB matrix
+gives the weight matrix:
+*/
+
+SpectrumToSrgbConverter::SpectrumToSrgbConverter(
+    const std::vector<double>& wavelengths)
+    : size_(wavelengths.size()), weights_(3 * wavelengths.size(), 0.0) {
+  assert(size_ > 0);
+  const int dlambda = 1;
+  for (int lambda = kLambdaMin; lambda < kLambdaMax; lambda += dlambda) {
+    // The indices and weights of the samples used by Interpolate.
+    unsigned int index = size_ - 1;
+    double u = 0.0;
+    if (lambda < wavelengths[0]) {
+      index = 0;
+    } else {
+      for (unsigned int i = 0; i < size_ - 1; ++i) {
+        if (lambda < wavelengths[i + 1]) {
+          index = i;
+          u = (lambda - wavelengths[i]) / (wavelengths[i + 1] - wavelengths[i]);
+          break;
+        }
+      }
+    }
+    double x_bar = CieColorMatchingFunctionTableValue(lambda, 1);
+    double y_bar = CieColorMatchingFunctionTableValue(lambda, 2);
+    double z_bar = CieColorMatchingFunctionTableValue(lambda, 3);
+    for (int c = 0; c < 3; ++c) {
+      double weight = MAX_LUMINOUS_EFFICACY * dlambda * (
+          XYZ_TO_SRGB[3 * c] * x_bar + XYZ_TO_SRGB[3 * c + 1] * y_bar +
+          XYZ_TO_SRGB[3 * c + 2] * z_bar);
+      weights_[c * size_ + index] += weight * (1.0 - u);
+      if (u > 0.0) {
+        weights_[c * size_ + index + 1] += weight * u;
+      }
+    }
+  }
+}
+
+/*
+<p>A conversion is then a matrix-vector product, and the batch version simply
+applies it to each spectrum. The inner loops are written as simple dot products
+over contiguous arrays, without any branch, so that the compiler can vectorize
+them:
+*/
+
+void SpectrumToSrgbConverter::Convert(const double* spectrum,
+    double* r, double* g, double* b) const {
+  const double* r_weights = weights_.data();
+  const double* g_weights = r_weights + size_;
+  const double* b_weights = g_weights + size_;
+  double sum_r = 0.0;
+  double sum_g = 0.0;
+  double sum_b = 0.0;
+  for (unsigned int i = 0; i < size_; ++i) {
+    sum_r += r_weights[i] * spectrum[i];
+    sum_g += g_weights[i] * spectrum[i];
+    sum_b += b_weights[i] * spectrum[i];
+  }
+  *r = sum_r;
+  *g = sum_g;
+  *b = sum_b;
+}
+
+void SpectrumToSrgbConverter::Convert(
+    unsigned int count, const double* spectra, double* rgb) const {
+  for (size_t i = 0; i < count; ++i) {
+    Convert(spectra + i * size_, rgb + 3 * i, rgb + 3 * i + 1, rgb + 3 * i + 2);
+  }
+}
+
+}  // namespace atmosphere
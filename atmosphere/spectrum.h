@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2017 Eric Bruneton
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*<h2>atmosphere/spectrum.h</h2>
+
+<p>This file provides utility functions to convert functions of the wavelength,
+specified by samples at arbitrary wavelengths, to the 3 wavelengths used in the
+precomputed textures, or to luminance or linear sRGB values. They do not depend
+on OpenGL, and are used by the <a href="model.h.html">GPU model</a> as well as
+by the <a href="cpu/model.h.html">RGB CPU model</a>.
+*/
+
+#ifndef ATMOSPHERE_SPECTRUM_H_
+#define ATMOSPHERE_SPECTRUM_H_
+
+#include <vector>
+
+namespace atmosphere {
+
+// The wavelengths, in nanometers, of the 3 color channels of the precomputed
+// textures, in precomputed irradiance mode.
+constexpr double kLambdaR = 680.0;
+constexpr double kLambdaG = 550.0;
+constexpr double kLambdaB = 440.0;
+
+// The range of wavelengths, in nanometers, covered by the CIE color matching
+// functions in constants.h.
+constexpr int kLambdaMin = 360;
+constexpr int kLambdaMax = 830;
+
+// Returns the value of the given column of CIE_2_DEG_COLOR_MATCHING_FUNCTIONS
+// (1 for x_bar, 2 for y_bar, 3 for z_bar) at the given wavelength, in nm.
+double CieColorMatchingFunctionTableValue(double wavelength, int column);
+
+// Returns the value at 'wavelength' of the function specified by its values
+// 'wavelength_function' at the given 'wavelengths' (sorted in increasing
+// order), with a linear interpolation.
+double Interpolate(
+    const std::vector<double>& wavelengths,
+    const std::vector<double>& wavelength_function,
+    double wavelength);
+
+// Computes the "spectral radiance to luminance" conversion constants, in
+// lumen.nm / watt, for the kLambdaR, kLambdaG and kLambdaB wavelengths.
+void ComputeSpectralRadianceToLuminanceFactors(
+    const std::vector<double>& wavelengths,
+    const std::vector<double>& solar_irradiance,
+    double lambda_power, double* k_r, double* k_g, double* k_b);
+
+// Converts functions of the wavelength, specified by their values at the
+// 'wavelengths' given to the constructor (sorted in increasing order), to
+// linear sRGB (see Model::ConvertSpectrumToLinearSrgb). The interpolation and
+// the integration with the CIE color matching functions are done once and for
+// all in the constructor, which precomputes a 3xN weight matrix. Each
+// conversion is then a small matrix-vector product.
+class SpectrumToSrgbConverter {
+ public:
+  explicit SpectrumToSrgbConverter(const std::vector<double>& wavelengths);
+
+  unsigned int size() const { return size_; }
+
+  // Converts one spectrum, given by its size() values.
+  void Convert(const double* spectrum, double* r, double* g, double* b) const;
+
+  // Converts 'count' spectra, stored contiguously in 'spectra' (size() values
+  // per spectrum), and stores the results in 'rgb' (3 values per spectrum).
+  void Convert(
+      unsigned int count, const double* spectra, double* rgb) const;
+
+ private:
+  const unsigned int size_;
+  // The weights for the r, g and b components (size_ values each), including
+  // the MAX_LUMINOUS_EFFICACY factor.
+  std::vector<double> weights_;
+};
+
+}  // namespace atmosphere
+
+#endif  // ATMOSPHERE_SPECTRUM_H_